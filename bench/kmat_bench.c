@@ -0,0 +1,743 @@
+#include "tools/competition_tools.h"
+#include "tools/celestial_systems.h"
+#include "tools/file_io.h"
+#include "tools/thread_pool.h"
+#include "tools/ephem_cache.h"
+#include "orbit_calculator/transfer_calc.h"
+#include "orbit_calculator/itin_tool.h"
+#include "orbit_calculator/lambert_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>		// for GetProcessMemoryInfo()
+#else
+#include <sys/resource.h>	// for getrusage()
+#endif
+
+// Benchmarks of the trajectory kernels and of complete searches (no GUI).
+// All inputs are drawn from a fixed-seed generator (reseeded for every benchmark --> same inputs with any --filter),
+// results are written as JSON (throughput, latency percentiles of the timed batches and peak resident memory).
+// The results of the kernels and scenarios are also verified (flyby roots against a dense scan, stored and resumed itineraries).
+
+#define BENCH_SEED 0x4b4d4154424e4348ULL
+#define BENCH_NUM_INPUTS 4096				// inputs per kernel benchmark (cycled through by the batches)
+#define BENCH_FIXTURE_NUM_DEP_DATES 3		// departure dates of the search providing the itineraries for scoring and .itins storing/loading
+#define BENCH_QUICK_NUM_DEP_DATES 1			// departure dates of the end-to-end scenarios in quick mode
+#define BENCH_MAX_RESULTS 32
+#define BENCH_FLYBY_ROOT_CASES 240			// arrivals whose flybys are compared against a dense scan
+#define BENCH_FLYBY_ROOT_SCAN_STEP 0.25		// days between the samples of the dense scan
+#define BENCH_FLYBY_ROOT_MATCH_TOLERANCE 0.01	// days between a root of the dense scan and the flyby found for it
+
+struct Bench_Options {
+	const char *systems_directory;
+	const char *queue_directory;
+	const char *out_filepath;	// "-": stdout
+	const char *filter;			// only benchmarks and scenarios with this in their name (NULL: all)
+	int is_quick;				// fewer samples and departure dates (smoke test)
+	int num_threads;			// <= 0: number of available cores
+	int num_repetitions;
+};
+
+struct Bench_Latency {
+	double min, p50, p90, p99, max;
+};
+
+struct Bench_Result {
+	char name[64];
+	long num_ops;
+	double total_time;			// s
+	double items_per_op;		// e.g. nodes stored per .itins file (0: ops only)
+	struct Bench_Latency latency;	// kernels: ns per op; scenarios: s per search
+	// scenarios
+	const char *queue_filename;
+	int num_deps, num_nodes, num_itins;
+	int is_roundtrip_equal;		// itineraries of the first run are the same after storing and loading them (.itins)
+	int is_resume_equal;		// a run stopped by a time limit and resumed from its checkpoint finds the itineraries of the first run
+	long peak_rss;				// kB after the benchmark (peak of the process up to then)
+};
+
+// roots of find_viable_flybys compared against a dense scan of the excess velocity difference (sign changes)
+struct Bench_Flyby_Root_Coverage {
+	int is_checked;
+	int num_cases;
+	int num_full_cases;		// found as many flybys as a call can store (not compared)
+	int num_roots;			// feasible roots of the dense scan
+	int num_found_roots;	// of them found by find_viable_flybys
+};
+
+struct Bench_Env {
+	struct Bench_Options options;
+	CelestSystem *system;
+	uint64_t rng_state;
+	struct Bench_Result kernels[BENCH_MAX_RESULTS];
+	int num_kernels;
+	struct Bench_Result scenarios[BENCH_MAX_RESULTS];
+	int num_scenarios;
+	struct Bench_Flyby_Root_Coverage flyby_root_coverage;
+};
+
+// operation index of the inputs (returns a value that is accumulated to keep the compiler from removing the calculation)
+typedef double (*Bench_Op)(void *data, int index);
+
+static volatile double bench_sink;
+
+
+static double get_bench_time() {
+	#ifdef _WIN32
+		LARGE_INTEGER frequency, counter;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&counter);
+		return (double) counter.QuadPart / (double) frequency.QuadPart;
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (double) ts.tv_sec + ts.tv_nsec * 1e-9;
+	#endif
+}
+
+// peak resident memory of the process in kB
+static long get_bench_peak_rss() {
+	#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+		return (long) (counters.PeakWorkingSetSize / 1024);
+	#else
+		struct rusage usage;
+		if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+		#ifdef __APPLE__
+			return usage.ru_maxrss / 1024;	// bytes
+		#else
+			return usage.ru_maxrss;
+		#endif
+	#endif
+}
+
+static void seed_bench_rng(struct Bench_Env *env) {
+	env->rng_state = BENCH_SEED;
+}
+
+// xorshift64*
+static double get_bench_random(struct Bench_Env *env, double min, double max) {
+	env->rng_state ^= env->rng_state >> 12;
+	env->rng_state ^= env->rng_state << 25;
+	env->rng_state ^= env->rng_state >> 27;
+	uint64_t x = env->rng_state * 0x2545F4914F6CDD1DULL;
+	return min + (max-min) * ((double) (x >> 11) / 9007199254740992.0);
+}
+
+static Body * get_bench_random_body(struct Bench_Env *env, Body *other_body) {
+	Body *body;
+	do {
+		body = env->system->bodies[(int) get_bench_random(env, 0, env->system->num_bodies)];
+	} while(body == other_body);
+	return body;
+}
+
+static int is_bench_selected(struct Bench_Env *env, const char *name) {
+	return env->options.filter == NULL || strstr(name, env->options.filter) != NULL;
+}
+
+static int compare_bench_samples(const void *a, const void *b) {
+	double sample_a = *(const double *) a, sample_b = *(const double *) b;
+	return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+// nearest-rank percentiles (sorts samples)
+static struct Bench_Latency get_bench_latency(double *samples, int num_samples) {
+	qsort(samples, num_samples, sizeof(double), compare_bench_samples);
+	struct Bench_Latency latency;
+	double percentiles[3] = {0.5, 0.9, 0.99};
+	double *values[3] = {&latency.p50, &latency.p90, &latency.p99};
+	for(int i = 0; i < 3; i++) {
+		int index = (int) ceil(percentiles[i] * num_samples) - 1;
+		*values[i] = samples[index < 0 ? 0 : index];
+	}
+	latency.min = samples[0];
+	latency.max = samples[num_samples-1];
+	return latency;
+}
+
+static int get_bench_num_samples(struct Bench_Env *env, int num_samples) {
+	if(env->options.is_quick) num_samples = num_samples/10 > 3 ? num_samples/10 : 3;
+	return num_samples * env->options.num_repetitions;
+}
+
+// time num_samples batches of batch_size ops (after one warm-up batch) and add the result
+static void run_bench_kernel(struct Bench_Env *env, const char *name, Bench_Op op, void *data, int num_inputs, int batch_size, int num_samples, double items_per_op) {
+	num_samples = get_bench_num_samples(env, num_samples);
+	double *samples = (double *) malloc(num_samples * sizeof(double));
+	double sink = 0, total_time = 0;
+	int index = 0;
+
+	printf("%-32s", name);
+	fflush(stdout);
+	for(int i = 0; i < batch_size; i++) sink += op(data, i % num_inputs);
+	for(int i = 0; i < num_samples; i++) {
+		double start = get_bench_time();
+		for(int j = 0; j < batch_size; j++) {
+			sink += op(data, index);
+			if(++index == num_inputs) index = 0;
+		}
+		double batch_time = get_bench_time() - start;
+		total_time += batch_time;
+		samples[i] = batch_time / batch_size * 1e9;
+	}
+	bench_sink += sink;
+
+	struct Bench_Result *result = &env->kernels[env->num_kernels++];
+	*result = (struct Bench_Result) {
+		.num_ops = (long) num_samples * batch_size,
+		.total_time = total_time,
+		.items_per_op = items_per_op,
+		.latency = get_bench_latency(samples, num_samples),
+		.peak_rss = get_bench_peak_rss()
+	};
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	printf("%12.0f ops/s   p50 %10.0f ns   p99 %10.0f ns\n", result->num_ops / total_time, result->latency.p50, result->latency.p99);
+	free(samples);
+}
+
+
+/*********************************************************************
+ *                          Kernel benchmarks
+ *********************************************************************/
+
+struct Bench_Lambert_Inputs {
+	Vector3 *r0, *r1;
+	double *dt;		// s
+	Lambert3 *tf;	// solutions (for the periapsis benchmark)
+	Body *cb;
+	CelestSystem *system;
+};
+
+struct Bench_Osv_Inputs {
+	Body **bodies;
+	double *jd;
+};
+
+struct Bench_Flyby_Inputs {
+	struct ItinStep *steps;
+	Body **next_bodies;
+	double min_dt, max_dt;
+	struct Flyby_Search_Scratch *scratch;
+	CelestSystem *system;
+};
+
+struct Bench_Itins {
+	Itin_Calc_Data calc_data;
+	Itin_Calc_Results results;
+	struct ItinStep **arrivals;
+	int num_arrivals;
+	char filepath[1024];
+	CelestSystem *system;
+};
+
+static double bench_osv_from_elements(void *data, int index) {
+	struct Bench_Osv_Inputs *inputs = (struct Bench_Osv_Inputs *) data;
+	return osv_from_elements(inputs->bodies[index]->orbit, inputs->jd[index]).r.x;
+}
+
+static double bench_calc_lambert3(void *data, int index) {
+	struct Bench_Lambert_Inputs *inputs = (struct Bench_Lambert_Inputs *) data;
+	return calc_lambert3(inputs->r0[index], inputs->r1[index], inputs->dt[index], inputs->cb).v0.x;
+}
+
+static double bench_calc_heliocentric_periapsis(void *data, int index) {
+	struct Bench_Lambert_Inputs *inputs = (struct Bench_Lambert_Inputs *) data;
+	Lambert3 tf = inputs->tf[index];
+	return calc_heliocentric_periapsis(tf.r0, tf.v0, tf.r1, tf.v1, inputs->system).x;
+}
+
+static double bench_find_viable_flybys(void *data, int index) {
+	struct Bench_Flyby_Inputs *inputs = (struct Bench_Flyby_Inputs *) data;
+	struct ItinStep step = inputs->steps[index];
+	find_viable_flybys(&step, inputs->system, inputs->next_bodies[index], inputs->min_dt, inputs->max_dt, NULL, inputs->scratch);
+	int num_flybys = step.num_next_nodes;
+	for(int i = 0; i < step.num_next_nodes; i++) free_itinerary(step.next[i]);
+	free(step.next);
+	return num_flybys;
+}
+
+static double bench_get_itin_competition_score(void *data, int index) {
+	struct Bench_Itins *itins = (struct Bench_Itins *) data;
+	return get_itin_competition_score(itins->arrivals[index], itins->system);
+}
+
+static double bench_store_itineraries_in_bfile(void *data, int index) {
+	struct Bench_Itins *itins = (struct Bench_Itins *) data;
+	store_itineraries_in_bfile(itins->results.departures, itins->results.num_nodes, itins->results.num_deps, itins->results.num_itins,
+							   itins->calc_data, itins->system, itins->filepath, get_current_bin_file_type());
+	return itins->results.num_nodes;
+}
+
+static double bench_load_itineraries_from_bfile(void *data, int index) {
+	struct Bench_Itins *itins = (struct Bench_Itins *) data;
+	struct ItinsLoadFileResults load_results = load_itineraries_from_bfile(itins->filepath);
+	if(load_results.departures == NULL) return 0;
+	for(int i = 0; i < load_results.header.num_deps; i++) free_itinerary(load_results.departures[i]);
+	free(load_results.departures);
+	free_competition_calc_data(&load_results.header.calc_data);
+	free_celestial_system(load_results.header.system);
+	return load_results.header.num_nodes;
+}
+
+static void run_bench_state_kernels(struct Bench_Env *env) {
+	int n = BENCH_NUM_INPUTS;
+	if(is_bench_selected(env, "osv_from_elements")) {
+		seed_bench_rng(env);
+		struct Bench_Osv_Inputs inputs = {.bodies = (Body **) malloc(n * sizeof(Body *)), .jd = (double *) malloc(n * sizeof(double))};
+		for(int i = 0; i < n; i++) {
+			inputs.bodies[i] = get_bench_random_body(env, NULL);
+			inputs.jd[i] = get_bench_random(env, 0, 30000);
+		}
+		run_bench_kernel(env, "osv_from_elements", bench_osv_from_elements, &inputs, n, 1000, 200, 0);
+		free(inputs.bodies);
+		free(inputs.jd);
+	}
+
+	if(!is_bench_selected(env, "calc_lambert3") && !is_bench_selected(env, "calc_heliocentric_periapsis")) return;
+	// transfers between random bodies (50 to 3000 days)
+	seed_bench_rng(env);
+	struct Bench_Lambert_Inputs inputs = {
+			.r0 = (Vector3 *) malloc(n * sizeof(Vector3)),
+			.r1 = (Vector3 *) malloc(n * sizeof(Vector3)),
+			.dt = (double *) malloc(n * sizeof(double)),
+			.tf = (Lambert3 *) malloc(n * sizeof(Lambert3)),
+			.cb = env->system->cb,
+			.system = env->system
+	};
+	for(int i = 0; i < n; i++) {
+		Body *body0 = get_bench_random_body(env, NULL);
+		Body *body1 = get_bench_random_body(env, body0);
+		double jd0 = get_bench_random(env, 0, 30000);
+		double dt = get_bench_random(env, 50, 3000);
+		inputs.r0[i] = osv_from_elements(body0->orbit, jd0).r;
+		inputs.r1[i] = osv_from_elements(body1->orbit, jd0 + dt).r;
+		inputs.dt[i] = dt * 86400;
+		inputs.tf[i] = calc_lambert3(inputs.r0[i], inputs.r1[i], inputs.dt[i], inputs.cb);
+	}
+	if(is_bench_selected(env, "calc_lambert3"))
+		run_bench_kernel(env, "calc_lambert3", bench_calc_lambert3, &inputs, n, 100, 200, 0);
+	if(is_bench_selected(env, "calc_heliocentric_periapsis"))
+		run_bench_kernel(env, "calc_heliocentric_periapsis", bench_calc_heliocentric_periapsis, &inputs, n, 100, 200, 0);
+	free(inputs.r0);
+	free(inputs.r1);
+	free(inputs.dt);
+	free(inputs.tf);
+}
+
+// difference of the departure excess velocity of the transfer dt after the arrival step to its arrival excess velocity (NaN: no transfer)
+static double get_bench_flyby_diff_vinf(struct ItinStep *step, Body *next_body, CelestSystem *system, double dt, Lambert3 *tf) {
+	OSV osv = body_state_at(system, next_body, step->date + dt / 86400);
+	*tf = calc_lambert3(step->r, osv.r, dt, system->cb);
+	return mag_vec3(subtract_vec3(tf->v0, step->v_body)) - mag_vec3(subtract_vec3(step->v_arr, step->v_body));
+}
+
+// flyby and heliocentric periapsis as accepted by find_viable_flybys
+static int is_bench_flyby_feasible(struct ItinStep *step, Lambert3 tf, CelestSystem *system) {
+	double rel_flyby_alt = get_flyby_periapsis(step->v_arr, tf.v0, step->v_body, step->body)/step->body->radius - 1;
+	if(!(rel_flyby_alt > 0.1 && rel_flyby_alt < 100)) return 0;	// also rejects bodies without mass (NaN)
+	double rp_sq = sq_mag_vec3(calc_heliocentric_periapsis(tf.r0, tf.v0, tf.r1, tf.v1, system))/(AU*AU);
+	return rp_sq > 0.05*0.05 || (rp_sq > 0.01*0.01 && !step->had_low_perihelion);
+}
+
+// bisects the sign change of the dense scan (returns 0 for a discontinuity, e.g. the change of the transfer plane at 180 degrees)
+static int solve_bench_flyby_root(struct ItinStep *step, Body *next_body, CelestSystem *system, double a, double fa, double b, double *root, Lambert3 *tf) {
+	for(int i = 0; i < 60 && b-a > 1e-3; i++) {
+		double m = (a+b)/2;
+		double fm = get_bench_flyby_diff_vinf(step, next_body, system, m, tf);
+		if(isnan(fm)) return 0;
+		if((fm < 0) == (fa < 0)) { a = m; fa = fm; }
+		else b = m;
+	}
+	*root = (a+b)/2;
+	return fabs(get_bench_flyby_diff_vinf(step, next_body, system, *root, tf)) < 1;
+}
+
+// every feasible root of a dense scan needs to be found by find_viable_flybys (the root search assumes at most two roots per synodic window)
+static void check_bench_flyby_root_coverage(struct Bench_Env *env, struct Bench_Flyby_Inputs *inputs, int num_cases) {
+	struct Bench_Flyby_Root_Coverage *coverage = &env->flyby_root_coverage;
+	*coverage = (struct Bench_Flyby_Root_Coverage) {.is_checked = 1, .num_cases = num_cases};
+	CelestSystem *system = inputs->system;
+	double scan_step = BENCH_FLYBY_ROOT_SCAN_STEP * 86400;
+	for(int i = 0; i < num_cases; i++) {
+		struct ItinStep step = inputs->steps[i];
+		Body *next_body = inputs->next_bodies[i];
+		find_viable_flybys(&step, system, next_body, inputs->min_dt, inputs->max_dt, NULL, inputs->scratch);
+		if(step.num_next_nodes >= FLYBY_SEARCH_MAX_NEW_STEPS) {
+			coverage->num_full_cases++;
+			for(int j = 0; j < step.num_next_nodes; j++) free_itinerary(step.next[j]);
+			free(step.next);
+			continue;
+		}
+
+		Lambert3 tf;
+		double dt0 = inputs->min_dt, diff0 = get_bench_flyby_diff_vinf(&step, next_body, system, dt0, &tf);
+		while(dt0 < inputs->max_dt) {
+			double dt1 = dt0 + scan_step < inputs->max_dt ? dt0 + scan_step : inputs->max_dt;
+			double diff1 = get_bench_flyby_diff_vinf(&step, next_body, system, dt1, &tf);
+			double root;
+			if(!isnan(diff0) && !isnan(diff1) && (diff0 < 0) != (diff1 < 0) &&
+			   solve_bench_flyby_root(&step, next_body, system, dt0, diff0, dt1, &root, &tf) && is_bench_flyby_feasible(&step, tf, system)) {
+				coverage->num_roots++;
+				for(int j = 0; j < step.num_next_nodes; j++) {
+					if(fabs(step.next[j]->date - (step.date + root / 86400)) < BENCH_FLYBY_ROOT_MATCH_TOLERANCE) {
+						coverage->num_found_roots++;
+						break;
+					}
+				}
+			}
+			dt0 = dt1;
+			diff0 = diff1;
+		}
+		for(int j = 0; j < step.num_next_nodes; j++) free_itinerary(step.next[j]);
+		free(step.next);
+	}
+	printf("find_viable_flybys: %d of %d roots of a %.2f-day scan found (%d arrivals, %d with the maximum number of flybys not compared)\n",
+		   coverage->num_found_roots, coverage->num_roots, BENCH_FLYBY_ROOT_SCAN_STEP, num_cases, coverage->num_full_cases);
+}
+
+static void run_bench_flyby_kernel(struct Bench_Env *env) {
+	if(!is_bench_selected(env, "find_viable_flybys")) return;
+	int n = BENCH_NUM_INPUTS;
+	seed_bench_rng(env);
+	// arrivals at random bodies with excess velocities of 3 to 12 km/s in random directions
+	struct Bench_Flyby_Inputs inputs = {
+			.steps = (struct ItinStep *) calloc(n, sizeof(struct ItinStep)),
+			.next_bodies = (Body **) malloc(n * sizeof(Body *)),
+			.min_dt = MIN_TRANSFER_DURATION * 86400.0,
+			.max_dt = 2000 * 86400.0,
+			.scratch = (struct Flyby_Search_Scratch *) malloc(sizeof(struct Flyby_Search_Scratch)),
+			.system = env->system
+	};
+	for(int i = 0; i < n; i++) {
+		struct ItinStep *step = &inputs.steps[i];
+		step->body = get_bench_random_body(env, NULL);
+		step->date = get_bench_random(env, 0, 30000);
+		OSV osv = osv_from_elements(step->body->orbit, step->date);
+		step->r = osv.r;
+		step->v_body = osv.v;
+		double z = get_bench_random(env, -1, 1), phi = get_bench_random(env, 0, 2*M_PI);
+		Vector3 v_inf = scale_vec3(vec3(sqrt(1-z*z)*cos(phi), sqrt(1-z*z)*sin(phi), z), get_bench_random(env, 3000, 12000));
+		step->v_arr = add_vec3(osv.v, v_inf);
+		inputs.next_bodies[i] = get_bench_random_body(env, step->body);
+	}
+	run_bench_kernel(env, "find_viable_flybys", bench_find_viable_flybys, &inputs, n, 1, 200, 0);
+	check_bench_flyby_root_coverage(env, &inputs, env->options.is_quick ? BENCH_FLYBY_ROOT_CASES/10 : BENCH_FLYBY_ROOT_CASES);
+	free(inputs.steps);
+	free(inputs.next_bodies);
+	free(inputs.scratch);
+}
+
+static void get_bench_queue_filepath(struct Bench_Env *env, const char *filename, char *filepath, size_t size) {
+	snprintf(filepath, size, "%s%s", env->options.queue_directory, filename);
+}
+
+// itineraries of the first departure dates of the example sequence (the search itself is not timed)
+static int create_bench_itins(struct Bench_Env *env, struct Bench_Itins *itins) {
+	char queue_filepath[1024];
+	get_bench_queue_filepath(env, "exampleSequence.txt", queue_filepath, sizeof(queue_filepath));
+	*itins = (struct Bench_Itins) {.system = env->system};
+	if(!load_competition_calc_data(queue_filepath, env->system, &itins->calc_data)) return 0;
+	itins->calc_data.jd_max_dep = itins->calc_data.jd_min_dep + (BENCH_FIXTURE_NUM_DEP_DATES-1) * itins->calc_data.step_dep_date;
+
+	init_lambert_cache(-1);
+	itins->results = search_for_itineraries(itins->calc_data);
+	if(itins->results.num_itins == 0) {
+		printf("No itineraries found for scoring and storing benchmarks (%s)\n", queue_filepath);
+		free_itin_calc_results(&itins->results);
+		free_competition_calc_data(&itins->calc_data);
+		return 0;
+	}
+
+	itins->arrivals = (struct ItinStep **) malloc(itins->results.num_itins * sizeof(struct ItinStep *));
+	for(int i = 0; i < itins->results.num_deps; i++)
+		store_itineraries_in_array(itins->results.departures[i], itins->arrivals, &itins->num_arrivals);
+	snprintf(itins->filepath, sizeof(itins->filepath), "kmat_bench.itins");
+	return 1;
+}
+
+static void free_bench_itins(struct Bench_Itins *itins) {
+	remove(itins->filepath);
+	free(itins->arrivals);
+	free_itin_calc_results(&itins->results);
+	free_competition_calc_data(&itins->calc_data);
+}
+
+static void run_bench_itin_kernels(struct Bench_Env *env) {
+	if(!is_bench_selected(env, "get_itin_competition_score") && !is_bench_selected(env, "store_itineraries_in_bfile") &&
+	   !is_bench_selected(env, "load_itineraries_from_bfile")) return;
+	struct Bench_Itins itins;
+	if(!create_bench_itins(env, &itins)) return;
+	// the scored itineraries are independent of the Lambert cache
+	init_lambert_cache(0);
+
+	if(is_bench_selected(env, "get_itin_competition_score"))
+		run_bench_kernel(env, "get_itin_competition_score", bench_get_itin_competition_score, &itins, itins.num_arrivals, 10, 100, 0);
+	// loading needs a stored file
+	if(is_bench_selected(env, "store_itineraries_in_bfile") || is_bench_selected(env, "load_itineraries_from_bfile"))
+		run_bench_kernel(env, "store_itineraries_in_bfile", bench_store_itineraries_in_bfile, &itins, 1, 1, 30, itins.results.num_nodes);
+	if(is_bench_selected(env, "load_itineraries_from_bfile"))
+		run_bench_kernel(env, "load_itineraries_from_bfile", bench_load_itineraries_from_bfile, &itins, 1, 1, 30, itins.results.num_nodes);
+	free_bench_itins(&itins);
+}
+
+
+/*********************************************************************
+ *                        End-to-end scenarios
+ *********************************************************************/
+
+static void get_bench_arrival_dates(struct ItinStep **departures, int num_deps, double *dates, int *num_dates) {
+	struct ItinStep **arrivals = (struct ItinStep **) malloc((*num_dates > 0 ? *num_dates : 1) * sizeof(struct ItinStep *));
+	int index = 0;
+	for(int i = 0; i < num_deps; i++) store_itineraries_in_array(departures[i], arrivals, &index);
+	for(int i = 0; i < index; i++) dates[i] = arrivals[i]->date;
+	qsort(dates, index, sizeof(double), compare_bench_samples);
+	*num_dates = index;
+	free(arrivals);
+}
+
+// loaded .itins file has the same number of itineraries, nodes and arrival dates as the results (order independent)
+static int is_bench_itins_equal(Itin_Calc_Results *results, struct ItinsLoadFileResults *load_results) {
+	if(load_results->departures == NULL) return results->num_itins == 0;
+
+	int num_itins = 0, num_loaded_itins = 0;
+	for(int i = 0; i < results->num_deps; i++) num_itins += get_number_of_itineraries(results->departures[i]);
+	for(int i = 0; i < load_results->header.num_deps; i++) num_loaded_itins += get_number_of_itineraries(load_results->departures[i]);
+
+	int is_equal = num_itins == num_loaded_itins && load_results->header.num_nodes == results->num_nodes;
+	if(is_equal) {
+		double *dates = (double *) malloc((num_itins > 0 ? num_itins : 1) * sizeof(double));
+		double *loaded_dates = (double *) malloc((num_itins > 0 ? num_itins : 1) * sizeof(double));
+		int num_dates = num_itins, num_loaded_dates = num_loaded_itins;
+		get_bench_arrival_dates(results->departures, results->num_deps, dates, &num_dates);
+		get_bench_arrival_dates(load_results->departures, load_results->header.num_deps, loaded_dates, &num_loaded_dates);
+		for(int i = 0; i < num_dates && is_equal; i++) is_equal = dates[i] == loaded_dates[i];
+		free(dates);
+		free(loaded_dates);
+	}
+	return is_equal;
+}
+
+static void free_bench_load_results(struct ItinsLoadFileResults *load_results) {
+	if(load_results->departures == NULL) return;
+	for(int i = 0; i < load_results->header.num_deps; i++) free_itinerary(load_results->departures[i]);
+	free(load_results->departures);
+	free_competition_calc_data(&load_results->header.calc_data);
+	free_celestial_system(load_results->header.system);
+}
+
+// store results in an .itins file and load them again: same itineraries
+static int is_bench_itins_roundtrip_equal(Itin_Calc_Results *results, Itin_Calc_Data calc_data, CelestSystem *system) {
+	const char *filepath = "kmat_bench_roundtrip.itins";
+	remove(filepath);
+	store_itineraries_in_bfile(results->departures, results->num_nodes, results->num_deps, results->num_itins, calc_data, system, (char *) filepath, get_current_bin_file_type());
+	struct ItinsLoadFileResults load_results = load_itineraries_from_bfile((char *) filepath);
+	remove(filepath);
+	int is_equal = is_bench_itins_equal(results, &load_results);
+	free_bench_load_results(&load_results);
+	return is_equal;
+}
+
+// stop the search after max_search_time seconds (departures cut by the time limit are left for resuming), resume it from
+// its checkpoint and load the completed .itins file: same itineraries as the uninterrupted results
+static int is_bench_itins_resume_equal(Itin_Calc_Results *results, Itin_Calc_Data calc_data, CelestSystem *system, double max_search_time) {
+	const char *filepath = "kmat_bench_resume.itins", *checkpoint_filepath = "kmat_bench_resume.itins.ckpt";
+	struct ItinsBFileWriter *writer = open_itins_bfile_writer(calc_data, system, (char *) filepath, get_current_bin_file_type());
+	if(writer == NULL) return 0;
+	Itin_Result_Sink result_sink = get_checkpointed_itins_bfile_result_sink(writer);
+	calc_data.result_sink = &result_sink;
+	calc_data.max_search_time = max_search_time;
+	calc_data.hide_progress = 1;
+
+	// the stopped run has to calculate its transfers again (like a new process)
+	init_lambert_cache(-1);
+	Itin_Calc_Results stopped_results = search_for_itineraries(calc_data);
+	free_itin_calc_results(&stopped_results);
+	close_itins_bfile_writer(writer);
+
+	struct Competition_Calc_Settings settings = {.hide_progress = 1};
+	int is_resumed = resume_competition_calc((char *) filepath, system, &settings);
+	struct ItinsLoadFileResults load_results = is_resumed ? load_itineraries_from_bfile((char *) filepath) : (struct ItinsLoadFileResults) {0};
+	remove(filepath);
+	remove(checkpoint_filepath);
+	int is_equal = is_resumed && is_bench_itins_equal(results, &load_results);
+	free_bench_load_results(&load_results);
+	return is_equal;
+}
+
+static void run_bench_scenario(struct Bench_Env *env, const char *name, const char *queue_filename) {
+	if(!is_bench_selected(env, name)) return;
+	char queue_filepath[1024];
+	get_bench_queue_filepath(env, queue_filename, queue_filepath, sizeof(queue_filepath));
+	Itin_Calc_Data calc_data;
+	if(!load_competition_calc_data(queue_filepath, env->system, &calc_data)) return;
+	if(env->options.is_quick)
+		calc_data.jd_max_dep = calc_data.jd_min_dep + (BENCH_QUICK_NUM_DEP_DATES-1) * calc_data.step_dep_date;
+
+	int num_runs = env->options.num_repetitions;
+	double *samples = (double *) malloc(num_runs * sizeof(double));
+	struct Bench_Result *result = &env->scenarios[env->num_scenarios++];
+	*result = (struct Bench_Result) {.queue_filename = queue_filename};
+	snprintf(result->name, sizeof(result->name), "%s", name);
+
+	for(int i = 0; i < num_runs; i++) {
+		// every run starts with an empty Lambert cache
+		init_lambert_cache(-1);
+		printf("\n%s (run %d/%d)\n", name, i+1, num_runs);
+		double start = get_bench_time();
+		Itin_Calc_Results results = search_for_itineraries(calc_data);
+		samples[i] = get_bench_time() - start;
+		result->total_time += samples[i];
+		result->num_deps = results.num_deps;
+		result->num_nodes = results.num_nodes;
+		result->num_itins = results.num_itins;
+		if(i == 0) {
+			result->is_roundtrip_equal = is_bench_itins_roundtrip_equal(&results, calc_data, env->system);
+			if(!result->is_roundtrip_equal) printf("%s: itineraries changed after storing and loading them!\n", name);
+			// stopped halfway through the uninterrupted run
+			result->is_resume_equal = is_bench_itins_resume_equal(&results, calc_data, env->system, samples[i]/2);
+			if(!result->is_resume_equal) printf("%s: itineraries changed after stopping and resuming the search!\n", name);
+		}
+		free_itin_calc_results(&results);
+	}
+	result->num_ops = num_runs;
+	result->latency = get_bench_latency(samples, num_runs);
+	result->peak_rss = get_bench_peak_rss();
+	printf("%s: %.3f s (median of %d), %d itineraries, %ld kB peak RSS\n", name, result->latency.p50, num_runs, result->num_itins, result->peak_rss);
+
+	free(samples);
+	free_competition_calc_data(&calc_data);
+}
+
+
+/*********************************************************************
+ *                               Output
+ *********************************************************************/
+
+static void write_bench_latency_json(const char *key, struct Bench_Latency latency, FILE *file) {
+	fprintf(file, "\"%s\": {\"min\": %.6g, \"p50\": %.6g, \"p90\": %.6g, \"p99\": %.6g, \"max\": %.6g}",
+			key, latency.min, latency.p50, latency.p90, latency.p99, latency.max);
+}
+
+static void write_bench_json(struct Bench_Env *env, FILE *file) {
+	fprintf(file, "{\n\t\"seed\": %llu,\n\t\"quick\": %s,\n\t\"repetitions\": %d,\n\t\"num_threads\": %d,\n",
+			(unsigned long long) BENCH_SEED, env->options.is_quick ? "true" : "false", env->options.num_repetitions, get_default_thread_pool_size());
+	fprintf(file, "\t\"system\": \"%s\",\n\t\"num_bodies\": %d,\n", env->system->name, env->system->num_bodies);
+
+	fprintf(file, "\t\"benchmarks\": [");
+	for(int i = 0; i < env->num_kernels; i++) {
+		struct Bench_Result *result = &env->kernels[i];
+		fprintf(file, "%s\n\t\t{\"name\": \"%s\", \"ops\": %ld, \"total_time\": %.6f, \"ops_per_s\": %.6g, ",
+				i > 0 ? "," : "", result->name, result->num_ops, result->total_time, result->num_ops / result->total_time);
+		if(result->items_per_op > 0) fprintf(file, "\"items_per_s\": %.6g, ", result->num_ops * result->items_per_op / result->total_time);
+		write_bench_latency_json("latency_ns", result->latency, file);
+		fprintf(file, ", \"peak_rss_kb\": %ld}", result->peak_rss);
+	}
+	fprintf(file, "%s],\n", env->num_kernels > 0 ? "\n\t" : "");
+
+	fprintf(file, "\t\"scenarios\": [");
+	for(int i = 0; i < env->num_scenarios; i++) {
+		struct Bench_Result *result = &env->scenarios[i];
+		fprintf(file, "%s\n\t\t{\"name\": \"%s\", \"queue\": \"%s\", \"runs\": %ld, \"num_deps\": %d, \"num_nodes\": %d, \"num_itins\": %d, ",
+				i > 0 ? "," : "", result->name, result->queue_filename, result->num_ops, result->num_deps, result->num_nodes, result->num_itins);
+		fprintf(file, "\"itins_per_s\": %.6g, \"nodes_per_s\": %.6g, ", result->num_itins / result->latency.p50, result->num_nodes / result->latency.p50);
+		fprintf(file, "\"roundtrip_equal\": %s, \"resume_equal\": %s, ", result->is_roundtrip_equal ? "true" : "false", result->is_resume_equal ? "true" : "false");
+		write_bench_latency_json("time_s", result->latency, file);
+		fprintf(file, ", \"peak_rss_kb\": %ld}", result->peak_rss);
+	}
+	fprintf(file, "%s],\n", env->num_scenarios > 0 ? "\n\t" : "");
+
+	struct Bench_Flyby_Root_Coverage *coverage = &env->flyby_root_coverage;
+	if(coverage->is_checked) {
+		fprintf(file, "\t\"flyby_root_coverage\": {\"cases\": %d, \"full_cases\": %d, \"roots\": %d, \"found\": %d, \"complete\": %s},\n",
+				coverage->num_cases, coverage->num_full_cases, coverage->num_roots, coverage->num_found_roots, coverage->num_found_roots == coverage->num_roots ? "true" : "false");
+	}
+
+	fprintf(file, "\t\"peak_rss_kb\": %ld\n}\n", get_bench_peak_rss());
+}
+
+static int store_bench_json(struct Bench_Env *env) {
+	if(strcmp(env->options.out_filepath, "-") == 0) {
+		write_bench_json(env, stdout);
+		return 1;
+	}
+	FILE *file = fopen(env->options.out_filepath, "w");
+	if(file == NULL) {
+		printf("Could not write benchmark results to %s\n", env->options.out_filepath);
+		return 0;
+	}
+	write_bench_json(env, file);
+	fclose(file);
+	printf("\nBenchmark results written to %s\n", env->options.out_filepath);
+	return 1;
+}
+
+static void print_bench_usage() {
+	printf("Usage: KMAT_bench [options]\n"
+		   "  --systems DIR      directory of the celestial systems (default: ../Celestial_Systems/)\n"
+		   "  --queue DIR        directory of the queue files of the scenarios (default: ../Queue/)\n"
+		   "  --out FILE         JSON results (default: kmat_bench.json; -: stdout)\n"
+		   "  --filter NAME      only benchmarks and scenarios containing NAME\n"
+		   "  --quick            fewer samples and one departure date per scenario\n"
+		   "  -t, --threads N    worker threads of the searches (default: number of cores)\n"
+		   "  --repetitions N    repetitions of every benchmark and scenario (default: 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+	struct Bench_Env *env = (struct Bench_Env *) calloc(1, sizeof(struct Bench_Env));
+	env->options = (struct Bench_Options) {
+			.systems_directory = "../Celestial_Systems/",
+			.queue_directory = "../Queue/",
+			.out_filepath = "kmat_bench.json",
+			.num_repetitions = 1
+	};
+
+	for(int i = 1; i < argc; i++) {
+		int has_value = i+1 < argc;
+		if(strcmp(argv[i], "--systems") == 0 && has_value) env->options.systems_directory = argv[++i];
+		else if(strcmp(argv[i], "--queue") == 0 && has_value) env->options.queue_directory = argv[++i];
+		else if(strcmp(argv[i], "--out") == 0 && has_value) env->options.out_filepath = argv[++i];
+		else if(strcmp(argv[i], "--filter") == 0 && has_value) env->options.filter = argv[++i];
+		else if(strcmp(argv[i], "--quick") == 0) env->options.is_quick = 1;
+		else if((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && has_value) env->options.num_threads = (int) strtol(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--repetitions") == 0 && has_value) env->options.num_repetitions = (int) strtol(argv[++i], NULL, 10);
+		else {
+			print_bench_usage();
+			free(env);
+			return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+	}
+	if(env->options.num_repetitions < 1) env->options.num_repetitions = 1;
+	set_default_thread_pool_size(env->options.num_threads);
+
+	init_available_systems((char *) env->options.systems_directory);
+	if(get_num_available_systems() == 0) {
+		printf("No celestial system found in %s\n", env->options.systems_directory);
+		free(env);
+		return 1;
+	}
+	env->system = get_available_systems()[0];
+
+	// kernels are timed without the Lambert cache (repeated inputs would only measure cache hits)
+	init_lambert_cache(0);
+	run_bench_state_kernels(env);
+	run_bench_flyby_kernel(env);
+	run_bench_itin_kernels(env);
+
+	run_bench_scenario(env, "sequence", "exampleSequence.txt");
+	run_bench_scenario(env, "itinerary_from_t0", "exampleItineraryFromT0.txt");
+
+	int is_stored = store_bench_json(env);
+
+	free_lambert_cache();
+	free_all_celestial_systems();
+	free(env);
+	return is_stored ? 0 : 1;
+}
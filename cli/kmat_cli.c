@@ -0,0 +1,298 @@
+#include "queue_watcher.h"
+#include "tools/competition_tools.h"
+#include "tools/celestial_systems.h"
+#include "tools/file_io.h"
+#include "tools/thread_pool.h"
+#include "orbit_calculator/lambert_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Non-interactive runs of queue files (no GUI): every queue file is one job, up to max_running_jobs jobs run at the same
+// time and share the worker threads and the memory budget evenly. Jobs are written to <out-dir>/<queue name>.itins.
+// With --watch, the queue directory is watched for new files instead (see queue_watcher.h).
+// With --rank, the best-scoring itineraries of .itins files are printed instead (no search).
+
+struct Cli_Options {
+	const char *systems_directory;
+	const char *out_filepath;		// single job only (NULL: named after the queue file in out_directory)
+	const char *out_directory;
+	int num_threads;				// all jobs together (<= 0: number of available cores)
+	int max_running_jobs;			// <= 0: one job at a time (--watch: limited by the threads only)
+	double max_memory;				// all jobs together in bytes (<= 0: no limit)
+	int is_writing_stats;			// <itins path>.stats.json next to every .itins file
+	double stats_snapshot_interval;
+	int is_resuming;				// inputs are .itins files of cancelled runs
+	const char *watch_directory;	// NULL: run the given queue files and exit
+	double poll_interval;
+	int num_ranked_itins;			// > 0: print the best itineraries of the input .itins files
+	int score_top_k;				// > 0: branch-and-bound on the competition score
+	double max_search_time;			// seconds per job (<= 0: no limit)
+	double min_arr_window;			// days (<= 0: exhaustive initial transfer sweep)
+	int prune_equivalent_steps;
+	int use_meet_in_the_middle;
+	double max_ephem_cache_error;	// m (<= 0: exact body states)
+};
+
+struct Cli_Job {
+	const char *input_filepath;		// queue file (resuming: .itins file)
+	char store_filepath[1024];
+	char stats_filepath[1040];
+	char best_filepath[1040];
+	struct Competition_Calc_Settings settings;
+	CelestSystem *system;
+	int is_resuming;
+	int is_successful;
+	double elapsed_time;
+};
+
+
+static void print_cli_usage() {
+	printf("Usage: KMAT_cli [options] QUEUE_FILE...\n"
+		   "       KMAT_cli --resume [options] ITINS_FILE...\n"
+		   "  -o, --out FILE         .itins file of the search (only with a single queue file)\n"
+		   "  -d, --out-dir DIR      directory of the .itins files named after the queue files (default: ../Itineraries/)\n"
+		   "  -t, --threads N        worker threads of all running jobs together (default: number of cores)\n"
+		   "  -j, --jobs N           queue files calculated at the same time (default: 1)\n"
+		   "  -m, --memory MB        memory budget of all running jobs together (departure dates beyond it are skipped; resumable)\n"
+		   "  --stats                write search statistics next to every .itins file (<file>.stats.json)\n"
+		   "  --stats-interval S     also write the statistics every S seconds during the search\n"
+		   "  -k, --top-k K          only search for the K best-scoring itineraries (cuts branches that can't beat them),\n"
+		   "                         they are also written to <file>.best.itins during the search\n"
+		   "  --time-limit S         stop every search after S seconds (best departure dates first; resumable)\n"
+		   "  --min-arr-window D     sample the arrival dates of the initial transfers coarse-to-fine, feasible arrival date\n"
+		   "                         windows narrower than D days can be missed (default: every arrival date is evaluated)\n"
+		   "  --prune                only continue one of several equivalent sibling steps (faster, can lose itineraries;\n"
+		   "                         pass it again with --resume)\n"
+		   "  --mitm                 search long sequences with meet in the middle (faster, sampled dates can lose itineraries;\n"
+		   "                         pass it again with --resume)\n"
+		   "  --ephem-cache M        interpolate body states from tables with a maximum position error of M meters\n"
+		   "                         (faster; default: exact body states)\n"
+		   "  --systems DIR          directory of the celestial systems (default: ../Celestial_Systems/)\n"
+		   "  --resume               continue the given .itins files from their checkpoints\n"
+		   "\n"
+		   "       KMAT_cli --rank N [-t N] ITINS_FILE...\n"
+		   "  Prints the N best-scoring itineraries of every .itins file (scored in parallel).\n"
+		   "\n"
+		   "       KMAT_cli --watch DIR [options]\n"
+		   "  Runs every queue file (<name>.txt or <name>.p<priority>.txt) that appears in DIR, jobs with a higher priority get\n"
+		   "  more of the threads and the memory budget. Jobs and their results are moved to DIR/running, DIR/done and DIR/failed.\n"
+		   "  Stops when DIR/" QUEUE_WATCHER_STOP_FILENAME " is created or on Ctrl+C (interrupted jobs are resumed on the next start).\n"
+		   "  --poll-interval S      seconds between two scans of DIR (default: %d)\n"
+		   "  -j, -t, -m, -k, --time-limit, --min-arr-window, --prune, --mitm, --ephem-cache and --stats-interval as above (-j default: no limit besides the threads)\n", QUEUE_WATCHER_DEFAULT_POLL_INTERVAL);
+}
+
+// <out_directory>/<file name of queue_filepath without extension>.itins
+static void get_cli_store_filepath(const char *queue_filepath, const char *out_directory, char *store_filepath, size_t size) {
+	const char *name = queue_filepath;
+	for(const char *c = queue_filepath; *c != '\0'; c++) if(*c == '/' || *c == '\\') name = c+1;
+	const char *extension = strrchr(name, '.');
+	int name_length = extension != NULL && extension != name ? (int) (extension - name) : (int) strlen(name);
+	size_t dir_length = strlen(out_directory);
+	const char *separator = dir_length > 0 && out_directory[dir_length-1] != '/' && out_directory[dir_length-1] != '\\' ? "/" : "";
+	snprintf(store_filepath, size, "%s%s%.*s.itins", out_directory, separator, name_length, name);
+}
+
+static int compare_porkchop_points_by_score(const void *a, const void *b) {
+	double score_a = ((struct PorkchopPoint *) a)->score, score_b = ((struct PorkchopPoint *) b)->score;
+	return (score_a < score_b) - (score_a > score_b);
+}
+
+// print the num_ranked best-scoring itineraries of the .itins file (returns 0 if the file can't be loaded)
+static int print_ranked_itins(const char *filepath, int num_ranked, struct Thread_Pool *pool) {
+	if(!does_file_exist(filepath)) {
+		printf("Could not open %s\n", filepath);
+		return 0;
+	}
+	struct ItinsLoadFileResults load_results = load_itineraries_from_bfile((char *) filepath);
+	if(load_results.departures == NULL) return 0;
+	ItinStepBinHeaderData header = load_results.header;
+
+	int num_itins = 0;
+	for(int i = 0; i < header.num_deps; i++) num_itins += get_number_of_itineraries(load_results.departures[i]);
+	struct ItinStep **arrivals = (struct ItinStep **) malloc((num_itins > 0 ? num_itins : 1) * sizeof(struct ItinStep *));
+	int index = 0;
+	for(int i = 0; i < header.num_deps; i++) store_itineraries_in_array(load_results.departures[i], arrivals, &index);
+
+	struct PorkchopPoint *points = (struct PorkchopPoint *) malloc((num_itins > 0 ? num_itins : 1) * sizeof(struct PorkchopPoint));
+	create_porkchop_points(arrivals, num_itins, header.calc_data.dv_filter.dep_periapsis, header.calc_data.dv_filter.arr_periapsis, points, pool);
+	qsort(points, num_itins, sizeof(struct PorkchopPoint), compare_porkchop_points_by_score);
+
+	printf("%s: %d itineraries\n", filepath, num_itins);
+	for(int i = 0; i < num_ranked && i < num_itins; i++) {
+		struct PorkchopPoint *pp = &points[i];
+		printf("%4d. score %10.4f%s  dep %.3f  dur %8.2f d  dv dep %8.1f m/s  dsm %8.1f m/s  ",
+			   i+1, pp->score, pp->is_score_valid ? "" : " (invalid)", pp->dep_date, pp->dur, pp->dv_dep, pp->dv_dsm);
+		struct ItinStep *step = get_first(pp->arrival);
+		while(step != NULL) {
+			if(step->body != NULL) printf("%s%s", step->body->name, step->num_next_nodes > 0 ? "-" : "");
+			step = step->num_next_nodes > 0 ? step->next[0] : NULL;
+		}
+		printf("\n");
+	}
+
+	free(points);
+	free(arrivals);
+	for(int i = 0; i < header.num_deps; i++) free_itinerary(load_results.departures[i]);
+	free(load_results.departures);
+	if(header.file_type > 2) free_competition_calc_data(&header.calc_data);
+	if(!is_available_system(header.system)) free_celestial_system(header.system);
+	return 1;
+}
+
+static void *run_cli_job(void *args) {
+	struct Cli_Job *job = (struct Cli_Job *) args;
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	printf("\nStarting %s -> %s\n", job->input_filepath, job->store_filepath);
+
+	if(job->is_resuming) job->is_successful = resume_competition_calc(job->store_filepath, job->system, &job->settings);
+	else job->is_successful = run_competition_calc((char *) job->input_filepath, job->store_filepath, job->system, &job->settings);
+
+	gettimeofday(&end, NULL);
+	job->elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("\n%s %s (%.1f s)\n", job->is_successful ? "Finished" : "Failed", job->input_filepath, job->elapsed_time);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	struct Cli_Options options = {
+			.systems_directory = "../Celestial_Systems/",
+			.out_directory = "../Itineraries/"
+	};
+	const char **input_filepaths = (const char **) malloc(argc * sizeof(char *));
+	int num_jobs = 0;
+
+	for(int i = 1; i < argc; i++) {
+		int has_value = i+1 < argc;
+		if((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--out") == 0) && has_value) options.out_filepath = argv[++i];
+		else if((strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--out-dir") == 0) && has_value) options.out_directory = argv[++i];
+		else if((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && has_value) options.num_threads = (int) strtol(argv[++i], NULL, 10);
+		else if((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && has_value) options.max_running_jobs = (int) strtol(argv[++i], NULL, 10);
+		else if((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--memory") == 0) && has_value) options.max_memory = strtod(argv[++i], NULL) * 1e6;
+		else if((strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "--top-k") == 0) && has_value) options.score_top_k = (int) strtol(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--rank") == 0 && has_value) options.num_ranked_itins = (int) strtol(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--time-limit") == 0 && has_value) options.max_search_time = strtod(argv[++i], NULL);
+		else if(strcmp(argv[i], "--min-arr-window") == 0 && has_value) options.min_arr_window = strtod(argv[++i], NULL);
+		else if(strcmp(argv[i], "--prune") == 0) options.prune_equivalent_steps = 1;
+		else if(strcmp(argv[i], "--mitm") == 0) options.use_meet_in_the_middle = 1;
+		else if(strcmp(argv[i], "--ephem-cache") == 0 && has_value) options.max_ephem_cache_error = strtod(argv[++i], NULL);
+		else if(strcmp(argv[i], "--stats") == 0) options.is_writing_stats = 1;
+		else if(strcmp(argv[i], "--stats-interval") == 0 && has_value) options.stats_snapshot_interval = strtod(argv[++i], NULL);
+		else if(strcmp(argv[i], "--systems") == 0 && has_value) options.systems_directory = argv[++i];
+		else if(strcmp(argv[i], "--resume") == 0) options.is_resuming = 1;
+		else if(strcmp(argv[i], "--watch") == 0 && has_value) options.watch_directory = argv[++i];
+		else if(strcmp(argv[i], "--poll-interval") == 0 && has_value) options.poll_interval = strtod(argv[++i], NULL);
+		else if(argv[i][0] == '-' && argv[i][1] != '\0') {
+			print_cli_usage();
+			free(input_filepaths);
+			return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		} else input_filepaths[num_jobs++] = argv[i];
+	}
+	if((num_jobs == 0 && options.watch_directory == NULL) || (options.out_filepath != NULL && num_jobs > 1)) {
+		if(num_jobs > 1) printf("--out can only be used with a single queue file\n");
+		print_cli_usage();
+		free(input_filepaths);
+		return 1;
+	}
+
+	init_available_systems((char *) options.systems_directory);
+	if(get_num_available_systems() == 0) {
+		printf("No celestial system found in %s\n", options.systems_directory);
+		free(input_filepaths);
+		return 1;
+	}
+	CelestSystem *system = get_available_systems()[0];
+
+	if(options.num_ranked_itins > 0) {
+		struct Thread_Pool *pool = create_thread_pool(options.num_threads);
+		int num_failed_files = 0;
+		for(int i = 0; i < num_jobs; i++) if(!print_ranked_itins(input_filepaths[i], options.num_ranked_itins, pool)) num_failed_files++;
+		destroy_thread_pool(pool);
+		free(input_filepaths);
+		free_lambert_cache();
+		free_all_celestial_systems();
+		return num_failed_files > 0 ? 1 : 0;
+	}
+
+	if(options.watch_directory != NULL) {
+		struct Queue_Watcher_Settings watcher_settings = {
+				.queue_directory = options.watch_directory,
+				.num_threads = options.num_threads,
+				.max_running_jobs = options.max_running_jobs,
+				.max_memory = options.max_memory,
+				.poll_interval = options.poll_interval,
+				.stats_snapshot_interval = options.stats_snapshot_interval,
+				.score_top_k = options.score_top_k,
+				.max_search_time = options.max_search_time,
+				.min_arr_window = options.min_arr_window,
+				.prune_equivalent_steps = options.prune_equivalent_steps,
+				.use_meet_in_the_middle = options.use_meet_in_the_middle,
+				.max_ephem_cache_error = options.max_ephem_cache_error
+		};
+		int num_failed_jobs = run_queue_watcher(&watcher_settings, system);
+		free(input_filepaths);
+		free_lambert_cache();
+		free_all_celestial_systems();
+		return num_failed_jobs != 0 ? 1 : 0;
+	}
+
+	// running jobs share the threads and the memory budget
+	int num_running_jobs = options.max_running_jobs < 1 ? 1 : options.max_running_jobs < num_jobs ? options.max_running_jobs : num_jobs;
+	int num_threads = options.num_threads > 0 ? options.num_threads : get_num_available_cores();
+	int num_threads_per_job = num_threads / num_running_jobs > 0 ? num_threads / num_running_jobs : 1;
+	if(!options.is_resuming && options.out_filepath == NULL) create_directory_if_not_exists(options.out_directory);
+
+	struct Cli_Job *jobs = (struct Cli_Job *) calloc(num_jobs, sizeof(struct Cli_Job));
+	for(int i = 0; i < num_jobs; i++) {
+		struct Cli_Job *job = &jobs[i];
+		job->input_filepath = input_filepaths[i];
+		job->system = system;
+		job->is_resuming = options.is_resuming;
+		if(options.is_resuming) snprintf(job->store_filepath, sizeof(job->store_filepath), "%s", input_filepaths[i]);
+		else if(options.out_filepath != NULL) snprintf(job->store_filepath, sizeof(job->store_filepath), "%s", options.out_filepath);
+		else get_cli_store_filepath(input_filepaths[i], options.out_directory, job->store_filepath, sizeof(job->store_filepath));
+		snprintf(job->stats_filepath, sizeof(job->stats_filepath), "%s.stats.json", job->store_filepath);
+		snprintf(job->best_filepath, sizeof(job->best_filepath), "%s.best.itins", job->store_filepath);
+
+		job->settings = (struct Competition_Calc_Settings) {
+				.num_threads = num_threads_per_job,
+				.max_memory = options.max_memory > 0 ? options.max_memory / num_running_jobs : 0,
+				.stats_filepath = options.is_writing_stats ? job->stats_filepath : NULL,
+				.stats_snapshot_interval = options.stats_snapshot_interval,
+				.score_top_k = options.score_top_k,
+				.max_search_time = options.max_search_time,
+				.best_itins_filepath = options.score_top_k > 0 ? job->best_filepath : NULL,
+				.min_arr_window = options.min_arr_window,
+				.prune_equivalent_steps = options.prune_equivalent_steps,
+				.use_meet_in_the_middle = options.use_meet_in_the_middle,
+				.max_ephem_cache_error = options.max_ephem_cache_error,
+				// progress lines of several searches would overwrite each other
+				.hide_progress = num_running_jobs > 1
+		};
+	}
+
+	printf("%d job(s), %d at a time with %d thread(s) each\n", num_jobs, num_running_jobs, num_threads_per_job);
+	if(num_running_jobs == 1) {
+		for(int i = 0; i < num_jobs; i++) run_cli_job(&jobs[i]);
+	} else {
+		struct Thread_Pool *job_pool = create_thread_pool(num_running_jobs);
+		for(int i = 0; i < num_jobs; i++) submit_detached_thread_pool_task(job_pool, run_cli_job, &jobs[i]);
+		join_thread_pool(job_pool);
+		destroy_thread_pool(job_pool);
+	}
+
+	int num_failed_jobs = 0;
+	printf("\n");
+	for(int i = 0; i < num_jobs; i++) {
+		printf("%-8s %s -> %s (%.1f s)\n", jobs[i].is_successful ? "ok" : "FAILED", jobs[i].input_filepath, jobs[i].store_filepath, jobs[i].elapsed_time);
+		if(!jobs[i].is_successful) num_failed_jobs++;
+	}
+
+	free(jobs);
+	free(input_filepaths);
+	free_lambert_cache();
+	free_all_celestial_systems();
+	return num_failed_jobs > 0 ? 1 : 0;
+}
@@ -0,0 +1,298 @@
+#include "queue_watcher.h"
+#include "tools/competition_tools.h"
+#include "tools/file_io.h"
+#include "tools/thread_pool.h"
+#include "orbit_calculator/itin_search_status.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+
+
+struct Queue_Job {
+	char name[256];					// queue file name without .txt
+	char job_filepath[1280];		// running/<name>.txt
+	char itins_filepath[1280];		// running/<name>.itins
+	char stats_filepath[1300];
+	char best_filepath[1300];		// best itineraries (only with score_top_k)
+	int priority;
+	int num_threads;
+	int is_resuming;
+	Itin_Search_Status *status;
+	struct Queue_Watcher *watcher;
+	struct Queue_Job *next;
+};
+
+struct Queue_Watcher {
+	struct Queue_Watcher_Settings settings;
+	CelestSystem *system;
+	char running_directory[1100], done_directory[1100], failed_directory[1100];
+	int num_threads, max_running_jobs;
+	int num_used_threads, num_running_jobs;
+	int num_finished_jobs, num_failed_jobs;
+	struct Queue_Job *running_jobs;
+	struct Thread_Pool *job_pool;	// one worker per running job (blocked while its search runs on its own pool)
+	thread_mutex_t lock;
+	thread_cond_t cond;				// signalled when a job ends
+	int has_ended_job;				// a job ended since the last scan
+};
+
+// queue file that can be started
+struct Queue_Candidate {
+	char *filename;
+	int priority;
+	int is_resuming;				// left in running/ by an earlier watcher with a checkpoint
+};
+
+static volatile sig_atomic_t is_queue_watcher_interrupted = 0;
+
+
+static void interrupt_queue_watcher(int signal_number) {
+	is_queue_watcher_interrupted = 1;
+}
+
+// <name>.p<priority>.txt (QUEUE_WATCHER_DEFAULT_PRIORITY without priority suffix)
+static int get_queue_job_priority(const char *filename) {
+	const char *extension = strrchr(filename, '.');
+	if(extension == NULL) return QUEUE_WATCHER_DEFAULT_PRIORITY;
+	const char *c = extension;
+	while(c > filename && isdigit((unsigned char) c[-1])) c--;
+	if(c == extension || c-2 < filename || c[-1] != 'p' || c[-2] != '.') return QUEUE_WATCHER_DEFAULT_PRIORITY;
+	int priority = (int) strtol(c, NULL, 10);
+	return priority > 0 ? priority : QUEUE_WATCHER_DEFAULT_PRIORITY;
+}
+
+static int compare_queue_candidates(const void *a, const void *b) {
+	const struct Queue_Candidate *cand_a = (const struct Queue_Candidate *) a, *cand_b = (const struct Queue_Candidate *) b;
+	if(cand_a->is_resuming != cand_b->is_resuming) return cand_b->is_resuming - cand_a->is_resuming;
+	if(cand_a->priority != cand_b->priority) return cand_b->priority - cand_a->priority;
+	return strcmp(cand_a->filename, cand_b->filename);
+}
+
+static int is_queue_job_running(struct Queue_Watcher *watcher, const char *name) {
+	for(struct Queue_Job *job = watcher->running_jobs; job != NULL; job = job->next) if(strcmp(job->name, name) == 0) return 1;
+	return 0;
+}
+
+// move the job file and its results from running/ to directory
+static void move_queue_job_files(struct Queue_Job *job, const char *directory) {
+	const char *suffixes[] = {".txt", ".itins", ".itins.ckpt", ".itins.stats.json", ".itins.best.itins"};
+	for(int i = 0; i < 4; i++) {
+		char from_filepath[1400], to_filepath[1400];
+		snprintf(from_filepath, sizeof(from_filepath), "%s/%s%s", job->watcher->running_directory, job->name, suffixes[i]);
+		snprintf(to_filepath, sizeof(to_filepath), "%s/%s%s", directory, job->name, suffixes[i]);
+		if(does_file_exist(from_filepath)) move_file(from_filepath, to_filepath);
+	}
+}
+
+static void *run_queue_job(void *args) {
+	struct Queue_Job *job = (struct Queue_Job *) args;
+	struct Queue_Watcher *watcher = job->watcher;
+
+	// memory budget is shared like the cores
+	struct Competition_Calc_Settings settings = {
+			.num_threads = job->num_threads,
+			.max_memory = watcher->settings.max_memory > 0 ? watcher->settings.max_memory * job->num_threads / watcher->num_threads : 0,
+			.stats_filepath = job->stats_filepath,
+			.stats_snapshot_interval = watcher->settings.stats_snapshot_interval,
+			.hide_progress = 1,
+			.score_top_k = watcher->settings.score_top_k,
+			.max_search_time = watcher->settings.max_search_time,
+			.best_itins_filepath = watcher->settings.score_top_k > 0 ? job->best_filepath : NULL,
+			.min_arr_window = watcher->settings.min_arr_window,
+			.prune_equivalent_steps = watcher->settings.prune_equivalent_steps,
+			.use_meet_in_the_middle = watcher->settings.use_meet_in_the_middle,
+			.max_ephem_cache_error = watcher->settings.max_ephem_cache_error,
+			.status = job->status
+	};
+	int is_successful = job->is_resuming ?
+			resume_competition_calc(job->itins_filepath, watcher->system, &settings) :
+			run_competition_calc(job->job_filepath, job->itins_filepath, watcher->system, &settings);
+
+	// cancelled by stopping the watcher: resumed from the checkpoint on the next start (stopped by the time limit: done)
+	int is_cancelled = is_itin_search_cancelled(job->status) && !is_itin_search_deadline_reached(job->status);
+	if(!is_cancelled) move_queue_job_files(job, is_successful ? watcher->done_directory : watcher->failed_directory);
+	printf("\n%s job %s\n", is_cancelled ? "Interrupted" : is_successful ? "Finished" : "Failed", job->name);
+
+	lock_thread_mutex(&watcher->lock);
+	struct Queue_Job **link = &watcher->running_jobs;
+	while(*link != job) link = &(*link)->next;
+	*link = job->next;
+	watcher->num_used_threads -= job->num_threads;
+	watcher->num_running_jobs--;
+	if(!is_cancelled) {
+		if(is_successful) watcher->num_finished_jobs++;
+		else watcher->num_failed_jobs++;
+	}
+	watcher->has_ended_job = 1;
+	broadcast_thread_cond(&watcher->cond);
+	unlock_thread_mutex(&watcher->lock);
+
+	free_itin_search_status(job->status);
+	free(job);
+	return NULL;
+}
+
+// move the queue file to running/ and start the job (watcher is locked)
+static void start_queue_job(struct Queue_Watcher *watcher, struct Queue_Candidate *cand, int num_threads) {
+	struct Queue_Job *job = (struct Queue_Job *) calloc(1, sizeof(struct Queue_Job));
+	snprintf(job->name, sizeof(job->name), "%.*s", (int) (strlen(cand->filename) - 4), cand->filename);
+	snprintf(job->job_filepath, sizeof(job->job_filepath), "%s/%s", watcher->running_directory, cand->filename);
+	snprintf(job->itins_filepath, sizeof(job->itins_filepath), "%s/%s.itins", watcher->running_directory, job->name);
+	snprintf(job->stats_filepath, sizeof(job->stats_filepath), "%s.stats.json", job->itins_filepath);
+	snprintf(job->best_filepath, sizeof(job->best_filepath), "%s.best.itins", job->itins_filepath);
+	job->priority = cand->priority;
+	job->num_threads = num_threads;
+	job->is_resuming = cand->is_resuming;
+	job->watcher = watcher;
+
+	if(!job->is_resuming) {
+		char queue_filepath[1400];
+		snprintf(queue_filepath, sizeof(queue_filepath), "%s/%s", watcher->settings.queue_directory, cand->filename);
+		if(!move_file(queue_filepath, job->job_filepath)) {
+			free(job);
+			return;
+		}
+	}
+	job->status = create_itin_search_status();
+	job->next = watcher->running_jobs;
+	watcher->running_jobs = job;
+	watcher->num_used_threads += num_threads;
+	watcher->num_running_jobs++;
+
+	printf("\n%s job %s (priority %d, %d threads)\n", job->is_resuming ? "Resuming" : "Starting", job->name, job->priority, num_threads);
+	submit_detached_thread_pool_task(watcher->job_pool, run_queue_job, job);
+}
+
+// add the .txt files of directory as candidates (running/: jobs of an earlier watcher)
+static int add_queue_candidates(struct Queue_Watcher *watcher, const char *directory, int is_running_directory, struct Queue_Candidate **cands, int num_cands) {
+	char **filenames;
+	int num_files = get_directory_file_names(directory, ".txt", &filenames);
+	if(num_files <= 0) {
+		free_directory_file_names(filenames, 0);
+		return num_cands;
+	}
+	*cands = (struct Queue_Candidate *) realloc(*cands, (num_cands + num_files) * sizeof(struct Queue_Candidate));
+	for(int i = 0; i < num_files; i++) {
+		struct Queue_Candidate cand = {.filename = filenames[i], .priority = get_queue_job_priority(filenames[i])};
+		if(is_running_directory) {
+			char name[256], filepath[1400];
+			snprintf(name, sizeof(name), "%.*s", (int) (strlen(filenames[i]) - 4), filenames[i]);
+			if(is_queue_job_running(watcher, name)) {
+				free(filenames[i]);
+				continue;
+			}
+			snprintf(filepath, sizeof(filepath), "%s/%s.itins.ckpt", directory, name);
+			cand.is_resuming = does_file_exist(filepath);
+			// nothing to resume from --> back to the queue
+			if(!cand.is_resuming) {
+				char queue_filepath[1400];
+				snprintf(filepath, sizeof(filepath), "%s/%s", directory, filenames[i]);
+				snprintf(queue_filepath, sizeof(queue_filepath), "%s/%s", watcher->settings.queue_directory, filenames[i]);
+				move_file(filepath, queue_filepath);
+				free(filenames[i]);
+				continue;
+			}
+		}
+		(*cands)[num_cands++] = cand;
+	}
+	free(filenames);
+	return num_cands;
+}
+
+// start queued jobs while there are free cores (cores are divided by the priorities of the running and the started jobs)
+static void schedule_queue_jobs(struct Queue_Watcher *watcher) {
+	lock_thread_mutex(&watcher->lock);
+	struct Queue_Candidate *cands = NULL;
+	int num_cands = add_queue_candidates(watcher, watcher->running_directory, 1, &cands, 0);
+	num_cands = add_queue_candidates(watcher, watcher->settings.queue_directory, 0, &cands, num_cands);
+	if(num_cands > 1) qsort(cands, num_cands, sizeof(struct Queue_Candidate), compare_queue_candidates);
+
+	int num_started = watcher->max_running_jobs - watcher->num_running_jobs;
+	if(num_started > num_cands) num_started = num_cands;
+	int total_priority = 0;
+	for(struct Queue_Job *job = watcher->running_jobs; job != NULL; job = job->next) total_priority += job->priority;
+	for(int i = 0; i < num_started; i++) total_priority += cands[i].priority;
+
+	for(int i = 0; i < num_started; i++) {
+		int num_free_threads = watcher->num_threads - watcher->num_used_threads;
+		if(num_free_threads <= 0) break;
+		int num_threads = watcher->num_threads * cands[i].priority / total_priority;
+		if(num_threads < 1) num_threads = 1;
+		if(num_threads > num_free_threads) num_threads = num_free_threads;
+		start_queue_job(watcher, &cands[i], num_threads);
+	}
+	unlock_thread_mutex(&watcher->lock);
+
+	for(int i = 0; i < num_cands; i++) free(cands[i].filename);
+	free(cands);
+}
+
+static int is_queue_watcher_stop_requested(struct Queue_Watcher *watcher) {
+	if(is_queue_watcher_interrupted) return 1;
+	char stop_filepath[1100];
+	snprintf(stop_filepath, sizeof(stop_filepath), "%s/%s", watcher->settings.queue_directory, QUEUE_WATCHER_STOP_FILENAME);
+	if(!does_file_exist(stop_filepath)) return 0;
+	// stop file is consumed (the next watcher starts normally)
+	remove(stop_filepath);
+	return 1;
+}
+
+int run_queue_watcher(struct Queue_Watcher_Settings *settings, CelestSystem *system) {
+	char **filenames;
+	int num_files = get_directory_file_names(settings->queue_directory, NULL, &filenames);
+	if(num_files < 0) {
+		printf("Can't read queue directory %s\n", settings->queue_directory);
+		return -1;
+	}
+	free_directory_file_names(filenames, num_files);
+
+	struct Queue_Watcher *watcher = (struct Queue_Watcher *) calloc(1, sizeof(struct Queue_Watcher));
+	watcher->settings = *settings;
+	watcher->system = system;
+	watcher->num_threads = settings->num_threads > 0 ? settings->num_threads : get_num_available_cores();
+	watcher->max_running_jobs = settings->max_running_jobs > 0 ? settings->max_running_jobs : watcher->num_threads;
+	snprintf(watcher->running_directory, sizeof(watcher->running_directory), "%s/running", settings->queue_directory);
+	snprintf(watcher->done_directory, sizeof(watcher->done_directory), "%s/done", settings->queue_directory);
+	snprintf(watcher->failed_directory, sizeof(watcher->failed_directory), "%s/failed", settings->queue_directory);
+	create_directory_if_not_exists(watcher->running_directory);
+	create_directory_if_not_exists(watcher->done_directory);
+	create_directory_if_not_exists(watcher->failed_directory);
+	init_thread_mutex(&watcher->lock);
+	init_thread_cond(&watcher->cond);
+	watcher->job_pool = create_thread_pool(watcher->max_running_jobs);
+
+	signal(SIGINT, interrupt_queue_watcher);
+	signal(SIGTERM, interrupt_queue_watcher);
+
+	int poll_interval_ms = (int) ((settings->poll_interval > 0 ? settings->poll_interval : QUEUE_WATCHER_DEFAULT_POLL_INTERVAL) * 1000);
+	printf("Watching %s (%d threads, at most %d jobs at a time; create %s/%s or press Ctrl+C to stop)\n",
+		   settings->queue_directory, watcher->num_threads, watcher->max_running_jobs, settings->queue_directory, QUEUE_WATCHER_STOP_FILENAME);
+
+	while(!is_queue_watcher_stop_requested(watcher)) {
+		schedule_queue_jobs(watcher);
+		// woken up early when a job ends (its cores can be given to the next job)
+		lock_thread_mutex(&watcher->lock);
+		if(!watcher->has_ended_job) timed_wait_thread_cond(&watcher->cond, &watcher->lock, poll_interval_ms);
+		watcher->has_ended_job = 0;
+		unlock_thread_mutex(&watcher->lock);
+	}
+
+	// running jobs end at their next checkpoint and are resumed by the next watcher
+	printf("\nStopping queue watcher...\n");
+	lock_thread_mutex(&watcher->lock);
+	for(struct Queue_Job *job = watcher->running_jobs; job != NULL; job = job->next) cancel_itin_search(job->status);
+	while(watcher->num_running_jobs > 0) wait_thread_cond(&watcher->cond, &watcher->lock);
+	unlock_thread_mutex(&watcher->lock);
+	destroy_thread_pool(watcher->job_pool);
+
+	printf("%d job(s) finished, %d failed\n", watcher->num_finished_jobs, watcher->num_failed_jobs);
+	int num_failed_jobs = watcher->num_failed_jobs;
+	destroy_thread_cond(&watcher->cond);
+	destroy_thread_mutex(&watcher->lock);
+	free(watcher);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	return num_failed_jobs;
+}
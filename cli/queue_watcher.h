@@ -0,0 +1,35 @@
+#ifndef KMAT_QUEUE_WATCHER_H
+#define KMAT_QUEUE_WATCHER_H
+
+#include "orbitlib.h"
+
+#define QUEUE_WATCHER_DEFAULT_POLL_INTERVAL 5	// seconds between two scans of the queue directory
+#define QUEUE_WATCHER_STOP_FILENAME "STOP"		// creating this file in the queue directory stops the watcher
+#define QUEUE_WATCHER_DEFAULT_PRIORITY 1
+
+// Long-running scheduler of the queue files (*.txt in the run_competition_calc format) of a directory.
+// Jobs are started with the highest priority first (file name <name>.p<priority>.txt, default: QUEUE_WATCHER_DEFAULT_PRIORITY)
+// and get a share of the cores (and memory budget) proportional to their priority, the cores of all running jobs never exceed
+// num_threads. A started job is moved to running/ and its .itins file, checkpoint and statistics are written next to it,
+// finished jobs are moved to done/ (failed/ if the search could not be started) together with their results.
+// Jobs cancelled by stopping the watcher stay in running/ and are resumed from their checkpoint on the next start.
+struct Queue_Watcher_Settings {
+	const char *queue_directory;
+	int num_threads;				// cores shared by all running jobs (<= 0: number of available cores)
+	int max_running_jobs;			// <= 0: num_threads
+	double max_memory;				// memory budget of all running jobs together in bytes (<= 0: no limit)
+	double poll_interval;			// seconds (<= 0: QUEUE_WATCHER_DEFAULT_POLL_INTERVAL)
+	double stats_snapshot_interval;	// seconds between statistics snapshots of the running jobs (<= 0: only at the end)
+	int score_top_k;				// > 0: every job only searches for its score_top_k best-scoring itineraries (written to <name>.itins.best.itins)
+	double max_search_time;			// seconds after which a job is stopped and counted as done (<= 0: no limit)
+	int use_meet_in_the_middle;		// search long sequences with meet in the middle (lossy)
+	int prune_equivalent_steps;		// only continue one of several equivalent sibling steps (lossy)
+	double min_arr_window;			// > 0: coarse-to-fine initial transfer sweep (feasible arrival date windows narrower than this [days] can be missed)
+	double max_ephem_cache_error;	// > 0: body states are interpolated with this maximum position error [m] (<= 0: exact states)
+};
+
+// watch the queue directory until the stop file appears or the process is interrupted (SIGINT, SIGTERM)
+// returns the number of failed jobs (-1 if the queue directory can't be read)
+int run_queue_watcher(struct Queue_Watcher_Settings *settings, CelestSystem *system);
+
+#endif //KMAT_QUEUE_WATCHER_H
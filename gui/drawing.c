@@ -1,18 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "drawing.h"
 #include "settings.h"
 #include "math.h"
-#include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
 
 
 void draw_body(Camera *camera, CelestSystem *system, Body *body, double jd_date) {
-	set_cairo_body_color(get_camera_screen_cairo(camera), body);
 	OSV osv_body = {.r = vec3(0,0,0)};
-	if(body != system->cb) osv_body = system->prop_method == ORB_ELEMENTS ?
-										osv_from_elements(body->orbit, jd_date) :
-									  	osv_from_ephem(body->ephem, body->num_ephems, jd_date, system->cb);
-	Vector2 p2d_body = p3d_to_p2d(camera, osv_body.r);
+	if(body != system->cb) osv_body = body_state_at(system, body, jd_date);
+	draw_body_at_position(camera, body, osv_body.r);
+}
+
+void draw_body_at_position(Camera *camera, Body *body, Vector3 r) {
+	set_cairo_body_color(get_camera_screen_cairo(camera), body);
+	Vector2 p2d_body = p3d_to_p2d(camera, r);
 	cairo_arc(get_camera_screen_cairo(camera), p2d_body.x, p2d_body.y, 5, 0, 2 * M_PI);
 	cairo_fill(get_camera_screen_cairo(camera));
 }
@@ -36,10 +39,13 @@ void draw_orbit(Camera *camera, Orbit orbit) {
 void draw_celestial_system(Camera *camera, CelestSystem *system, double jd_date) {
 	draw_body(camera, system, system->cb, jd_date);
 
+	OSV *body_osvs = (OSV *) malloc(system->num_bodies * sizeof(OSV));
+	bodies_state_at(system, system->bodies, system->num_bodies, jd_date, body_osvs);
 	for(int i = 0; i < system->num_bodies; i++) {
-		draw_body(camera, system, system->bodies[i], jd_date);
+		draw_body_at_position(camera, system->bodies[i], body_osvs[i].r);
 		draw_orbit(camera, system->bodies[i]->orbit);
 	}
+	free(body_osvs);
 }
 
 void draw_trajectory(Camera *camera, struct OSV osv0, double dt, struct Body *attractor) {
@@ -131,14 +137,10 @@ void draw_itinerary(Camera *camera, CelestSystem *system, struct ItinStep *tf, d
 	}
 
 	if(current_time <= get_first(tf)->date) {
-		OSV osv_body = system->prop_method == ORB_ELEMENTS ?
-				   osv_from_elements(get_first(tf)->body->orbit, current_time) :
-				   osv_from_ephem(get_first(tf)->body->ephem, get_first(tf)->body->num_ephems, current_time, system->cb);
+		OSV osv_body = body_state_at(system, get_first(tf)->body, current_time);
 		draw_itinerary_spacecraft(camera, osv_body.r);
 	} else if(current_time >= tf->date) {
-		OSV osv_body = system->prop_method == ORB_ELEMENTS ?
-							  osv_from_elements(tf->body->orbit, current_time) :
-							  osv_from_ephem(tf->body->ephem, tf->body->num_ephems, current_time, system->cb);
+		OSV osv_body = body_state_at(system, tf->body, current_time);
 		draw_itinerary_spacecraft(camera, osv_body.r);
 	}
 
@@ -434,7 +436,6 @@ int get_porkchop_xaxis_y() {return porkchop_xaxis_y;}
 
 void draw_porkchop(cairo_t *cr, double width, double height, struct PorkchopAnalyzerPoint *porkchop, int num_itins, enum LastTransferType last_transfer_type, int dur0arrdate1) {
 	double score, depdate, dur, arrdate;
-	CelestSystem *system = porkchop[0].data.arrival->body->orbit.cb->system;
 
 	Vector2 origin = {dur0arrdate1 ? porkchop_arrdate_yaxis_x : porkchop_dur_yaxis_x, height-porkchop_xaxis_y};
 
@@ -446,7 +447,7 @@ void draw_porkchop(cairo_t *cr, double width, double height, struct PorkchopAnal
 	double min_depdate = pp.dep_date, max_depdate = pp.dep_date;
 	double min_dur = pp.dur, max_dur = pp.dur;
 	double min_arrdate = pp.dep_date+pp.dur, max_arrdate = pp.dep_date+pp.dur;
-	double min_score = -get_itin_competition_score(pp.arrival, system);
+	double min_score = -pp.score;
 	double max_score = min_score;
 
 	// find min and max
@@ -454,7 +455,7 @@ void draw_porkchop(cairo_t *cr, double width, double height, struct PorkchopAnal
 		if(!porkchop[i].inside_filter) continue;
 		pp = porkchop[i].data;
 
-		score = -get_itin_competition_score(pp.arrival, system);
+		score = -pp.score;
 		depdate = pp.dep_date;
 		dur = pp.dur;
 		arrdate = pp.dep_date+pp.dur;
@@ -517,7 +518,7 @@ void draw_porkchop(cairo_t *cr, double width, double height, struct PorkchopAnal
 	while(i >= 0) {
 		pp = porkchop[draw_idx[i]].data;
 
-		score = -get_itin_competition_score(pp.arrival, system);
+		score = -pp.score;
 		depdate = pp.dep_date;
 		dur = pp.dur;
 		arrdate = pp.dep_date+pp.dur;
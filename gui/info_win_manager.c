@@ -1,6 +1,5 @@
 #include "info_win_manager.h"
 #include "orbit_calculator/transfer_calc.h"
-#include "tools/thread_pool.h"
 
 
 GObject *prog_window;
@@ -30,7 +29,7 @@ static gboolean update_sc_ic_progress_window(gpointer data) {
 	struct Transfer_Calc_Status calc_status = get_current_transfer_calc_status();
 	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(tf_prog_bar), calc_status.progress);
 	char s[200];
-	if(get_thread_counter(3) == 0)
+	if(!calc_status.is_cancelled)
 		sprintf(s, "Departure dates analyzed: %d / %d\nItineraries found: %d", calc_status.num_deps, (int) calc_status.jd_diff, calc_status.num_itins);
 	else
 		sprintf(s, "Departures dates analyzed: %d / %d\nItineraries found: %d\nEnding Calculations...", calc_status.num_deps, (int) calc_status.jd_diff, calc_status.num_itins);
@@ -50,7 +49,7 @@ void end_sc_ic_progress_window() {
 }
 
 G_MODULE_EXPORT void end_progress_calculation() {
-	get_incr_thread_counter(3);
+	cancel_current_transfer_calc();
 }
 
 void show_msg_window(char *msg) {
@@ -4,6 +4,7 @@
 #include "gui/settings.h"
 #include "gui/info_win_manager.h"
 #include "tools/file_io.h"
+#include "tools/thread_pool.h"
 
 
 GObject *tf_ic_window;
@@ -133,14 +134,14 @@ gboolean end_ic_calc_thread() {
 	gtk_widget_set_sensitive(GTK_WIDGET(tf_ic_window), 1);
 
 	save_itineraries_ic(ic_results.departures, ic_results.num_deps, ic_results.num_nodes, ic_results.num_itins);
-	for(int i = 0; i < ic_results.num_deps; i++) free_itinerary(ic_results.departures[i]);
-	free(ic_results.departures);
+	int num_deps = ic_results.num_deps;
+	free_itin_calc_results(&ic_results);
 	free(ic_calc_data.seq_info.to_target.flyby_bodies);
-	if(ic_results.num_deps == 0) show_msg_window("No itineraries found!");
+	if(num_deps == 0) show_msg_window("No itineraries found!");
 	return G_SOURCE_REMOVE;
 }
 
-void ic_calc_thread() {
+void *ic_calc_thread(void *args) {
 	char *string;
 
 	string = (char*) gtk_entry_get_text(GTK_ENTRY(tf_ic_mindepdate));
@@ -186,12 +187,13 @@ void ic_calc_thread() {
 
 	// GUI stuff needs to happen in main thread
 	g_idle_add((GSourceFunc)end_ic_calc_thread, NULL);
+	return NULL;
 }
 
 G_MODULE_EXPORT void on_calc_ic() {
 	if(ic_system == NULL) return;
 	gtk_widget_set_sensitive(GTK_WIDGET(tf_ic_window), 0);
-	g_thread_new("calc_thread", (GThreadFunc) ic_calc_thread, NULL);
+	submit_detached_thread_pool_task(get_global_thread_pool(), ic_calc_thread, NULL);
 	init_sc_ic_progress_window();
 }
 
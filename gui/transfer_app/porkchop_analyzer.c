@@ -7,6 +7,7 @@
 #include "tools/file_io.h"
 #include "gui/info_win_manager.h"
 #include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
 
 #include <string.h>
 #include <locale.h>
@@ -113,16 +114,16 @@ void update_pa_itinerary_preview() {
 	// Sun
 	draw_body(pa_itin_preview_camera, pa_system, pa_system->cb, current_date_pa);
 	// Planets
+	struct OSV *body_osvs = (struct OSV *) malloc(pa_system->num_bodies * sizeof(struct OSV));
+	bodies_state_at(pa_system, pa_system->bodies, pa_system->num_bodies, current_date_pa, body_osvs);
 	for(int i = 0; i < pa_system->num_bodies; i++) {
 		if(!body_show_status_pa[i]) continue;
-		draw_body(pa_itin_preview_camera, pa_system, pa_system->bodies[i], current_date_pa);
+		draw_body_at_position(pa_itin_preview_camera, pa_system->bodies[i], body_osvs[i].r);
 		struct Orbit orbit = pa_system->bodies[i]->orbit;
-		if(pa_system->prop_method == EPHEMS) {
-			struct OSV body_osv = osv_from_ephem(pa_system->bodies[i]->ephem, pa_system->bodies[i]->num_ephems, current_date_pa, pa_system->cb);
-			orbit = constr_orbit_from_osv(body_osv.r, body_osv.v, pa_system->cb);
-		}
+		if(pa_system->prop_method == EPHEMS) orbit = constr_orbit_from_osv(body_osvs[i].r, body_osvs[i].v, pa_system->cb);
 		draw_orbit(pa_itin_preview_camera, orbit);
 	}
+	free(body_osvs);
 	// Transfers
 	if(curr_transfer_pa != NULL) draw_itinerary(pa_itin_preview_camera, pa_system, curr_transfer_pa, current_date_pa);
 
@@ -282,7 +283,10 @@ void free_all_porkchop_analyzer_itins() {
 	curr_transfer_pa = NULL;
 	free(pa_groups);
 	pa_groups = NULL;
-	if(!is_available_system(pa_system)) free_celestial_system(pa_system);
+	if(!is_available_system(pa_system)) {
+		free_ephem_cache(pa_system);
+		free_celestial_system(pa_system);
+	}
 	pa_system = NULL;
 	
 	if(pa_analysis_params.num_deps > 0 && pa_analysis_params.file_type > 2) {
@@ -638,13 +642,16 @@ void analyze_departure_itins() {
 	int index = 0;
 	struct ItinStep **arrivals = (struct ItinStep**) malloc(num_itins * sizeof(struct ItinStep*));
 	for(int i = 0; i < pa_num_deps; i++) store_itineraries_in_array(pa_departures[i], arrivals, &index);
+	// scored in parallel on the worker threads (large files)
+	struct PorkchopPoint *points = malloc(num_itins * sizeof(struct PorkchopPoint));
+	create_porkchop_points(arrivals, num_itins, get_first(arrivals[0])->body->atmo_alt + pa_dep_periapsis, arrivals[0]->body->atmo_alt + pa_arr_periapsis, points, NULL);
 	pa_porkchop_points = malloc(num_itins * sizeof(struct PorkchopAnalyzerPoint));
 	for(int i = 0; i < num_itins; i++) {
-		pa_porkchop_points[i].data = create_porkchop_point(arrivals[i], get_first(arrivals[0])->body->atmo_alt + pa_dep_periapsis, arrivals[0]->body->atmo_alt + pa_arr_periapsis);
-		pa_porkchop_points[i].data.score = get_itin_competition_score(pa_porkchop_points[i].data.arrival, pa_system);
+		pa_porkchop_points[i].data = points[i];
 		pa_porkchop_points[i].inside_filter = 1;
 		pa_porkchop_points[i].group = NULL;
 	}
+	free(points);
 	free(arrivals);
 
 	pa_num_itins = num_itins;
@@ -1,6 +1,5 @@
 #include "porkchop_analyzer_tools.h"
 #include "gui/drawing.h"
-#include "tools/competition_tools.h"
 #include <stdlib.h>
 
 
@@ -59,8 +58,7 @@ void sort_porkchop(struct PorkchopAnalyzerPoint *pp, int num_itins, enum LastTra
 //		if(last_transfer_type == TF_CAPTURE) dvs[i] += pp[i].data.dv_arr_cap;
 //		if(last_transfer_type == TF_CIRC) dvs[i] += pp[i].data.dv_arr_circ;
 		dvs[i] = -pp[i].data.score;
-		if(pp[i].data.score <= 0) {printf("%d/%d    %f\n", i, num_itins, pp[i].data.score); num_invalid++;
-			print_itin_competition_score(pp[i].data.arrival, pp[i].data.arrival->body->orbit.cb->system);}
+		if(pp[i].data.score <= 0) num_invalid++;
 	}
 	printf("___ %d/%d\n", num_invalid, num_itins);
 
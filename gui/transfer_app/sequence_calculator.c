@@ -4,6 +4,7 @@
 #include "gui/settings.h"
 #include "gui/info_win_manager.h"
 #include "tools/file_io.h"
+#include "tools/thread_pool.h"
 #include <string.h>
 
 GObject *tf_sc_window;
@@ -168,14 +169,14 @@ gboolean end_sc_calc_thread() {
 	gtk_widget_set_sensitive(GTK_WIDGET(tf_sc_window), 1);
 
 	save_itineraries_sc(sc_results.departures, sc_results.num_deps, sc_results.num_nodes, sc_results.num_itins);
-	for(int i = 0; i < sc_results.num_deps; i++) free_itinerary(sc_results.departures[i]);
-	free(sc_results.departures);
+	int num_deps = sc_results.num_deps;
+	free_itin_calc_results(&sc_results);
 	free(sc_calc_data.seq_info.spec_seq.bodies);
-	if(sc_results.num_deps == 0) show_msg_window("No itineraries found!");
+	if(num_deps == 0) show_msg_window("No itineraries found!");
 	return G_SOURCE_REMOVE;
 }
 
-void sc_calc_thread() {
+void *sc_calc_thread(void *args) {
 	char *string;
 
 	string = (char*) gtk_entry_get_text(GTK_ENTRY(tf_sc_mindepdate));
@@ -220,6 +221,7 @@ void sc_calc_thread() {
 
 	// GUI stuff needs to happen in main thread
 	g_idle_add((GSourceFunc)end_sc_calc_thread, NULL);
+	return NULL;
 }
 
 
@@ -235,7 +237,7 @@ G_MODULE_EXPORT void on_calc_sc() {
 	}
 
 	gtk_widget_set_sensitive(GTK_WIDGET(tf_sc_window), 0);
-	g_thread_new("calc_thread", (GThreadFunc) sc_calc_thread, NULL);
+	submit_detached_thread_pool_task(get_global_thread_pool(), sc_calc_thread, NULL);
 	init_sc_ic_progress_window();
 }
 
@@ -7,6 +7,7 @@
 #include "tools/file_io.h"
 #include "gui/info_win_manager.h"
 #include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
 
 #include <string.h>
 #include <gtk/gtk.h>
@@ -117,17 +118,17 @@ void update_tp_system_view() {
 
 	draw_body(tp_system_camera, tp_system, tp_system->cb, current_date_tp);
 
+	struct OSV *body_osvs = (struct OSV *) malloc(tp_system->num_bodies * sizeof(struct OSV));
+	bodies_state_at(tp_system, tp_system->bodies, tp_system->num_bodies, current_date_tp, body_osvs);
 	for(int i = 0; i < tp_system->num_bodies; i++) {
 		if(!body_show_status_tp[i]) continue;
-		draw_body(tp_system_camera, tp_system, tp_system->bodies[i], current_date_tp);
+		draw_body_at_position(tp_system_camera, tp_system->bodies[i], body_osvs[i].r);
 		if(tp_system->bodies[i]->id > 1000) continue;
 		struct Orbit orbit = tp_system->bodies[i]->orbit;
-		if(tp_system->prop_method == EPHEMS) {
-			struct OSV body_osv = osv_from_ephem(tp_system->bodies[i]->ephem, tp_system->bodies[i]->num_ephems, current_date_tp, tp_system->cb);
-			orbit = constr_orbit_from_osv(body_osv.r, body_osv.v, tp_system->cb);
-		}
+		if(tp_system->prop_method == EPHEMS) orbit = constr_orbit_from_osv(body_osvs[i].r, body_osvs[i].v, tp_system->cb);
 		draw_orbit(tp_system_camera, orbit);
 	}
+	free(body_osvs);
 
 	if(curr_transfer_tp != NULL) {
 		if(curr_transfer_tp->next != NULL) {
@@ -193,6 +194,8 @@ G_MODULE_EXPORT void on_tp_system_change() {
 			gtk_combo_box_get_active(GTK_COMBO_BOX(cb_tp_system)) == -1) return;
 	
 	if(!is_available_system(get_top_level_system(tp_system)) && tp_system != NULL) {
+		free_ephem_cache(tp_system);
+		free_ephem_cache(get_top_level_system(tp_system));
 		free_celestial_system(get_top_level_system(tp_system));
 		tp_system = NULL;
 		remove_combobox_last_entry(GTK_COMBO_BOX(cb_tp_system));
@@ -555,9 +558,11 @@ G_MODULE_EXPORT void on_add_transfer(GtkWidget* widget, gpointer data) {
 	if(tp_system == NULL) return;
 	struct ItinStep *new_transfer = (struct ItinStep *) malloc(sizeof(struct ItinStep));
 	new_transfer->body = tp_system->home_body ? : tp_system->bodies[0];
+	new_transfer->score_state = (struct Itin_Score_State) {0};
 	new_transfer->prev = NULL;
 	new_transfer->next = NULL;
 	new_transfer->num_next_nodes = 0;
+	new_transfer->is_end_node = false;
 
 	struct ItinStep *next = (curr_transfer_tp != NULL && curr_transfer_tp->next != NULL) ? curr_transfer_tp->next[0] : NULL;
 
@@ -632,7 +637,8 @@ int find_closest_transfer(struct ItinStep *step) {
 	temp->next = NULL;
 	temp->prev = NULL;
 	temp->num_next_nodes = 0;
-	find_viable_flybys(temp, tp_system, step->body, 86400, 86400*365.25*200);
+	temp->is_end_node = false;
+	find_viable_flybys(temp, tp_system, step->body, 86400, 86400*365.25*200, NULL, NULL);
 
 	if(temp->next != NULL) {
 		struct ItinStep *new_step = temp->next[0];
@@ -724,7 +730,10 @@ G_MODULE_EXPORT void on_load_itinerary(GtkWidget* widget, gpointer data) {
 		update_body_dropdown(GTK_COMBO_BOX(cb_tp_tfbody), NULL);
 		free_itinerary(get_first(curr_transfer_tp));
 	}
-	if(!is_available_system(tp_system) && tp_system != NULL) free_celestial_system(tp_system);
+	if(!is_available_system(tp_system) && tp_system != NULL) {
+		free_ephem_cache(tp_system);
+		free_celestial_system(tp_system);
+	}
 	curr_transfer_tp = NULL;
 	tp_system = NULL;
 	if(gtk_combo_box_get_active(GTK_COMBO_BOX(cb_tp_system)) == get_num_available_systems()) remove_combobox_last_entry(GTK_COMBO_BOX(cb_tp_system));
@@ -1,7 +1,11 @@
 #include "tools/tool_funcs.h"
 #include "tools/competition_tools.h"
+#include "tools/thread_pool.h"
 #include "gui/gui_manager.h"
+#include "orbit_calculator/lambert_cache.h"
 #include <math.h>
+#include <string.h>
+#include <stdlib.h>
 
 #ifdef _WIN32
 #include <windows.h>  // for SetPriorityClass(), SetThreadPriority()
@@ -24,7 +28,14 @@ void set_low_priority() {
 	#endif
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+	// number of worker threads (default: number of available cores)
+	for(int i = 1; i < argc; i++) {
+		if((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && i+1 < argc) {
+			set_default_thread_pool_size((int) strtol(argv[++i], NULL, 10));
+		}
+	}
+
 	set_low_priority();
 
 	init_available_systems("../Celestial_Systems/");
@@ -45,18 +56,21 @@ int main() {
             break;
         case 2:
 			char title2[] = "CHOOSE PROGRAM:";
-			char options2[] = "Back; Itin from T0; Itin from Fly-by; Sequence";
+			char options2[] = "Back; Itin from T0; Itin from Fly-by; Sequence; Resume from checkpoint";
 			char question2[] = "Program: ";
 			selection = user_selection(title2, options2, question2);
 			switch(selection) {
 				case 1:
-					run_competition_calc("../Queue/exampleItineraryFromT0.txt", "../Itineraries/test.itins", get_available_systems()[0]);
+					run_competition_calc("../Queue/exampleItineraryFromT0.txt", "../Itineraries/test.itins", get_available_systems()[0], NULL);
 					break;
 				case 2:
-					run_competition_calc("../Queue/exampleItineraryFromFb.txt", "../Itineraries/test.itins", get_available_systems()[0]);
+					run_competition_calc("../Queue/exampleItineraryFromFb.txt", "../Itineraries/test.itins", get_available_systems()[0], NULL);
 					break;
 				case 3:
-					run_competition_calc("../Queue/exampleSequence.txt", "../Itineraries/test.itins", get_available_systems()[0]);
+					run_competition_calc("../Queue/exampleSequence.txt", "../Itineraries/test.itins", get_available_systems()[0], NULL);
+					break;
+				case 4:
+					resume_competition_calc("../Itineraries/test.itins", get_available_systems()[0], NULL);
 					break;
 				default: break;
 			}
@@ -67,6 +81,7 @@ int main() {
     } while(selection != 0);
 	
 
+	free_lambert_cache();
 	free_all_celestial_systems();
     return 0;
 }
\ No newline at end of file
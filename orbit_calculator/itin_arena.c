@@ -0,0 +1,249 @@
+#include "itin_arena.h"
+#include "itin_tool.h"
+#include "tools/thread_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define ITIN_ARENA_CHUNK_SIZE (1 << 20)				// bytes per chunk
+#define ITIN_ARENA_NUM_ARRAY_CLASSES 32				// next step arrays with a capacity of 2^class
+#define ITIN_ARENA_FREE_LIST_FLUSH_SIZE 4096		// local free lists get handed to the arena when reaching this size
+#define ITIN_ARENA_ALIGNMENT 16
+#define ITIN_ARENA_THREAD_CACHE_SIZE 4
+
+
+struct Itin_Arena_Chunk {
+	struct Itin_Arena_Chunk *next;
+	size_t size;
+};	// 16 bytes, keeps the chunk data aligned
+
+// singly linked list threaded through the freed memory
+struct Itin_Arena_Free_List {
+	void *head, *tail;
+	size_t count;
+};
+
+// allocation state of one thread inside one arena
+struct Itin_Arena_Local {
+	int *thread_key;
+	struct Itin_Arena_Chunk *chunks;
+	char *ptr, *end;
+	struct Itin_Arena_Free_List free_steps;
+	struct Itin_Arena_Free_List free_arrays[ITIN_ARENA_NUM_ARRAY_CLASSES];
+	struct Itin_Arena_Local *next;
+};
+
+struct Itin_Arena {
+	unsigned long long id;
+	thread_mutex_t lock;
+	struct Itin_Arena_Local *locals;
+	// memory freed by threads that do not allocate it again (e.g. a writer thread) is shared through these lists
+	struct Itin_Arena_Free_List shared_free_steps;
+	struct Itin_Arena_Free_List shared_free_arrays[ITIN_ARENA_NUM_ARRAY_CLASSES];
+	atomic_size_t num_shared_free_steps;
+	atomic_size_t num_shared_free_arrays[ITIN_ARENA_NUM_ARRAY_CLASSES];
+	atomic_size_t num_bytes;
+};
+
+static atomic_ullong next_arena_id = 1;
+
+// the address of this variable identifies the thread
+static _Thread_local int thread_key;
+static _Thread_local struct {
+	unsigned long long arena_id;
+	struct Itin_Arena_Local *local;
+} thread_cache[ITIN_ARENA_THREAD_CACHE_SIZE];
+static _Thread_local int thread_cache_next = 0;
+
+
+struct Itin_Arena * create_itin_arena() {
+	struct Itin_Arena *arena = (struct Itin_Arena *) calloc(1, sizeof(struct Itin_Arena));
+	arena->id = atomic_fetch_add(&next_arena_id, 1);
+	init_thread_mutex(&arena->lock);
+	atomic_init(&arena->num_shared_free_steps, 0);
+	for(int i = 0; i < ITIN_ARENA_NUM_ARRAY_CLASSES; i++) atomic_init(&arena->num_shared_free_arrays[i], 0);
+	atomic_init(&arena->num_bytes, 0);
+	return arena;
+}
+
+void free_itin_arena(struct Itin_Arena *arena) {
+	if(arena == NULL) return;
+	struct Itin_Arena_Local *local = arena->locals;
+	while(local != NULL) {
+		struct Itin_Arena_Chunk *chunk = local->chunks;
+		while(chunk != NULL) {
+			struct Itin_Arena_Chunk *next_chunk = chunk->next;
+			free(chunk);
+			chunk = next_chunk;
+		}
+		struct Itin_Arena_Local *next_local = local->next;
+		free(local);
+		local = next_local;
+	}
+	destroy_thread_mutex(&arena->lock);
+	free(arena);
+}
+
+size_t get_itin_arena_num_bytes(struct Itin_Arena *arena) {
+	return atomic_load(&arena->num_bytes);
+}
+
+static struct Itin_Arena_Local * get_local_arena(struct Itin_Arena *arena) {
+	for(int i = 0; i < ITIN_ARENA_THREAD_CACHE_SIZE; i++) {
+		if(thread_cache[i].arena_id == arena->id) return thread_cache[i].local;
+	}
+
+	lock_thread_mutex(&arena->lock);
+	struct Itin_Arena_Local *local = arena->locals;
+	while(local != NULL && local->thread_key != &thread_key) local = local->next;
+	if(local == NULL) {
+		local = (struct Itin_Arena_Local *) calloc(1, sizeof(struct Itin_Arena_Local));
+		local->thread_key = &thread_key;
+		local->next = arena->locals;
+		arena->locals = local;
+	}
+	unlock_thread_mutex(&arena->lock);
+
+	thread_cache[thread_cache_next].arena_id = arena->id;
+	thread_cache[thread_cache_next].local = local;
+	thread_cache_next = (thread_cache_next + 1) % ITIN_ARENA_THREAD_CACHE_SIZE;
+	return local;
+}
+
+static void * alloc_from_chunks(struct Itin_Arena *arena, struct Itin_Arena_Local *local, size_t size) {
+	size = (size + ITIN_ARENA_ALIGNMENT - 1) & ~((size_t) ITIN_ARENA_ALIGNMENT - 1);
+	if(local->ptr == NULL || local->ptr + size > local->end) {
+		// big arrays get their own chunk (current chunk stays in use)
+		int is_dedicated = size > ITIN_ARENA_CHUNK_SIZE/4;
+		size_t chunk_size = is_dedicated ? size : ITIN_ARENA_CHUNK_SIZE;
+		struct Itin_Arena_Chunk *chunk = (struct Itin_Arena_Chunk *) malloc(sizeof(struct Itin_Arena_Chunk) + chunk_size);
+		if(chunk == NULL) return NULL;
+		chunk->size = chunk_size;
+		chunk->next = local->chunks;
+		local->chunks = chunk;
+		atomic_fetch_add(&arena->num_bytes, sizeof(struct Itin_Arena_Chunk) + chunk_size);
+		if(is_dedicated) return (char *) chunk + sizeof(struct Itin_Arena_Chunk);
+		local->ptr = (char *) chunk + sizeof(struct Itin_Arena_Chunk);
+		local->end = local->ptr + chunk_size;
+	}
+	void *mem = local->ptr;
+	local->ptr += size;
+	return mem;
+}
+
+static void push_to_free_list(struct Itin_Arena_Free_List *list, void *mem) {
+	*(void **) mem = list->head;
+	if(list->head == NULL) list->tail = mem;
+	list->head = mem;
+	list->count++;
+}
+
+static void * pop_from_free_list(struct Itin_Arena_Free_List *list) {
+	void *mem = list->head;
+	if(mem == NULL) return NULL;
+	list->head = *(void **) mem;
+	if(list->head == NULL) list->tail = NULL;
+	list->count--;
+	return mem;
+}
+
+// moves all elements of src to the front of dst
+static void splice_free_lists(struct Itin_Arena_Free_List *dst, struct Itin_Arena_Free_List *src) {
+	if(src->head == NULL) return;
+	*(void **) src->tail = dst->head;
+	if(dst->head == NULL) dst->tail = src->tail;
+	dst->head = src->head;
+	dst->count += src->count;
+	*src = (struct Itin_Arena_Free_List) {NULL, NULL, 0};
+}
+
+static void flush_to_shared_free_list(struct Itin_Arena *arena, struct Itin_Arena_Free_List *local_list, struct Itin_Arena_Free_List *shared_list, atomic_size_t *num_shared) {
+	lock_thread_mutex(&arena->lock);
+	splice_free_lists(shared_list, local_list);
+	atomic_store(num_shared, shared_list->count);
+	unlock_thread_mutex(&arena->lock);
+}
+
+static void fetch_from_shared_free_list(struct Itin_Arena *arena, struct Itin_Arena_Free_List *local_list, struct Itin_Arena_Free_List *shared_list, atomic_size_t *num_shared) {
+	if(atomic_load_explicit(num_shared, memory_order_relaxed) == 0) return;
+	lock_thread_mutex(&arena->lock);
+	splice_free_lists(local_list, shared_list);
+	atomic_store(num_shared, 0);
+	unlock_thread_mutex(&arena->lock);
+}
+
+struct ItinStep * new_itin_step(struct Itin_Arena *arena) {
+	struct ItinStep *step;
+	if(arena == NULL) step = (struct ItinStep *) malloc(sizeof(struct ItinStep));
+	else {
+		struct Itin_Arena_Local *local = get_local_arena(arena);
+		if(local->free_steps.head == NULL) fetch_from_shared_free_list(arena, &local->free_steps, &arena->shared_free_steps, &arena->num_shared_free_steps);
+		step = pop_from_free_list(&local->free_steps);
+		if(step == NULL) step = alloc_from_chunks(arena, local, sizeof(struct ItinStep));
+	}
+	step->is_end_node = false;
+	return step;
+}
+
+void free_itin_step(struct Itin_Arena *arena, struct ItinStep *step) {
+	if(arena == NULL) { free(step); return; }
+	struct Itin_Arena_Local *local = get_local_arena(arena);
+	push_to_free_list(&local->free_steps, step);
+	if(local->free_steps.count >= ITIN_ARENA_FREE_LIST_FLUSH_SIZE)
+		flush_to_shared_free_list(arena, &local->free_steps, &arena->shared_free_steps, &arena->num_shared_free_steps);
+}
+
+static int get_array_class(int num_next_nodes) {
+	int array_class = 0;
+	while((1 << array_class) < num_next_nodes && array_class < ITIN_ARENA_NUM_ARRAY_CLASSES-1) array_class++;
+	return array_class;
+}
+
+// arena arrays store their size class in the slot before the first element
+struct ItinStep ** new_itin_next_array(struct Itin_Arena *arena, int num_next_nodes) {
+	if(arena == NULL) return (struct ItinStep **) malloc(num_next_nodes * sizeof(struct ItinStep *));
+	int array_class = get_array_class(num_next_nodes);
+	struct Itin_Arena_Local *local = get_local_arena(arena);
+	struct Itin_Arena_Free_List *free_list = &local->free_arrays[array_class];
+	if(free_list->head == NULL) fetch_from_shared_free_list(arena, free_list, &arena->shared_free_arrays[array_class], &arena->num_shared_free_arrays[array_class]);
+	uintptr_t *array = pop_from_free_list(free_list);
+	if(array == NULL) array = alloc_from_chunks(arena, local, ((1 << array_class) + 1) * sizeof(struct ItinStep *));
+	if(array == NULL) return NULL;
+	array[0] = array_class;
+	return (struct ItinStep **) (array + 1);
+}
+
+struct ItinStep ** resize_itin_next_array(struct Itin_Arena *arena, struct ItinStep **next, int num_next_nodes) {
+	if(next == NULL) return new_itin_next_array(arena, num_next_nodes);
+	if(arena == NULL) return (struct ItinStep **) realloc(next, num_next_nodes * sizeof(struct ItinStep *));
+	int array_class = (int) ((uintptr_t *) next)[-1];
+	if((1 << array_class) >= num_next_nodes) return next;
+	struct ItinStep **new_next = new_itin_next_array(arena, num_next_nodes);
+	if(new_next == NULL) return NULL;
+	memcpy(new_next, next, (1 << array_class) * sizeof(struct ItinStep *));
+	free_itin_next_array(arena, next);
+	return new_next;
+}
+
+void free_itin_next_array(struct Itin_Arena *arena, struct ItinStep **next) {
+	if(arena == NULL) { free(next); return; }
+	uintptr_t *array = (uintptr_t *) next - 1;
+	int array_class = (int) array[0];
+	struct Itin_Arena_Local *local = get_local_arena(arena);
+	push_to_free_list(&local->free_arrays[array_class], array);
+	if(local->free_arrays[array_class].count >= ITIN_ARENA_FREE_LIST_FLUSH_SIZE)
+		flush_to_shared_free_list(arena, &local->free_arrays[array_class], &arena->shared_free_arrays[array_class], &arena->num_shared_free_arrays[array_class]);
+}
+
+void free_itin_arena_itinerary(struct Itin_Arena *arena, struct ItinStep *step) {
+	if(step == NULL) return;
+	if(arena == NULL) { free_itinerary(step); return; }
+	if(step->next != NULL) {
+		for(int i = 0; i < step->num_next_nodes; i++) {
+			free_itin_arena_itinerary(arena, step->next[i]);
+		}
+		free_itin_next_array(arena, step->next);
+	}
+	free_itin_step(arena, step);
+}
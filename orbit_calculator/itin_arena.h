@@ -0,0 +1,40 @@
+#ifndef KMAT_ITIN_ARENA_H
+#define KMAT_ITIN_ARENA_H
+
+#include <stddef.h>
+
+struct ItinStep;
+
+// Chunked arena for the itinerary steps and next step arrays of one search. Every thread allocates from its own chunks
+// (no locking), freed steps and arrays go to free lists for reuse and everything is released at once with free_itin_arena.
+struct Itin_Arena;
+
+
+// create an empty arena
+struct Itin_Arena * create_itin_arena();
+
+// free all chunks of the arena (all steps and arrays allocated from it become invalid)
+void free_itin_arena(struct Itin_Arena *arena);
+
+// returns the number of bytes currently reserved by the arena's chunks
+size_t get_itin_arena_num_bytes(struct Itin_Arena *arena);
+
+// allocate an itinerary step (arena == NULL: allocated with malloc)
+struct ItinStep * new_itin_step(struct Itin_Arena *arena);
+
+// return a single step to the arena's free list (next steps are not touched; arena == NULL: free)
+void free_itin_step(struct Itin_Arena *arena, struct ItinStep *step);
+
+// allocate a next step array for at least num_next_nodes steps (arena == NULL: allocated with malloc)
+struct ItinStep ** new_itin_next_array(struct Itin_Arena *arena, int num_next_nodes);
+
+// grow next step array to hold at least num_next_nodes steps (next == NULL: new array; arena == NULL: realloc; returns NULL on failure)
+struct ItinStep ** resize_itin_next_array(struct Itin_Arena *arena, struct ItinStep **next, int num_next_nodes);
+
+// return a next step array to the arena's free list (arena == NULL: free)
+void free_itin_next_array(struct Itin_Arena *arena, struct ItinStep **next);
+
+// return step and all its next steps to the arena's free lists (arena == NULL: free_itinerary)
+void free_itin_arena_itinerary(struct Itin_Arena *arena, struct ItinStep *step);
+
+#endif //KMAT_ITIN_ARENA_H
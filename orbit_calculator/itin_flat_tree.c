@@ -0,0 +1,187 @@
+#include "itin_flat_tree.h"
+#include "itin_arena.h"
+#include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
+#include <stdlib.h>
+
+
+struct Itin_Flat_Tree * create_itin_flat_tree_from_departures(struct ItinStep **departures, int num_deps, CelestSystem *system) {
+	struct Itin_Flat_Tree *tree = (struct Itin_Flat_Tree *) malloc(sizeof(struct Itin_Flat_Tree));
+	tree->system = system;
+	tree->num_layers = 0;
+	tree->layers = NULL;
+
+	// linked steps of the current layer (same order as the flat nodes)
+	struct ItinStep **curr_steps = (struct ItinStep **) malloc(num_deps * sizeof(struct ItinStep *));
+	uint32_t num_curr_steps = 0;
+	for(int i = 0; i < num_deps; i++) if(departures[i] != NULL) curr_steps[num_curr_steps++] = departures[i];
+
+	while(num_curr_steps > 0) {
+		tree->layers = (struct Itin_Flat_Layer *) realloc(tree->layers, (tree->num_layers+1) * sizeof(struct Itin_Flat_Layer));
+		struct Itin_Flat_Layer *layer = &tree->layers[tree->num_layers];
+		layer->nodes = (struct Itin_Flat_Node *) malloc(num_curr_steps * sizeof(struct Itin_Flat_Node));
+		layer->num_nodes = num_curr_steps;
+		tree->num_layers++;
+
+		uint32_t num_next_steps = 0;
+		for(uint32_t i = 0; i < num_curr_steps; i++) num_next_steps += curr_steps[i]->num_next_nodes;
+		struct ItinStep **next_steps = (struct ItinStep **) malloc((num_next_steps > 0 ? num_next_steps : 1) * sizeof(struct ItinStep *));
+
+		uint32_t next_index = 0;
+		struct Itin_Flat_Layer *prev_layer = tree->num_layers > 1 ? &tree->layers[tree->num_layers-2] : NULL;
+		uint32_t parent_index = 0;
+		for(uint32_t i = 0; i < num_curr_steps; i++) {
+			struct ItinStep *step = curr_steps[i];
+			int body_id = step->body != NULL ? get_body_system_id(step->body, system) : -1;
+			if(body_id < 0 || body_id >= ITIN_FLAT_NO_BODY) {
+				printf("Itinerary step body not part of the system (flat trees can't store deep-space maneuvers)\n");
+				free(next_steps);
+				free(curr_steps);
+				free_itin_flat_tree(tree);
+				return NULL;
+			}
+
+			// children are stored in parent order --> parent index only moves forward
+			if(prev_layer != NULL) {
+				while(prev_layer->nodes[parent_index].first_child + prev_layer->nodes[parent_index].num_children <= i) parent_index++;
+			}
+
+			layer->nodes[i] = (struct Itin_Flat_Node) {
+				.date = step->date,
+				.v_arr = step->v_arr,
+				.v_dep = step->v_dep,
+				.parent = prev_layer != NULL ? parent_index : ITIN_FLAT_NO_INDEX,
+				.first_child = next_index,
+				.num_children = step->num_next_nodes,
+				.body = (uint16_t) body_id,
+				.flags = (step->had_low_perihelion ? ITIN_FLAT_LOW_PERIHELION : 0) | (step->is_end_node ? ITIN_FLAT_END_NODE : 0)
+			};
+			for(int j = 0; j < step->num_next_nodes; j++) next_steps[next_index++] = step->next[j];
+		}
+
+		free(curr_steps);
+		curr_steps = next_steps;
+		num_curr_steps = num_next_steps;
+	}
+	free(curr_steps);
+
+	return tree;
+}
+
+void free_itin_flat_tree(struct Itin_Flat_Tree *tree) {
+	if(tree == NULL) return;
+	for(int i = 0; i < tree->num_layers; i++) free(tree->layers[i].nodes);
+	free(tree->layers);
+	free(tree);
+}
+
+size_t get_itin_flat_tree_num_bytes(struct Itin_Flat_Tree *tree) {
+	size_t num_bytes = sizeof(struct Itin_Flat_Tree) + tree->num_layers * sizeof(struct Itin_Flat_Layer);
+	for(int i = 0; i < tree->num_layers; i++) num_bytes += tree->layers[i].num_nodes * sizeof(struct Itin_Flat_Node);
+	return num_bytes;
+}
+
+int get_number_of_flat_departures(struct Itin_Flat_Tree *tree) {
+	return tree->num_layers > 0 ? (int) tree->layers[0].num_nodes : 0;
+}
+
+int get_total_number_of_stored_flat_nodes(struct Itin_Flat_Tree *tree) {
+	int num_nodes = 0;
+	for(int i = 0; i < tree->num_layers; i++) num_nodes += (int) tree->layers[i].num_nodes;
+	return num_nodes;
+}
+
+int get_number_of_flat_itineraries(struct Itin_Flat_Tree *tree) {
+	int num_itins = 0;
+	for(int i = 1; i < tree->num_layers; i++) {
+		struct Itin_Flat_Layer *layer = &tree->layers[i];
+		for(uint32_t j = 0; j < layer->num_nodes; j++) if(layer->nodes[j].num_children == 0 || (layer->nodes[j].flags & ITIN_FLAT_END_NODE)) num_itins++;
+	}
+	return num_itins;
+}
+
+// pre-order traversal (same order as store_itineraries_in_array)
+static void store_flat_itineraries_from_node_in_array(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref ref, struct Itin_Flat_Node_Ref *array, int *index) {
+	struct Itin_Flat_Node *node = &tree->layers[ref.layer].nodes[ref.index];
+	if((node->num_children == 0 || (node->flags & ITIN_FLAT_END_NODE)) && ref.layer > 0) array[(*index)++] = ref;
+	for(uint32_t i = 0; i < node->num_children; i++) {
+		store_flat_itineraries_from_node_in_array(tree, (struct Itin_Flat_Node_Ref) {ref.layer+1, node->first_child+i}, array, index);
+	}
+}
+
+int store_flat_itineraries_in_array(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref *array) {
+	int index = 0;
+	for(int i = 0; i < get_number_of_flat_departures(tree); i++) {
+		store_flat_itineraries_from_node_in_array(tree, (struct Itin_Flat_Node_Ref) {0, (uint32_t) i}, array, &index);
+	}
+	return index;
+}
+
+void copy_flat_node_to_itin_step(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref ref, struct ItinStep *step) {
+	struct Itin_Flat_Node *node = &tree->layers[ref.layer].nodes[ref.index];
+	CelestSystem *system = tree->system;
+	Body *body = system->bodies[node->body];
+	OSV body_osv = body_state_at(system, body, node->date);
+
+	step->body = body;
+	step->date = node->date;
+	step->r = body_osv.r;
+	step->v_body = body_osv.v;
+	step->v_arr = node->v_arr;
+	step->v_dep = node->v_dep;
+	step->had_low_perihelion = (node->flags & ITIN_FLAT_LOW_PERIHELION) != 0;
+}
+
+static struct ItinStep * create_itin_step_from_flat_node(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref ref, struct ItinStep *prev, struct Itin_Arena *arena) {
+	struct Itin_Flat_Node *node = &tree->layers[ref.layer].nodes[ref.index];
+	struct ItinStep *step = new_itin_step(arena);
+	copy_flat_node_to_itin_step(tree, ref, step);
+	step->prev = prev;
+	step->is_end_node = (node->flags & ITIN_FLAT_END_NODE) != 0;
+	update_itin_step_score(step, tree->system);
+	step->num_next_nodes = (int) node->num_children;
+	step->next = NULL;
+	if(node->num_children > 0) {
+		step->next = new_itin_next_array(arena, step->num_next_nodes);
+		for(uint32_t i = 0; i < node->num_children; i++) {
+			step->next[i] = create_itin_step_from_flat_node(tree, (struct Itin_Flat_Node_Ref) {ref.layer+1, node->first_child+i}, step, arena);
+		}
+	}
+	return step;
+}
+
+struct ItinStep ** create_departures_from_itin_flat_tree(struct Itin_Flat_Tree *tree, struct Itin_Arena *arena) {
+	int num_deps = get_number_of_flat_departures(tree);
+	struct ItinStep **departures = (struct ItinStep **) malloc((num_deps > 0 ? num_deps : 1) * sizeof(struct ItinStep *));
+	for(int i = 0; i < num_deps; i++) {
+		departures[i] = create_itin_step_from_flat_node(tree, (struct Itin_Flat_Node_Ref) {0, (uint32_t) i}, NULL, arena);
+	}
+	return departures;
+}
+
+struct ItinStep * create_itin_copy_from_flat_node(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref ref) {
+	struct ItinStep *arrival = NULL, *next = NULL;
+	while(1) {
+		struct ItinStep *step = (struct ItinStep *) malloc(sizeof(struct ItinStep));
+		copy_flat_node_to_itin_step(tree, ref, step);
+		step->prev = NULL;
+		step->is_end_node = false;
+		if(next == NULL) {
+			arrival = step;
+			step->next = NULL;
+			step->num_next_nodes = 0;
+		} else {
+			next->prev = step;
+			step->next = (struct ItinStep **) malloc(sizeof(struct ItinStep *));
+			step->next[0] = next;
+			step->num_next_nodes = 1;
+		}
+		next = step;
+
+		if(ref.layer == 0) break;
+		ref.index = tree->layers[ref.layer].nodes[ref.index].parent;
+		ref.layer--;
+	}
+	update_itin_score_states(next, tree->system);
+	return arrival;
+}
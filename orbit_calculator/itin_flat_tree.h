@@ -0,0 +1,73 @@
+#ifndef KMAT_ITIN_FLAT_TREE_H
+#define KMAT_ITIN_FLAT_TREE_H
+
+#include "itin_tool.h"
+#include <stdint.h>
+
+#define ITIN_FLAT_NO_INDEX UINT32_MAX	// parent index of departures
+#define ITIN_FLAT_NO_BODY UINT16_MAX
+
+enum ItinFlatNodeFlags {ITIN_FLAT_LOW_PERIHELION = 1, ITIN_FLAT_END_NODE = 2};
+
+// compact itinerary step (r and v_body are not stored, they are taken from the body's ephemeris/orbit at date)
+struct Itin_Flat_Node {
+	double date;
+	Vector3 v_arr, v_dep;
+	uint32_t parent;		// index in previous layer
+	uint32_t first_child;	// index of first next step in next layer (next steps of one node are contiguous)
+	uint32_t num_children;
+	uint16_t body;			// index in system->bodies
+	uint16_t flags;
+};	// 72 bytes
+
+// all nodes of the same depth (departure: layer 0)
+struct Itin_Flat_Layer {
+	struct Itin_Flat_Node *nodes;
+	uint32_t num_nodes;
+};
+
+// itinerary tree stored in contiguous per-depth arrays instead of linked ItinSteps
+struct Itin_Flat_Tree {
+	CelestSystem *system;
+	int num_layers;
+	struct Itin_Flat_Layer *layers;
+};
+
+// reference to a node of a flat tree
+struct Itin_Flat_Node_Ref {
+	int layer;
+	uint32_t index;
+};
+
+
+// create flat tree from departures (departures stay untouched; returns NULL if a step has a body that is not part of the system)
+struct Itin_Flat_Tree * create_itin_flat_tree_from_departures(struct ItinStep **departures, int num_deps, CelestSystem *system);
+
+// free flat tree and all its layers
+void free_itin_flat_tree(struct Itin_Flat_Tree *tree);
+
+// returns the number of bytes used by the flat tree
+size_t get_itin_flat_tree_num_bytes(struct Itin_Flat_Tree *tree);
+
+// returns the number of departures of the flat tree
+int get_number_of_flat_departures(struct Itin_Flat_Tree *tree);
+
+// returns the total number of nodes stored in the flat tree
+int get_total_number_of_stored_flat_nodes(struct Itin_Flat_Tree *tree);
+
+// returns the number of itineraries (leaves that are not departures and end nodes) of the flat tree
+int get_number_of_flat_itineraries(struct Itin_Flat_Tree *tree);
+
+// stores references to all arrival nodes of the flat tree in array (array needs space for get_number_of_flat_itineraries; returns number of stored references)
+int store_flat_itineraries_in_array(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref *array);
+
+// fill body, date, vectors and had_low_perihelion of step from given flat node (prev and next are not touched)
+void copy_flat_node_to_itin_step(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref ref, struct ItinStep *step);
+
+// create linked ItinStep departures from flat tree for the existing itinerary helpers (steps allocated from arena; arena == NULL: malloc; departures array needs to be freed)
+struct ItinStep ** create_departures_from_itin_flat_tree(struct Itin_Flat_Tree *tree, struct Itin_Arena *arena);
+
+// create and return linked copy of the single itinerary ending at given node (arrival first; needs to be freed with free_itinerary(get_first(step)))
+struct ItinStep * create_itin_copy_from_flat_node(struct Itin_Flat_Tree *tree, struct Itin_Flat_Node_Ref ref);
+
+#endif //KMAT_ITIN_FLAT_TREE_H
@@ -0,0 +1,442 @@
+#include "itin_mitm.h"
+#include "itin_arena.h"
+#include "lambert_cache.h"
+#include "itin_search_status.h"
+#include "itin_stats.h"
+#include "itin_score_bound.h"
+#include "tools/thread_pool.h"
+#include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#define MITM_MAX_JOINS_PER_STEP 100
+#define MITM_TASKS_PER_WORKER 4
+#define MITM_VINF_LOOKUP_FACTOR 5		// partials are looked up with a wider excess velocity window than accepted (their excess velocity changes when the transfer is solved from the forward date)
+
+
+// partial itinerary from the body of its level to the last body (only the first transfer is stored, the rest is found via next)
+struct Itin_Mitm_Node {
+	double date;				// date at the body of the level
+	double jd_arr;				// arrival date at the last body
+	Vector3 r, v_body;
+	Vector3 v_dep, v_arr;		// transfer to the body of the next level (last level: none)
+	double v_inf;				// excess velocity of v_dep (join key)
+	long bucket;				// date bucket of date (join key; only set at the middle level)
+	bool is_low_perihelion;		// transfer to the next level passes the sun closer than 0.05 AU
+	bool had_low_perihelion;	// any transfer to the last body passes the sun closer than 0.05 AU
+	int next;					// index at the next level (-1: last level)
+};
+
+struct Itin_Mitm_Level {
+	struct Itin_Mitm_Node *nodes;
+	int num_nodes, capacity;
+};
+
+struct Itin_Mitm_Index {
+	CelestSystem *system;
+	Body **bodies;
+	int num_steps, mid_step;
+	struct Itin_Mitm_Level *levels;		// levels[k]: partials from bodies[k] (mid_step <= k < num_steps; levels[mid_step] sorted by date bucket and excess velocity)
+	double jd_min_dep, max_duration;
+	int num_dates_per_body;				// resolution of the transfer sweep to the last body
+	double max_date_diff, max_vinf_diff;
+	struct Dv_Filter dv_filter;
+	_Atomic long num_joins;
+};
+
+// new partials of one task (parents: start to end at the next level)
+struct Mitm_Level_Task_Args {
+	struct Itin_Mitm_Index *index;
+	struct ItinSearchContext *search_ctx;
+	int level, start, end;
+	struct Itin_Mitm_Level result;
+};
+
+
+static double get_mitm_earliest_date(struct Itin_Mitm_Index *index, int level) {
+	return index->jd_min_dep + level*MIN_TRANSFER_DURATION;
+}
+
+static long get_mitm_date_bucket(struct Itin_Mitm_Index *index, double date) {
+	return (long) floor(date / index->max_date_diff);
+}
+
+// returns a new node at the end of the level (NULL if out of memory)
+static struct Itin_Mitm_Node * add_mitm_node(struct Itin_Mitm_Level *level) {
+	if(level->num_nodes == level->capacity) {
+		int new_capacity = level->capacity > 0 ? level->capacity*2 : 64;
+		struct Itin_Mitm_Node *new_nodes = (struct Itin_Mitm_Node *) realloc(level->nodes, new_capacity * sizeof(struct Itin_Mitm_Node));
+		if(new_nodes == NULL) {
+			printf("\nERROR WHILE ALLOCATING BACKWARD PARTIALS!!!\n");
+			return NULL;
+		}
+		level->nodes = new_nodes;
+		level->capacity = new_capacity;
+	}
+	return &level->nodes[level->num_nodes++];
+}
+
+// transfers from the second to last body to the arrival of the parent (sweep of transfer durations like the initial transfers of the forward search)
+static void calc_mitm_last_transfers(struct Itin_Mitm_Index *index, int parent_idx, struct Itin_Mitm_Level *result) {
+	CelestSystem *system = index->system;
+	int level = index->num_steps-2;
+	Body *dep_body = index->bodies[level], *arr_body = index->bodies[level+1];
+	struct Itin_Mitm_Node *parent = &index->levels[level+1].nodes[parent_idx];
+	struct Dv_Filter *dv_filter = &index->dv_filter;
+
+	OSV dep_body_temp_osv = body_state_at(system, dep_body, parent->date);
+	double r0 = mag_vec3(dep_body_temp_osv.r), r1 = mag_vec3(parent->r);
+	double r_ratio = r1/r0;
+	Hohmann hohmann = calc_hohmann_transfer(r0, r1, system->cb);
+	double hohmann_dur = hohmann.dur/86400;
+	double min_duration = MIN_TRANSFER_DURATION;
+	double max_duration = (4*(r_ratio-0.85)*(r_ratio-0.85)+1.5) * hohmann_dur; if(max_duration/hohmann_dur > 3) max_duration = hohmann_dur*3;
+	if(parent->date - max_duration < get_mitm_earliest_date(index, level)) max_duration = parent->date - get_mitm_earliest_date(index, level);
+	if(max_duration > index->max_duration) max_duration = index->max_duration;
+
+	for(int i = 0; i < index->num_dates_per_body; i++) {
+		double duration = min_duration + (max_duration - min_duration) * i/(index->num_dates_per_body - 1);
+		if(duration > max_duration) break;
+		double jd_dep = parent->date - duration;
+		OSV osv_dep = body_state_at(system, dep_body, jd_dep);
+		Lambert3 tf = calc_cached_lambert3(dep_body, jd_dep, osv_dep.r, arr_body, parent->date, parent->r, system->cb);
+		if(isnan(tf.v0.x)) continue;
+
+		if(dv_filter->last_transfer_type != TF_FLYBY) {
+			double v_inf_arr = mag_vec3(subtract_vec3(tf.v1, parent->v_body));
+			double rp = alt2radius(arr_body, dv_filter->arr_periapsis);
+			double dv_arr = dv_filter->last_transfer_type == TF_CAPTURE ? dv_capture(arr_body, rp, v_inf_arr) : dv_circ(arr_body, rp, v_inf_arr);
+			if(dv_arr > dv_filter->max_satdv || dv_arr > dv_filter->max_totdv) continue;
+		}
+
+		Vector3 rp_heliocentric = calc_heliocentric_periapsis(tf.r0, tf.v0, tf.r1, tf.v1, system);
+		double rp_sq = sq_mag_vec3(rp_heliocentric)/(AU*AU);
+		if(rp_sq < 0.01*0.01) continue;
+
+		struct Itin_Mitm_Node *node = add_mitm_node(result);
+		if(node == NULL) return;
+		node->date = jd_dep;
+		node->jd_arr = parent->jd_arr;
+		node->r = osv_dep.r;
+		node->v_body = osv_dep.v;
+		node->v_dep = tf.v0;
+		node->v_arr = tf.v1;
+		node->v_inf = mag_vec3(subtract_vec3(tf.v0, osv_dep.v));
+		node->is_low_perihelion = rp_sq < 0.05*0.05;
+		node->had_low_perihelion = node->is_low_perihelion;
+		node->next = parent_idx;
+	}
+}
+
+// transfers from the body of the level to flybys of the parent
+static void calc_mitm_flyby_transfers(struct Itin_Mitm_Index *index, int parent_idx, int level, struct Flyby_Search_Scratch *scratch, struct Itin_Mitm_Level *result) {
+	struct Itin_Mitm_Node *parent = &index->levels[level+1].nodes[parent_idx];
+	double max_duration = parent->date - get_mitm_earliest_date(index, level);
+	if(parent->date - (parent->jd_arr - index->max_duration) < max_duration) max_duration = parent->date - (parent->jd_arr - index->max_duration);
+	if(max_duration <= MIN_TRANSFER_DURATION) return;
+
+	int num_new = find_viable_backward_flybys(index->bodies[level+1], parent->date, parent->r, parent->v_body, parent->v_dep, parent->had_low_perihelion,
+											  index->system, index->bodies[level], MIN_TRANSFER_DURATION*86400, max_duration*86400, scratch);
+	for(int i = 0; i < num_new; i++) {
+		struct Itin_Mitm_Node *node = add_mitm_node(result);
+		if(node == NULL) return;
+		node->date = parent->date - scratch->new_dt[i]/86400;
+		node->jd_arr = parent->jd_arr;
+		node->r = scratch->new_osv[i].r;
+		node->v_body = scratch->new_osv[i].v;
+		node->v_dep = scratch->new_tf[i].v0;
+		node->v_arr = scratch->new_tf[i].v1;
+		node->v_inf = mag_vec3(subtract_vec3(node->v_dep, node->v_body));
+		node->had_low_perihelion = scratch->new_low_perihelion[i];
+		node->is_low_perihelion = node->had_low_perihelion && !parent->had_low_perihelion;
+		node->next = parent_idx;
+	}
+}
+
+static void *calc_mitm_level_task(void *args) {
+	struct Mitm_Level_Task_Args *task_args = (struct Mitm_Level_Task_Args *) args;
+	struct Itin_Mitm_Index *index = task_args->index;
+	struct Flyby_Search_Scratch local_scratch;
+	struct Flyby_Search_Scratch *scratch = get_flyby_search_scratch(task_args->search_ctx);
+	if(scratch == NULL) scratch = &local_scratch;
+	long stage_start = start_itin_stats_stage(task_args->search_ctx->stats);
+
+	for(int i = task_args->start; i < task_args->end; i++) {
+		if(is_itin_search_cancelled(task_args->search_ctx->status)) break;
+		if(task_args->level == index->num_steps-2) calc_mitm_last_transfers(index, i, &task_args->result);
+		else calc_mitm_flyby_transfers(index, i, task_args->level, scratch, &task_args->result);
+	}
+	end_itin_stats_stage(task_args->search_ctx->stats, ITIN_STATS_STAGE_MITM_BUILD, stage_start);
+	return NULL;
+}
+
+// calculate all partials of the level from the partials of the next level (split into tasks on the search's pool)
+static void calc_mitm_level(struct Itin_Mitm_Index *index, int level, struct ItinSearchContext *search_ctx) {
+	int num_parents = index->levels[level+1].num_nodes;
+	int num_tasks = search_ctx->pool != NULL ? MITM_TASKS_PER_WORKER*get_thread_pool_size(search_ctx->pool) : 1;
+	if(num_tasks > num_parents) num_tasks = num_parents;
+	if(num_tasks == 0) return;
+
+	struct Mitm_Level_Task_Args *task_args = (struct Mitm_Level_Task_Args *) calloc(num_tasks, sizeof(struct Mitm_Level_Task_Args));
+	struct Thread_Pool_Task **tasks = (struct Thread_Pool_Task **) malloc(num_tasks * sizeof(struct Thread_Pool_Task *));
+	for(int i = 0; i < num_tasks; i++) {
+		task_args[i].index = index;
+		task_args[i].search_ctx = search_ctx;
+		task_args[i].level = level;
+		task_args[i].start = (int) ((long) num_parents * i / num_tasks);
+		task_args[i].end = (int) ((long) num_parents * (i+1) / num_tasks);
+		if(search_ctx->pool != NULL) tasks[i] = submit_thread_pool_task(search_ctx->pool, calc_mitm_level_task, &task_args[i]);
+		else calc_mitm_level_task(&task_args[i]);
+	}
+	if(search_ctx->pool != NULL) for(int i = 0; i < num_tasks; i++) join_thread_pool_task(tasks[i]);
+
+	// partials of the tasks in order of their parents
+	struct Itin_Mitm_Level *result = &index->levels[level];
+	for(int i = 0; i < num_tasks; i++) {
+		for(int j = 0; j < task_args[i].result.num_nodes; j++) {
+			struct Itin_Mitm_Node *node = add_mitm_node(result);
+			if(node == NULL) break;
+			*node = task_args[i].result.nodes[j];
+		}
+		free(task_args[i].result.nodes);
+	}
+	free(tasks);
+	free(task_args);
+}
+
+static int compare_mitm_join_keys(const void *a, const void *b) {
+	const struct Itin_Mitm_Node *node_a = (const struct Itin_Mitm_Node *) a, *node_b = (const struct Itin_Mitm_Node *) b;
+	if(node_a->bucket != node_b->bucket) return node_a->bucket < node_b->bucket ? -1 : 1;
+	if(node_a->v_inf != node_b->v_inf) return node_a->v_inf < node_b->v_inf ? -1 : 1;
+	return 0;
+}
+
+struct Itin_Mitm_Index * build_itin_mitm_index(Itin_Calc_Data *calc_data, struct ItinSearchContext *search_ctx) {
+	struct ItinSequenceInfoSpecItin *seq_info = &calc_data->seq_info.spec_seq;
+	if(seq_info->type != ITIN_SEQ_INFO_SPEC_SEQ || seq_info->num_steps < 3) return NULL;
+	// double swing-bys are not supported by the backward steps
+	for(int i = 1; i < seq_info->num_steps; i++) if(seq_info->bodies[i] == seq_info->bodies[i-1]) return NULL;
+
+	struct Itin_Mitm_Index *index = (struct Itin_Mitm_Index *) calloc(1, sizeof(struct Itin_Mitm_Index));
+	index->system = seq_info->system;
+	index->bodies = seq_info->bodies;
+	index->num_steps = seq_info->num_steps;
+	index->mid_step = seq_info->num_steps/2;
+	index->levels = (struct Itin_Mitm_Level *) calloc(seq_info->num_steps, sizeof(struct Itin_Mitm_Level));
+	index->jd_min_dep = calc_data->jd_min_dep;
+	index->max_duration = calc_data->max_duration;
+	index->num_dates_per_body = calc_data->num_arr_dates_per_body > 1 ? calc_data->num_arr_dates_per_body : NUM_INITIAL_TRANSFERS_PER_BODY;
+	index->max_date_diff = calc_data->mitm_max_date_diff > 0 ? calc_data->mitm_max_date_diff : MITM_DEFAULT_MAX_DATE_DIFF;
+	index->max_vinf_diff = calc_data->mitm_max_vinf_diff > 0 ? calc_data->mitm_max_vinf_diff : MITM_DEFAULT_MAX_VINF_DIFF;
+	index->dv_filter = calc_data->dv_filter;
+	atomic_init(&index->num_joins, 0);
+
+	// arrival dates at the last body (departure date step)
+	int last = index->num_steps-1;
+	double jd_max_arr = calc_data->jd_max_dep + calc_data->max_duration < calc_data->jd_max_arr ? calc_data->jd_max_dep + calc_data->max_duration : calc_data->jd_max_arr;
+	for(double jd_arr = get_mitm_earliest_date(index, last); jd_arr <= jd_max_arr; jd_arr += calc_data->step_dep_date) {
+		struct Itin_Mitm_Node *node = add_mitm_node(&index->levels[last]);
+		if(node == NULL) break;
+		OSV osv_arr = body_state_at(index->system, index->bodies[last], jd_arr);
+		*node = (struct Itin_Mitm_Node) {
+				.date = jd_arr,
+				.jd_arr = jd_arr,
+				.r = osv_arr.r,
+				.v_body = osv_arr.v,
+				.next = -1
+		};
+	}
+
+	for(int level = last-1; level >= index->mid_step; level--) {
+		calc_mitm_level(index, level, search_ctx);
+		if(is_itin_search_cancelled(search_ctx->status)) {
+			free_itin_mitm_index(index);
+			return NULL;
+		}
+	}
+
+	// join keys are stored with the nodes (qsort has no context argument and searches can run at the same time)
+	struct Itin_Mitm_Level *mid_level = &index->levels[index->mid_step];
+	for(int i = 0; i < mid_level->num_nodes; i++) mid_level->nodes[i].bucket = get_mitm_date_bucket(index, mid_level->nodes[i].date);
+	qsort(mid_level->nodes, mid_level->num_nodes, sizeof(struct Itin_Mitm_Node), compare_mitm_join_keys);
+	return index;
+}
+
+int get_itin_mitm_mid_step(struct Itin_Mitm_Index *index) {
+	return index->mid_step;
+}
+
+// index of the first partial of the middle level with a join key not smaller than (bucket, v_inf)
+static int find_first_mitm_join_candidate(struct Itin_Mitm_Index *index, long bucket, double v_inf) {
+	struct Itin_Mitm_Level *mid_level = &index->levels[index->mid_step];
+	int lo = 0, hi = mid_level->num_nodes;
+	while(lo < hi) {
+		int m = (lo + hi) / 2;
+		long node_bucket = mid_level->nodes[m].bucket;
+		if(node_bucket < bucket || (node_bucket == bucket && mid_level->nodes[m].v_inf < v_inf)) lo = m+1;
+		else hi = m;
+	}
+	return lo;
+}
+
+static int is_mitm_flyby_periapsis_valid(Vector3 v_arr, Vector3 v_dep, Vector3 v_body, Body *body) {
+	double rp_flyby = get_flyby_periapsis(v_arr, v_dep, v_body, body);
+	return rp_flyby/body->radius - 1 > 0.1 && rp_flyby/body->radius - 1 < 100;
+}
+
+// joins the forward step at the middle body with the partial starting at the next level at next_idx
+// (transfer between them is solved from the forward date; returns first step of the copied partial or NULL if the join is not viable
+// or, with a score bound, not one of the best itineraries)
+static struct ItinStep * join_mitm_partial(struct ItinStep *step, int next_idx, struct Itin_Mitm_Index *index, struct Itin_Arena *arena, struct Itin_Score_Bound *score_bound) {
+	int mid = index->mid_step;
+	Body **bodies = index->bodies;
+	CelestSystem *system = index->system;
+	struct Itin_Mitm_Node *node = &index->levels[mid+1].nodes[next_idx];
+
+	Lambert3 tf = calc_cached_lambert3(bodies[mid], step->date, step->r, bodies[mid+1], node->date, node->r, system->cb);
+	if(isnan(tf.v0.x)) return NULL;
+
+	// middle flyby
+	double v_inf_arr = mag_vec3(subtract_vec3(step->v_arr, step->v_body));
+	if(fabs(mag_vec3(subtract_vec3(tf.v0, step->v_body)) - v_inf_arr) > index->max_vinf_diff) return NULL;
+	if(!is_mitm_flyby_periapsis_valid(step->v_arr, tf.v0, step->v_body, bodies[mid])) return NULL;
+
+	// flyby at the first body of the backward partial
+	if(node->next >= 0) {
+		if(fabs(mag_vec3(subtract_vec3(tf.v1, node->v_body)) - node->v_inf) > index->max_vinf_diff) return NULL;
+		if(!is_mitm_flyby_periapsis_valid(tf.v1, node->v_dep, node->v_body, bodies[mid+1])) return NULL;
+	}
+
+	Vector3 rp_heliocentric = calc_heliocentric_periapsis(tf.r0, tf.v0, tf.r1, tf.v1, system);
+	double rp_sq = sq_mag_vec3(rp_heliocentric)/(AU*AU);
+	if(rp_sq < 0.01*0.01) return NULL;
+	int is_low_perihelion = rp_sq < 0.05*0.05;
+	if(step->had_low_perihelion + is_low_perihelion + node->had_low_perihelion > 1) return NULL;
+
+	// copy partial behind the forward step
+	struct ItinStep *prev = step, *first = NULL, *new_step = NULL;
+	bool had_low_perihelion = step->had_low_perihelion || is_low_perihelion;
+	Vector3 v_dep = tf.v0, v_arr = tf.v1;
+	int level = mid+1;
+	while(1) {
+		new_step = new_itin_step(arena);
+		new_step->body = bodies[level];
+		new_step->date = node->date;
+		new_step->r = node->r;
+		new_step->v_body = node->v_body;
+		new_step->v_dep = v_dep;
+		new_step->v_arr = v_arr;
+		new_step->had_low_perihelion = had_low_perihelion;
+		new_step->num_next_nodes = 0;
+		new_step->prev = prev;
+		new_step->next = NULL;
+		update_itin_step_score(new_step, system);
+		if(prev == step) first = new_step;
+		else {
+			prev->next = new_itin_next_array(arena, 1);
+			prev->next[0] = new_step;
+			prev->num_next_nodes = 1;
+		}
+		if(node->next < 0) break;
+
+		had_low_perihelion = had_low_perihelion || node->is_low_perihelion;
+		v_dep = node->v_dep;
+		v_arr = node->v_arr;
+		node = &index->levels[++level].nodes[node->next];
+		prev = new_step;
+	}
+
+	// dv requirements of the whole itinerary (same as for the last step of the forward search)
+	struct Dv_Filter *dv_filter = &index->dv_filter;
+	struct PorkchopPoint porkchop_point = create_porkchop_point(new_step, dv_filter->dep_periapsis, dv_filter->arr_periapsis);
+	double dv_sat = porkchop_point.dv_dsm;
+	if(dv_filter->last_transfer_type == TF_CAPTURE) dv_sat += porkchop_point.dv_arr_cap;
+	if(dv_filter->last_transfer_type == TF_CIRC) dv_sat += porkchop_point.dv_arr_circ;
+	if(dv_sat > dv_filter->max_satdv || porkchop_point.dv_dep + dv_sat > dv_filter->max_totdv) {
+		free_itin_arena_itinerary(arena, first);
+		return NULL;
+	}
+	if(score_bound != NULL && !add_itin_to_score_bound(score_bound, new_step)) {
+		free_itin_arena_itinerary(arena, first);
+		return NULL;
+	}
+	return first;
+}
+
+// joins the forward step at the middle body with all matching partials (returns number of joins)
+static int join_mitm_partials_at_step(struct ItinStep *step, struct Itin_Mitm_Index *index, struct Itin_Arena *arena, struct Itin_Score_Bound *score_bound) {
+	struct Itin_Mitm_Level *mid_level = &index->levels[index->mid_step];
+	double jd_dep = get_first(step)->date;
+	double v_inf = mag_vec3(subtract_vec3(step->v_arr, step->v_body));
+	double max_key_vinf_diff = MITM_VINF_LOOKUP_FACTOR * index->max_vinf_diff;
+	long bucket = get_mitm_date_bucket(index, step->date);
+
+	struct ItinStep *joins[MITM_MAX_JOINS_PER_STEP];
+	int joined_next[MITM_MAX_JOINS_PER_STEP];
+	int num_joins = 0;
+
+	for(long b = bucket-1; b <= bucket+1 && num_joins < MITM_MAX_JOINS_PER_STEP; b++) {
+		for(int i = find_first_mitm_join_candidate(index, b, v_inf - max_key_vinf_diff); i < mid_level->num_nodes && num_joins < MITM_MAX_JOINS_PER_STEP; i++) {
+			struct Itin_Mitm_Node *node = &mid_level->nodes[i];
+			if(node->bucket != b || node->v_inf > v_inf + max_key_vinf_diff) break;
+			if(fabs(node->date - step->date) > index->max_date_diff) continue;
+			if(node->jd_arr - jd_dep > index->max_duration) continue;
+			if(index->levels[index->mid_step+1].nodes[node->next].date - step->date < MIN_TRANSFER_DURATION) continue;
+
+			// partials that only differ at the middle body lead to the same join (transfer is solved from the forward date)
+			int is_joined = 0;
+			for(int j = 0; j < num_joins; j++) if(joined_next[j] == node->next) is_joined = 1;
+			if(is_joined) continue;
+
+			struct ItinStep *join = join_mitm_partial(step, node->next, index, arena, score_bound);
+			if(join == NULL) continue;
+			joined_next[num_joins] = node->next;
+			joins[num_joins++] = join;
+		}
+	}
+
+	if(num_joins > 0) {
+		step->next = new_itin_next_array(arena, num_joins);
+		for(int i = 0; i < num_joins; i++) step->next[i] = joins[i];
+		step->num_next_nodes = num_joins;
+		atomic_fetch_add(&index->num_joins, num_joins);
+	}
+	return num_joins;
+}
+
+static int join_mitm_partials_below(struct ItinStep *step, int depth, struct Itin_Mitm_Index *index, struct Itin_Arena *arena, struct Itin_Search_Status *status, struct Itin_Score_Bound *score_bound, struct Itin_Stats *stats) {
+	if(is_itin_search_cancelled(status)) return 0;
+	if(is_itin_step_cut_by_score_bound(step, score_bound, stats)) return 0;
+	if(depth == index->mid_step) return join_mitm_partials_at_step(step, index, arena, score_bound) > 0;
+
+	for(int i = 0; i < step->num_next_nodes; i++) {
+		if(!join_mitm_partials_below(step->next[i], depth+1, index, arena, status, score_bound, stats)) {
+			remove_next_step_from_itinerary(step, i, arena);
+			i--;
+		}
+	}
+	return step->num_next_nodes > 0;
+}
+
+int join_itin_mitm_partials(struct ItinStep *departure, struct Itin_Mitm_Index *index, struct ItinSearchContext *search_ctx) {
+	if(search_ctx == NULL) return join_mitm_partials_below(departure, 0, index, NULL, NULL, NULL, NULL);
+	long stage_start = start_itin_stats_stage(search_ctx->stats);
+	int has_itins = join_mitm_partials_below(departure, 0, index, search_ctx->arena, search_ctx->status, search_ctx->score_bound, search_ctx->stats);
+	end_itin_stats_stage(search_ctx->stats, ITIN_STATS_STAGE_MITM_JOIN, stage_start);
+	return has_itins;
+}
+
+void print_itin_mitm_index_stats(struct Itin_Mitm_Index *index) {
+	printf("Meet in the middle (joined at step %d): backward partials", index->mid_step);
+	for(int i = index->num_steps-1; i >= index->mid_step; i--) printf(" %d", index->levels[i].num_nodes);
+	printf(", %ld joins\n", atomic_load(&index->num_joins));
+}
+
+void free_itin_mitm_index(struct Itin_Mitm_Index *index) {
+	if(index == NULL) return;
+	for(int i = 0; i < index->num_steps; i++) free(index->levels[i].nodes);
+	free(index->levels);
+	free(index);
+}
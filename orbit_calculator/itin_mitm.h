@@ -0,0 +1,35 @@
+#ifndef KMAT_ITIN_MITM_H
+#define KMAT_ITIN_MITM_H
+
+#include "transfer_calc.h"
+
+#define MITM_DEFAULT_MAX_DATE_DIFF 2		// days
+#define MITM_DEFAULT_MAX_VINF_DIFF 10		// m/s
+
+// Meet in the middle for specific sequences: partial itineraries from every arrival date at the last body are calculated
+// backwards down to the middle body before the search. The forward steps stop at the middle body and every middle flyby
+// is joined with the backward partials that reach the middle body at about the same date with about the same excess
+// velocity (sorted by date bucket and excess velocity). The transfer after the middle flyby is solved again from the
+// forward date --> joined flybys are checked like every other flyby, but their incoming and outgoing excess velocity may
+// differ by up to the join tolerance (instead of matching exactly).
+struct Itin_Mitm_Index;
+
+
+// calculate backward partials from the last body down to the middle body of the sequence of calc_data (tasks on the search's pool)
+// returns NULL if the sequence is too short or the search got cancelled
+struct Itin_Mitm_Index * build_itin_mitm_index(Itin_Calc_Data *calc_data, struct ItinSearchContext *search_ctx);
+
+// step index of the middle body (forward steps end here)
+int get_itin_mitm_mid_step(struct Itin_Mitm_Index *index);
+
+// join the forward steps of the departure ending at the middle body with the backward partials (steps without joins are removed)
+// returns 1 if the departure has itineraries to the last body afterwards (0 otherwise)
+int join_itin_mitm_partials(struct ItinStep *departure, struct Itin_Mitm_Index *index, struct ItinSearchContext *search_ctx);
+
+// print number of backward partials and joins
+void print_itin_mitm_index_stats(struct Itin_Mitm_Index *index);
+
+// free index and its partials
+void free_itin_mitm_index(struct Itin_Mitm_Index *index);
+
+#endif //KMAT_ITIN_MITM_H
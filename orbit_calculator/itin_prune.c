@@ -0,0 +1,97 @@
+#include "itin_prune.h"
+#include "itin_arena.h"
+#include "itin_stats.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+
+struct Prune_Candidate {
+	struct ItinStep *step;
+	int index;				// index in the next steps of the parent
+	Vector3 v_inf;
+	double mag_v_inf;
+	double score;			// accumulated competition score (0 if not compared)
+	int is_removed;
+};
+
+
+static int compare_prune_candidates(const void *a, const void *b) {
+	const struct Prune_Candidate *cand_a = (const struct Prune_Candidate *) a, *cand_b = (const struct Prune_Candidate *) b;
+	if(cand_a->step->body != cand_b->step->body) return (uintptr_t) cand_a->step->body < (uintptr_t) cand_b->step->body ? -1 : 1;
+	if(cand_a->step->date != cand_b->step->date) return cand_a->step->date < cand_b->step->date ? -1 : 1;
+	return cand_a->index - cand_b->index;
+}
+
+// a is not worse than b in any criterion (equal candidates dominate each other)
+static int dominates_prune_candidate(struct Prune_Candidate *a, struct Prune_Candidate *b) {
+	if(a->step->date > b->step->date || a->mag_v_inf > b->mag_v_inf) return 0;
+	if(a->step->had_low_perihelion && !b->step->had_low_perihelion) return 0;
+	return a->score >= b->score;
+}
+
+// near-duplicates: higher score, no low perihelion, lower excess velocity, earlier arrival
+static int is_better_prune_candidate(struct Prune_Candidate *a, struct Prune_Candidate *b) {
+	if(a->score != b->score) return a->score > b->score;
+	if(a->step->had_low_perihelion != b->step->had_low_perihelion) return !a->step->had_low_perihelion;
+	if(a->mag_v_inf != b->mag_v_inf) return a->mag_v_inf < b->mag_v_inf;
+	return a->step->date <= b->step->date;
+}
+
+int prune_equivalent_next_steps(struct ItinStep *step, struct Prune_Filter *filter, CelestSystem *system, struct Itin_Arena *arena, struct Itin_Stats *stats) {
+	if(filter == NULL || !filter->is_enabled || step->num_next_nodes < 2) return 0;
+	long stage_start = start_itin_stats_stage(stats);
+	double max_date_diff = filter->max_date_diff > 0 ? filter->max_date_diff : PRUNE_DEFAULT_MAX_DATE_DIFF;
+	double max_vinf_diff = filter->max_vinf_diff > 0 ? filter->max_vinf_diff : PRUNE_DEFAULT_MAX_VINF_DIFF;
+	double cluster_date_diff = filter->cluster_date_diff > 0 ? filter->cluster_date_diff : PRUNE_DEFAULT_CLUSTER_DATE_DIFF;
+	double cluster_vinf_diff = filter->cluster_vinf_diff > 0 ? filter->cluster_vinf_diff : PRUNE_DEFAULT_CLUSTER_VINF_DIFF;
+	double window = max_date_diff > cluster_date_diff ? max_date_diff : cluster_date_diff;
+
+	int num_cands = step->num_next_nodes;
+	struct Prune_Candidate *cands = (struct Prune_Candidate *) malloc(num_cands * sizeof(struct Prune_Candidate));
+	if(cands == NULL) return 0;
+	for(int i = 0; i < num_cands; i++) {
+		struct ItinStep *next = step->next[i];
+		cands[i] = (struct Prune_Candidate) {.step = next, .index = i, .score = filter->use_competition_score ? get_itin_step_score(next) : 0};
+		cands[i].v_inf = subtract_vec3(next->v_arr, next->v_body);
+		cands[i].mag_v_inf = mag_vec3(cands[i].v_inf);
+	}
+	// equivalent next steps are neighbours after sorting by body and date
+	qsort(cands, num_cands, sizeof(struct Prune_Candidate), compare_prune_candidates);
+
+	for(int i = 0; i < num_cands; i++) {
+		struct Prune_Candidate *a = &cands[i];
+		for(int j = i+1; j < num_cands && !a->is_removed; j++) {
+			struct Prune_Candidate *b = &cands[j];
+			if(b->step->body != a->step->body || b->step->date - a->step->date > window) break;
+			if(b->is_removed) continue;
+			double date_diff = b->step->date - a->step->date;
+			double vinf_diff = mag_vec3(subtract_vec3(a->v_inf, b->v_inf));
+
+			if(date_diff <= cluster_date_diff && vinf_diff <= cluster_vinf_diff) {
+				if(is_better_prune_candidate(a, b)) b->is_removed = 1;
+				else a->is_removed = 1;
+			} else if(date_diff <= max_date_diff && vinf_diff <= max_vinf_diff) {
+				if(dominates_prune_candidate(a, b)) b->is_removed = 1;
+				else if(dominates_prune_candidate(b, a)) a->is_removed = 1;
+			}
+		}
+	}
+
+	// remaining next steps keep their order
+	char *is_removed = (char *) calloc(num_cands, sizeof(char));
+	for(int i = 0; i < num_cands; i++) is_removed[cands[i].index] = (char) cands[i].is_removed;
+	int num_kept = 0;
+	for(int i = 0; i < num_cands; i++) {
+		if(is_removed[i]) {
+			add_itin_stats_count(get_itin_step_stats_record(stats, step, step->next[i]->body), ITIN_STATS_NODES_PRUNED, 1);
+			free_itin_arena_itinerary(arena, step->next[i]);
+		} else step->next[num_kept++] = step->next[i];
+	}
+	step->num_next_nodes = num_kept;
+	end_itin_stats_stage(stats, ITIN_STATS_STAGE_PRUNE, stage_start);
+
+	free(is_removed);
+	free(cands);
+	return num_cands - num_kept;
+}
@@ -0,0 +1,17 @@
+#ifndef KMAT_ITIN_PRUNE_H
+#define KMAT_ITIN_PRUNE_H
+
+#include "itin_tool.h"
+
+#define PRUNE_DEFAULT_MAX_DATE_DIFF 2			// days
+#define PRUNE_DEFAULT_MAX_VINF_DIFF 100			// m/s
+#define PRUNE_DEFAULT_CLUSTER_DATE_DIFF 0.1		// days
+#define PRUNE_DEFAULT_CLUSTER_VINF_DIFF 5		// m/s
+
+
+// removes next steps of step that are dominated by an equivalent next step (same body, close arrival date and excess velocity vector;
+// not later, not faster, not a lower score and no low perihelion if the other has none) or are a worse near-duplicate of one
+// returns the number of removed next steps (their subtrees are returned to the arena; counted in stats if not NULL)
+int prune_equivalent_next_steps(struct ItinStep *step, struct Prune_Filter *filter, CelestSystem *system, struct Itin_Arena *arena, struct Itin_Stats *stats);
+
+#endif //KMAT_ITIN_PRUNE_H
@@ -0,0 +1,343 @@
+#include "itin_score_bound.h"
+#include "itin_arena.h"
+#include "itin_stats.h"
+#include "transfer_calc.h"
+#include "tools/competition_tools.h"
+#include "tools/file_io.h"
+#include "tools/thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdatomic.h>
+
+
+struct Itin_Score_Bound {
+	int top_k;
+	atomic_ullong *top_scores;		// bits of the K best scores (scores are >= 0 --> ordered like their bit patterns)
+	_Alignas(64) atomic_ullong threshold;	// bits of the lowest top score (only increases; read for every bound check)
+	atomic_ullong incumbent;		// bits of the best score
+	atomic_long num_cut_steps;
+
+	double max_flyby_factor;		// best seasonal and velocity penalty of a single flyby
+	double *remaining_weights;		// specific sequence: summed weights of the bodies after depth (NULL: to target)
+	int num_steps;
+	double max_weight;				// to target: weight of the heaviest flyby or arrival body
+	double jd_max_arr, max_duration;	// latest arrival; to target: maximum duration from the departure (<= 0: none)
+
+	// copies of the best itineraries (arrivals, best first; can lag behind the score slots for a moment)
+	struct ItinStep **best_itins;
+	double *best_scores;
+	int num_best_itins;
+	long num_best_changes, num_stored_changes;
+	thread_mutex_t best_lock;
+	Itin_Calc_Data calc_data;		// header of the .itins files
+
+	// snapshots
+	struct Thread_Pool *snapshot_pool;
+	const char *snapshot_filepath;
+	double snapshot_interval;
+	int is_writing_snapshots;
+	thread_mutex_t snapshot_lock;
+	thread_cond_t snapshot_cond;
+};
+
+struct Score_Bound_Sort_Key {
+	double upper_bound;
+	struct ItinStep *step;
+};
+
+
+static uint64_t get_score_bits(double score) {
+	uint64_t bits;
+	memcpy(&bits, &score, sizeof(bits));
+	return bits;
+}
+
+static double get_bits_score(uint64_t bits) {
+	double score;
+	memcpy(&score, &bits, sizeof(score));
+	return score;
+}
+
+static void raise_score_bits(atomic_ullong *target, uint64_t bits) {
+	unsigned long long curr = atomic_load_explicit(target, memory_order_relaxed);
+	while(curr < bits && !atomic_compare_exchange_weak_explicit(target, &curr, bits, memory_order_relaxed, memory_order_relaxed));
+}
+
+struct Itin_Score_Bound * create_itin_score_bound(struct Itin_Calc_Data *calc_data, int top_k) {
+	if(top_k < 1) top_k = 1;
+	struct Itin_Score_Bound *bound = (struct Itin_Score_Bound *) calloc(1, sizeof(struct Itin_Score_Bound));
+	bound->top_k = top_k;
+	bound->top_scores = (atomic_ullong *) malloc(top_k * sizeof(atomic_ullong));
+	for(int i = 0; i < top_k; i++) atomic_init(&bound->top_scores[i], get_score_bits(0));
+	atomic_init(&bound->threshold, get_score_bits(0));
+	atomic_init(&bound->incumbent, get_score_bits(0));
+	atomic_init(&bound->num_cut_steps, 0);
+
+	bound->best_itins = (struct ItinStep **) malloc(top_k * sizeof(struct ItinStep *));
+	bound->best_scores = (double *) malloc(top_k * sizeof(double));
+	init_thread_mutex(&bound->best_lock);
+	bound->calc_data = *calc_data;
+	init_thread_mutex(&bound->snapshot_lock);
+	init_thread_cond(&bound->snapshot_cond);
+
+	bound->max_flyby_factor = get_max_competition_flyby_factor();
+	bound->jd_max_arr = calc_data->jd_max_arr;
+	// specific sequences: limited by the latest arrival only (looser than the search, which also limits every departure to
+	// max_duration in calc_itins_from_departure, but never cuts a valid itinerary)
+	bound->max_duration = 0;
+	if(calc_data->seq_info.to_target.type == ITIN_SEQ_INFO_SPEC_SEQ) {
+		struct ItinSequenceInfoSpecItin *seq_info = &calc_data->seq_info.spec_seq;
+		bound->num_steps = seq_info->num_steps;
+		bound->remaining_weights = (double *) calloc(seq_info->num_steps + 1, sizeof(double));
+		for(int i = seq_info->num_steps-1; i > 0; i--) bound->remaining_weights[i-1] = bound->remaining_weights[i] + seq_info->bodies[i]->scale_height;
+	} else {
+		struct ItinSequenceInfoToTarget *seq_info = &calc_data->seq_info.to_target;
+		bound->max_duration = calc_data->max_duration;
+		bound->max_weight = seq_info->arr_body->scale_height;
+		for(int i = 0; i < seq_info->num_flyby_bodies; i++)
+			if(seq_info->flyby_bodies[i]->scale_height > bound->max_weight) bound->max_weight = seq_info->flyby_bodies[i]->scale_height;
+	}
+	return bound;
+}
+
+void free_itin_score_bound(struct Itin_Score_Bound *bound) {
+	if(bound == NULL) return;
+	stop_itin_score_bound_snapshots(bound);
+	for(int i = 0; i < bound->num_best_itins; i++) free_itinerary(get_first(bound->best_itins[i]));
+	free(bound->best_itins);
+	free(bound->best_scores);
+	destroy_thread_mutex(&bound->best_lock);
+	destroy_thread_cond(&bound->snapshot_cond);
+	destroy_thread_mutex(&bound->snapshot_lock);
+	free(bound->top_scores);
+	free(bound->remaining_weights);
+	free(bound);
+}
+
+double get_itin_step_score_upper_bound(struct ItinStep *step, struct Itin_Score_Bound *bound) {
+	if(step->score_state.is_invalid) return 0;
+	int depth = 0;
+	struct ItinStep *first = step;
+	while(first->prev != NULL) {
+		first = first->prev;
+		depth++;
+	}
+
+	// every further flyby takes at least MIN_TRANSFER_DURATION
+	double jd_max = bound->jd_max_arr;
+	if(bound->max_duration > 0 && first->date + bound->max_duration < jd_max) jd_max = first->date + bound->max_duration;
+	int max_num_flybys = jd_max > step->date ? (int) ((jd_max - step->date) / MIN_TRANSFER_DURATION) : 0;
+
+	double remaining_weight;
+	if(bound->remaining_weights != NULL) {
+		if(depth >= bound->num_steps || bound->num_steps-1 - depth > max_num_flybys) return 0;
+		remaining_weight = bound->remaining_weights[depth];
+	} else remaining_weight = max_num_flybys * bound->max_weight;
+
+	// departure counts as a flyby (excess velocity of the first transfer)
+	if(step->prev == NULL) remaining_weight += step->body->scale_height;
+	return step->score_state.score + remaining_weight * bound->max_flyby_factor;
+}
+
+int is_itin_step_cut_by_score_bound(struct ItinStep *step, struct Itin_Score_Bound *bound, struct Itin_Stats *stats) {
+	if(bound == NULL) return 0;
+	if(get_itin_step_score_upper_bound(step, bound) > get_itin_score_bound_threshold(bound)) return 0;
+	atomic_fetch_add_explicit(&bound->num_cut_steps, 1, memory_order_relaxed);
+	if(step->prev != NULL) add_itin_stats_count(get_itin_step_stats_record(stats, step->prev, step->body), ITIN_STATS_NODES_SCORE_BOUNDED, 1);
+	return 1;
+}
+
+int prune_score_bounded_next_steps(struct ItinStep *step, int num_next_steps, struct Itin_Score_Bound *bound, struct Itin_Arena *arena, struct Itin_Stats *stats) {
+	if(bound == NULL) return 0;
+	int num_removed = 0;
+	for(int i = 0; i < num_next_steps - num_removed; i++) {
+		// end nodes stay as complete itineraries (calc_next_itin_to_target_step doesn't continue them if they are cut)
+		if(step->next[i]->is_end_node) continue;
+		if(is_itin_step_cut_by_score_bound(step->next[i], bound, stats)) {
+			remove_next_step_from_itinerary(step, i, arena);
+			num_removed++;
+			i--;
+		}
+	}
+	return num_removed;
+}
+
+static int compare_score_bound_sort_keys(const void *a, const void *b) {
+	double bound_a = ((struct Score_Bound_Sort_Key *) a)->upper_bound;
+	double bound_b = ((struct Score_Bound_Sort_Key *) b)->upper_bound;
+	return (bound_a < bound_b) - (bound_a > bound_b);
+}
+
+void sort_next_steps_by_score_bound(struct ItinStep *step, int num_next_steps, struct Itin_Score_Bound *bound) {
+	if(bound == NULL || num_next_steps < 2) return;
+	struct Score_Bound_Sort_Key *keys = (struct Score_Bound_Sort_Key *) malloc(num_next_steps * sizeof(struct Score_Bound_Sort_Key));
+	for(int i = 0; i < num_next_steps; i++) keys[i] = (struct Score_Bound_Sort_Key) {get_itin_step_score_upper_bound(step->next[i], bound), step->next[i]};
+	qsort(keys, num_next_steps, sizeof(struct Score_Bound_Sort_Key), compare_score_bound_sort_keys);
+	for(int i = 0; i < num_next_steps; i++) step->next[i] = keys[i].step;
+	free(keys);
+}
+
+int add_itin_end_nodes_to_score_bound(struct ItinStep *step, struct Itin_Score_Bound *bound, struct Itin_Stats *stats) {
+	int num_end_nodes = 0;
+	for(int i = 0; i < step->num_next_nodes; i++) {
+		struct ItinStep *next = step->next[i];
+		if(!next->is_end_node) continue;
+		if(bound != NULL && !add_itin_to_score_bound(bound, next)) {
+			atomic_fetch_add_explicit(&bound->num_cut_steps, 1, memory_order_relaxed);
+			add_itin_stats_count(get_itin_step_stats_record(stats, step, next->body), ITIN_STATS_NODES_SCORE_BOUNDED, 1);
+			next->is_end_node = false;
+		} else num_end_nodes++;
+	}
+	return num_end_nodes;
+}
+
+int add_itin_arrivals_to_score_bound(struct ItinStep *step, struct Itin_Score_Bound *bound, struct Itin_Arena *arena, struct Itin_Stats *stats) {
+	if(bound == NULL) return step->num_next_nodes;
+	for(int i = 0; i < step->num_next_nodes; i++) {
+		if(!add_itin_to_score_bound(bound, step->next[i])) {
+			atomic_fetch_add_explicit(&bound->num_cut_steps, 1, memory_order_relaxed);
+			add_itin_stats_count(get_itin_step_stats_record(stats, step, step->next[i]->body), ITIN_STATS_NODES_SCORE_BOUNDED, 1);
+			remove_next_step_from_itinerary(step, i, arena);
+			i--;
+		}
+	}
+	return step->num_next_nodes;
+}
+
+int add_itin_score_to_bound(struct Itin_Score_Bound *bound, double score) {
+	if(!(score > 0)) return 0;
+	uint64_t bits = get_score_bits(score);
+
+	// replace the lowest top score (slots only increase --> the lowest one is still the lowest if it didn't change)
+	while(1) {
+		int min_index = 0;
+		unsigned long long min_bits = atomic_load_explicit(&bound->top_scores[0], memory_order_relaxed);
+		for(int i = 1; i < bound->top_k; i++) {
+			unsigned long long slot_bits = atomic_load_explicit(&bound->top_scores[i], memory_order_relaxed);
+			if(slot_bits < min_bits) {
+				min_bits = slot_bits;
+				min_index = i;
+			}
+		}
+		if(bits <= min_bits) return 0;
+		if(atomic_compare_exchange_weak_explicit(&bound->top_scores[min_index], &min_bits, bits, memory_order_relaxed, memory_order_relaxed)) break;
+	}
+	raise_score_bits(&bound->incumbent, bits);
+
+	// lowest top score seen by this scan is never above the current one (cuts stay optimistic)
+	unsigned long long min_bits = atomic_load_explicit(&bound->top_scores[0], memory_order_relaxed);
+	for(int i = 1; i < bound->top_k; i++) {
+		unsigned long long slot_bits = atomic_load_explicit(&bound->top_scores[i], memory_order_relaxed);
+		if(slot_bits < min_bits) min_bits = slot_bits;
+	}
+	raise_score_bits(&bound->threshold, min_bits);
+	return 1;
+}
+
+int add_itin_to_score_bound(struct Itin_Score_Bound *bound, struct ItinStep *arrival) {
+	double score = get_itin_step_score(arrival);
+	if(!add_itin_score_to_bound(bound, score)) return 0;
+
+	lock_thread_mutex(&bound->best_lock);
+	int pos = bound->num_best_itins;
+	while(pos > 0 && bound->best_scores[pos-1] < score) pos--;
+	// a better one has been added by another worker in the meantime
+	if(pos < bound->top_k) {
+		if(bound->num_best_itins == bound->top_k) free_itinerary(get_first(bound->best_itins[bound->top_k-1]));
+		else bound->num_best_itins++;
+		for(int i = bound->num_best_itins-1; i > pos; i--) {
+			bound->best_itins[i] = bound->best_itins[i-1];
+			bound->best_scores[i] = bound->best_scores[i-1];
+		}
+		bound->best_itins[pos] = create_itin_copy_from_arrival(arrival);
+		bound->best_scores[pos] = score;
+		bound->num_best_changes++;
+	}
+	unlock_thread_mutex(&bound->best_lock);
+	return 1;
+}
+
+int get_num_itin_score_bound_best_itins(struct Itin_Score_Bound *bound) {
+	lock_thread_mutex(&bound->best_lock);
+	int num_best_itins = bound->num_best_itins;
+	unlock_thread_mutex(&bound->best_lock);
+	return num_best_itins;
+}
+
+int store_itin_score_bound_best_itins(struct Itin_Score_Bound *bound, const char *filepath) {
+	char tmp_filepath[1050];
+	snprintf(tmp_filepath, sizeof(tmp_filepath), "%s.tmp", filepath);
+
+	// copies are written without holding the lock (workers adding itineraries don't wait for the file)
+	lock_thread_mutex(&bound->best_lock);
+	int num_best_itins = bound->num_best_itins;
+	struct ItinStep **departures = (struct ItinStep **) malloc((num_best_itins > 0 ? num_best_itins : 1) * sizeof(struct ItinStep *));
+	for(int i = 0; i < num_best_itins; i++) departures[i] = get_first(create_itin_copy_from_arrival(bound->best_itins[i]));
+	bound->num_stored_changes = bound->num_best_changes;
+	unlock_thread_mutex(&bound->best_lock);
+
+	int num_nodes = 0;
+	for(int i = 0; i < num_best_itins; i++) num_nodes += get_total_number_of_stored_steps(departures[i]);
+	remove(tmp_filepath);
+	store_itineraries_in_bfile(departures, num_nodes, num_best_itins, num_best_itins, bound->calc_data,
+							   bound->calc_data.seq_info.to_target.system, tmp_filepath, get_current_bin_file_type());
+	for(int i = 0; i < num_best_itins; i++) free_itinerary(departures[i]);
+	free(departures);
+
+	if(!does_file_exist(tmp_filepath)) {
+		printf("Could not write the best itineraries to %s\n", filepath);
+		return 0;
+	}
+	return move_file(tmp_filepath, filepath);
+}
+
+static void *write_itin_score_bound_snapshots(void *args) {
+	struct Itin_Score_Bound *bound = (struct Itin_Score_Bound *) args;
+	int interval_ms = (int) (bound->snapshot_interval * 1000);
+	lock_thread_mutex(&bound->snapshot_lock);
+	while(bound->is_writing_snapshots) {
+		timed_wait_thread_cond(&bound->snapshot_cond, &bound->snapshot_lock, interval_ms);
+		if(!bound->is_writing_snapshots) break;
+		lock_thread_mutex(&bound->best_lock);
+		int has_changed = bound->num_best_changes != bound->num_stored_changes;
+		unlock_thread_mutex(&bound->best_lock);
+		if(has_changed) store_itin_score_bound_best_itins(bound, bound->snapshot_filepath);
+	}
+	unlock_thread_mutex(&bound->snapshot_lock);
+	return NULL;
+}
+
+void start_itin_score_bound_snapshots(struct Itin_Score_Bound *bound, const char *filepath, double interval) {
+	if(bound == NULL || filepath == NULL || interval <= 0 || bound->snapshot_pool != NULL) return;
+	bound->snapshot_filepath = filepath;
+	bound->snapshot_interval = interval;
+	bound->is_writing_snapshots = 1;
+	bound->snapshot_pool = create_thread_pool(1);
+	submit_detached_thread_pool_task(bound->snapshot_pool, write_itin_score_bound_snapshots, bound);
+}
+
+void stop_itin_score_bound_snapshots(struct Itin_Score_Bound *bound) {
+	if(bound == NULL || bound->snapshot_pool == NULL) return;
+	lock_thread_mutex(&bound->snapshot_lock);
+	bound->is_writing_snapshots = 0;
+	broadcast_thread_cond(&bound->snapshot_cond);
+	unlock_thread_mutex(&bound->snapshot_lock);
+	destroy_thread_pool(bound->snapshot_pool);
+	bound->snapshot_pool = NULL;
+}
+
+double get_itin_score_bound_incumbent(struct Itin_Score_Bound *bound) {
+	return get_bits_score(atomic_load_explicit(&bound->incumbent, memory_order_relaxed));
+}
+
+double get_itin_score_bound_threshold(struct Itin_Score_Bound *bound) {
+	return get_bits_score(atomic_load_explicit(&bound->threshold, memory_order_relaxed));
+}
+
+void print_itin_score_bound_stats(struct Itin_Score_Bound *bound) {
+	printf("Score bound: best score %.4f, %d. best score %.4f, %ld steps cut\n",
+		   get_itin_score_bound_incumbent(bound), bound->top_k, get_itin_score_bound_threshold(bound), atomic_load(&bound->num_cut_steps));
+}
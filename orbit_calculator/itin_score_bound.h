@@ -0,0 +1,73 @@
+#ifndef KMAT_ITIN_SCORE_BOUND_H
+#define KMAT_ITIN_SCORE_BOUND_H
+
+#include "itin_tool.h"
+
+#define DEFAULT_BEST_ITINS_SNAPSHOT_INTERVAL 30	// seconds between two snapshots of the best itineraries
+
+struct Itin_Calc_Data;
+
+// Branch-and-bound on the competition score of one search. The scores of the K best itineraries found so far are kept
+// in lock-free slots shared by all workers (the best one is the incumbent). A step is cut as soon as its optimistic
+// upper bound (score so far + every remaining flyby with the body weight (scale_height) and the best seasonal and
+// velocity penalty factors; the number of remaining flybys is limited by the sequence and the time left until the
+// latest arrival) can't beat the K-th best score anymore.
+// Copies of the K best itineraries are kept as well (anytime search: written to disk during and at the end of the search).
+struct Itin_Score_Bound;
+
+// score bound for the sequence or target search of calc_data keeping the top_k best scores
+struct Itin_Score_Bound * create_itin_score_bound(struct Itin_Calc_Data *calc_data, int top_k);
+
+// free score bound and its best itineraries (no worker may use it meanwhile)
+void free_itin_score_bound(struct Itin_Score_Bound *bound);
+
+// optimistic upper bound of the score of all itineraries continuing after step (0: no valid itinerary possible)
+double get_itin_step_score_upper_bound(struct ItinStep *step, struct Itin_Score_Bound *bound);
+
+// returns 1 if no itinerary continuing after step can beat the K best ones found so far (0 otherwise or if bound is NULL)
+// (cut steps are counted in stats if not NULL; the caller removes step)
+int is_itin_step_cut_by_score_bound(struct ItinStep *step, struct Itin_Score_Bound *bound, struct Itin_Stats *stats);
+
+// removes the next steps with an index below num_next_steps that are cut by the score bound (no-op if bound is NULL; end nodes are kept)
+// returns the number of removed next steps (their subtrees are returned to the arena)
+int prune_score_bounded_next_steps(struct ItinStep *step, int num_next_steps, struct Itin_Score_Bound *bound, struct Itin_Arena *arena, struct Itin_Stats *stats);
+
+// sort the next steps with an index below num_next_steps by their score upper bound (most promising first; no-op if bound is NULL)
+void sort_next_steps_by_score_bound(struct ItinStep *step, int num_next_steps, struct Itin_Score_Bound *bound);
+
+// the next steps of step marked as end nodes are complete itineraries: they are added to the K best ones,
+// end nodes that don't make it into the K best ones are unmarked (only continued); returns the number of remaining end nodes
+int add_itin_end_nodes_to_score_bound(struct ItinStep *step, struct Itin_Score_Bound *bound, struct Itin_Stats *stats);
+
+// all next steps of step are final arrivals of the sequence: they are added to the K best ones,
+// arrivals that don't make it into the K best ones are removed (no-op if bound is NULL); returns the number of remaining next steps
+int add_itin_arrivals_to_score_bound(struct ItinStep *step, struct Itin_Score_Bound *bound, struct Itin_Arena *arena, struct Itin_Stats *stats);
+
+// add the score of a complete itinerary; returns 1 if it is one of the K best scores so far (0 otherwise)
+int add_itin_score_to_bound(struct Itin_Score_Bound *bound, double score);
+
+// add the complete itinerary ending with arrival (copied if it is one of the K best so far); returns 1 if it is one of them (0 otherwise)
+int add_itin_to_score_bound(struct Itin_Score_Bound *bound, struct ItinStep *arrival);
+
+// number of best itineraries kept so far (at most K)
+int get_num_itin_score_bound_best_itins(struct Itin_Score_Bound *bound);
+
+// write the best itineraries found so far to an .itins file (replaced at once --> never left half-written; returns 0 on failure)
+int store_itin_score_bound_best_itins(struct Itin_Score_Bound *bound, const char *filepath);
+
+// also write the best itineraries to filepath every interval seconds if they changed until stop_itin_score_bound_snapshots is called
+void start_itin_score_bound_snapshots(struct Itin_Score_Bound *bound, const char *filepath, double interval);
+
+// stop writing snapshots (the last snapshot stays in the file until it is overwritten)
+void stop_itin_score_bound_snapshots(struct Itin_Score_Bound *bound);
+
+// best score found so far (0: none)
+double get_itin_score_bound_incumbent(struct Itin_Score_Bound *bound);
+
+// K-th best score found so far (0 while less than K itineraries have been found)
+double get_itin_score_bound_threshold(struct Itin_Score_Bound *bound);
+
+// print incumbent, threshold and number of cut steps
+void print_itin_score_bound_stats(struct Itin_Score_Bound *bound);
+
+#endif //KMAT_ITIN_SCORE_BOUND_H
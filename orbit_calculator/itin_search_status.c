@@ -0,0 +1,198 @@
+#include "itin_search_status.h"
+#include "tools/tool_funcs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+
+static Itin_Search_Status *active_searches = NULL;
+static thread_mutex_t active_searches_lock = THREAD_MUTEX_INITIALIZER;
+
+
+Itin_Search_Status * create_itin_search_status() {
+	Itin_Search_Status *status = (Itin_Search_Status *) alloc_cache_aligned(sizeof(Itin_Search_Status));
+	if(status == NULL) return NULL;
+	atomic_init(&status->is_cancelled, 0);
+	status->pool = NULL;
+	status->num_tallies = 0;
+	status->tallies = NULL;
+	status->num_all_deps = 0;
+	status->reporter_pool = NULL;
+	status->report_text = NULL;
+	status->is_reporting = 0;
+	init_thread_mutex(&status->report_lock);
+	init_thread_cond(&status->report_cond);
+	status->deadline_pool = NULL;
+	status->max_search_time = 0;
+	status->is_waiting_for_deadline = 0;
+	atomic_init(&status->is_deadline_reached, 0);
+	init_thread_mutex(&status->deadline_lock);
+	init_thread_cond(&status->deadline_cond);
+	status->next_active = NULL;
+	return status;
+}
+
+void free_itin_search_status(Itin_Search_Status *status) {
+	if(status == NULL) return;
+	free_cache_aligned(status->tallies);
+	destroy_thread_cond(&status->report_cond);
+	destroy_thread_mutex(&status->report_lock);
+	destroy_thread_cond(&status->deadline_cond);
+	destroy_thread_mutex(&status->deadline_lock);
+	free_cache_aligned(status);
+}
+
+void begin_itin_search_status(Itin_Search_Status *status, struct Thread_Pool *pool, int num_all_deps) {
+	int num_tallies = (pool != NULL ? get_thread_pool_size(pool) : 0) + 1;
+	if(status->tallies == NULL || status->num_tallies < num_tallies) {
+		free_cache_aligned(status->tallies);
+		status->tallies = (struct Itin_Search_Tally *) alloc_cache_aligned(num_tallies * sizeof(struct Itin_Search_Tally));
+	}
+	status->num_tallies = num_tallies;
+	for(int i = 0; i < num_tallies; i++) {
+		atomic_init(&status->tallies[i].num_deps, 0);
+		atomic_init(&status->tallies[i].num_itins, 0);
+	}
+	status->pool = pool;
+	status->num_all_deps = num_all_deps;
+	atomic_store(&status->is_deadline_reached, 0);
+}
+
+void add_itin_search_progress(Itin_Search_Status *status, int num_deps, long num_itins) {
+	if(status == NULL || status->tallies == NULL) return;
+	int worker_id = get_current_thread_pool() == status->pool ? get_current_thread_pool_worker_id() : -1;
+	// last tally is shared by all threads outside the pool
+	struct Itin_Search_Tally *tally = &status->tallies[worker_id >= 0 ? worker_id : status->num_tallies-1];
+	atomic_fetch_add_explicit(&tally->num_deps, num_deps, memory_order_relaxed);
+	atomic_fetch_add_explicit(&tally->num_itins, num_itins, memory_order_relaxed);
+}
+
+Itin_Search_Progress get_itin_search_progress(Itin_Search_Status *status) {
+	Itin_Search_Progress progress = {0};
+	if(status == NULL) return progress;
+	for(int i = 0; i < status->num_tallies; i++) {
+		progress.num_deps += atomic_load_explicit(&status->tallies[i].num_deps, memory_order_relaxed);
+		progress.num_itins += atomic_load_explicit(&status->tallies[i].num_itins, memory_order_relaxed);
+	}
+	progress.num_all_deps = status->num_all_deps;
+	progress.is_cancelled = is_itin_search_cancelled(status);
+	return progress;
+}
+
+void cancel_itin_search(Itin_Search_Status *status) {
+	if(status != NULL) atomic_store_explicit(&status->is_cancelled, 1, memory_order_relaxed);
+}
+
+static void render_itin_search_progress(Itin_Search_Status *status) {
+	Itin_Search_Progress progress = get_itin_search_progress(status);
+	show_progress((char *) status->report_text, (double) progress.num_deps, progress.num_all_deps > 0 ? progress.num_all_deps : 1);
+}
+
+static void *report_itin_search_progress(void *args) {
+	Itin_Search_Status *status = (Itin_Search_Status *) args;
+	lock_thread_mutex(&status->report_lock);
+	while(status->is_reporting) {
+		render_itin_search_progress(status);
+		timed_wait_thread_cond(&status->report_cond, &status->report_lock, ITIN_SEARCH_REPORT_INTERVAL);
+	}
+	unlock_thread_mutex(&status->report_lock);
+	return NULL;
+}
+
+void start_itin_search_reporter(Itin_Search_Status *status, const char *text) {
+	if(status == NULL || status->reporter_pool != NULL) return;
+	status->report_text = text;
+	status->is_reporting = 1;
+	status->reporter_pool = create_thread_pool(1);
+	submit_detached_thread_pool_task(status->reporter_pool, report_itin_search_progress, status);
+}
+
+void stop_itin_search_reporter(Itin_Search_Status *status) {
+	if(status == NULL || status->reporter_pool == NULL) return;
+	lock_thread_mutex(&status->report_lock);
+	status->is_reporting = 0;
+	broadcast_thread_cond(&status->report_cond);
+	unlock_thread_mutex(&status->report_lock);
+	destroy_thread_pool(status->reporter_pool);
+	status->reporter_pool = NULL;
+
+	render_itin_search_progress(status);
+	printf("\n");
+}
+
+static double get_elapsed_seconds(struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void *wait_for_itin_search_deadline(void *args) {
+	Itin_Search_Status *status = (Itin_Search_Status *) args;
+	struct timeval start;
+	gettimeofday(&start, NULL);
+	lock_thread_mutex(&status->deadline_lock);
+	while(status->is_waiting_for_deadline) {
+		double remaining_time = status->max_search_time - get_elapsed_seconds(&start);
+		if(remaining_time <= 0) {
+			atomic_store(&status->is_deadline_reached, 1);
+			cancel_itin_search(status);
+			break;
+		}
+		// woken up early by stop_itin_search_deadline (or spuriously)
+		timed_wait_thread_cond(&status->deadline_cond, &status->deadline_lock, remaining_time < 1e6 ? (int) (remaining_time*1000) + 1 : 1000000000);
+	}
+	unlock_thread_mutex(&status->deadline_lock);
+	return NULL;
+}
+
+void start_itin_search_deadline(Itin_Search_Status *status, double max_search_time) {
+	if(status == NULL || max_search_time <= 0 || status->deadline_pool != NULL) return;
+	status->max_search_time = max_search_time;
+	status->is_waiting_for_deadline = 1;
+	status->deadline_pool = create_thread_pool(1);
+	submit_detached_thread_pool_task(status->deadline_pool, wait_for_itin_search_deadline, status);
+}
+
+void stop_itin_search_deadline(Itin_Search_Status *status) {
+	if(status == NULL || status->deadline_pool == NULL) return;
+	lock_thread_mutex(&status->deadline_lock);
+	status->is_waiting_for_deadline = 0;
+	broadcast_thread_cond(&status->deadline_cond);
+	unlock_thread_mutex(&status->deadline_lock);
+	destroy_thread_pool(status->deadline_pool);
+	status->deadline_pool = NULL;
+}
+
+int is_itin_search_deadline_reached(Itin_Search_Status *status) {
+	return status != NULL && atomic_load(&status->is_deadline_reached) != 0;
+}
+
+void register_active_itin_search(Itin_Search_Status *status) {
+	lock_thread_mutex(&active_searches_lock);
+	status->next_active = active_searches;
+	active_searches = status;
+	unlock_thread_mutex(&active_searches_lock);
+}
+
+void unregister_active_itin_search(Itin_Search_Status *status) {
+	lock_thread_mutex(&active_searches_lock);
+	Itin_Search_Status **link = &active_searches;
+	while(*link != NULL && *link != status) link = &(*link)->next_active;
+	if(*link != NULL) *link = status->next_active;
+	status->next_active = NULL;
+	unlock_thread_mutex(&active_searches_lock);
+}
+
+int get_current_itin_search_progress(Itin_Search_Progress *progress) {
+	lock_thread_mutex(&active_searches_lock);
+	int is_running = active_searches != NULL;
+	if(is_running) *progress = get_itin_search_progress(active_searches);
+	unlock_thread_mutex(&active_searches_lock);
+	return is_running;
+}
+
+void cancel_current_itin_search() {
+	lock_thread_mutex(&active_searches_lock);
+	cancel_itin_search(active_searches);
+	unlock_thread_mutex(&active_searches_lock);
+}
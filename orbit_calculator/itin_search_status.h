@@ -0,0 +1,98 @@
+#ifndef KMAT_ITIN_SEARCH_STATUS_H
+#define KMAT_ITIN_SEARCH_STATUS_H
+
+#include "tools/thread_pool.h"
+#include <stdatomic.h>
+
+#define ITIN_SEARCH_REPORT_INTERVAL 200		// ms between two progress updates of the reporter thread
+
+// Progress and cancellation of one itinerary search (every search has its own status --> searches can run at the same time).
+// Workers count finished departures and found itineraries in their own tally (own cache line, never written by other threads),
+// the tallies are merged whenever the progress is read (reporter thread, GUI). Cancellation is a flag polled with one relaxed load.
+struct Itin_Search_Tally {
+	_Alignas(64) atomic_long num_deps;
+	atomic_long num_itins;
+};
+
+typedef struct Itin_Search_Status {
+	_Alignas(64) atomic_int is_cancelled;	// own cache line (read in the inner loops of every worker)
+	struct Thread_Pool *pool;				// workers of this pool count in their own tally
+	int num_tallies;						// workers of pool + one tally for all other threads
+	struct Itin_Search_Tally *tallies;
+	int num_all_deps;
+
+	// reporter thread (prints the progress of the search to stdout)
+	struct Thread_Pool *reporter_pool;
+	const char *report_text;
+	int is_reporting;
+	thread_mutex_t report_lock;
+	thread_cond_t report_cond;
+
+	// deadline thread (cancels the search when its wall-clock time limit is reached)
+	struct Thread_Pool *deadline_pool;
+	double max_search_time;				// seconds
+	int is_waiting_for_deadline;
+	atomic_int is_deadline_reached;
+	thread_mutex_t deadline_lock;
+	thread_cond_t deadline_cond;
+
+	struct Itin_Search_Status *next_active;	// running searches (most recently started first)
+} Itin_Search_Status;
+
+typedef struct Itin_Search_Progress {
+	long num_deps;			// finished (or skipped) departure dates
+	long num_itins;			// itineraries found so far
+	int num_all_deps;
+	int is_cancelled;
+} Itin_Search_Progress;
+
+
+// create status of a search that has not been started or cancelled
+Itin_Search_Status * create_itin_search_status();
+
+// free status (the search needs to be finished)
+void free_itin_search_status(Itin_Search_Status *status);
+
+// reset tallies for a search of num_all_deps departure dates running on pool (cancellation before the start is kept)
+void begin_itin_search_status(Itin_Search_Status *status, struct Thread_Pool *pool, int num_all_deps);
+
+// add finished departure dates and found itineraries to the tally of the calling thread
+void add_itin_search_progress(Itin_Search_Status *status, int num_deps, long num_itins);
+
+// merged tallies
+Itin_Search_Progress get_itin_search_progress(Itin_Search_Status *status);
+
+// let the running tasks of the search end as soon as possible
+void cancel_itin_search(Itin_Search_Status *status);
+
+// returns 1 if the search has been cancelled (0 otherwise or if status is NULL)
+static inline int is_itin_search_cancelled(Itin_Search_Status *status) {
+	return status != NULL && atomic_load_explicit(&status->is_cancelled, memory_order_relaxed) != 0;
+}
+
+// start reporter thread that renders the progress with show_progress every ITIN_SEARCH_REPORT_INTERVAL (workers print nothing)
+void start_itin_search_reporter(Itin_Search_Status *status, const char *text);
+
+// render the final progress and stop the reporter thread
+void stop_itin_search_reporter(Itin_Search_Status *status);
+
+// start deadline thread that cancels the search max_search_time seconds from now (no-op if max_search_time <= 0)
+void start_itin_search_deadline(Itin_Search_Status *status, double max_search_time);
+
+// stop the deadline thread (search ended before its deadline)
+void stop_itin_search_deadline(Itin_Search_Status *status);
+
+// returns 1 if the search has been cancelled by its deadline (0 otherwise)
+int is_itin_search_deadline_reached(Itin_Search_Status *status);
+
+// add to / remove from the running searches (progress and cancellation of the most recently started one are exposed to the GUI)
+void register_active_itin_search(Itin_Search_Status *status);
+void unregister_active_itin_search(Itin_Search_Status *status);
+
+// progress of the most recently started running search (returns 0 if no search is running)
+int get_current_itin_search_progress(Itin_Search_Progress *progress);
+
+// cancel the most recently started running search
+void cancel_current_itin_search();
+
+#endif //KMAT_ITIN_SEARCH_STATUS_H
@@ -0,0 +1,237 @@
+#include "itin_stats.h"
+#include "tools/thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+// counters of one worker (stage times on their own cache line, records allocated separately)
+struct Itin_Stats_Worker {
+	_Alignas(64) atomic_long stage_time[NUM_ITIN_STATS_STAGES];	// ns
+	struct Itin_Stats_Record *records;
+};
+
+struct Itin_Stats {
+	Body **bodies;
+	int num_bodies;
+	int num_records;					// ITIN_STATS_MAX_DEPTH * (num_bodies+1)^2 per worker
+	struct Thread_Pool *pool;
+	int num_workers;					// workers of pool + one for all other threads
+	struct Itin_Stats_Worker *workers;
+	long start_time;
+
+	// snapshots
+	struct Thread_Pool *snapshot_pool;
+	const char *snapshot_filepath;
+	double snapshot_interval;
+	int is_writing_snapshots;
+	thread_mutex_t snapshot_lock;
+	thread_cond_t snapshot_cond;
+};
+
+static const char *itin_stats_counter_names[NUM_ITIN_STATS_COUNTERS] = {
+		"flyby_searches", "lambert_calls", "bracket_samples", "root_iterations", "roots",
+		"rejected_flyby_periapsis_low", "rejected_flyby_periapsis_high", "rejected_perihelion", "rejected_repeated_low_perihelion",
+		"rejected_dv", "rejected_approach", "nodes_created", "nodes_pruned", "nodes_score_bounded"
+};
+
+static const char *itin_stats_stage_names[NUM_ITIN_STATS_STAGES] = {
+		"initial_transfers", "flyby_search", "dv_filter", "prune", "mitm_build", "mitm_join"
+};
+
+
+static long get_itin_stats_time() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (long) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+struct Itin_Stats * create_itin_stats(Body **bodies, int num_bodies, struct Thread_Pool *pool) {
+	struct Itin_Stats *stats = (struct Itin_Stats *) calloc(1, sizeof(struct Itin_Stats));
+	if(stats == NULL) return NULL;
+	stats->bodies = (Body **) malloc(num_bodies * sizeof(Body *));
+	for(int i = 0; i < num_bodies; i++) stats->bodies[i] = bodies[i];
+	stats->num_bodies = num_bodies;
+	stats->num_records = ITIN_STATS_MAX_DEPTH * (num_bodies+1) * (num_bodies+1);
+	stats->pool = pool;
+	stats->num_workers = (pool != NULL ? get_thread_pool_size(pool) : 0) + 1;
+	stats->workers = (struct Itin_Stats_Worker *) alloc_cache_aligned(stats->num_workers * sizeof(struct Itin_Stats_Worker));
+
+	// records of different workers never share a cache line
+	size_t records_size = stats->num_records * sizeof(struct Itin_Stats_Record);
+	for(int i = 0; i < stats->num_workers; i++) {
+		struct Itin_Stats_Worker *worker = &stats->workers[i];
+		for(int j = 0; j < NUM_ITIN_STATS_STAGES; j++) atomic_init(&worker->stage_time[j], 0);
+		worker->records = (struct Itin_Stats_Record *) alloc_cache_aligned(records_size);
+		for(int j = 0; j < stats->num_records; j++)
+			for(int k = 0; k < NUM_ITIN_STATS_COUNTERS; k++) atomic_init(&worker->records[j].counter[k], 0);
+	}
+	stats->start_time = get_itin_stats_time();
+	init_thread_mutex(&stats->snapshot_lock);
+	init_thread_cond(&stats->snapshot_cond);
+	return stats;
+}
+
+void free_itin_stats(struct Itin_Stats *stats) {
+	if(stats == NULL) return;
+	stop_itin_stats_snapshots(stats);
+	for(int i = 0; i < stats->num_workers; i++) free_cache_aligned(stats->workers[i].records);
+	free_cache_aligned(stats->workers);
+	free(stats->bodies);
+	destroy_thread_cond(&stats->snapshot_cond);
+	destroy_thread_mutex(&stats->snapshot_lock);
+	free(stats);
+}
+
+// worker of the calling thread (last worker: all threads outside the pool)
+static struct Itin_Stats_Worker * get_itin_stats_worker(struct Itin_Stats *stats) {
+	int worker_id = get_current_thread_pool() == stats->pool ? get_current_thread_pool_worker_id() : -1;
+	return &stats->workers[worker_id >= 0 ? worker_id : stats->num_workers-1];
+}
+
+// index of body in the search bodies (num_bodies: other)
+static int get_itin_stats_body_index(struct Itin_Stats *stats, Body *body) {
+	for(int i = 0; i < stats->num_bodies; i++) if(stats->bodies[i] == body) return i;
+	return stats->num_bodies;
+}
+
+struct Itin_Stats_Record * get_itin_stats_record(struct Itin_Stats *stats, int depth, Body *from_body, Body *to_body) {
+	if(stats == NULL) return NULL;
+	if(depth < 0) depth = 0;
+	if(depth >= ITIN_STATS_MAX_DEPTH) depth = ITIN_STATS_MAX_DEPTH-1;
+	int num_indices = stats->num_bodies+1;
+	int index = (depth*num_indices + get_itin_stats_body_index(stats, from_body))*num_indices + get_itin_stats_body_index(stats, to_body);
+	return &get_itin_stats_worker(stats)->records[index];
+}
+
+struct Itin_Stats_Record * get_itin_step_stats_record(struct Itin_Stats *stats, struct ItinStep *step, Body *to_body) {
+	if(stats == NULL) return NULL;
+	return get_itin_stats_record(stats, get_itin_step_depth(step), step->body, to_body);
+}
+
+long start_itin_stats_stage(struct Itin_Stats *stats) {
+	return stats != NULL ? get_itin_stats_time() : 0;
+}
+
+void end_itin_stats_stage(struct Itin_Stats *stats, enum Itin_Stats_Stage stage, long start) {
+	if(stats == NULL) return;
+	atomic_fetch_add_explicit(&get_itin_stats_worker(stats)->stage_time[stage], get_itin_stats_time() - start, memory_order_relaxed);
+}
+
+static void write_itin_stats_json_string(const char *string, FILE *file) {
+	fputc('"', file);
+	for(const char *c = string; *c != '\0'; c++) {
+		if(*c == '"' || *c == '\\') fputc('\\', file);
+		if((unsigned char) *c >= 0x20) fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+static void write_itin_stats_json_counters(long *counter, FILE *file) {
+	for(int i = 0; i < NUM_ITIN_STATS_COUNTERS; i++)
+		fprintf(file, "%s\"%s\": %ld", i > 0 ? ", " : "", itin_stats_counter_names[i], counter[i]);
+}
+
+void write_itin_stats_json(struct Itin_Stats *stats, FILE *file) {
+	int num_indices = stats->num_bodies+1;
+	long totals[NUM_ITIN_STATS_COUNTERS] = {0};
+	long counter[NUM_ITIN_STATS_COUNTERS];
+
+	fprintf(file, "{\n\t\"elapsed_time\": %.6f,\n\t\"num_threads\": %d,\n", (get_itin_stats_time() - stats->start_time) / 1e9, stats->num_workers-1);
+
+	// summed over all workers (time of parallel stages exceeds the elapsed time)
+	fprintf(file, "\t\"stage_time\": {");
+	for(int i = 0; i < NUM_ITIN_STATS_STAGES; i++) {
+		long stage_time = 0;
+		for(int j = 0; j < stats->num_workers; j++) stage_time += atomic_load_explicit(&stats->workers[j].stage_time[i], memory_order_relaxed);
+		fprintf(file, "%s\"%s\": %.6f", i > 0 ? ", " : "", itin_stats_stage_names[i], stage_time / 1e9);
+	}
+	fprintf(file, "},\n");
+
+	// every depth and body pair with at least one count
+	fprintf(file, "\t\"transitions\": [");
+	int num_transitions = 0;
+	for(int i = 0; i < stats->num_records; i++) {
+		int is_empty = 1;
+		for(int k = 0; k < NUM_ITIN_STATS_COUNTERS; k++) {
+			counter[k] = 0;
+			for(int j = 0; j < stats->num_workers; j++) counter[k] += atomic_load_explicit(&stats->workers[j].records[i].counter[k], memory_order_relaxed);
+			if(counter[k] != 0) is_empty = 0;
+			totals[k] += counter[k];
+		}
+		if(is_empty) continue;
+
+		int to_index = i % num_indices, from_index = i / num_indices % num_indices, depth = i / (num_indices*num_indices);
+		fprintf(file, "%s\n\t\t{\"depth\": %d, \"from\": ", num_transitions > 0 ? "," : "", depth);
+		write_itin_stats_json_string(from_index < stats->num_bodies ? stats->bodies[from_index]->name : "other", file);
+		fprintf(file, ", \"to\": ");
+		write_itin_stats_json_string(to_index < stats->num_bodies ? stats->bodies[to_index]->name : "other", file);
+		fprintf(file, ", ");
+		write_itin_stats_json_counters(counter, file);
+		fprintf(file, "}");
+		num_transitions++;
+	}
+	fprintf(file, "%s],\n", num_transitions > 0 ? "\n\t" : "");
+
+	fprintf(file, "\t\"totals\": {");
+	write_itin_stats_json_counters(totals, file);
+	fprintf(file, "}\n}\n");
+}
+
+int store_itin_stats_json(struct Itin_Stats *stats, const char *filepath) {
+	if(strcmp(filepath, "-") == 0) {
+		write_itin_stats_json(stats, stdout);
+		fflush(stdout);
+		return 1;
+	}
+
+	char tmp_filepath[1024];
+	snprintf(tmp_filepath, sizeof(tmp_filepath), "%s.tmp", filepath);
+	FILE *file = fopen(tmp_filepath, "w");
+	if(file == NULL) {
+		printf("Could not write search statistics to %s\n", filepath);
+		return 0;
+	}
+	write_itin_stats_json(stats, file);
+	fclose(file);
+	#ifdef _WIN32
+		remove(filepath);
+	#endif
+	if(rename(tmp_filepath, filepath) != 0) {
+		printf("Could not write search statistics to %s\n", filepath);
+		return 0;
+	}
+	return 1;
+}
+
+static void *write_itin_stats_snapshots(void *args) {
+	struct Itin_Stats *stats = (struct Itin_Stats *) args;
+	int interval_ms = (int) (stats->snapshot_interval * 1000);
+	lock_thread_mutex(&stats->snapshot_lock);
+	while(stats->is_writing_snapshots) {
+		timed_wait_thread_cond(&stats->snapshot_cond, &stats->snapshot_lock, interval_ms);
+		if(stats->is_writing_snapshots) store_itin_stats_json(stats, stats->snapshot_filepath);
+	}
+	unlock_thread_mutex(&stats->snapshot_lock);
+	return NULL;
+}
+
+void start_itin_stats_snapshots(struct Itin_Stats *stats, const char *filepath, double interval) {
+	if(stats == NULL || filepath == NULL || interval <= 0 || stats->snapshot_pool != NULL) return;
+	stats->snapshot_filepath = filepath;
+	stats->snapshot_interval = interval;
+	stats->is_writing_snapshots = 1;
+	stats->snapshot_pool = create_thread_pool(1);
+	submit_detached_thread_pool_task(stats->snapshot_pool, write_itin_stats_snapshots, stats);
+}
+
+void stop_itin_stats_snapshots(struct Itin_Stats *stats) {
+	if(stats == NULL || stats->snapshot_pool == NULL) return;
+	lock_thread_mutex(&stats->snapshot_lock);
+	stats->is_writing_snapshots = 0;
+	broadcast_thread_cond(&stats->snapshot_cond);
+	unlock_thread_mutex(&stats->snapshot_lock);
+	destroy_thread_pool(stats->snapshot_pool);
+	stats->snapshot_pool = NULL;
+}
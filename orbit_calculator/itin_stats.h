@@ -0,0 +1,83 @@
+#ifndef KMAT_ITIN_STATS_H
+#define KMAT_ITIN_STATS_H
+
+#include "itin_tool.h"
+#include <stdatomic.h>
+
+#define ITIN_STATS_MAX_DEPTH 16		// deeper steps are counted at the last depth
+
+// Instrumentation of one itinerary search (disabled: the search has no Itin_Stats and every hook is a NULL check).
+// Counters are kept per worker (own cache lines, no locks) for every depth and body pair of the search bodies
+// (bodies outside of the list are counted as "other") and merged when the statistics are written as JSON.
+enum Itin_Stats_Counter {
+	ITIN_STATS_FLYBY_SEARCHES,				// calls of the flyby search (one per step and next body)
+	ITIN_STATS_LAMBERT_CALLS,				// transfers solved or taken from the Lambert cache
+	ITIN_STATS_BRACKET_SAMPLES,				// samples refining a synodic window until the roots are bracketed
+	ITIN_STATS_ROOT_ITERATIONS,				// iterations of the root finder inside the brackets
+	ITIN_STATS_ROOTS,						// transfers with matching excess velocity
+	ITIN_STATS_REJECTED_FLYBY_PERIAPSIS_LOW,	// flyby periapsis below 0.1 body radii altitude
+	ITIN_STATS_REJECTED_FLYBY_PERIAPSIS_HIGH,	// flyby periapsis above 100 body radii altitude
+	ITIN_STATS_REJECTED_PERIHELION,			// heliocentric periapsis below 0.01 AU
+	ITIN_STATS_REJECTED_REPEATED_LOW_PERIHELION,	// heliocentric periapsis below 0.05 AU after an earlier one
+	ITIN_STATS_REJECTED_DV,					// dv filter (initial transfers: departure and arrival dv; otherwise: last transfer)
+	ITIN_STATS_REJECTED_APPROACH,			// initial transfers without a start from -200 AU (geometry, initial flyby periapsis or time)
+	ITIN_STATS_NODES_CREATED,
+	ITIN_STATS_NODES_PRUNED,
+	ITIN_STATS_NODES_SCORE_BOUNDED,			// steps and complete itineraries that can't beat the K best scores (score bound)
+	NUM_ITIN_STATS_COUNTERS
+};
+
+enum Itin_Stats_Stage {
+	ITIN_STATS_STAGE_INITIAL_TRANSFERS,
+	ITIN_STATS_STAGE_FLYBY_SEARCH,
+	ITIN_STATS_STAGE_DV_FILTER,
+	ITIN_STATS_STAGE_PRUNE,
+	ITIN_STATS_STAGE_MITM_BUILD,
+	ITIN_STATS_STAGE_MITM_JOIN,
+	NUM_ITIN_STATS_STAGES
+};
+
+// counters of one depth and body pair (of one worker)
+struct Itin_Stats_Record {
+	atomic_long counter[NUM_ITIN_STATS_COUNTERS];
+};
+
+struct Itin_Stats;
+
+
+// create statistics for a search over the given bodies running on pool (NULL: counted on the calling thread)
+struct Itin_Stats * create_itin_stats(Body **bodies, int num_bodies, struct Thread_Pool *pool);
+
+// free statistics (no worker may count meanwhile)
+void free_itin_stats(struct Itin_Stats *stats);
+
+// record of the calling worker for transfers from a step at depth at from_body to to_body (NULL if stats is NULL)
+struct Itin_Stats_Record * get_itin_stats_record(struct Itin_Stats *stats, int depth, Body *from_body, Body *to_body);
+
+// record for the transfers from step to to_body (NULL if stats is NULL)
+struct Itin_Stats_Record * get_itin_step_stats_record(struct Itin_Stats *stats, struct ItinStep *step, Body *to_body);
+
+static inline void add_itin_stats_count(struct Itin_Stats_Record *record, enum Itin_Stats_Counter counter, long amount) {
+	if(record != NULL) atomic_fetch_add_explicit(&record->counter[counter], amount, memory_order_relaxed);
+}
+
+// start of a timed stage (0 if stats is NULL)
+long start_itin_stats_stage(struct Itin_Stats *stats);
+
+// add time since start (returned by start_itin_stats_stage) to the stage of the calling worker
+void end_itin_stats_stage(struct Itin_Stats *stats, enum Itin_Stats_Stage stage, long start);
+
+// write merged statistics as JSON to file
+void write_itin_stats_json(struct Itin_Stats *stats, FILE *file);
+
+// write merged statistics as JSON to filepath ("-": stdout; replaced atomically: written to filepath.tmp first)
+// returns 0 if the file could not be written (1 otherwise)
+int store_itin_stats_json(struct Itin_Stats *stats, const char *filepath);
+
+// write a snapshot to filepath every interval seconds until stop_itin_stats_snapshots is called
+void start_itin_stats_snapshots(struct Itin_Stats *stats, const char *filepath, double interval);
+
+// stop writing snapshots (the last snapshot stays in the file until it is overwritten)
+void stop_itin_stats_snapshots(struct Itin_Stats *stats);
+
+#endif //KMAT_ITIN_STATS_H
@@ -1,8 +1,16 @@
 #include "itin_tool.h"
+#include "itin_arena.h"
+#include "itin_prune.h"
+#include "itin_score_bound.h"
+#include "itin_search_status.h"
+#include "itin_stats.h"
 #include "double_swing_by.h"
 #include "tools/thread_pool.h"
 #include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
+#include "lambert_cache.h"
 #include <math.h>
+#include <float.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -31,113 +39,382 @@ void calc_time_to_next_conjunction_and_opposition(Vector3 r0, OSV osv0_next, Bod
 	*next_opposition_dt = dt_opp;
 }
 
-void find_viable_flybys(struct ItinStep *tf, CelestSystem *system, Body *next_body, double min_dt, double max_dt) {
-	OSV osv_dep = {tf->r, tf->v_body};
-	OSV osv_arr0 = system->prop_method == ORB_ELEMENTS ?
-				   osv_from_elements(next_body->orbit, tf->date) :
-				   osv_from_ephem(next_body->ephem, next_body->num_ephems, tf->date, system->cb);
+// state of one flyby search (forward: transfers departing from the flyby step to the other body; backward: transfers from the other body arriving at the flyby step)
+struct Flyby_Search {
+	Body *body;					// flyby body
+	double date;
+	Vector3 r, v_body;
+	Vector3 v_fixed;			// forward: arrival velocity at the flyby; backward: departure velocity from the flyby
+	double v_inf;				// excess velocity of v_fixed (the excess velocity of the searched transfers needs to match it)
+	int had_low_perihelion;
+	Body *other_body;
+	int is_backward;
+	CelestSystem *system;
+	struct Flyby_Search_Scratch *scratch;
+	struct Itin_Stats_Record *stats;	// counters of the search's depth and body pair (NULL: not instrumented)
+};
+
+const double FLYBY_SEARCH_VINF_TOLERANCE = 1e-4;	// m/s
+const double FLYBY_SEARCH_MIN_DT_STEP = 1e-6;		// s
+const double FLYBY_SEARCH_WINDOW_MARGIN = 1e-4;		// brackets of a synodic window are moved inwards by this fraction of its duration (transfers at conjunction and opposition are degenerate)
+
+// calculates transfer dt after (backward: before) the flyby (stored as last transfer of the scratch) and returns the difference of its excess velocity at the flyby body to v_inf
+double calc_flyby_diff_vinf(struct Flyby_Search *search, double dt) {
+	struct Flyby_Search_Scratch *scratch = search->scratch;
+	scratch->last_dt = dt;
+	scratch->num_evaluations++;
+	add_itin_stats_count(search->stats, ITIN_STATS_LAMBERT_CALLS, 1);
+	if(!search->is_backward) {
+		double t1 = search->date + dt / 86400;
+		scratch->last_osv = body_state_at(search->system, search->other_body, t1);
+		scratch->last_tf = calc_cached_lambert3(search->body, search->date, search->r, search->other_body, t1, scratch->last_osv.r, search->system->cb);
+		return mag_vec3(subtract_vec3(scratch->last_tf.v0, search->v_body)) - search->v_inf;
+	} else {
+		double t0 = search->date - dt / 86400;
+		scratch->last_osv = body_state_at(search->system, search->other_body, t0);
+		scratch->last_tf = calc_cached_lambert3(search->other_body, t0, scratch->last_osv.r, search->body, search->date, search->r, search->system->cb);
+		return mag_vec3(subtract_vec3(scratch->last_tf.v1, search->v_body)) - search->v_inf;
+	}
+}
+
+// stores the last calculated transfer in the scratch if the flyby and the heliocentric periapsis are feasible (returns 0 if no more transfers can be stored)
+int add_flyby_candidate(struct Flyby_Search *search) {
+	struct Flyby_Search_Scratch *scratch = search->scratch;
+	Lambert3 new_transfer = scratch->last_tf;
+	double rp_flyby = search->is_backward ?
+			get_flyby_periapsis(new_transfer.v1, search->v_fixed, search->v_body, search->body) :
+			get_flyby_periapsis(search->v_fixed, new_transfer.v0, search->v_body, search->body);
+	double rel_flyby_alt = rp_flyby/search->body->radius - 1;
+	add_itin_stats_count(search->stats, ITIN_STATS_ROOTS, 1);
+	if(rel_flyby_alt > 0.1 && rel_flyby_alt < 100) {
+		Vector3 rp_heliocentric = calc_heliocentric_periapsis(new_transfer.r0, new_transfer.v0, new_transfer.r1, new_transfer.v1, search->system);
+		double rp_sq = sq_mag_vec3(rp_heliocentric)/(AU*AU);
+		if(rp_sq > 0.05*0.05 || rp_sq > 0.01*0.01 && !search->had_low_perihelion) {
+			int i = scratch->num_new++;
+			scratch->new_dt[i] = scratch->last_dt;
+			scratch->new_tf[i] = new_transfer;
+			scratch->new_osv[i] = scratch->last_osv;
+			scratch->new_low_perihelion[i] = search->had_low_perihelion || rp_sq < 0.05*0.05;
+		} else {
+			add_itin_stats_count(search->stats, rp_sq > 0.01*0.01 ? ITIN_STATS_REJECTED_REPEATED_LOW_PERIHELION : ITIN_STATS_REJECTED_PERIHELION, 1);
+		}
+	} else {
+		add_itin_stats_count(search->stats, rel_flyby_alt > 0.1 ? ITIN_STATS_REJECTED_FLYBY_PERIAPSIS_HIGH : ITIN_STATS_REJECTED_FLYBY_PERIAPSIS_LOW, 1);
+	}
+	return scratch->num_new < FLYBY_SEARCH_MAX_NEW_STEPS;
+}
+
+// inserts sample into the samples of the current window (sorted by dt)
+void insert_flyby_sample(struct Flyby_Search_Scratch *scratch, double dt, double diff_vinf) {
+	int i = scratch->num_samples;
+	while(i > 0 && scratch->dt[i-1] > dt) {
+		scratch->dt[i] = scratch->dt[i-1];
+		scratch->diff_vinf[i] = scratch->diff_vinf[i-1];
+		i--;
+	}
+	scratch->dt[i] = dt;
+	scratch->diff_vinf[i] = diff_vinf;
+	scratch->num_samples++;
+}
+
+// Brent's method between a and b (diff_vinf changes sign); returns 1 if a root has been found (last calculated transfer of the scratch)
+int solve_flyby_bracket(struct Flyby_Search *search, double a, double fa, double b, double fb) {
+	double c = b, fc = fb, d = b-a, e = d;
+	while(search->scratch->num_evaluations < FLYBY_SEARCH_MAX_EVALUATIONS) {
+		if((fb > 0) == (fc > 0)) {
+			c = a; fc = fa;
+			d = b-a; e = d;
+		}
+		if(fabs(fc) < fabs(fb)) {
+			a = b; b = c; c = a;
+			fa = fb; fb = fc; fc = fa;
+		}
+		double tol = 2*DBL_EPSILON*fabs(b) + FLYBY_SEARCH_MIN_DT_STEP;
+		double m = 0.5*(c-b);
+		if(fabs(m) <= tol) return 0;	// step size 0 (imprecision)
+
+		if(fabs(e) >= tol && fabs(fa) > fabs(fb)) {
+			// inverse quadratic interpolation (secant if only two points are available)
+			double p, q, s = fb/fa;
+			if(a == c) {
+				p = 2*m*s;
+				q = 1-s;
+			} else {
+				double r = fb/fc;
+				q = fa/fc;
+				p = s*(2*m*q*(q-r) - (b-a)*(r-1));
+				q = (q-1)*(r-1)*(s-1);
+			}
+			if(p > 0) q = -q;
+			p = fabs(p);
+			double min1 = 3*m*q - fabs(tol*q), min2 = fabs(e*q);
+			if(2*p < (min1 < min2 ? min1 : min2)) {
+				e = d;
+				d = p/q;
+			} else {
+				d = m;
+				e = d;
+			}
+		} else {
+			d = m;
+			e = d;
+		}
+		a = b; fa = fb;
+		b += fabs(d) > tol ? d : (m > 0 ? tol : -tol);
+		add_itin_stats_count(search->stats, ITIN_STATS_ROOT_ITERATIONS, 1);
+		fb = calc_flyby_diff_vinf(search, b);
+		if(fabs(fb) < FLYBY_SEARCH_VINF_TOLERANCE) return 1;
+	}
+	return 0;
+}
+
+// lower bound of a function with monotone derivative between samples i and i+1 from the secants of the neighbouring samples
+// (returns the bound and stores the date at which it is reached in x; orientation: 1 increasing derivative, -1 decreasing derivative)
+double get_flyby_interval_lower_bound(struct Flyby_Search_Scratch *scratch, int i, int orientation, double *x) {
+	double x0 = scratch->dt[i], x1 = scratch->dt[i+1];
+	int has_left = i > 0, has_right = i+2 < scratch->num_samples;
+	double m_left = 0, b_left = 0, m_right = 0, b_right = 0;
+	if(has_left) {
+		m_left = orientation*(scratch->diff_vinf[i] - scratch->diff_vinf[i-1]) / (x0 - scratch->dt[i-1]);
+		b_left = orientation*scratch->diff_vinf[i] - m_left*x0;
+	}
+	if(has_right) {
+		m_right = orientation*(scratch->diff_vinf[i+2] - scratch->diff_vinf[i+1]) / (scratch->dt[i+2] - x1);
+		b_right = orientation*scratch->diff_vinf[i+1] - m_right*x1;
+	}
+
+	*x = (x0 + x1) / 2;
+	if(has_left && has_right && m_left < m_right) {
+		double x_cross = (b_right - b_left) / (m_left - m_right);
+		if(x_cross > x0 && x_cross < x1) {
+			*x = x_cross;
+			return m_left*x_cross + b_left;
+		}
+	}
+	// bound reached at one of the samples (only one secant or secants not crossing in between)
+	double lb0 = has_left ? m_left*x0 + b_left : -INFINITY, lb1 = has_left ? m_left*x1 + b_left : -INFINITY;
+	if(has_right) {
+		if(m_right*x0 + b_right > lb0) lb0 = m_right*x0 + b_right;
+		if(m_right*x1 + b_right > lb1) lb1 = m_right*x1 + b_right;
+	}
+	return lb0 < lb1 ? lb0 : lb1;
+}
+
+// finds the dates inside the window at which diff_vinf is 0 (diff_vinf has a monotone derivative inside a synodic window --> at most two roots)
+// returns 0 if no more steps can be stored
+int find_flybys_in_window(struct Flyby_Search *search, double dt0, double diff0, double dt1, double diff1) {
+	struct Flyby_Search_Scratch *scratch = search->scratch;
+	scratch->num_samples = 0;
+	scratch->num_evaluations = 2;	// brackets calculated in batch
+	insert_flyby_sample(scratch, dt0, diff0);
+	insert_flyby_sample(scratch, dt1, diff1);
+	for(int i = 0; i < 2; i++) {
+		if(fabs(scratch->diff_vinf[i]) >= FLYBY_SEARCH_VINF_TOLERANCE) continue;
+		calc_flyby_diff_vinf(search, scratch->dt[i]);
+		if(!add_flyby_candidate(search)) return 0;
+	}
+
+	// direction of the monotone derivative from the midpoint (the minimum of orientation*diff_vinf lies between the neighbours of the smallest sample)
+	double dt_mid = (dt0 + dt1) / 2;
+	add_itin_stats_count(search->stats, ITIN_STATS_BRACKET_SAMPLES, 1);
+	double diff_mid = calc_flyby_diff_vinf(search, dt_mid);
+	if(isnan(diff_mid)) return 1;
+	insert_flyby_sample(scratch, dt_mid, diff_mid);
+	int orientation = diff_mid <= (diff0 + diff1) / 2 ? 1 : -1;
+
+	// refine around the extremum until the roots are bracketed or the function is shown to not reach 0
+	while(scratch->num_evaluations < FLYBY_SEARCH_MAX_EVALUATIONS && scratch->num_samples < FLYBY_SEARCH_MAX_EVALUATIONS) {
+		int has_bracket = 0, min_idx = 0;
+		for(int i = 0; i < scratch->num_samples; i++) {
+			if(i > 0 && (scratch->diff_vinf[i-1] < 0) != (scratch->diff_vinf[i] < 0)) has_bracket = 1;
+			if(orientation*scratch->diff_vinf[i] < orientation*scratch->diff_vinf[min_idx]) min_idx = i;
+		}
+		if(has_bracket) break;
+		// all samples on the side of the extremum (orientation*diff_vinf lies below the chords between samples)
+		if(orientation*scratch->diff_vinf[min_idx] < 0) return 1;
+
+		double best_lb = INFINITY, best_x = 0;
+		for(int i = min_idx-1; i <= min_idx; i++) {
+			if(i < 0 || i+1 >= scratch->num_samples) continue;
+			double x;
+			double lb = get_flyby_interval_lower_bound(scratch, i, orientation, &x);
+			if(lb < best_lb) {
+				// keep the new sample away from the existing ones
+				double margin = 0.01*(scratch->dt[i+1] - scratch->dt[i]);
+				if(x < scratch->dt[i] + margin) x = scratch->dt[i] + margin;
+				if(x > scratch->dt[i+1] - margin) x = scratch->dt[i+1] - margin;
+				best_lb = lb;
+				best_x = x;
+			}
+		}
+		if(best_lb > 0) return 1;
+		if(best_x - scratch->dt[min_idx] < FLYBY_SEARCH_MIN_DT_STEP && scratch->dt[min_idx] - best_x < FLYBY_SEARCH_MIN_DT_STEP) return 1;
+
+		add_itin_stats_count(search->stats, ITIN_STATS_BRACKET_SAMPLES, 1);
+		double diff = calc_flyby_diff_vinf(search, best_x);
+		if(isnan(diff)) return 1;
+		insert_flyby_sample(scratch, best_x, diff);
+	}
+
+	// solve brackets in order of date
+	for(int i = 1; i < scratch->num_samples; i++) {
+		double a = scratch->dt[i-1], fa = scratch->diff_vinf[i-1], b = scratch->dt[i], fb = scratch->diff_vinf[i];
+		if((fa < 0) == (fb < 0)) continue;
+		if(solve_flyby_bracket(search, a, fa, b, fb) && !add_flyby_candidate(search)) return 0;
+	}
+	return 1;
+}
+
+// finds the transfers of the search between min_dt and max_dt whose excess velocity at the flyby body matches (stored in the scratch)
+void find_flyby_transfers(struct Flyby_Search *search, double min_dt, double max_dt) {
+	struct Flyby_Search_Scratch *scratch = search->scratch;
+	CelestSystem *system = search->system;
+	scratch->num_new = 0;
+	init_lambert_batch_in_buffer(&scratch->batch, scratch->batch_buffer, 2*FLYBY_SEARCH_WINDOW_BATCH);
+
+	OSV osv_other0 = body_state_at(system, search->other_body, search->date);
 	double next_conjunction_dt, next_opposition_dt;
-	calc_time_to_next_conjunction_and_opposition(osv_dep.r, osv_arr0, system->cb, &next_conjunction_dt, &next_opposition_dt);
-	Orbit arr0 = constr_orbit_from_osv(osv_arr0.r, osv_arr0.v, system->cb);
-	double period_arr0 = calc_orbital_period(arr0);
-	
+	calc_time_to_next_conjunction_and_opposition(search->r, osv_other0, system->cb, &next_conjunction_dt, &next_opposition_dt);
+	Orbit other0 = constr_orbit_from_osv(osv_other0.r, osv_other0.v, system->cb);
+	double period_other0 = calc_orbital_period(other0);
+	// backward: previous conjunction and opposition
+	if(search->is_backward) {
+		next_conjunction_dt = period_other0 - next_conjunction_dt;
+		next_opposition_dt = period_other0 - next_opposition_dt;
+	}
+
 	double dt0, dt1;
 	if(next_conjunction_dt < next_opposition_dt) {
-		dt0 = next_opposition_dt - period_arr0;
+		dt0 = next_opposition_dt - period_other0;
 		dt1 = next_conjunction_dt;
 	} else {
-		dt0 = next_conjunction_dt - period_arr0;
+		dt0 = next_conjunction_dt - period_other0;
 		dt1 = next_opposition_dt;
 	}
-	
-	// x: dt, y: diff_vinf
-	DataArray2 *data = data_array2_create();
-	int max_new_steps = 100;
-	struct ItinStep *new_steps[max_new_steps];
-	int counter = 0;
 
-	double t0 = tf->date;
-	double last_dt, dt, t1, diff_vinf;
-
-	Vector3 v_init = subtract_vec3(tf->v_arr, tf->v_body);
-
-	while(dt0 < max_dt && counter < max_new_steps) {
-		int right_side = 0;	// 0 = left, 1 = right
-
-		for(int i = 0; i < 100; i++) {
-			if(i == 0) dt = dt0;
-			if(dt < min_dt) dt = min_dt;
-			if(dt > max_dt) dt = max_dt;
-
-			t1 = t0 + dt / 86400;
-
-			struct OSV osv_arr = system->prop_method == ORB_ELEMENTS ?
-					osv_from_elements(next_body->orbit, t1) :
-					osv_from_ephem(next_body->ephem, next_body->num_ephems, t1, system->cb);
-
-			Lambert3 new_transfer = calc_lambert3(osv_dep.r, osv_arr.r, dt, system->cb);
-			Vector3 v_dep = subtract_vec3(new_transfer.v0, tf->v_body);
-			diff_vinf = mag_vec3(v_dep) - mag_vec3(v_init);
-
-			if(fabs(diff_vinf) < 1e-4) {
-				double rp_flyby = get_flyby_periapsis(tf->v_arr, new_transfer.v0, tf->v_body, tf->body);
-				if(rp_flyby/tf->body->radius - 1 > 0.1 && rp_flyby/tf->body->radius - 1 < 100) {
-					Vector3 rp_heliocentric = calc_heliocentric_periapsis(new_transfer.r0, new_transfer.v0, new_transfer.r1, new_transfer.v1, system);
-					double rp_sq = sq_mag_vec3(rp_heliocentric)/(AU*AU);
-					if(rp_sq > 0.05*0.05 || rp_sq > 0.01*0.01 && !tf->had_low_perihelion) {
-						new_steps[counter] = (struct ItinStep *) malloc(sizeof(struct ItinStep));
-						new_steps[counter]->body = next_body;
-						new_steps[counter]->date = t1;
-						new_steps[counter]->r = osv_arr.r;
-						new_steps[counter]->v_dep = new_transfer.v0;
-						new_steps[counter]->v_arr = new_transfer.v1;
-						new_steps[counter]->v_body = osv_arr.v;
-						new_steps[counter]->had_low_perihelion = tf->had_low_perihelion || rp_sq < 0.05*0.05;
-						new_steps[counter]->num_next_nodes = 0;
-						new_steps[counter]->prev = tf;
-						new_steps[counter]->next = NULL;
-						counter++;
-					}
-				}
+	int can_store = 1;
+	while(dt0 < max_dt && can_store) {
+		// brackets of the next synodic windows (between conjunction and opposition)
+		int num_windows = 0;
+		while(num_windows < FLYBY_SEARCH_WINDOW_BATCH && dt0 < max_dt) {
+			double margin = FLYBY_SEARCH_WINDOW_MARGIN * (dt1 - dt0);
+			scratch->window_dt[2*num_windows] = dt0 + margin > min_dt ? dt0 + margin : min_dt;
+			scratch->window_dt[2*num_windows+1] = dt1 - margin < max_dt ? dt1 - margin : max_dt;
+			num_windows++;
+			double temp = dt1;
+			dt1 = dt0 + period_other0;
+			dt0 = temp;
+		}
 
-				if(!right_side) right_side = 1;
-				else break;
+		if(!search->is_backward) {
+			// transfers to the window brackets start at the same position --> solve them together
+			clear_lambert_batch(&scratch->batch);
+			for(int i = 0; i < 2*num_windows; i++) {
+				double t1 = search->date + scratch->window_dt[i] / 86400;
+				OSV osv_arr = body_state_at(system, search->other_body, t1);
+				Lambert3 cached_tf;
+				if(get_cached_lambert3(search->body, search->date, search->r, search->other_body, t1, osv_arr.r, system->cb, &cached_tf)) {
+					scratch->window_diff_vinf[i] = mag_vec3(subtract_vec3(cached_tf.v0, search->v_body)) - search->v_inf;
+					continue;
+				}
+				scratch->batch_window_indices[add_lambert_batch_problem(&scratch->batch, osv_arr.r, (t1 - search->date) * 86400)] = i;
 			}
-
-
-			data_array2_insert_new(data, dt, diff_vinf);
-
-			if(!can_be_negative_monot_deriv(data)) break;
-			last_dt = dt;
-			if(i == 0) dt = dt1;
-			else dt = root_finder_monot_deriv_next_x(data, right_side ? 1 : 0);
-			if(i > 3 && dt == last_dt) break;	// step size 0 (imprecision)
-			if(isnan(dt) || isinf(dt)) break;
+			solve_lambert_batch(&scratch->batch, search->r, system->cb);
+			add_itin_stats_count(search->stats, ITIN_STATS_LAMBERT_CALLS, 2*num_windows);
+			for(int j = 0; j < scratch->batch.num_problems; j++) {
+				int i = scratch->batch_window_indices[j];
+				Lambert3 new_transfer = get_lambert_batch_solution(&scratch->batch, search->r, j);
+				store_lambert3_in_cache(search->body, search->date, search->other_body, search->date + scratch->window_dt[i] / 86400, system->cb, new_transfer);
+				scratch->window_diff_vinf[i] = mag_vec3(subtract_vec3(new_transfer.v0, search->v_body)) - search->v_inf;
+			}
+		} else {
+			// transfers to the window brackets end at the same position (no shared departure for the batch)
+			for(int i = 0; i < 2*num_windows; i++)
+				scratch->window_diff_vinf[i] = calc_flyby_diff_vinf(search, scratch->window_dt[i]);
 		}
 
-		data_array2_clear(data);
-
-		double temp = dt1;
-		dt1 = dt0 + period_arr0;
-		dt0 = temp;
+		for(int i = 0; i < num_windows && can_store; i++) {
+			double w0 = scratch->window_dt[2*i], w1 = scratch->window_dt[2*i+1];
+			double diff0 = scratch->window_diff_vinf[2*i], diff1 = scratch->window_diff_vinf[2*i+1];
+			if(w1 <= w0 || isnan(diff0) || isnan(diff1)) continue;	// outside of [min_dt, max_dt] or no transfer
+			can_store = find_flybys_in_window(search, w0, diff0, w1, diff1);
+		}
 	}
-	
-	data_array2_free(data);
+}
+
+void find_viable_flybys(struct ItinStep *tf, CelestSystem *system, Body *next_body, double min_dt, double max_dt, struct ItinSearchContext *search_ctx, struct Flyby_Search_Scratch *scratch) {
+	struct Itin_Arena *arena = search_ctx != NULL ? search_ctx->arena : NULL;
+	struct Itin_Stats *stats = search_ctx != NULL ? search_ctx->stats : NULL;
+	struct Flyby_Search_Scratch local_scratch;
+	if(scratch == NULL) scratch = &local_scratch;
+	long stage_start = start_itin_stats_stage(stats);
+
+	struct Flyby_Search search = {
+			.body = tf->body,
+			.date = tf->date,
+			.r = tf->r,
+			.v_body = tf->v_body,
+			.v_fixed = tf->v_arr,
+			.v_inf = mag_vec3(subtract_vec3(tf->v_arr, tf->v_body)),
+			.had_low_perihelion = tf->had_low_perihelion,
+			.other_body = next_body,
+			.is_backward = 0,
+			.system = system,
+			.scratch = scratch,
+			.stats = get_itin_step_stats_record(stats, tf, next_body)
+	};
+	add_itin_stats_count(search.stats, ITIN_STATS_FLYBY_SEARCHES, 1);
+	find_flyby_transfers(&search, min_dt, max_dt);
+	int counter = scratch->num_new;
+	add_itin_stats_count(search.stats, ITIN_STATS_NODES_CREATED, counter);
 
 	if(counter > 0) {
-		if(tf->num_next_nodes == 0) tf->next = (struct ItinStep **) malloc(counter * sizeof(struct ItinStep *));
+		if(tf->num_next_nodes == 0 && tf->next == NULL) tf->next = new_itin_next_array(arena, counter);
 		else {
-			struct ItinStep ** new_next = realloc(tf->next, (counter+tf->num_next_nodes) * sizeof(struct ItinStep *));
+			struct ItinStep ** new_next = resize_itin_next_array(arena, tf->next, counter+tf->num_next_nodes);
 			if(new_next == NULL) {
 				printf("\nERROR WHILE REALLOCATING ITINERARIES DURING TRANSFER CALCULATION!!!\n");
 				return;
 			}
 			tf->next = new_next;
 		}
-		for(int i = 0; i < counter; i++) tf->next[i+tf->num_next_nodes] = new_steps[i];
+		for(int i = 0; i < counter; i++) {
+			struct ItinStep *new_step = new_itin_step(arena);
+			new_step->body = next_body;
+			new_step->date = tf->date + scratch->new_dt[i] / 86400;
+			new_step->r = scratch->new_osv[i].r;
+			new_step->v_dep = scratch->new_tf[i].v0;
+			new_step->v_arr = scratch->new_tf[i].v1;
+			new_step->v_body = scratch->new_osv[i].v;
+			new_step->had_low_perihelion = scratch->new_low_perihelion[i];
+			new_step->num_next_nodes = 0;
+			new_step->prev = tf;
+			new_step->next = NULL;
+			update_itin_step_score(new_step, system);
+			tf->next[i+tf->num_next_nodes] = new_step;
+		}
 
 		tf->num_next_nodes += counter;
 	}
+	end_itin_stats_stage(stats, ITIN_STATS_STAGE_FLYBY_SEARCH, stage_start);
+}
+
+int find_viable_backward_flybys(Body *body, double date, Vector3 r, Vector3 v_body, Vector3 v_dep, int had_low_perihelion, CelestSystem *system, Body *prev_body, double min_dt, double max_dt, struct Flyby_Search_Scratch *scratch) {
+	struct Flyby_Search search = {
+			.body = body,
+			.date = date,
+			.r = r,
+			.v_body = v_body,
+			.v_fixed = v_dep,
+			.v_inf = mag_vec3(subtract_vec3(v_dep, v_body)),
+			.had_low_perihelion = had_low_perihelion,
+			.other_body = prev_body,
+			.is_backward = 1,
+			.system = system,
+			.scratch = scratch
+	};
+	find_flyby_transfers(&search, min_dt, max_dt);
+	return scratch->num_new;
 }
 
 
@@ -247,7 +524,7 @@ void print_itinerary(struct ItinStep *itin) {
 int get_number_of_itineraries(struct ItinStep *itin) {
 	if(itin == NULL || (itin->prev == NULL && itin->num_next_nodes == 0)) return 0;
 	if(itin->num_next_nodes == 0) return 1;
-	int counter = 0;
+	int counter = itin->is_end_node ? 1 : 0;
 	for(int i = 0; i < itin->num_next_nodes; i++) {
 		counter += get_number_of_itineraries(itin->next[i]);
 	}
@@ -257,7 +534,8 @@ int get_number_of_itineraries(struct ItinStep *itin) {
 int get_total_number_of_stored_steps(struct ItinStep *itin) {
 	if(itin == NULL) return 0;
 	if(itin->num_next_nodes == 0) return 1;
-	int counter = 1;
+	// end nodes with next steps are stored a second time as leaf in .itins files
+	int counter = itin->is_end_node ? 2 : 1;
 	for(int i = 0; i < itin->num_next_nodes; i++) {
 		counter += get_total_number_of_stored_steps(itin->next[i]);
 	}
@@ -265,7 +543,7 @@ int get_total_number_of_stored_steps(struct ItinStep *itin) {
 }
 
 void store_itineraries_in_array(struct ItinStep *itin, struct ItinStep **array, int *index) {
-	if(itin->num_next_nodes == 0) {
+	if(itin->num_next_nodes == 0 || itin->is_end_node) {
 		array[*index] = itin;
 		(*index)++;
 	}
@@ -282,6 +560,10 @@ double get_itinerary_duration(struct ItinStep *itin) {
 	return jd1-jd0;
 }
 
+double get_itin_step_score(struct ItinStep *step) {
+	return step->score_state.is_invalid ? 0 : step->score_state.score;
+}
+
 struct PorkchopPoint *create_porkchop_array_from_departures(struct ItinStep **departures, int num_deps, double dep_periapsis, double arr_periapsis) {
 	int num_itins = 0;
 	for(int i = 0; i < num_deps; i++) num_itins += get_number_of_itineraries(departures[i]);
@@ -290,9 +572,7 @@ struct PorkchopPoint *create_porkchop_array_from_departures(struct ItinStep **de
 	int index = 0;
 	for(int i = 0; i < num_deps; i++) store_itineraries_in_array(departures[i], arrivals, &index);
 	struct PorkchopPoint *porkchop_points = malloc(num_itins * sizeof(struct PorkchopPoint));
-	for(int i = 0; i < num_itins; i++) {
-		porkchop_points[i] = create_porkchop_point(arrivals[i], dep_periapsis, arr_periapsis);
-	}
+	create_porkchop_points(arrivals, num_itins, dep_periapsis, arr_periapsis, porkchop_points, NULL);
 	free(arrivals);
 
 	return porkchop_points;
@@ -301,7 +581,8 @@ struct PorkchopPoint *create_porkchop_array_from_departures(struct ItinStep **de
 struct PorkchopPoint create_porkchop_point(struct ItinStep *itin, double dep_periapsis, double arr_periapsis) {
 	struct PorkchopPoint pp;
 	pp.arrival = itin;
-	pp.score = 0;
+	pp.score = get_itin_step_score(itin);
+	pp.is_score_valid = !itin->score_state.is_invalid;
 	pp.dur = get_itinerary_duration(itin);
 
 	double vinf = mag_vec3(subtract_vec3(itin->v_arr, itin->v_body));
@@ -322,62 +603,173 @@ struct PorkchopPoint create_porkchop_point(struct ItinStep *itin, double dep_per
 	return pp;
 }
 
-int calc_next_spec_itin_step(struct ItinStep *curr_step, CelestSystem *system, Body **bodies, double jd_max_arr, struct Dv_Filter *dv_filter, int num_steps, int step) {
+struct Porkchop_Batch_Task_Args {
+	struct ItinStep **arrivals;
+	struct PorkchopPoint *points;
+	int num_points;
+	double dep_periapsis, arr_periapsis;
+};
+
+void *create_porkchop_points_task(void *args) {
+	struct Porkchop_Batch_Task_Args *task_args = (struct Porkchop_Batch_Task_Args *) args;
+	for(int i = 0; i < task_args->num_points; i++)
+		task_args->points[i] = create_porkchop_point(task_args->arrivals[i], task_args->dep_periapsis, task_args->arr_periapsis);
+	return NULL;
+}
+
+void create_porkchop_points(struct ItinStep **arrivals, int num_itins, double dep_periapsis, double arr_periapsis, struct PorkchopPoint *points, struct Thread_Pool *pool) {
+	int num_batches = (num_itins + PORKCHOP_BATCH_SIZE - 1) / PORKCHOP_BATCH_SIZE;
+	if(num_batches <= 1) {
+		for(int i = 0; i < num_itins; i++) points[i] = create_porkchop_point(arrivals[i], dep_periapsis, arr_periapsis);
+		return;
+	}
+
+	if(pool == NULL) pool = get_global_thread_pool();
+	struct Porkchop_Batch_Task_Args *task_args = malloc(num_batches * sizeof(struct Porkchop_Batch_Task_Args));
+	struct Thread_Pool_Task **tasks = malloc(num_batches * sizeof(struct Thread_Pool_Task *));
+	for(int i = 0; i < num_batches; i++) {
+		int first = i * PORKCHOP_BATCH_SIZE;
+		int num_points = num_itins - first < PORKCHOP_BATCH_SIZE ? num_itins - first : PORKCHOP_BATCH_SIZE;
+		task_args[i] = (struct Porkchop_Batch_Task_Args) {arrivals + first, points + first, num_points, dep_periapsis, arr_periapsis};
+		tasks[i] = submit_thread_pool_task(pool, create_porkchop_points_task, &task_args[i]);
+	}
+	for(int i = 0; i < num_batches; i++) join_thread_pool_task(tasks[i]);
+	free(tasks);
+	free(task_args);
+}
+
+struct Spec_Itin_Step_Task_Args {
+	struct ItinStep *step;
+	CelestSystem *system;
+	Body **bodies;
+	double jd_max_arr;
+	struct Dv_Filter *dv_filter;
+	int num_steps, step_idx;
+	struct ItinSearchContext *search_ctx;
+	int has_valid_itins;
+};
+
+struct To_Target_Itin_Step_Task_Args {
+	struct ItinStep *step;
+	struct ItinSequenceInfoToTarget *seq_info;
+	double jd_max_arr, max_total_duration;
+	struct Dv_Filter *dv_filter;
+	struct ItinSearchContext *search_ctx;
+	int has_valid_itins;
+};
+
+// returns 1 if the next steps of a step at the given depth should be calculated as separate tasks (0 otherwise)
+int calc_next_steps_as_tasks(struct ItinSearchContext *search_ctx, int depth, int num_next_nodes) {
+	if(search_ctx == NULL || search_ctx->pool == NULL) return 0;
+	return depth < search_ctx->max_task_depth && num_next_nodes >= search_ctx->min_task_num_next_nodes;
+}
+
+void *calc_next_spec_itin_step_task(void *args) {
+	struct Spec_Itin_Step_Task_Args *task_args = (struct Spec_Itin_Step_Task_Args *) args;
+	task_args->has_valid_itins = calc_next_spec_itin_step(task_args->step, task_args->system, task_args->bodies, task_args->jd_max_arr, task_args->dv_filter, task_args->num_steps, task_args->step_idx, task_args->search_ctx);
+	return NULL;
+}
+
+void *calc_next_itin_to_target_step_task(void *args) {
+	struct To_Target_Itin_Step_Task_Args *task_args = (struct To_Target_Itin_Step_Task_Args *) args;
+	task_args->has_valid_itins = calc_next_itin_to_target_step(task_args->step, task_args->seq_info, task_args->jd_max_arr, task_args->max_total_duration, task_args->dv_filter, task_args->search_ctx);
+	return NULL;
+}
+
+// scratch of the calling worker (NULL if the search has none or the caller is not a worker of its pool)
+// (find_viable_flybys doesn't wait for other tasks --> tasks running on the same worker never use the scratch at the same time)
+struct Flyby_Search_Scratch * get_flyby_search_scratch(struct ItinSearchContext *search_ctx) {
+	if(search_ctx == NULL || search_ctx->flyby_scratch == NULL || search_ctx->pool == NULL) return NULL;
+	if(get_current_thread_pool() != search_ctx->pool) return NULL;
+	int worker_id = get_current_thread_pool_worker_id();
+	return worker_id >= 0 ? &search_ctx->flyby_scratch[worker_id] : NULL;
+}
+
+int calc_next_spec_itin_step(struct ItinStep *curr_step, CelestSystem *system, Body **bodies, double jd_max_arr, struct Dv_Filter *dv_filter, int num_steps, int step, struct ItinSearchContext *search_ctx) {
+	// better itineraries might have been found since curr_step was created
+	if(is_itin_step_cut_by_score_bound(curr_step, search_ctx->score_bound, search_ctx->stats)) return 0;
+
 	double max_duration = jd_max_arr-curr_step->date;
 	double min_duration = MIN_TRANSFER_DURATION;
-	if(max_duration > min_duration && get_thread_counter(3) == 0) {
-		if(bodies[step] != bodies[step - 1]) find_viable_flybys(curr_step, system, bodies[step], min_duration * 86400, max_duration * 86400);
+	if(max_duration > min_duration && !is_itin_search_cancelled(search_ctx->status)) {
+		if(bodies[step] != bodies[step - 1]) find_viable_flybys(curr_step, system, bodies[step], min_duration * 86400, max_duration * 86400, search_ctx, get_flyby_search_scratch(search_ctx));
 		else {
 			printf("DSB not yet reimplemented!\n");
 			//		find_viable_dsb_flybys(curr_step, &bodies[step+1]->ephem, bodies[step+1],
 			//							   min_duration[step-1]*86400, max_duration[step-1]*86400, min_duration[step]*86400, max_duration[step]*86400);
 		}
 
-		for(int i = 0; i < curr_step->num_next_nodes; i++) {
-			struct ItinStep *next = bodies[step] != bodies[step - 1] ? curr_step->next[i] : curr_step->next[i]->next[0]->next[0];
-			if(step == num_steps - 1) {
-				struct PorkchopPoint porkchop_point = create_porkchop_point(next, dv_filter->dep_periapsis, dv_filter->arr_periapsis);
+		if(step == num_steps - 1) {
+			long stage_start = start_itin_stats_stage(search_ctx->stats);
+			struct Itin_Stats_Record *stats = get_itin_step_stats_record(search_ctx->stats, curr_step, bodies[step]);
+			for(int i = 0; i < curr_step->num_next_nodes; i++) {
+				struct PorkchopPoint porkchop_point = create_porkchop_point(curr_step->next[i], dv_filter->dep_periapsis, dv_filter->arr_periapsis);
 				double dv_sat = porkchop_point.dv_dsm;
 				if(dv_filter->last_transfer_type == 1) dv_sat += porkchop_point.dv_arr_cap;
 				if(dv_filter->last_transfer_type == 2) dv_sat += porkchop_point.dv_arr_circ;
 				if(dv_sat > dv_filter->max_satdv || porkchop_point.dv_dep + dv_sat > dv_filter->max_totdv) {
-					if(curr_step->num_next_nodes <= 1) {
-						remove_step_from_itinerary(next);
-						return 0;
-					} else {
-						remove_step_from_itinerary(next);
-					}
+					remove_next_step_from_itinerary(curr_step, i, search_ctx->arena);
+					add_itin_stats_count(stats, ITIN_STATS_REJECTED_DV, 1);
 					i--;
 				}
 			}
+			end_itin_stats_stage(search_ctx->stats, ITIN_STATS_STAGE_DV_FILTER, stage_start);
 		}
+		prune_equivalent_next_steps(curr_step, search_ctx->prune_filter, system, search_ctx->arena, search_ctx->stats);
+		// complete itineraries (meet in the middle: forward steps end at the middle body)
+		if(step == num_steps - 1 && search_ctx->mitm == NULL) add_itin_arrivals_to_score_bound(curr_step, search_ctx->score_bound, search_ctx->arena, search_ctx->stats);
+		else prune_score_bounded_next_steps(curr_step, curr_step->num_next_nodes, search_ctx->score_bound, search_ctx->arena, search_ctx->stats);
 	}
 
-	if(curr_step->num_next_nodes == 0) {
-		remove_step_from_itinerary(curr_step);
-		return 0;
-	}
+	// no valid next steps (curr_step gets removed by the caller)
+	if(curr_step->num_next_nodes == 0) return 0;
 
-	int num_valid = 0;
-	int init_num_nodes = curr_step->num_next_nodes;
-	int step_del = 0;
-	int result;
+	if(step < num_steps-1) return continue_to_next_spec_itin_steps(curr_step, system, bodies, jd_max_arr, dv_filter, num_steps, step + 1, search_ctx);
+	else return 1;
+}
 
-	if(step < num_steps-1) {
-		for(int i = 0; i < init_num_nodes; i++) {
-			if(bodies[step] != bodies[step-1]) result = calc_next_spec_itin_step(curr_step->next[i - step_del], system, bodies, jd_max_arr, dv_filter, num_steps, step + 1);
-			else result = calc_next_spec_itin_step(curr_step->next[i - step_del]->next[0]->next[0], system, bodies, jd_max_arr, dv_filter, num_steps, step + 2);
-			num_valid += result;
-			if(!result) step_del++;
+int continue_to_next_spec_itin_steps(struct ItinStep *curr_step, CelestSystem *system, Body **bodies, double jd_max_arr, struct Dv_Filter *dv_filter, int num_steps, int step, struct ItinSearchContext *search_ctx) {
+	int num_next_nodes = curr_step->num_next_nodes;
+	// most promising branches first (finds good itineraries early --> more steps are cut by the score bound)
+	sort_next_steps_by_score_bound(curr_step, num_next_nodes, search_ctx->score_bound);
+
+	if(calc_next_steps_as_tasks(search_ctx, step-2, num_next_nodes)) {
+		// calculate every next step (and its subtree) as a separate task; next steps only modify their own subtree
+		struct Spec_Itin_Step_Task_Args *task_args = malloc(num_next_nodes * sizeof(struct Spec_Itin_Step_Task_Args));
+		struct Thread_Pool_Task **tasks = malloc(num_next_nodes * sizeof(struct Thread_Pool_Task *));
+		for(int i = 0; i < num_next_nodes; i++) {
+			task_args[i] = (struct Spec_Itin_Step_Task_Args) {curr_step->next[i], system, bodies, jd_max_arr, dv_filter, num_steps, step, search_ctx, 0};
+			tasks[i] = submit_thread_pool_task(search_ctx->pool, calc_next_spec_itin_step_task, &task_args[i]);
 		}
-	} else return 1;
+		for(int i = 0; i < num_next_nodes; i++) join_thread_pool_task(tasks[i]);
+		// remove from the back to keep the indices of the remaining next steps
+		for(int i = num_next_nodes-1; i >= 0; i--) {
+			if(!task_args[i].has_valid_itins) remove_next_step_from_itinerary(curr_step, i, search_ctx->arena);
+		}
+		free(tasks);
+		free(task_args);
+	} else {
+		for(int i = 0; i < curr_step->num_next_nodes; i++) {
+			if(!calc_next_spec_itin_step(curr_step->next[i], system, bodies, jd_max_arr, dv_filter, num_steps, step, search_ctx)) {
+				remove_next_step_from_itinerary(curr_step, i, search_ctx->arena);
+				i--;
+			}
+		}
+	}
 
-	return num_valid > 0;
+	return curr_step->num_next_nodes > 0;
 }
 
-int calc_next_itin_to_target_step(struct ItinStep *curr_step, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter) {
+int calc_next_itin_to_target_step(struct ItinStep *curr_step, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter, struct ItinSearchContext *search_ctx) {
+	struct Itin_Arena *arena = search_ctx->arena;
+	struct Itin_Stats *stats = search_ctx->stats;
+	struct Itin_Score_Bound *score_bound = search_ctx->score_bound;
+	// better itineraries might have been found since curr_step was created (end nodes are kept, but not continued)
+	if(is_itin_step_cut_by_score_bound(curr_step, score_bound, stats)) return curr_step->is_end_node;
+
+	struct Flyby_Search_Scratch *scratch = get_flyby_search_scratch(search_ctx);
 	for(int i = 0; i < seq_info->num_flyby_bodies; i++) {
-		if(get_thread_counter(3) > 0) break;
+		if(is_itin_search_cancelled(search_ctx->status)) break;
 		if(seq_info->flyby_bodies[i] == curr_step->body) continue;
 		double jd_max;
 		if(get_first(curr_step)->date + max_total_duration < jd_max_arr)
@@ -387,101 +779,98 @@ int calc_next_itin_to_target_step(struct ItinStep *curr_step, struct ItinSequenc
 		double max_duration = jd_max-curr_step->date;
 		double min_duration = MIN_TRANSFER_DURATION;
 		if(max_duration > min_duration)
-			find_viable_flybys(curr_step, seq_info->system, seq_info->flyby_bodies[i], min_duration*86400, max_duration*86400);
+			find_viable_flybys(curr_step, seq_info->system, seq_info->flyby_bodies[i], min_duration*86400, max_duration*86400, search_ctx, scratch);
 	}
 
 
 	if(curr_step->num_next_nodes == 0) {
-//		remove_step_from_itinerary(curr_step);
 		return 1;
 	}
 
-	int num_of_end_nodes = find_copy_and_store_end_nodes(curr_step, seq_info->arr_body);
-
-	// remove end nodes that do not satisfy dv requirements
-	num_of_end_nodes = remove_end_nodes_that_do_not_satisfy_dv_requirements(curr_step, num_of_end_nodes, dv_filter);
-	if(curr_step->num_next_nodes <= 0) return 0;
-
-	// returns 1 if has valid steps (0 otherwise)
-	return continue_to_next_steps_and_check_for_valid_itins(curr_step, num_of_end_nodes, seq_info, jd_max_arr, max_total_duration, dv_filter);
+	prune_equivalent_next_steps(curr_step, search_ctx->prune_filter, seq_info->system, arena, stats);
+	int num_of_end_nodes = mark_end_nodes(curr_step, seq_info->arr_body);
+
+	// end nodes that do not satisfy dv requirements are only continued
+	long stage_start = start_itin_stats_stage(stats);
+	int num_all_end_nodes = num_of_end_nodes;
+	num_of_end_nodes = unmark_end_nodes_that_do_not_satisfy_dv_requirements(curr_step, dv_filter);
+	add_itin_stats_count(get_itin_step_stats_record(stats, curr_step, seq_info->arr_body), ITIN_STATS_REJECTED_DV, num_all_end_nodes - num_of_end_nodes);
+	end_itin_stats_stage(stats, ITIN_STATS_STAGE_DV_FILTER, stage_start);
+	add_itin_end_nodes_to_score_bound(curr_step, score_bound, stats);
+	prune_score_bounded_next_steps(curr_step, curr_step->num_next_nodes, score_bound, arena, stats);
+	// no valid next steps (curr_step gets removed by the caller if it is not an end node itself)
+	if(curr_step->num_next_nodes <= 0) return curr_step->is_end_node;
+
+	// returns 1 if has valid steps or is an end node (0 otherwise)
+	return continue_to_next_steps_and_check_for_valid_itins(curr_step, seq_info, jd_max_arr, max_total_duration, dv_filter, search_ctx) || curr_step->is_end_node;
 }
 
-int continue_to_next_steps_and_check_for_valid_itins(struct ItinStep *curr_step, int num_of_end_nodes, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter) {
-	int num_valid = num_of_end_nodes;
-	int init_num_nodes = curr_step->num_next_nodes;
-	int step_del = 0;
-	int has_valid_init;
-
-	for(int i = 0; i < init_num_nodes-num_of_end_nodes; i++) {
-		int idx = i - step_del;
-		has_valid_init = calc_next_itin_to_target_step(curr_step->next[idx], seq_info, jd_max_arr, max_total_duration, dv_filter);
-		num_valid += has_valid_init;
-		if(!has_valid_init) step_del++;
+int continue_to_next_steps_and_check_for_valid_itins(struct ItinStep *curr_step, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter, struct ItinSearchContext *search_ctx) {
+	int num_init_nodes = curr_step->num_next_nodes;
+	// most promising branches first (finds good itineraries early --> more steps are cut by the score bound)
+	sort_next_steps_by_score_bound(curr_step, num_init_nodes, search_ctx->score_bound);
+
+	if(calc_next_steps_as_tasks(search_ctx, get_itin_step_depth(curr_step), num_init_nodes)) {
+		// calculate every next step (and its subtree) as a separate task; next steps only modify their own subtree
+		struct To_Target_Itin_Step_Task_Args *task_args = malloc(num_init_nodes * sizeof(struct To_Target_Itin_Step_Task_Args));
+		struct Thread_Pool_Task **tasks = malloc(num_init_nodes * sizeof(struct Thread_Pool_Task *));
+		for(int i = 0; i < num_init_nodes; i++) {
+			task_args[i] = (struct To_Target_Itin_Step_Task_Args) {curr_step->next[i], seq_info, jd_max_arr, max_total_duration, dv_filter, search_ctx, 0};
+			tasks[i] = submit_thread_pool_task(search_ctx->pool, calc_next_itin_to_target_step_task, &task_args[i]);
+		}
+		for(int i = 0; i < num_init_nodes; i++) join_thread_pool_task(tasks[i]);
+		// remove from the back to keep the indices of the remaining next steps
+		for(int i = num_init_nodes-1; i >= 0; i--) {
+			if(!task_args[i].has_valid_itins) remove_next_step_from_itinerary(curr_step, i, search_ctx->arena);
+		}
+		free(tasks);
+		free(task_args);
+	} else {
+		for(int i = 0; i < num_init_nodes; i++) {
+			if(!calc_next_itin_to_target_step(curr_step->next[i], seq_info, jd_max_arr, max_total_duration, dv_filter, search_ctx)) {
+				remove_next_step_from_itinerary(curr_step, i, search_ctx->arena);
+				num_init_nodes--;
+				i--;
+			}
+		}
 	}
 
-	return num_valid > 0;
+	return curr_step->num_next_nodes > 0;
 }
 
-int find_copy_and_store_end_nodes(struct ItinStep *curr_step, struct Body *arr_body) {
+int mark_end_nodes(struct ItinStep *curr_step, struct Body *arr_body) {
 	int num_of_end_nodes = 0;
 	for(int i = 0; i < curr_step->num_next_nodes; i++) {
-		if(curr_step->next[i]->body == arr_body) num_of_end_nodes++;
-	}
-	// if there were end nodes found, copy them and store them at the end
-	if(num_of_end_nodes > 0) {
-		struct ItinStep ** new_next = realloc(curr_step->next, (num_of_end_nodes+curr_step->num_next_nodes) * sizeof(struct ItinStep *));
-		if(new_next == NULL) {
-			printf("\nERROR WHILE REALLOCATING ITINERARIES DURING END NODE COPYING!!!\n");
-			return 0;
-		}
-		curr_step->next = new_next;
-
-		int end_node_idx = 0;
-
-		for(int i = 0; i < curr_step->num_next_nodes; i++) {
-			if(curr_step->next[i]->body == arr_body) {
-				struct ItinStep *end_node = malloc(num_of_end_nodes * sizeof(struct ItinStep));
-				end_node->body 	= curr_step->next[i]->body;
-				end_node->date 	= curr_step->next[i]->date;
-				end_node->r 	= curr_step->next[i]->r;
-				end_node->v_dep = curr_step->next[i]->v_dep;
-				end_node->v_arr = curr_step->next[i]->v_arr;
-				end_node->v_body= curr_step->next[i]->v_body;
-				end_node->num_next_nodes = 0;
-				end_node->prev 	= curr_step->next[i]->prev;
-				end_node->next 	= NULL;
-
-				curr_step->next[curr_step->num_next_nodes + end_node_idx] = end_node;
-				end_node_idx++;
-			}
-		}
+		curr_step->next[i]->is_end_node = curr_step->next[i]->body == arr_body;
+		if(curr_step->next[i]->is_end_node) num_of_end_nodes++;
 	}
-
-	curr_step->num_next_nodes += num_of_end_nodes;
 	return num_of_end_nodes;
 }
 
-int remove_end_nodes_that_do_not_satisfy_dv_requirements(struct ItinStep *curr_step, int num_of_end_nodes, struct Dv_Filter *dv_filter) {
-	for(int i = curr_step->num_next_nodes-num_of_end_nodes; i < curr_step->num_next_nodes; i++) {
+int unmark_end_nodes_that_do_not_satisfy_dv_requirements(struct ItinStep *curr_step, struct Dv_Filter *dv_filter) {
+	int num_of_end_nodes = 0;
+	for(int i = 0; i < curr_step->num_next_nodes; i++) {
 		struct ItinStep *next = curr_step->next[i];
+		if(!next->is_end_node) continue;
 		struct PorkchopPoint porkchop_point = create_porkchop_point(next, dv_filter->dep_periapsis, dv_filter->arr_periapsis);
 		double dv_sat = porkchop_point.dv_dsm;
 		if(dv_filter->last_transfer_type == 1) dv_sat += porkchop_point.dv_arr_cap;
 		if(dv_filter->last_transfer_type == 2) dv_sat += porkchop_point.dv_arr_circ;
-		if(dv_sat > dv_filter->max_satdv || porkchop_point.dv_dep + dv_sat > dv_filter->max_totdv) {
-			if(curr_step->num_next_nodes <= 1) {
-				remove_step_from_itinerary(next);
-				curr_step->num_next_nodes = 0;
-			} else {
-				remove_step_from_itinerary(next);
-			}
-			i--;
-			num_of_end_nodes--;
-		}
+		if(dv_sat > dv_filter->max_satdv || porkchop_point.dv_dep + dv_sat > dv_filter->max_totdv) next->is_end_node = false;
+		else num_of_end_nodes++;
 	}
 	return num_of_end_nodes;
 }
 
+int get_itin_step_depth(struct ItinStep *step) {
+	int depth = 0;
+	while(step->prev != NULL) {
+		step = step->prev;
+		depth++;
+	}
+	return depth;
+}
+
 int get_num_of_itin_layers(struct ItinStep *step) {
 	int counter = 0;
 	while(step != NULL) {
@@ -496,9 +885,7 @@ void update_itin_body_osvs(struct ItinStep *step, CelestSystem *system) {
 	OSV body_osv;
 	while(step != NULL) {
 		if(step->body != NULL) {
-			body_osv = system->prop_method == ORB_ELEMENTS ?
-					osv_from_elements(step->body->orbit, step->date) :
-					osv_from_ephem(step->body->ephem, step->body->num_ephems, step->date, system->cb);
+			body_osv = body_state_at(system, step->body, step->date);
 			step->r = body_osv.r;
 			step->v_body = body_osv.v;
 		} else step->v_body = vec3(0, 0, 0);	// don't draw the trajectory (except changed in later calc)
@@ -550,8 +937,7 @@ void calc_itin_v_vectors_from_dates_and_r(struct ItinStep *step, CelestSystem *s
 				}
 			}
 		} else {
-			double dt = (next->date - step->date) * 86400;
-			Lambert3 transfer = calc_lambert3(step->r, next->r, dt, system->cb);
+			Lambert3 transfer = calc_cached_lambert3(step->body, step->date, step->r, next->body, next->date, next->r, system->cb);
 			next->v_dep = transfer.v0;
 			next->v_arr = transfer.v1;
 		}
@@ -566,11 +952,13 @@ void copy_step_body_vectors_and_date(struct ItinStep *orig_step, struct ItinStep
 	step_copy->v_arr = orig_step->v_arr;
 	step_copy->v_dep = orig_step->v_dep;
 	step_copy->date = orig_step->date;
+	step_copy->score_state = orig_step->score_state;
 }
 
 struct ItinStep * create_itin_copy(struct ItinStep *step) {
 	struct ItinStep *new_step = (struct ItinStep*) malloc(sizeof(struct ItinStep));
 	copy_step_body_vectors_and_date(step, new_step);
+	new_step->is_end_node = step->is_end_node;
 	new_step->prev = NULL;
 	new_step->num_next_nodes = step->num_next_nodes;
 	if(step->num_next_nodes > 0) {
@@ -586,6 +974,7 @@ struct ItinStep * create_itin_copy(struct ItinStep *step) {
 struct ItinStep * create_itin_copy_from_arrival(struct ItinStep *step) {
 	struct ItinStep *step_copy = (struct ItinStep*) malloc(sizeof(struct ItinStep));
 	copy_step_body_vectors_and_date(step, step_copy);
+	step_copy->is_end_node = false;
 	step_copy->next = NULL;
 	step_copy->num_next_nodes = 0;
 
@@ -594,6 +983,7 @@ struct ItinStep * create_itin_copy_from_arrival(struct ItinStep *step) {
 		step_copy->prev->next = (struct ItinStep**) malloc(sizeof(struct ItinStep*));
 		step_copy->prev->next[0] = step_copy;
 		step_copy->prev->num_next_nodes = 1;
+		step_copy->prev->is_end_node = false;
 
 		step = step->prev;
 		step_copy = step_copy->prev;
@@ -917,6 +1307,15 @@ void remove_step_from_itinerary(struct ItinStep *step) {
 	free_itinerary(step);
 }
 
+void remove_next_step_from_itinerary(struct ItinStep *step, int next_index, struct Itin_Arena *arena) {
+	struct ItinStep *next = step->next[next_index];
+	step->num_next_nodes--;
+	for(int i = next_index; i < step->num_next_nodes; i++) {
+		step->next[i] = step->next[i+1];
+	}
+	free_itin_arena_itinerary(arena, next);
+}
+
 void free_itinerary(struct ItinStep *step) {
 	if(step == NULL) return;
 	if(step->next != NULL) {
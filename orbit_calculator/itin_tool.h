@@ -2,14 +2,29 @@
 #define KSP_ITIN_TOOL_H
 
 #include "tools/celestial_systems.h"
+#include "lambert_batch.h"
 #include <stdio.h>
 
+#define FLYBY_SEARCH_MAX_EVALUATIONS 100	// transfers calculated per synodic window
+#define FLYBY_SEARCH_MAX_NEW_STEPS 100		// flybys found per call of find_viable_flybys
+#define FLYBY_SEARCH_WINDOW_BATCH 32		// synodic windows whose boundaries are solved together
+#define PORKCHOP_BATCH_SIZE 4096			// porkchop points calculated per thread pool task
+
+// competition score of the itinerary up to a step (derived from the state of the previous step, see update_itin_step_score)
+struct Itin_Score_State {
+	double score;					// summed flyby scores (the arrival at the step counts as a flyby)
+	bool had_low_perihelion;		// a transfer passed closer than 0.05 AU to the central body
+	bool is_invalid;				// perihelion or flyby altitude constraint violated (score is 0)
+};
+
 struct ItinStep {
 	Body *body;
 	Vector3 r;
 	Vector3 v_arr, v_body, v_dep;
 	double date;
 	bool had_low_perihelion;
+	bool is_end_node;		// to target: also a complete itinerary (arrival at the target) while its next steps continue it
+	struct Itin_Score_State score_state;
 	int num_next_nodes;
 	struct ItinStep *prev;
 	struct ItinStep **next;
@@ -39,9 +54,18 @@ struct Dv_Filter {
 	int last_transfer_type;
 };
 
+// next steps of a step at the same body are equivalent if their arrival dates and excess velocity vectors are close
+struct Prune_Filter {
+	int is_enabled;									// 0: all next steps are kept
+	double max_date_diff, max_vinf_diff;			// equivalent within these [days, m/s]: next steps dominated on date, |v_inf|, score and low perihelion are removed (<= 0: default)
+	double cluster_date_diff, cluster_vinf_diff;	// near-duplicates within these [days, m/s]: only the best one is kept (<= 0: default)
+	int use_competition_score;						// accumulated competition score is compared as well (0: not compared)
+};
+
 struct PorkchopPoint {
 		struct ItinStep *arrival;
 		double score;
+		bool is_score_valid;	// no invalid flyby or perihelion (score is 0 otherwise)
 		double dep_date, dur;
 		double dv_dep, dv_dsm, dv_arr_cap, dv_arr_circ;
 };
@@ -49,8 +73,59 @@ struct PorkchopPoint {
 
 enum LastTransferType {TF_FLYBY, TF_CAPTURE, TF_CIRC};
 
-// find viable flybys to next body with a given arrival trajectory
-void find_viable_flybys(struct ItinStep *tf, CelestSystem *system, Body *next_body, double min_dt, double max_dt);
+extern const int MIN_TRANSFER_DURATION;	// days
+
+struct Thread_Pool;
+struct Itin_Arena;
+struct Flyby_Search_Scratch;
+struct Itin_Mitm_Index;
+struct Itin_Search_Status;
+struct Itin_Stats;
+struct Itin_Score_Bound;
+
+// shared settings and state of a single itinerary search (handed down the recursive step calculations)
+struct ItinSearchContext {
+	struct Thread_Pool *pool;		// pool the search runs on (NULL: everything is calculated on the calling thread)
+	struct Itin_Arena *arena;		// arena the steps of the search are allocated from (NULL: malloc)
+	int max_task_depth;				// next steps of steps with a lower depth (departure: 0) are calculated as separate tasks
+	int min_task_num_next_nodes;	// minimum number of next steps for calculating them as separate tasks
+	struct Flyby_Search_Scratch *flyby_scratch;	// one per worker of the pool (NULL: find_viable_flybys uses its stack)
+	struct Itin_Mitm_Index *mitm;	// specific sequences: backward partials the forward steps are joined with at the middle body (NULL: forward only)
+	struct Prune_Filter *prune_filter;	// equivalent next steps are pruned after they have been found (NULL: no pruning)
+	struct Itin_Search_Status *status;	// progress and cancellation of the search (NULL: not cancellable)
+	struct Itin_Stats *stats;			// instrumentation of the search (NULL: disabled)
+	struct Itin_Score_Bound *score_bound;	// branch-and-bound on the competition score (NULL: disabled)
+};
+
+// fixed-capacity memory of find_viable_flybys (provided by the caller and reused for every call to keep the search free of allocations)
+struct Flyby_Search_Scratch {
+	double dt[FLYBY_SEARCH_MAX_EVALUATIONS];			// samples of the current window (sorted by dt)
+	double diff_vinf[FLYBY_SEARCH_MAX_EVALUATIONS];
+	int num_samples, num_evaluations;
+	double window_dt[2*FLYBY_SEARCH_WINDOW_BATCH];		// brackets of the current synodic windows (window i: [window_dt[2i], window_dt[2i+1]])
+	double window_diff_vinf[2*FLYBY_SEARCH_WINDOW_BATCH];
+	int batch_window_indices[2*FLYBY_SEARCH_WINDOW_BATCH];
+	double batch_buffer[LAMBERT_BATCH_NUM_ARRAYS*2*FLYBY_SEARCH_WINDOW_BATCH];
+	struct Lambert_Batch batch;
+	double last_dt;										// last calculated transfer
+	Lambert3 last_tf;
+	OSV last_osv;										// state of the other body at the end (backward: start) of last_tf
+	double new_dt[FLYBY_SEARCH_MAX_NEW_STEPS];			// viable transfers found by the last search
+	Lambert3 new_tf[FLYBY_SEARCH_MAX_NEW_STEPS];
+	OSV new_osv[FLYBY_SEARCH_MAX_NEW_STEPS];
+	bool new_low_perihelion[FLYBY_SEARCH_MAX_NEW_STEPS];
+	int num_new;
+};
+
+// scratch of the calling worker (NULL if the search has none or the caller is not a worker of its pool)
+struct Flyby_Search_Scratch * get_flyby_search_scratch(struct ItinSearchContext *search_ctx);
+
+// find viable flybys to next body with a given arrival trajectory (search_ctx and scratch can be NULL)
+void find_viable_flybys(struct ItinStep *tf, CelestSystem *system, Body *next_body, double min_dt, double max_dt, struct ItinSearchContext *search_ctx, struct Flyby_Search_Scratch *scratch);
+
+// find viable transfers from prev_body departing min_dt to max_dt seconds before a flyby at body (date, r, v_body) that departs with v_dep
+// returns the number of transfers found (stored in the new_* arrays of scratch; new_dt is the transfer duration)
+int find_viable_backward_flybys(Body *body, double date, Vector3 r, Vector3 v_body, Vector3 v_dep, int had_low_perihelion, CelestSystem *system, Body *prev_body, double min_dt, double max_dt, struct Flyby_Search_Scratch *scratch);
 
 // find viable flybys to next body with a given arrival trajectory
 void find_viable_dsb_flybys(struct ItinStep *tf, Ephem **ephems, Body *next_body, double min_dt0, double max_dt0, double min_dt1, double max_dt1);
@@ -64,38 +139,52 @@ struct ItinStep * get_last(struct ItinStep *tf);
 // print itinerary dates (arrival first)
 void print_itinerary(struct ItinStep *itin);
 
-// returns the number of itineraries (departure first)
+// returns the number of itineraries (leaves and end nodes; departure first)
 int get_number_of_itineraries(struct ItinStep *itin);
 
-// returns number of total amount of stored ininerary steps (departure first)
+// returns number of total amount of stored ininerary steps as in .itins files (end nodes with next steps count twice; departure first)
 int get_total_number_of_stored_steps(struct ItinStep *itin);
 
-// stores all arrival nodes in array from itin (departure first)
+// stores all arrival nodes (leaves and end nodes, end nodes before their next steps) in array from itin (departure first)
 void store_itineraries_in_array(struct ItinStep *itin, struct ItinStep **array, int *index);
 
 // returns the itinerary duration in days (arrival first)
 double get_itinerary_duration(struct ItinStep *itin);
 
+// returns the competition score of the itinerary up to step from its score state (arrival first)
+double get_itin_step_score(struct ItinStep *step);
+
 // returns an array of porkchop points analyzed from the given departures (allocates porkchop array memory --> needs to be freed)
 struct PorkchopPoint *create_porkchop_array_from_departures(struct ItinStep **departures, int num_deps, double dep_periapsis, double arr_periapsis);
 
-// add itinerary departure date, duration, departure dv, deep-space maneuvre dv and arrival dv in porkchop array
+// add itinerary departure date, duration, competition score, departure dv, deep-space maneuvre dv and arrival dv in porkchop array
 struct PorkchopPoint create_porkchop_point(struct ItinStep *itin, double dep_periapsis, double arr_periapsis);
 
-// from current step and given information, initiate calculation of next steps
-int calc_next_spec_itin_step(struct ItinStep *curr_step, CelestSystem *system, Body **bodies, double jd_max_arr, struct Dv_Filter *dv_filter, int num_steps, int step);
+// fill points with the porkchop points of the num_itins arrivals (in parallel on pool in batches of PORKCHOP_BATCH_SIZE; NULL: global thread pool)
+void create_porkchop_points(struct ItinStep **arrivals, int num_itins, double dep_periapsis, double arr_periapsis, struct PorkchopPoint *points, struct Thread_Pool *pool);
 
-// from current step and given information, initiate calculation of next steps
-int calc_next_itin_to_target_step(struct ItinStep *curr_step, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter);
+// (search_ctx must not be NULL for the following step calculations; its members may be NULL as documented in ItinSearchContext)
+// from current step and given information, initiate calculation of next steps (returns 0 if curr_step has no valid next steps and should be removed by the caller)
+int calc_next_spec_itin_step(struct ItinStep *curr_step, CelestSystem *system, Body **bodies, double jd_max_arr, struct Dv_Filter *dv_filter, int num_steps, int step, struct ItinSearchContext *search_ctx);
 
-// initiate calc of next itinerary steps and return 0 if no steps are remaining in this itinerary (1 otherwise)
-int continue_to_next_steps_and_check_for_valid_itins(struct ItinStep *curr_step, int num_of_end_nodes, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter);
+// initiate calc of next spec itinerary steps (next steps of curr_step search for bodies[step]), remove next steps without valid itineraries and return 0 if no steps are remaining (1 otherwise)
+int continue_to_next_spec_itin_steps(struct ItinStep *curr_step, CelestSystem *system, Body **bodies, double jd_max_arr, struct Dv_Filter *dv_filter, int num_steps, int step, struct ItinSearchContext *search_ctx);
 
-// find end nodes (next step at arrival body) and copy to the end of the next steps array of curr_step
-int find_copy_and_store_end_nodes(struct ItinStep *curr_step, Body *arr_body);
+// from current step and given information, initiate calculation of next steps (returns 0 if curr_step has no valid next steps and should be removed by the caller)
+int calc_next_itin_to_target_step(struct ItinStep *curr_step, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter, struct ItinSearchContext *search_ctx);
 
-// removes end nodes from initerary that do not satisfy dv requirements (returns new number of end nodes)
-int remove_end_nodes_that_do_not_satisfy_dv_requirements(struct ItinStep *curr_step, int num_of_end_nodes, struct Dv_Filter *dv_filter);
+// initiate calc of next itinerary steps, remove next steps without valid itineraries and return 0 if no steps are remaining in this itinerary (1 otherwise)
+int continue_to_next_steps_and_check_for_valid_itins(struct ItinStep *curr_step, struct ItinSequenceInfoToTarget *seq_info, double jd_max_arr, double max_total_duration, struct Dv_Filter *dv_filter, struct ItinSearchContext *search_ctx);
+
+// mark the next steps of curr_step at the arrival body as end nodes (no copies; they are continued like the other next steps)
+// returns the number of end nodes
+int mark_end_nodes(struct ItinStep *curr_step, Body *arr_body);
+
+// unmark end nodes of the next steps of curr_step that do not satisfy dv requirements (they stay as regular next steps; returns new number of end nodes)
+int unmark_end_nodes_that_do_not_satisfy_dv_requirements(struct ItinStep *curr_step, struct Dv_Filter *dv_filter);
+
+// get the depth of the given step inside its itinerary (departure: 0)
+int get_itin_step_depth(struct ItinStep *step);
 
 // get the number of layers/steps in the given itinerary (departure first)
 int get_num_of_itin_layers(struct ItinStep *step);
@@ -106,7 +195,7 @@ void update_itin_body_osvs(struct ItinStep *step, CelestSystem *system);
 // calculate from velocity vectors for itinerary steps from date and r vector (departure first)
 void calc_itin_v_vectors_from_dates_and_r(struct ItinStep *step, CelestSystem *system);
 
-// copy the body reference, r and v vectors and date from orig_step to step_copy
+// copy the body reference, r and v vectors, date and score state from orig_step to step_copy (end node flag is not copied)
 void copy_step_body_vectors_and_date(struct ItinStep *orig_step, struct ItinStep *step_copy);
 
 // create and return copy of itineraries from given step (rising date)
@@ -130,6 +219,9 @@ void itinerary_step_parameters_to_string(char *s_label, char *s_values, enum Dat
 // removes this and all now unneeded steps from itineraries (no next node before arrival)
 void remove_step_from_itinerary(struct ItinStep *step);
 
+// removes the next step at the given index from step and frees it (with all its next steps; arena == NULL: malloc'ed steps)
+void remove_next_step_from_itinerary(struct ItinStep *step, int next_index, struct Itin_Arena *arena);
+
 // free to itinerary allocated memory
 void free_itinerary(struct ItinStep *step);
 
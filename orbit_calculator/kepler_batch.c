@@ -0,0 +1,148 @@
+#include "kepler_batch.h"
+#include <math.h>
+
+#define KEPLER_BATCH_LANES 8				// pairs solved together (2 AVX2 or 1 AVX-512 register per value)
+#define KEPLER_BATCH_NUM_ITERATIONS 6		// Halley iterations from Danby's starter (converged to machine precision for e < 0.99)
+
+// see lambert_batch.c (kernel compiled for AVX-512, AVX2 and the baseline instruction set, lane loops are branch-free)
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__ELF__) && defined(__GNUC__)
+#define KEPLER_BATCH_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define KEPLER_BATCH_TARGET_CLONES
+#endif
+
+struct Kepler_Batch_Block {
+	_Alignas(64) double ma[KEPLER_BATCH_LANES];
+	_Alignas(64) double mean_motion[KEPLER_BATCH_LANES];
+	_Alignas(64) double a[KEPLER_BATCH_LANES];
+	_Alignas(64) double e[KEPLER_BATCH_LANES];
+	_Alignas(64) double b[KEPLER_BATCH_LANES];
+	_Alignas(64) double px[KEPLER_BATCH_LANES];
+	_Alignas(64) double py[KEPLER_BATCH_LANES];
+	_Alignas(64) double pz[KEPLER_BATCH_LANES];
+	_Alignas(64) double qx[KEPLER_BATCH_LANES];
+	_Alignas(64) double qy[KEPLER_BATCH_LANES];
+	_Alignas(64) double qz[KEPLER_BATCH_LANES];
+	_Alignas(64) double rx[KEPLER_BATCH_LANES];
+	_Alignas(64) double ry[KEPLER_BATCH_LANES];
+	_Alignas(64) double rz[KEPLER_BATCH_LANES];
+	_Alignas(64) double vx[KEPLER_BATCH_LANES];
+	_Alignas(64) double vy[KEPLER_BATCH_LANES];
+	_Alignas(64) double vz[KEPLER_BATCH_LANES];
+};
+
+
+struct Kepler_Batch_Orbit prepare_kepler_batch_orbit(Orbit orbit, double jd_ref) {
+	struct Kepler_Batch_Orbit kb_orbit = {.jd_ref = jd_ref, .orbit = orbit};
+	double mu = orbit.cb->mu;
+	OSV osv = osv_from_elements(orbit, jd_ref);
+
+	double r = mag_vec3(osv.r);
+	Vector3 h = cross_vec3(osv.r, osv.v);
+	Vector3 e_vec = subtract_vec3(scale_vec3(cross_vec3(osv.v, h), 1/mu), scale_vec3(osv.r, 1/r));
+	kb_orbit.e = mag_vec3(e_vec);
+	kb_orbit.a = 1 / (2/r - dot_vec3(osv.v, osv.v)/mu);
+	kb_orbit.is_elliptic = kb_orbit.e < 1 && kb_orbit.a > 0;
+	if(!kb_orbit.is_elliptic) return kb_orbit;
+
+	kb_orbit.b = kb_orbit.a * sqrt(1 - kb_orbit.e*kb_orbit.e);
+	kb_orbit.mean_motion = sqrt(mu / (kb_orbit.a*kb_orbit.a*kb_orbit.a));
+	// circular orbit: periapsis at reference position
+	kb_orbit.p = kb_orbit.e > 1e-12 ? scale_vec3(e_vec, 1/kb_orbit.e) : scale_vec3(osv.r, 1/r);
+	kb_orbit.q = cross_vec3(norm_vec3(h), kb_orbit.p);
+
+	double ta = atan2(dot_vec3(osv.r, kb_orbit.q), dot_vec3(osv.r, kb_orbit.p));
+	double ea = atan2(sqrt(1 - kb_orbit.e*kb_orbit.e)*sin(ta), kb_orbit.e + cos(ta));
+	kb_orbit.ma_ref = ea - kb_orbit.e*sin(ea);
+	return kb_orbit;
+}
+
+// sine and cosine (reduced to [-pi/4, pi/4] by multiples of pi/2 and evaluated as series)
+static inline void calc_sincos_of_block(const double *restrict x, double *restrict sin_x, double *restrict cos_x) {
+	for(int l = 0; l < KEPLER_BATCH_LANES; l++) {
+		double k = floor(x[l]*M_2_PI + 0.5);
+		// pi/2 split in two parts (k*pi_2_hi is exact for |k| < 2^20)
+		double y = (x[l] - k*1.57079632673412561417) - k*6.07710050650619224932e-11;
+		double y2 = y*y;
+		double s = y*(1 + y2*(-1.0/6 + y2*(1.0/120 + y2*(-1.0/5040 + y2*(1.0/362880 + y2*(-1.0/39916800 + y2*(1.0/6227020800 + y2*(-1.0/1307674368000))))))));
+		double c = 1 + y2*(-1.0/2 + y2*(1.0/24 + y2*(-1.0/720 + y2*(1.0/40320 + y2*(-1.0/3628800 + y2*(1.0/479001600 + y2*(-1.0/87178291200 + y2*(1.0/20922789888000))))))));
+		int quadrant = ((int) k) & 3;
+		double s_q = quadrant & 1 ? c : s;
+		double c_q = quadrant & 1 ? s : c;
+		sin_x[l] = quadrant & 2 ? -s_q : s_q;
+		cos_x[l] = (quadrant+1) & 2 ? -c_q : c_q;
+	}
+}
+
+KEPLER_BATCH_TARGET_CLONES
+static void solve_kepler_batch_block(struct Kepler_Batch_Block *block) {
+	double ea[KEPLER_BATCH_LANES], sin_ea[KEPLER_BATCH_LANES], cos_ea[KEPLER_BATCH_LANES];
+
+	for(int l = 0; l < KEPLER_BATCH_LANES; l++) {
+		double ma = block->ma[l] - 2*M_PI*floor(block->ma[l]/(2*M_PI) + 0.5);	// [-pi, pi]
+		block->ma[l] = ma;
+		ea[l] = ma + 0.85*block->e[l]*(ma >= 0 ? 1 : -1);
+	}
+
+	for(int it = 0; it < KEPLER_BATCH_NUM_ITERATIONS; it++) {
+		calc_sincos_of_block(ea, sin_ea, cos_ea);
+		for(int l = 0; l < KEPLER_BATCH_LANES; l++) {
+			double e = block->e[l];
+			double f = ea[l] - e*sin_ea[l] - block->ma[l];
+			double df = 1 - e*cos_ea[l];
+			double ddf = e*sin_ea[l];
+			ea[l] -= f / (df - 0.5*f*ddf/df);
+		}
+	}
+	calc_sincos_of_block(ea, sin_ea, cos_ea);
+
+	for(int l = 0; l < KEPLER_BATCH_LANES; l++) {
+		double a = block->a[l], e = block->e[l], b = block->b[l];
+		double x = a*(cos_ea[l] - e);
+		double y = b*sin_ea[l];
+		double r = a*(1 - e*cos_ea[l]);
+		double v_scale = block->mean_motion[l]*a/r;
+		double vx = -a*v_scale*sin_ea[l];
+		double vy = b*v_scale*cos_ea[l];
+		block->rx[l] = x*block->px[l] + y*block->qx[l];
+		block->ry[l] = x*block->py[l] + y*block->qy[l];
+		block->rz[l] = x*block->pz[l] + y*block->qz[l];
+		block->vx[l] = vx*block->px[l] + vy*block->qx[l];
+		block->vy[l] = vx*block->py[l] + vy*block->qy[l];
+		block->vz[l] = vx*block->pz[l] + vy*block->qz[l];
+	}
+}
+
+void osv_from_kepler_batch(const struct Kepler_Batch_Orbit *orbits, const int *orbit_indices, const double *jds, OSV *osvs, int num) {
+	struct Kepler_Batch_Block block;
+
+	for(int i = 0; i < num; i += KEPLER_BATCH_LANES) {
+		int num_lanes = num - i < KEPLER_BATCH_LANES ? num - i : KEPLER_BATCH_LANES;
+		for(int l = 0; l < KEPLER_BATCH_LANES; l++) {
+			// unused lanes repeat the last pair
+			int index = i + (l < num_lanes ? l : num_lanes-1);
+			const struct Kepler_Batch_Orbit *orbit = &orbits[orbit_indices != NULL ? orbit_indices[index] : index];
+			block.ma[l] = orbit->ma_ref + orbit->mean_motion*(jds[index] - orbit->jd_ref)*86400;
+			block.mean_motion[l] = orbit->mean_motion;
+			block.a[l] = orbit->is_elliptic ? orbit->a : 1;
+			block.e[l] = orbit->is_elliptic ? orbit->e : 0;
+			block.b[l] = orbit->b;
+			block.px[l] = orbit->p.x;
+			block.py[l] = orbit->p.y;
+			block.pz[l] = orbit->p.z;
+			block.qx[l] = orbit->q.x;
+			block.qy[l] = orbit->q.y;
+			block.qz[l] = orbit->q.z;
+		}
+
+		solve_kepler_batch_block(&block);
+
+		for(int l = 0; l < num_lanes; l++) {
+			int index = i + l;
+			const struct Kepler_Batch_Orbit *orbit = &orbits[orbit_indices != NULL ? orbit_indices[index] : index];
+			osvs[index] = orbit->is_elliptic ?
+					(OSV) {vec3(block.rx[l], block.ry[l], block.rz[l]), vec3(block.vx[l], block.vy[l], block.vz[l])} :
+					osv_from_elements(orbit->orbit, jds[index]);
+		}
+	}
+}
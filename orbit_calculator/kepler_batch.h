@@ -0,0 +1,26 @@
+#ifndef KMAT_KEPLER_BATCH_H
+#define KMAT_KEPLER_BATCH_H
+
+#include "orbitlib.h"
+
+// Two-body orbit prepared for batch propagation (calibrated with the state of osv_from_elements at a reference date,
+// so batch states use the same epoch and frame as osv_from_elements)
+struct Kepler_Batch_Orbit {
+	double jd_ref;			// reference date
+	double ma_ref;			// mean anomaly at reference date
+	double mean_motion;		// [rad/s]
+	double a, e, b;			// semi-major axis, eccentricity, semi-minor axis
+	Vector3 p, q;			// unit vectors towards periapsis and 90° ahead of it in the orbital plane
+	int is_elliptic;		// non-elliptic orbits are calculated with osv_from_elements
+	Orbit orbit;
+};
+
+
+// prepare orbit for batch propagation (one call of osv_from_elements at jd_ref)
+struct Kepler_Batch_Orbit prepare_kepler_batch_orbit(Orbit orbit, double jd_ref);
+
+// states for num (orbit, date) pairs: pair i uses orbits[orbit_indices[i]] (orbit_indices NULL: orbits[i]) at jds[i]
+// (Kepler's equation is solved for blocks of pairs with a fixed number of Halley iterations; SIMD kernel selected at runtime)
+void osv_from_kepler_batch(const struct Kepler_Batch_Orbit *orbits, const int *orbit_indices, const double *jds, OSV *osvs, int num);
+
+#endif //KMAT_KEPLER_BATCH_H
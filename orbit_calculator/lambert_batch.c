@@ -0,0 +1,243 @@
+#include "lambert_batch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LAMBERT_BATCH_LANES 8					// problems solved together (2 AVX2 or 1 AVX-512 register per value)
+#define LAMBERT_BATCH_MAX_ITERATIONS 100
+#define LAMBERT_BATCH_NUM_STUMPFF_REDUCTIONS 10	// Stumpff functions are evaluated for |z| up to 0.1 * 4^10
+#define LAMBERT_BATCH_MIN_Z (-1e4)				// lower bound for hyperbolic transfers (faster ones are calculated with calc_lambert3)
+#define LAMBERT_BATCH_MAX_Z (4*M_PI*M_PI)		// single revolution
+#define LAMBERT_BATCH_TOLERANCE 1e-12			// relative time of flight error for convergence
+#define LAMBERT_BATCH_ACCEPTED_TOLERANCE 1e-9	// relative time of flight error above which calc_lambert3 is used
+
+// The kernel is compiled for AVX-512, AVX2 and the baseline instruction set and the fitting version is selected
+// when the program is loaded (ifunc, only available for ELF targets). All lane loops are written branch-free so
+// they can be vectorized.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__ELF__) && defined(__GNUC__)
+#define LAMBERT_BATCH_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LAMBERT_BATCH_TARGET_CLONES
+#endif
+
+struct Lambert_Batch_Block {
+	_Alignas(64) double r1x[LAMBERT_BATCH_LANES];
+	_Alignas(64) double r1y[LAMBERT_BATCH_LANES];
+	_Alignas(64) double r1z[LAMBERT_BATCH_LANES];
+	_Alignas(64) double dt[LAMBERT_BATCH_LANES];
+	_Alignas(64) double v0x[LAMBERT_BATCH_LANES];
+	_Alignas(64) double v0y[LAMBERT_BATCH_LANES];
+	_Alignas(64) double v0z[LAMBERT_BATCH_LANES];
+	_Alignas(64) double v1x[LAMBERT_BATCH_LANES];
+	_Alignas(64) double v1y[LAMBERT_BATCH_LANES];
+	_Alignas(64) double v1z[LAMBERT_BATCH_LANES];
+	_Alignas(64) double z[LAMBERT_BATCH_LANES];		// in: initial guess; out: universal variable of solution
+	_Alignas(64) int is_solved[LAMBERT_BATCH_LANES];
+};
+
+
+struct Lambert_Batch * create_lambert_batch(int capacity) {
+	struct Lambert_Batch *batch = (struct Lambert_Batch *) malloc(sizeof(struct Lambert_Batch));
+	batch->num_problems = 0;
+	batch->capacity = capacity;
+	double **arrays[] = {&batch->r1x, &batch->r1y, &batch->r1z, &batch->dt, &batch->v0x, &batch->v0y, &batch->v0z, &batch->v1x, &batch->v1y, &batch->v1z};
+	for(int i = 0; i < (int) (sizeof(arrays)/sizeof(arrays[0])); i++) *arrays[i] = (double *) malloc(capacity * sizeof(double));
+	return batch;
+}
+
+void init_lambert_batch_in_buffer(struct Lambert_Batch *batch, double *buffer, int capacity) {
+	batch->num_problems = 0;
+	batch->capacity = capacity;
+	double **arrays[] = {&batch->r1x, &batch->r1y, &batch->r1z, &batch->dt, &batch->v0x, &batch->v0y, &batch->v0z, &batch->v1x, &batch->v1y, &batch->v1z};
+	for(int i = 0; i < LAMBERT_BATCH_NUM_ARRAYS; i++) *arrays[i] = buffer + i*capacity;
+}
+
+void free_lambert_batch(struct Lambert_Batch *batch) {
+	if(batch == NULL) return;
+	double *arrays[] = {batch->r1x, batch->r1y, batch->r1z, batch->dt, batch->v0x, batch->v0y, batch->v0z, batch->v1x, batch->v1y, batch->v1z};
+	for(int i = 0; i < (int) (sizeof(arrays)/sizeof(arrays[0])); i++) free(arrays[i]);
+	free(batch);
+}
+
+void clear_lambert_batch(struct Lambert_Batch *batch) {
+	batch->num_problems = 0;
+}
+
+int add_lambert_batch_problem(struct Lambert_Batch *batch, Vector3 r1, double dt) {
+	if(batch->num_problems >= batch->capacity) return -1;
+	int index = batch->num_problems++;
+	batch->r1x[index] = r1.x;
+	batch->r1y[index] = r1.y;
+	batch->r1z[index] = r1.z;
+	batch->dt[index] = dt;
+	return index;
+}
+
+// Stumpff functions C(z) and S(z) (z is reduced by quartering until |z| <= 0.1, evaluated as series and scaled back up with the quadrupling formulas)
+static inline void calc_stumpff_functions_of_block(const double *restrict z, double *restrict c2, double *restrict c3) {
+	double x[LAMBERT_BATCH_LANES], c0[LAMBERT_BATCH_LANES], c1[LAMBERT_BATCH_LANES];
+	int num_reductions[LAMBERT_BATCH_LANES];
+
+	for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+		x[l] = z[l];
+		num_reductions[l] = 0;
+	}
+	for(int i = 0; i < LAMBERT_BATCH_NUM_STUMPFF_REDUCTIONS; i++) {
+		for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+			int reduce = fabs(x[l]) > 0.1;
+			x[l] = reduce ? x[l]*0.25 : x[l];
+			num_reductions[l] += reduce;
+		}
+	}
+	for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+		double xl = x[l];
+		c2[l] = 1.0/2 + xl*(-1.0/24 + xl*(1.0/720 + xl*(-1.0/40320 + xl*(1.0/3628800 + xl*(-1.0/479001600 + xl*(1.0/87178291200))))));
+		c3[l] = 1.0/6 + xl*(-1.0/120 + xl*(1.0/5040 + xl*(-1.0/362880 + xl*(1.0/39916800 + xl*(-1.0/6227020800 + xl*(1.0/1307674368000))))));
+		c0[l] = 1 - xl*c2[l];
+		c1[l] = 1 - xl*c3[l];
+	}
+	for(int i = 0; i < LAMBERT_BATCH_NUM_STUMPFF_REDUCTIONS; i++) {
+		for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+			int scale = i < num_reductions[l];
+			double c0_4 = 2*c0[l]*c0[l] - 1;
+			double c1_4 = c0[l]*c1[l];
+			double c2_4 = 0.5*c1[l]*c1[l];
+			double c3_4 = 0.25*(c2[l] + c0[l]*c3[l]);
+			c0[l] = scale ? c0_4 : c0[l];
+			c1[l] = scale ? c1_4 : c1[l];
+			c2[l] = scale ? c2_4 : c2[l];
+			c3[l] = scale ? c3_4 : c3[l];
+		}
+	}
+}
+
+// universal variable Lambert solver (Curtis, Algorithm 5.2) with a safeguarded Newton iteration on z for LAMBERT_BATCH_LANES problems
+LAMBERT_BATCH_TARGET_CLONES
+static void solve_lambert_batch_block(struct Lambert_Batch_Block *block, Vector3 r0, double mu) {
+	double r0_mag = sqrt(r0.x*r0.x + r0.y*r0.y + r0.z*r0.z);
+	double sqrt_mu = sqrt(mu);
+
+	double r1_mag[LAMBERT_BATCH_LANES], A[LAMBERT_BATCH_LANES], sqrt_mu_dt[LAMBERT_BATCH_LANES];
+	double z_low[LAMBERT_BATCH_LANES], z_high[LAMBERT_BATCH_LANES], F[LAMBERT_BATCH_LANES], y[LAMBERT_BATCH_LANES];
+	double c2[LAMBERT_BATCH_LANES], c3[LAMBERT_BATCH_LANES];
+	int is_valid[LAMBERT_BATCH_LANES], is_done[LAMBERT_BATCH_LANES];
+
+	for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+		r1_mag[l] = sqrt(block->r1x[l]*block->r1x[l] + block->r1y[l]*block->r1y[l] + block->r1z[l]*block->r1z[l]);
+		double cos_dtheta = (r0.x*block->r1x[l] + r0.y*block->r1y[l] + r0.z*block->r1z[l]) / (r0_mag*r1_mag[l]);
+		cos_dtheta = cos_dtheta > 1 ? 1 : cos_dtheta < -1 ? -1 : cos_dtheta;
+		// prograde transfer: transfer angle > 180° if the angular momentum would point south
+		double cross_z = r0.x*block->r1y[l] - r0.y*block->r1x[l];
+		double sin_dtheta = sqrt(1 - cos_dtheta*cos_dtheta) * (cross_z >= 0 ? 1 : -1);
+		A[l] = sin_dtheta * sqrt(r0_mag*r1_mag[l] / (1 - cos_dtheta));
+		sqrt_mu_dt[l] = sqrt_mu*block->dt[l];
+		// transfer angle of 0° or 180° (no defined transfer plane)
+		is_valid[l] = 1 - cos_dtheta > 1e-12 && fabs(sin_dtheta) > 1e-12 && block->dt[l] > 0;
+		is_done[l] = !is_valid[l];
+
+		z_low[l] = LAMBERT_BATCH_MIN_Z;
+		z_high[l] = LAMBERT_BATCH_MAX_Z;
+		double z = block->z[l];
+		block->z[l] = z > LAMBERT_BATCH_MIN_Z && z < LAMBERT_BATCH_MAX_Z && z == z ? z : 0;
+	}
+
+	for(int it = 0; it < LAMBERT_BATCH_MAX_ITERATIONS; it++) {
+		calc_stumpff_functions_of_block(block->z, c2, c3);
+
+		int num_done = 0;
+		for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+			double z = block->z[l], C = c2[l], S = c3[l];
+			double yl = r0_mag + r1_mag[l] + A[l]*(z*S - 1)/sqrt(C);
+			int is_y_valid = yl > 0;
+			double y_C = yl/C;
+			double sqrt_y = sqrt(yl);
+			double Fl = y_C*sqrt(y_C)*S + A[l]*sqrt_y - sqrt_mu_dt[l];
+			double dF = fabs(z) > 1e-4 ?
+						y_C*sqrt(y_C) * ((C - 3*S/(2*C))/(2*z) + 3*S*S/(4*C)) + A[l]/8 * (3*S/C*sqrt_y + A[l]*sqrt(C/yl)) :
+						sqrt(2)/40*yl*sqrt_y + A[l]/8 * (sqrt_y + A[l]*sqrt(1/(2*yl)));
+
+			// F increases with z (y <= 0: z too low)
+			int is_too_low = !is_y_valid || Fl < 0;
+			z_low[l] = is_too_low && z > z_low[l] ? z : z_low[l];
+			z_high[l] = !is_too_low && z < z_high[l] ? z : z_high[l];
+
+			int is_converged = is_y_valid && fabs(Fl) <= LAMBERT_BATCH_TOLERANCE*sqrt_mu_dt[l];
+			int is_bracket_closed = z_high[l] - z_low[l] <= 1e-15*(1 + fabs(z));
+			double z_newton = z - Fl/dF;
+			int use_newton = is_y_valid && dF > 0 && z_newton > z_low[l] && z_newton < z_high[l];
+			double z_next = use_newton ? z_newton : 0.5*(z_low[l] + z_high[l]);
+
+			int was_done = is_done[l];
+			is_done[l] = was_done || is_converged || is_bracket_closed;
+			block->z[l] = is_done[l] ? z : z_next;
+			F[l] = was_done ? F[l] : Fl;
+			y[l] = was_done ? y[l] : yl;
+			num_done += is_done[l];
+		}
+		if(num_done == LAMBERT_BATCH_LANES) break;
+	}
+
+	for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+		double f = 1 - y[l]/r0_mag;
+		double g = A[l]*sqrt(y[l]/mu);
+		double g_dot = 1 - y[l]/r1_mag[l];
+		block->v0x[l] = (block->r1x[l] - f*r0.x)/g;
+		block->v0y[l] = (block->r1y[l] - f*r0.y)/g;
+		block->v0z[l] = (block->r1z[l] - f*r0.z)/g;
+		block->v1x[l] = (g_dot*block->r1x[l] - r0.x)/g;
+		block->v1y[l] = (g_dot*block->r1y[l] - r0.y)/g;
+		block->v1z[l] = (g_dot*block->r1z[l] - r0.z)/g;
+		block->is_solved[l] = is_valid[l] && y[l] > 0 && fabs(F[l]) <= LAMBERT_BATCH_ACCEPTED_TOLERANCE*sqrt_mu_dt[l];
+	}
+}
+
+void solve_lambert_batch(struct Lambert_Batch *batch, Vector3 r0, Body *cb) {
+	struct Lambert_Batch_Block block;
+	double z_start = 0;
+
+	for(int i = 0; i < batch->num_problems; i += LAMBERT_BATCH_LANES) {
+		int num_lanes = batch->num_problems - i < LAMBERT_BATCH_LANES ? batch->num_problems - i : LAMBERT_BATCH_LANES;
+		for(int l = 0; l < LAMBERT_BATCH_LANES; l++) {
+			// unused lanes repeat the last problem
+			int index = i + (l < num_lanes ? l : num_lanes-1);
+			block.r1x[l] = batch->r1x[index];
+			block.r1y[l] = batch->r1y[index];
+			block.r1z[l] = batch->r1z[index];
+			block.dt[l] = batch->dt[index];
+			// neighbouring problems of a sweep have similar solutions
+			block.z[l] = z_start;
+		}
+
+		solve_lambert_batch_block(&block, r0, cb->mu);
+
+		for(int l = 0; l < num_lanes; l++) {
+			int index = i + l;
+			if(block.is_solved[l]) {
+				batch->v0x[index] = block.v0x[l];
+				batch->v0y[index] = block.v0y[l];
+				batch->v0z[index] = block.v0z[l];
+				batch->v1x[index] = block.v1x[l];
+				batch->v1y[index] = block.v1y[l];
+				batch->v1z[index] = block.v1z[l];
+			} else {
+				Lambert3 tf = calc_lambert3(r0, vec3(batch->r1x[index], batch->r1y[index], batch->r1z[index]), batch->dt[index], cb);
+				batch->v0x[index] = tf.v0.x;
+				batch->v0y[index] = tf.v0.y;
+				batch->v0z[index] = tf.v0.z;
+				batch->v1x[index] = tf.v1.x;
+				batch->v1y[index] = tf.v1.y;
+				batch->v1z[index] = tf.v1.z;
+			}
+		}
+		if(block.is_solved[num_lanes-1]) z_start = block.z[num_lanes-1];
+	}
+}
+
+Lambert3 get_lambert_batch_solution(struct Lambert_Batch *batch, Vector3 r0, int index) {
+	return (Lambert3) {
+		.r0 = r0,
+		.v0 = vec3(batch->v0x[index], batch->v0y[index], batch->v0z[index]),
+		.r1 = vec3(batch->r1x[index], batch->r1y[index], batch->r1z[index]),
+		.v1 = vec3(batch->v1x[index], batch->v1y[index], batch->v1z[index])
+	};
+}
@@ -0,0 +1,40 @@
+#ifndef KMAT_LAMBERT_BATCH_H
+#define KMAT_LAMBERT_BATCH_H
+
+#include "orbitlib.h"
+
+#define LAMBERT_BATCH_NUM_ARRAYS 10		// doubles per problem
+
+// Batch of single-revolution, prograde Lambert problems that share the same start position.
+// Inputs and solutions are stored as structure of arrays (problem i at index i).
+struct Lambert_Batch {
+	int num_problems, capacity;
+	double *r1x, *r1y, *r1z;	// target positions
+	double *dt;					// transfer durations [s]
+	double *v0x, *v0y, *v0z;	// departure velocities (solution)
+	double *v1x, *v1y, *v1z;	// arrival velocities (solution)
+};
+
+
+// create batch with space for capacity problems
+struct Lambert_Batch * create_lambert_batch(int capacity);
+
+// set up batch on caller-provided memory (LAMBERT_BATCH_NUM_ARRAYS*capacity doubles; no allocation, must not be freed with free_lambert_batch)
+void init_lambert_batch_in_buffer(struct Lambert_Batch *batch, double *buffer, int capacity);
+
+// free batch and its arrays
+void free_lambert_batch(struct Lambert_Batch *batch);
+
+// remove all problems from batch
+void clear_lambert_batch(struct Lambert_Batch *batch);
+
+// add problem (target position r1 after dt seconds) to batch and return its index (-1 if batch is full)
+int add_lambert_batch_problem(struct Lambert_Batch *batch, Vector3 r1, double dt);
+
+// solve all problems of the batch from r0 around cb (SIMD kernel selected at runtime; problems the kernel can't solve are calculated with calc_lambert3)
+void solve_lambert_batch(struct Lambert_Batch *batch, Vector3 r0, Body *cb);
+
+// return solution of problem with given index in the same form as calc_lambert3
+Lambert3 get_lambert_batch_solution(struct Lambert_Batch *batch, Vector3 r0, int index);
+
+#endif //KMAT_LAMBERT_BATCH_H
@@ -0,0 +1,238 @@
+#include "lambert_cache.h"
+#include "tools/thread_pool.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#define LAMBERT_CACHE_NUM_SHARDS 64				// power of 2 (threads hitting different shards don't wait for each other)
+#define LAMBERT_CACHE_EPOCH_QUANTUM 1e-8		// days (~1 ms)
+#define LAMBERT_CACHE_MIN_SHARD_CAPACITY 64
+
+
+struct Lambert_Cache_Entry {
+	Body *body0, *body1, *cb;
+	double jd0, jd1;
+	Lambert3 tf;
+	uint64_t hash;
+	int next;				// next entry of the same bucket (-1: last)
+	char referenced;		// CLOCK bit (set on hit, cleared when the hand passes)
+};
+
+// own cache line per shard (locks and counters of neighbouring shards are written by different threads)
+struct Lambert_Cache_Shard {
+	_Alignas(64) thread_mutex_t lock;
+	int num_entries, capacity, max_entries;
+	int clock_hand;
+	int num_buckets;		// power of 2
+	int *buckets;			// first entry of each bucket (-1: empty)
+	struct Lambert_Cache_Entry *entries;	// grows up to max_entries (indices stay valid)
+	long num_hits, num_misses, num_insertions, num_evictions;
+};
+
+struct Lambert_Cache {
+	int max_entries;		// 0: disabled
+	struct Lambert_Cache_Shard shards[LAMBERT_CACHE_NUM_SHARDS];
+};
+
+static _Atomic(struct Lambert_Cache *) lambert_cache;
+static thread_mutex_t lambert_cache_init_lock = THREAD_MUTEX_INITIALIZER;
+
+
+static struct Lambert_Cache * create_lambert_cache(int max_entries) {
+	struct Lambert_Cache *cache = (struct Lambert_Cache *) alloc_cache_aligned(sizeof(struct Lambert_Cache));
+	if(cache == NULL) return NULL;
+	cache->max_entries = max_entries > 0 ? max_entries : 0;
+	int max_shard_entries = (cache->max_entries + LAMBERT_CACHE_NUM_SHARDS-1) / LAMBERT_CACHE_NUM_SHARDS;
+	int num_buckets = 1;
+	while(num_buckets < max_shard_entries) num_buckets *= 2;
+
+	for(int i = 0; i < LAMBERT_CACHE_NUM_SHARDS; i++) {
+		struct Lambert_Cache_Shard *shard = &cache->shards[i];
+		init_thread_mutex(&shard->lock);
+		shard->num_entries = 0;
+		shard->capacity = 0;
+		shard->max_entries = max_shard_entries;
+		shard->clock_hand = 0;
+		shard->num_buckets = num_buckets;
+		shard->buckets = NULL;
+		shard->entries = NULL;
+		shard->num_hits = shard->num_misses = shard->num_insertions = shard->num_evictions = 0;
+	}
+	return cache;
+}
+
+static void free_lambert_cache_shards(struct Lambert_Cache *cache) {
+	for(int i = 0; i < LAMBERT_CACHE_NUM_SHARDS; i++) {
+		free(cache->shards[i].buckets);
+		free(cache->shards[i].entries);
+		destroy_thread_mutex(&cache->shards[i].lock);
+	}
+	free_cache_aligned(cache);
+}
+
+void init_lambert_cache(int max_entries) {
+	lock_thread_mutex(&lambert_cache_init_lock);
+	struct Lambert_Cache *old_cache = atomic_load(&lambert_cache);
+	atomic_store(&lambert_cache, create_lambert_cache(max_entries < 0 ? LAMBERT_CACHE_DEFAULT_MAX_ENTRIES : max_entries));
+	unlock_thread_mutex(&lambert_cache_init_lock);
+	if(old_cache != NULL) free_lambert_cache_shards(old_cache);
+}
+
+void free_lambert_cache() {
+	lock_thread_mutex(&lambert_cache_init_lock);
+	struct Lambert_Cache *old_cache = atomic_exchange(&lambert_cache, NULL);
+	unlock_thread_mutex(&lambert_cache_init_lock);
+	if(old_cache != NULL) free_lambert_cache_shards(old_cache);
+}
+
+static struct Lambert_Cache * get_lambert_cache() {
+	struct Lambert_Cache *cache = atomic_load_explicit(&lambert_cache, memory_order_acquire);
+	if(cache != NULL) return cache;
+
+	lock_thread_mutex(&lambert_cache_init_lock);
+	cache = atomic_load(&lambert_cache);
+	if(cache == NULL) {
+		cache = create_lambert_cache(LAMBERT_CACHE_DEFAULT_MAX_ENTRIES);
+		atomic_store_explicit(&lambert_cache, cache, memory_order_release);
+	}
+	unlock_thread_mutex(&lambert_cache_init_lock);
+	return cache;
+}
+
+static uint64_t get_lambert_cache_hash(Body *body0, double jd0, Body *body1, double jd1) {
+	uint64_t h = (uint64_t) (uintptr_t) body0 * 0x9E3779B97F4A7C15ull;
+	h = (h ^ (uint64_t) llround(jd0 / LAMBERT_CACHE_EPOCH_QUANTUM)) * 0xBF58476D1CE4E5B9ull;
+	h = (h ^ (uint64_t) (uintptr_t) body1) * 0x94D049BB133111EBull;
+	h = (h ^ (uint64_t) llround(jd1 / LAMBERT_CACHE_EPOCH_QUANTUM)) * 0x9E3779B97F4A7C15ull;
+	return h ^ (h >> 31);
+}
+
+static int is_same_vec3(Vector3 a, Vector3 b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// index of the entry with the given key (-1 if not in shard; shard needs to be locked)
+static int find_lambert_cache_entry(struct Lambert_Cache_Shard *shard, uint64_t hash, Body *body0, double jd0, Vector3 r0, Body *body1, double jd1, Vector3 r1, Body *cb) {
+	if(shard->buckets == NULL) return -1;
+	int i = shard->buckets[hash & (shard->num_buckets-1)];
+	while(i >= 0) {
+		struct Lambert_Cache_Entry *entry = &shard->entries[i];
+		if(entry->hash == hash && entry->body0 == body0 && entry->body1 == body1 && entry->cb == cb &&
+		   entry->jd0 == jd0 && entry->jd1 == jd1 && is_same_vec3(entry->tf.r0, r0) && is_same_vec3(entry->tf.r1, r1))
+			return i;
+		i = entry->next;
+	}
+	return -1;
+}
+
+static void unlink_lambert_cache_entry(struct Lambert_Cache_Shard *shard, int index) {
+	int *link = &shard->buckets[shard->entries[index].hash & (shard->num_buckets-1)];
+	while(*link != index) link = &shard->entries[*link].next;
+	*link = shard->entries[index].next;
+}
+
+// index of a free entry (grows the shard up to max_entries, evicts the first unreferenced entry after the clock hand afterwards; -1 if out of memory)
+static int get_free_lambert_cache_entry(struct Lambert_Cache_Shard *shard) {
+	if(shard->buckets == NULL) {
+		shard->buckets = (int *) malloc(shard->num_buckets * sizeof(int));
+		if(shard->buckets == NULL) return -1;
+		for(int i = 0; i < shard->num_buckets; i++) shard->buckets[i] = -1;
+	}
+	if(shard->num_entries < shard->max_entries) {
+		if(shard->num_entries == shard->capacity) {
+			int new_capacity = shard->capacity > 0 ? shard->capacity*2 : LAMBERT_CACHE_MIN_SHARD_CAPACITY;
+			if(new_capacity > shard->max_entries) new_capacity = shard->max_entries;
+			struct Lambert_Cache_Entry *new_entries = (struct Lambert_Cache_Entry *) realloc(shard->entries, new_capacity * sizeof(struct Lambert_Cache_Entry));
+			if(new_entries == NULL) return -1;
+			shard->entries = new_entries;
+			shard->capacity = new_capacity;
+		}
+		return shard->num_entries++;
+	}
+
+	while(shard->entries[shard->clock_hand].referenced) {
+		shard->entries[shard->clock_hand].referenced = 0;
+		shard->clock_hand = (shard->clock_hand+1) % shard->num_entries;
+	}
+	int index = shard->clock_hand;
+	shard->clock_hand = (shard->clock_hand+1) % shard->num_entries;
+	unlink_lambert_cache_entry(shard, index);
+	shard->num_evictions++;
+	return index;
+}
+
+int get_cached_lambert3(Body *body0, double jd0, Vector3 r0, Body *body1, double jd1, Vector3 r1, Body *cb, Lambert3 *tf) {
+	struct Lambert_Cache *cache = get_lambert_cache();
+	if(cache == NULL || cache->max_entries == 0) return 0;
+
+	uint64_t hash = get_lambert_cache_hash(body0, jd0, body1, jd1);
+	struct Lambert_Cache_Shard *shard = &cache->shards[hash >> (64-6) & (LAMBERT_CACHE_NUM_SHARDS-1)];
+	lock_thread_mutex(&shard->lock);
+	int index = find_lambert_cache_entry(shard, hash, body0, jd0, r0, body1, jd1, r1, cb);
+	if(index >= 0) {
+		shard->entries[index].referenced = 1;
+		*tf = shard->entries[index].tf;
+		shard->num_hits++;
+	} else shard->num_misses++;
+	unlock_thread_mutex(&shard->lock);
+	return index >= 0;
+}
+
+void store_lambert3_in_cache(Body *body0, double jd0, Body *body1, double jd1, Body *cb, Lambert3 tf) {
+	struct Lambert_Cache *cache = get_lambert_cache();
+	if(cache == NULL || cache->max_entries == 0) return;
+
+	uint64_t hash = get_lambert_cache_hash(body0, jd0, body1, jd1);
+	struct Lambert_Cache_Shard *shard = &cache->shards[hash >> (64-6) & (LAMBERT_CACHE_NUM_SHARDS-1)];
+	lock_thread_mutex(&shard->lock);
+	// already stored by another thread that missed at the same time
+	if(find_lambert_cache_entry(shard, hash, body0, jd0, tf.r0, body1, jd1, tf.r1, cb) < 0) {
+		int index = get_free_lambert_cache_entry(shard);
+		if(index >= 0) {
+			shard->entries[index] = (struct Lambert_Cache_Entry) {
+					.body0 = body0, .body1 = body1, .cb = cb,
+					.jd0 = jd0, .jd1 = jd1,
+					.tf = tf,
+					.hash = hash,
+					.next = shard->buckets[hash & (shard->num_buckets-1)],
+					.referenced = 0
+			};
+			shard->buckets[hash & (shard->num_buckets-1)] = index;
+			shard->num_insertions++;
+		}
+	}
+	unlock_thread_mutex(&shard->lock);
+}
+
+Lambert3 calc_cached_lambert3(Body *body0, double jd0, Vector3 r0, Body *body1, double jd1, Vector3 r1, Body *cb) {
+	Lambert3 tf;
+	if(get_cached_lambert3(body0, jd0, r0, body1, jd1, r1, cb, &tf)) return tf;
+	tf = calc_lambert3(r0, r1, (jd1 - jd0) * 86400, cb);
+	// stored with the requested positions (looked up with them)
+	tf.r0 = r0;
+	tf.r1 = r1;
+	store_lambert3_in_cache(body0, jd0, body1, jd1, cb, tf);
+	return tf;
+}
+
+struct Lambert_Cache_Stats get_lambert_cache_stats() {
+	struct Lambert_Cache_Stats stats = {0};
+	lock_thread_mutex(&lambert_cache_init_lock);
+	struct Lambert_Cache *cache = atomic_load(&lambert_cache);
+	if(cache != NULL) {
+		stats.max_entries = cache->max_entries;
+		for(int i = 0; i < LAMBERT_CACHE_NUM_SHARDS; i++) {
+			struct Lambert_Cache_Shard *shard = &cache->shards[i];
+			lock_thread_mutex(&shard->lock);
+			stats.num_hits += shard->num_hits;
+			stats.num_misses += shard->num_misses;
+			stats.num_insertions += shard->num_insertions;
+			stats.num_evictions += shard->num_evictions;
+			stats.num_entries += shard->num_entries;
+			unlock_thread_mutex(&shard->lock);
+		}
+	}
+	unlock_thread_mutex(&lambert_cache_init_lock);
+	return stats;
+}
@@ -0,0 +1,37 @@
+#ifndef KMAT_LAMBERT_CACHE_H
+#define KMAT_LAMBERT_CACHE_H
+
+#include "orbitlib.h"
+
+#define LAMBERT_CACHE_DEFAULT_MAX_ENTRIES (1<<18)	// ~40 MB
+
+// Process-wide cache of Lambert solutions between body states (shared by all threads, sharded by key hash, CLOCK eviction).
+// Keys are the body pair and the departure and arrival dates (hashed quantised to ~1 ms), hits are verified against the
+// exact dates, positions and central body --> a hit is always the solution calc_lambert3 returned for the same problem.
+struct Lambert_Cache_Stats {
+	long num_hits, num_misses;
+	long num_insertions, num_evictions;
+	int num_entries, max_entries;
+};
+
+
+// (re)create cache with space for max_entries solutions (0: caching disabled, < 0: LAMBERT_CACHE_DEFAULT_MAX_ENTRIES)
+// (no other thread may use the cache meanwhile; the cache is created with the default size on first use otherwise)
+void init_lambert_cache(int max_entries);
+
+// free cache and its entries (no other thread may use the cache meanwhile)
+void free_lambert_cache();
+
+// copy cached solution of the transfer from body0 (at r0, jd0) to body1 (at r1, jd1) around cb to tf and return 1 (0 if not cached)
+int get_cached_lambert3(Body *body0, double jd0, Vector3 r0, Body *body1, double jd1, Vector3 r1, Body *cb, Lambert3 *tf);
+
+// store solution of the transfer from body0 at jd0 to body1 at jd1 (positions taken from tf)
+void store_lambert3_in_cache(Body *body0, double jd0, Body *body1, double jd1, Body *cb, Lambert3 tf);
+
+// cached solution of the transfer from body0 (at r0, jd0) to body1 (at r1, jd1) around cb (calculated with calc_lambert3 and stored if not cached)
+Lambert3 calc_cached_lambert3(Body *body0, double jd0, Vector3 r0, Body *body1, double jd1, Vector3 r1, Body *cb);
+
+// hits, misses, insertions and evictions since the cache has been created
+struct Lambert_Cache_Stats get_lambert_cache_stats();
+
+#endif //KMAT_LAMBERT_CACHE_H
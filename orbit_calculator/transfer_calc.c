@@ -1,32 +1,371 @@
 #include "transfer_calc.h"
+#include "itin_arena.h"
+#include "lambert_batch.h"
+#include "lambert_cache.h"
+#include "itin_mitm.h"
+#include "itin_prune.h"
+#include "itin_score_bound.h"
+#include "itin_search_status.h"
+#include "itin_stats.h"
 #include "tools/tool_funcs.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <math.h>
+#include <stdatomic.h>
 #include "tools/thread_pool.h"
 #include "tools/competition_tools.h"
+#include "tools/ephem_cache.h"
 #include "tools/file_io.h"
 
 
 
+// queue of finished departure indices that are handed to the result sink and freed by the writer task
+typedef struct Itin_Result_Writer {
+	struct ItinStep **departures;
+	Itin_Result_Sink *sink;
+	struct Itin_Arena *arena;
+	int *finished_indices;
+	int num_finished, num_written;
+	int is_closed;
+	char *completed_deps;				// departure dates that have been handed to the sink (for checkpoints)
+	int num_all_deps;
+	struct timeval last_checkpoint;
+	int num_deps, num_nodes, num_itins;	// written to sink
+	thread_mutex_t lock;
+	thread_cond_t cond;
+} Itin_Result_Writer;
+
+#define NUM_INITIAL_TRANSFER_MARGINS 6
+
+// outcome of an initial transfer (screened: rejected before solving Lambert's problem)
+enum Initial_Transfer_Stage {
+	INITIAL_TF_ACCEPTED,
+	INITIAL_TF_SCREENED_DEP_DV,
+	INITIAL_TF_SCREENED_ARR_DV,
+	INITIAL_TF_REJECTED_DEP_DV,
+	INITIAL_TF_REJECTED_ARR_DV,
+	INITIAL_TF_REJECTED_APPROACH_GEOMETRY,
+	INITIAL_TF_REJECTED_PERIHELION,
+	INITIAL_TF_REJECTED_FLYBY_PERIAPSIS,
+	INITIAL_TF_REJECTED_APPROACH_TIME,
+	NUM_INITIAL_TF_STAGES
+};
+
+// counts of the initial transfer sweeps of a search
+typedef struct Initial_Transfer_Stats {
+	long num_samples, num_skipped, num_lambert;
+	long num_per_stage[NUM_INITIAL_TF_STAGES];
+	thread_mutex_t lock;
+} Initial_Transfer_Stats;
+
+// inputs of the initial transfer sweep of one departure
+typedef struct Initial_Transfer_Sweep {
+	OSV osv_dep;
+	double jd_dep;
+	Body *dep_body, *arr_body;
+	enum Transfer_Type tt;
+	struct Dv_Filter *dv_filter;
+	int check_arr_dv;		// dv of arrival at target is checked (sequence ends after this transfer)
+	CelestSystem *system;
+} Initial_Transfer_Sweep;
+
+// arrival date of the initial transfer sweep
+typedef struct Initial_Transfer_Sample {
+	double jd_arr;
+	OSV osv_arr;
+	Lambert3 tf;
+	Vector3 rp_heliocentric;
+	int is_evaluated, is_feasible;
+	double margins[NUM_INITIAL_TRANSFER_MARGINS];	// normalized margins of the constraints (>= 0: satisfied; used to decide where the sweep is refined)
+} Initial_Transfer_Sample;
+
+// memory budget of a search (departure dates started after the arena has grown beyond max_bytes are skipped)
+typedef struct Itin_Memory_Budget {
+	size_t max_bytes;		// 0: no limit
+	atomic_int num_skipped_deps;
+	char *is_skipped;		// per departure date (written only by the thread of that date)
+} Itin_Memory_Budget;
+
+// departure date with the key it is ordered by (lowest first)
+typedef struct Itin_Departure_Order {
+	double key;
+	int index;
+} Itin_Departure_Order;
+
 typedef struct Itin_Calc_Thread_Args {
 	struct ItinStep **departures;
 	Itin_Calc_Data *calc_data;
+	struct ItinSearchContext *search_ctx;
+	Itin_Result_Writer *result_writer;	// NULL: departures stay in memory
+	Initial_Transfer_Stats *initial_transfer_stats;
+	Itin_Memory_Budget *memory_budget;
+	int index;
 } Itin_Calc_Thread_Args;
 
-struct Thread_Progress_and_Prop_Info {
-	double jd_min_dep;
-	double jd_max_dep;
-} thread_progress_and_prop_info;
-
 const int NUM_INITIAL_TRANSFERS_PER_BODY = 500;
+const double ARR_DATE_REFINE_MARGIN = 0.5;			// intervals next to samples with a larger (negative) margin are refined
+const double INITIAL_TRANSFER_SCREEN_TOLERANCE = 1e-6;	// relative reduction of the screening bounds (rounding errors)
+const int DEFAULT_MAX_TASK_DEPTH = 3;
+const int DEFAULT_MIN_TASK_NUM_NEXT_NODES = 2;
+const double CHECKPOINT_INTERVAL = 60;	// seconds
+
+
+void push_finished_departure_to_result_writer(Itin_Result_Writer *writer, int index) {
+	lock_thread_mutex(&writer->lock);
+	writer->finished_indices[writer->num_finished++] = index;
+	broadcast_thread_cond(&writer->cond);
+	unlock_thread_mutex(&writer->lock);
+}
+
+void close_result_writer(Itin_Result_Writer *writer) {
+	lock_thread_mutex(&writer->lock);
+	writer->is_closed = 1;
+	broadcast_thread_cond(&writer->cond);
+	unlock_thread_mutex(&writer->lock);
+}
 
+void *write_finished_departures(void *args) {
+	Itin_Result_Writer *writer = (Itin_Result_Writer *) args;
+	lock_thread_mutex(&writer->lock);
+	while(1) {
+		while(writer->num_written == writer->num_finished && !writer->is_closed) wait_thread_cond(&writer->cond, &writer->lock);
+		if(writer->num_written == writer->num_finished) break;
+		int index = writer->finished_indices[writer->num_written++];
+		unlock_thread_mutex(&writer->lock);
+
+		struct ItinStep *departure = writer->departures[index];
+		if(departure->num_next_nodes > 0) {
+			writer->sink->store_departure(departure, writer->sink->sink_data);
+			writer->num_deps++;
+			writer->num_nodes += get_total_number_of_stored_steps(departure);
+			writer->num_itins += get_number_of_itineraries(departure);
+		}
+		// steps go back to the arena and get reused by the remaining departures
+		free_itin_arena_itinerary(writer->arena, departure);
+		writer->departures[index] = NULL;
+		writer->completed_deps[index] = 1;
+
+		if(writer->sink->store_checkpoint != NULL) {
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			if((now.tv_sec - writer->last_checkpoint.tv_sec) + (now.tv_usec - writer->last_checkpoint.tv_usec) / 1000000.0 > CHECKPOINT_INTERVAL) {
+				writer->sink->store_checkpoint(writer->completed_deps, writer->num_all_deps, writer->sink->sink_data);
+				writer->last_checkpoint = now;
+			}
+		}
+
+		lock_thread_mutex(&writer->lock);
+	}
+	unlock_thread_mutex(&writer->lock);
+
+	// final checkpoint (only missing departure dates are calculated when resuming a cancelled search)
+	if(writer->sink->store_checkpoint != NULL) writer->sink->store_checkpoint(writer->completed_deps, writer->num_all_deps, writer->sink->sink_data);
+	return NULL;
+}
+
+
+double calc_initial_transfer_dv_dep(Initial_Transfer_Sweep *sweep, double v_inf) {
+	Body *dep_body = sweep->dep_body;
+	if(dep_body == NULL) return mag_vec3(sweep->osv_dep.v);
+	double rp = alt2radius(dep_body, sweep->dv_filter->dep_periapsis);
+	return sweep->tt % 2 == 0 ? dv_capture(dep_body, rp, v_inf) : dv_circ(dep_body, rp, v_inf);
+}
+
+double calc_initial_transfer_dv_arr(Initial_Transfer_Sweep *sweep, double v_inf, OSV osv_arr) {
+	Body *arr_body = sweep->arr_body;
+	if(arr_body == NULL) return mag_vec3(osv_arr.v);
+	double rp = alt2radius(arr_body, sweep->dv_filter->arr_periapsis);
+	if(sweep->tt < 2) return dv_capture(arr_body, rp, v_inf);
+	else if(sweep->tt < 4) return dv_circ(arr_body, rp, v_inf);
+	else return 0;
+}
+
+// rejects samples that can't satisfy the dv requirements before Lambert's problem is solved: every conic through both
+// positions has a semi-major axis of at least s/2 (minimum-energy transfer) or is hyperbolic --> lower bound for both speeds
+enum Initial_Transfer_Stage screen_initial_transfer_sample(Initial_Transfer_Sweep *sweep, Initial_Transfer_Sample *sample) {
+	struct Dv_Filter *dv_filter = sweep->dv_filter;
+	double mu = sweep->system->cb->mu;
+	double r0 = mag_vec3(sweep->osv_dep.r), r1 = mag_vec3(sample->osv_arr.r);
+	double s = (r0 + r1 + mag_vec3(subtract_vec3(sample->osv_arr.r, sweep->osv_dep.r))) / 2;
+	double v0_min = sqrt(mu*(2/r0 - 2/s)) * (1 - INITIAL_TRANSFER_SCREEN_TOLERANCE);
+	double v1_min = sqrt(mu*(2/r1 - 2/s)) * (1 - INITIAL_TRANSFER_SCREEN_TOLERANCE);
+	double v_inf_dep_min = v0_min - mag_vec3(sweep->osv_dep.v);
+	double v_inf_arr_min = v1_min - mag_vec3(sample->osv_arr.v);
+
+	for(int i = 0; i < NUM_INITIAL_TRANSFER_MARGINS; i++) sample->margins[i] = NAN;
+
+	// margins of lower bounds are upper bounds of the actual margins
+	double dv_dep_min = calc_initial_transfer_dv_dep(sweep, v_inf_dep_min > 0 ? v_inf_dep_min : 0);
+	double max_dv_dep = dv_filter->max_totdv < dv_filter->max_depdv ? dv_filter->max_totdv : dv_filter->max_depdv;
+	sample->margins[0] = 1 - dv_dep_min/max_dv_dep;
+	if(dv_dep_min > dv_filter->max_totdv || dv_dep_min > dv_filter->max_depdv) return INITIAL_TF_SCREENED_DEP_DV;
+
+	if(sweep->check_arr_dv) {
+		double dv_arr_min = calc_initial_transfer_dv_arr(sweep, v_inf_arr_min > 0 ? v_inf_arr_min : 0, sample->osv_arr);
+		double totdv_margin = 1 - (dv_dep_min + dv_arr_min)/dv_filter->max_totdv;
+		double satdv_margin = 1 - dv_arr_min/dv_filter->max_satdv;
+		sample->margins[1] = totdv_margin < satdv_margin ? totdv_margin : satdv_margin;
+		if(dv_dep_min + dv_arr_min > dv_filter->max_totdv || dv_arr_min > dv_filter->max_satdv) return INITIAL_TF_SCREENED_ARR_DV;
+	}
+	return INITIAL_TF_ACCEPTED;
+}
+
+// checks the solved transfer (cheapest checks first, margins of checks after the first failed one stay NaN)
+enum Initial_Transfer_Stage evaluate_initial_transfer_sample(Initial_Transfer_Sweep *sweep, Initial_Transfer_Sample *sample, Lambert3 tf) {
+	struct Dv_Filter *dv_filter = sweep->dv_filter;
+	OSV osv_body0 = sweep->osv_dep;
+	Body *dep_body = sweep->dep_body;
+	CelestSystem *system = sweep->system;
+	sample->tf = tf;
+	sample->is_feasible = 0;
+	for(int i = 0; i < NUM_INITIAL_TRANSFER_MARGINS; i++) sample->margins[i] = NAN;
+
+	double dv_dep = calc_initial_transfer_dv_dep(sweep, fabs(mag_vec3(subtract_vec3(tf.v0, osv_body0.v))));
+	double dv_arr = calc_initial_transfer_dv_arr(sweep, fabs(mag_vec3(subtract_vec3(tf.v1, sample->osv_arr.v))), sample->osv_arr);
+
+	double max_dv_dep = dv_filter->max_totdv < dv_filter->max_depdv ? dv_filter->max_totdv : dv_filter->max_depdv;
+	sample->margins[0] = 1 - dv_dep/max_dv_dep;
+	if(dv_dep > dv_filter->max_totdv || dv_dep > dv_filter->max_depdv) return INITIAL_TF_REJECTED_DEP_DV;
+
+	sample->margins[1] = 1;
+	if(sweep->check_arr_dv) {
+		double totdv_margin = 1 - (dv_dep + dv_arr)/dv_filter->max_totdv;
+		double satdv_margin = 1 - dv_arr/dv_filter->max_satdv;
+		sample->margins[1] = totdv_margin < satdv_margin ? totdv_margin : satdv_margin;
+		if(dv_dep + dv_arr > dv_filter->max_totdv || dv_arr > dv_filter->max_satdv) return INITIAL_TF_REJECTED_ARR_DV;
+	}
+
+	// approach from (-200Au, 0, 0): the incoming velocity only has an x-component --> v_inf can't be smaller than the body's velocity perpendicular to x
+	double v_inf_sq = sq_mag_vec3(subtract_vec3(tf.v0, osv_body0.v));
+	double v_inf_x_sq = - osv_body0.v.y*osv_body0.v.y - osv_body0.v.z*osv_body0.v.z + v_inf_sq;
+	sample->margins[2] = v_inf_x_sq/v_inf_sq;
+	if(!(v_inf_x_sq >= 0)) return INITIAL_TF_REJECTED_APPROACH_GEOMETRY;
+
+	sample->rp_heliocentric = calc_heliocentric_periapsis(tf.r0, tf.v0, tf.r1, tf.v1, system);
+	sample->margins[3] = mag_vec3(sample->rp_heliocentric)/(0.01*AU) - 1;
+	if(sq_mag_vec3(sample->rp_heliocentric)/(AU*AU) < 0.01*0.01) return INITIAL_TF_REJECTED_PERIHELION;
+
+	// check if it can reach from (-200Au, 0, 0)
+	double v_inf_x = sqrt(v_inf_x_sq);
+	Vector3 v_arr0 = vec3(v_inf_x+osv_body0.v.x, 0, 0);
+	double initial_fly_by_rp = get_flyby_periapsis(v_arr0, tf.v0, osv_body0.v, dep_body);
+	double rel_fly_by_alt = initial_fly_by_rp/dep_body->radius-1;
+	sample->margins[4] = rel_fly_by_alt/0.1 - 1 < 1 - rel_fly_by_alt/100 ? rel_fly_by_alt/0.1 - 1 : 1 - rel_fly_by_alt/100;
+	if(rel_fly_by_alt < 0.1 || rel_fly_by_alt > 100) return INITIAL_TF_REJECTED_FLYBY_PERIAPSIS;
+
+	// check if it can start from (-200Au, 0, 0) after t0
+	OSV new_osv = propagate_osv_ta((OSV) {osv_body0.r, v_arr0}, system->cb,-angle_vec3_vec3(osv_body0.r, vec3(-200*AU, osv_body0.r.y, osv_body0.r.z)));
+	double approach_duration = (mag_vec3(subtract_vec3(osv_body0.r, new_osv.r))/mag_vec3(new_osv.v))/86400.0;
+	sample->margins[5] = (sweep->jd_dep - approach_duration)/approach_duration;
+	if(sweep->jd_dep - approach_duration < 0) return INITIAL_TF_REJECTED_APPROACH_TIME;
+
+	sample->is_feasible = 1;
+	return INITIAL_TF_ACCEPTED;
+}
+
+// adds the initial transfers to one body (difference of the sweep counts before and after them) to the search statistics
+void add_initial_transfer_stats_to_record(struct Itin_Stats_Record *record, Initial_Transfer_Stats *before, Initial_Transfer_Stats *after, int num_nodes) {
+	if(record == NULL) return;
+	long num[NUM_INITIAL_TF_STAGES], num_evaluated = 0;
+	for(int i = 0; i < NUM_INITIAL_TF_STAGES; i++) {
+		num[i] = after->num_per_stage[i] - before->num_per_stage[i];
+		if(i != INITIAL_TF_SCREENED_DEP_DV && i != INITIAL_TF_SCREENED_ARR_DV) num_evaluated += num[i];
+	}
+	add_itin_stats_count(record, ITIN_STATS_LAMBERT_CALLS, num_evaluated);
+	add_itin_stats_count(record, ITIN_STATS_REJECTED_DV, num[INITIAL_TF_SCREENED_DEP_DV] + num[INITIAL_TF_SCREENED_ARR_DV] + num[INITIAL_TF_REJECTED_DEP_DV] + num[INITIAL_TF_REJECTED_ARR_DV]);
+	add_itin_stats_count(record, ITIN_STATS_REJECTED_PERIHELION, num[INITIAL_TF_REJECTED_PERIHELION]);
+	add_itin_stats_count(record, ITIN_STATS_REJECTED_APPROACH, num[INITIAL_TF_REJECTED_APPROACH_GEOMETRY] + num[INITIAL_TF_REJECTED_FLYBY_PERIAPSIS] + num[INITIAL_TF_REJECTED_APPROACH_TIME]);
+	add_itin_stats_count(record, ITIN_STATS_NODES_CREATED, num_nodes);
+}
+
+void add_initial_transfer_stats(Initial_Transfer_Stats *stats, Initial_Transfer_Stats *add) {
+	lock_thread_mutex(&stats->lock);
+	stats->num_samples += add->num_samples;
+	stats->num_skipped += add->num_skipped;
+	stats->num_lambert += add->num_lambert;
+	for(int i = 0; i < NUM_INITIAL_TF_STAGES; i++) stats->num_per_stage[i] += add->num_per_stage[i];
+	unlock_thread_mutex(&stats->lock);
+}
+
+void print_initial_transfer_stats(Initial_Transfer_Stats *stats) {
+	const char *stage_names[NUM_INITIAL_TF_STAGES] = {
+			"accepted", "screened (departure dv bound)", "screened (arrival dv bound)", "rejected (departure dv)", "rejected (arrival dv)",
+			"rejected (approach geometry)", "rejected (heliocentric periapsis)", "rejected (initial flyby periapsis)", "rejected (approach time)"
+	};
+	printf("Initial transfers: %ld arrival dates, %ld skipped by the sampler, %ld Lambert solves\n", stats->num_samples, stats->num_skipped, stats->num_lambert);
+	for(int i = 0; i < NUM_INITIAL_TF_STAGES; i++) printf("  %-36s %ld\n", stage_names[i], stats->num_per_stage[i]);
+}
+
+// arrival dates between the sweep samples a and b are skipped if both samples miss the same constraint by far
+// (no sign change and not close to feasible; NaN margins never allow skipping)
+int initial_transfer_interval_needs_refinement(Initial_Transfer_Sample *a, Initial_Transfer_Sample *b) {
+	if(a->is_feasible || b->is_feasible) return 1;
+	for(int i = 0; i < NUM_INITIAL_TRANSFER_MARGINS; i++) {
+		if(a->margins[i] < -ARR_DATE_REFINE_MARGIN && b->margins[i] < -ARR_DATE_REFINE_MARGIN) return 0;
+	}
+	return 1;
+}
+
+// deviation of the phase angle between dep_body and arr_body at jd_dep from the one of a Hohmann transfer [0, pi]
+// (cheap estimate of how good the first transfer from this departure date can be)
+double calc_departure_phase_mismatch(CelestSystem *system, Body *dep_body, Body *arr_body, double jd_dep) {
+	OSV osv0 = body_state_at(system, dep_body, jd_dep);
+	OSV osv1 = body_state_at(system, arr_body, jd_dep);
+	double r0 = mag_vec3(osv0.r), r1 = mag_vec3(osv1.r);
+	Hohmann hohmann = calc_hohmann_transfer(r0, r1, system->cb);
+	// arr_body has to lead by the angle it doesn't cover during the transfer
+	double target_phase = M_PI - sqrt(system->cb->mu/(r1*r1*r1)) * hohmann.dur;
+	Vector3 orbit_normal = norm_vec3(cross_vec3(osv0.r, osv0.v));
+	double phase = atan2(dot_vec3(cross_vec3(osv0.r, osv1.r), orbit_normal), dot_vec3(osv0.r, osv1.r));
+	double mismatch = fmod(fabs(phase - target_phase), 2*M_PI);
+	return mismatch > M_PI ? 2*M_PI - mismatch : mismatch;
+}
+
+int compare_itin_departure_order(const void *a, const void *b) {
+	double key_a = ((Itin_Departure_Order *) a)->key, key_b = ((Itin_Departure_Order *) b)->key;
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+// departure dates ordered by their phase mismatch to the closest first flyby body (most promising first)
+void sort_departures_by_phase_mismatch(Itin_Calc_Data *calc_data, Itin_Departure_Order *order, int num_deps) {
+	CelestSystem *system = calc_data->seq_info.to_target.system;
+	for(int i = 0; i < num_deps; i++) {
+		double jd_dep = calc_data->jd_min_dep + i*calc_data->step_dep_date;
+		order[i] = (Itin_Departure_Order) {M_PI, i};
+		if(calc_data->seq_info.to_target.type == ITIN_SEQ_INFO_TO_TARGET) {
+			struct ItinSequenceInfoToTarget *seq_info = &calc_data->seq_info.to_target;
+			for(int j = 0; j < seq_info->num_flyby_bodies; j++) {
+				if(seq_info->flyby_bodies[j] == seq_info->dep_body) continue;
+				double mismatch = calc_departure_phase_mismatch(system, seq_info->dep_body, seq_info->flyby_bodies[j], jd_dep);
+				if(mismatch < order[i].key) order[i].key = mismatch;
+			}
+		} else {
+			struct ItinSequenceInfoSpecItin *seq_info = &calc_data->seq_info.spec_seq;
+			if(seq_info->bodies[1] != seq_info->bodies[0])
+				order[i].key = calc_departure_phase_mismatch(system, seq_info->bodies[0], seq_info->bodies[1], jd_dep);
+		}
+	}
+	qsort(order, num_deps, sizeof(Itin_Departure_Order), compare_itin_departure_order);
+}
 
 void *calc_itins_from_departure(void *args) {
 	Itin_Calc_Thread_Args *thread_args = (struct Itin_Calc_Thread_Args *)args;
 	Itin_Calc_Data *calc_data = thread_args->calc_data;
 
+	// calculation cancelled
+	if(is_itin_search_cancelled(thread_args->search_ctx->status)) return NULL;
+
+	// memory budget exceeded (not handed to the result sink --> calculated when resuming from the checkpoint)
+	Itin_Memory_Budget *memory_budget = thread_args->memory_budget;
+	if(memory_budget->max_bytes > 0 && get_itin_arena_num_bytes(thread_args->search_ctx->arena) > memory_budget->max_bytes) {
+		atomic_fetch_add_explicit(&memory_budget->num_skipped_deps, 1, memory_order_relaxed);
+		memory_budget->is_skipped[thread_args->index] = 1;
+		add_itin_search_progress(thread_args->search_ctx->status, 1, 0);
+		return NULL;
+	}
+
 	struct ItinStep **departures = thread_args->departures;
 	struct Dv_Filter dv_filter = calc_data->dv_filter;
 	double jd_min_dep = calc_data->jd_min_dep;
@@ -37,12 +376,14 @@ void *calc_itins_from_departure(void *args) {
 
 	CelestSystem *system;
 	Body *dep_body,
-		*arr_body,			// only to_target: target body
+		*arr_body,			// to_target: target body; spec_seq: last body in sequence
 		**fly_by_bodies;	// to_target: allowed fly_by_bodies; spec_seq: bodies in sequence
 	int num_initial_transfers,
 			num_steps,			// only spec_seq: number of steps in sequence
 			num_flyby_bodies;	// only to_target: number of allowed fly_by_bodies
 
+	int num_arr_dates_per_body = calc_data->num_arr_dates_per_body > 1 ? calc_data->num_arr_dates_per_body : NUM_INITIAL_TRANSFERS_PER_BODY;
+
 	enum Transfer_Type tt = dv_filter.last_transfer_type == TF_CIRC ? circcirc : dv_filter.last_transfer_type == TF_CAPTURE ? circcap : circfb;
 
 	if(itin_seq_type == ITIN_SEQ_INFO_TO_TARGET) {
@@ -52,31 +393,31 @@ void *calc_itins_from_departure(void *args) {
 		arr_body = calc_data->seq_info.to_target.arr_body;
 		fly_by_bodies = calc_data->seq_info.to_target.flyby_bodies;
 		num_flyby_bodies = calc_data->seq_info.to_target.num_flyby_bodies;
-		num_initial_transfers = NUM_INITIAL_TRANSFERS_PER_BODY * (system->num_bodies - 1);
+		num_initial_transfers = num_arr_dates_per_body * (system->num_bodies - 1);
 	} else {
 		// specific sequence
 		system = calc_data->seq_info.spec_seq.system;
 		dep_body = calc_data->seq_info.spec_seq.bodies[0];
 		fly_by_bodies = calc_data->seq_info.spec_seq.bodies;
 		num_steps = calc_data->seq_info.spec_seq.num_steps;
-		num_initial_transfers = NUM_INITIAL_TRANSFERS_PER_BODY;
+		arr_body = fly_by_bodies[num_steps-1];
+		num_initial_transfers = num_arr_dates_per_body;
+		// meet in the middle: forward steps end with a flyby at the middle body (joined with the backward partials afterwards)
+		if(thread_args->search_ctx->mitm != NULL) {
+			num_steps = get_itin_mitm_mid_step(thread_args->search_ctx->mitm) + 1;
+			dv_filter.last_transfer_type = TF_FLYBY;
+		}
 	}
 
-	// index in departure array (iterated over)
-	int index = get_incr_thread_counter(0);
-	// increase finished counter to 1 (first finished should reflect a num of finished of 1)
+	// index in departure array (one task per departure date)
+	int index = thread_args->index;
 
 	double jd_dep = jd_min_dep + index*calc_data->step_dep_date;
 	struct ItinStep *curr_step;
 	OSV osv_body0, osv_body1;
 
-	// used for progress feedback
-	double jd_diff = jd_max_dep-jd_min_dep+1;
-
-	while(jd_dep <= jd_max_dep && get_thread_counter(3) == 0) {
-		osv_body0 = system->prop_method == ORB_ELEMENTS ?
-					osv_from_elements(dep_body->orbit, jd_dep) :
-					osv_from_ephem(dep_body->ephem, dep_body->num_ephems, jd_dep, system->cb);
+	if(jd_dep <= jd_max_dep) {
+		osv_body0 = body_state_at(system, dep_body, jd_dep);
 
 		curr_step = departures[index];
 		curr_step->body = dep_body;
@@ -88,7 +429,8 @@ void *calc_itins_from_departure(void *args) {
 		curr_step->had_low_perihelion = false;
 		curr_step->num_next_nodes = num_initial_transfers;
 		curr_step->prev = NULL;
-		curr_step->next = (struct ItinStep **) malloc(curr_step->num_next_nodes * sizeof(struct ItinStep *));
+		update_itin_step_score(curr_step, system);
+		curr_step->next = new_itin_next_array(thread_args->search_ctx->arena, curr_step->num_next_nodes);
 
 		double jd_max_arr = jd_dep + max_total_duration < calc_data->jd_max_arr ? jd_dep + max_total_duration : calc_data->jd_max_arr;
 
@@ -96,6 +438,27 @@ void *calc_itins_from_departure(void *args) {
 		int num_next_bodies = itin_seq_type == ITIN_SEQ_INFO_TO_TARGET ? num_flyby_bodies : 1;
 		int next_step_id = 0;
 
+		Initial_Transfer_Sweep sweep = {
+				.osv_dep = osv_body0,
+				.jd_dep = jd_dep,
+				.dep_body = dep_body,
+				.arr_body = arr_body,
+				.tt = tt,
+				.dv_filter = &dv_filter,
+				.check_arr_dv = num_steps == 2 && dv_filter.last_transfer_type != TF_FLYBY,
+				.system = system
+		};
+		Initial_Transfer_Stats stats = {0};
+
+		struct Lambert_Batch *lambert_batch = create_lambert_batch(num_arr_dates_per_body);
+		Initial_Transfer_Sample *samples = (Initial_Transfer_Sample *) malloc(num_arr_dates_per_body * sizeof(Initial_Transfer_Sample));
+		int *batch_sample_indices = (int *) malloc(num_arr_dates_per_body * sizeof(int));
+		// intervals of the sweep that still need to be checked (start and end sample index)
+		int *intervals = (int *) malloc(2 * num_arr_dates_per_body * sizeof(int));
+		int *next_intervals = (int *) malloc(2 * num_arr_dates_per_body * sizeof(int));
+
+		struct Itin_Stats *itin_stats = thread_args->search_ctx->stats;
+		long stage_start = start_itin_stats_stage(itin_stats);
 		for(int i = 0; i < num_next_bodies; i++) {
 			if(itin_seq_type == ITIN_SEQ_INFO_TO_TARGET) {
 				next_step_body = fly_by_bodies[i];
@@ -103,10 +466,10 @@ void *calc_itins_from_departure(void *args) {
 			} else {
 				next_step_body = fly_by_bodies[1];
 			}
+			Initial_Transfer_Stats body_stats0 = stats;
+			int next_step_id0 = next_step_id;
 
-			OSV arr_body_temp_osv = system->prop_method == ORB_ELEMENTS ?
-										   osv_from_elements(next_step_body->orbit, jd_dep) :
-										   osv_from_ephem(next_step_body->ephem, next_step_body->num_ephems, jd_dep, system->cb);
+			OSV arr_body_temp_osv = body_state_at(system, next_step_body, jd_dep);
 
 			double r0 = mag_vec3(osv_body0.r), r1 = mag_vec3(arr_body_temp_osv.r);
 			double r_ratio =  r1/r0;
@@ -117,53 +480,99 @@ void *calc_itins_from_departure(void *args) {
 			if(jd_dep + max_duration >  jd_max_arr) max_duration = jd_max_arr-jd_dep;
 			double max_min_duration_diff = max_duration - min_duration;
 
-			for(int j = 0; j < NUM_INITIAL_TRANSFERS_PER_BODY; j++) {
-				double jd_arr = jd_dep + min_duration + max_min_duration_diff * j/(NUM_INITIAL_TRANSFERS_PER_BODY - 1);
-
+			// arrival dates of the sweep (last one not after jd_max_arr)
+			int num_arr_dates = 0;
+			while(num_arr_dates < num_arr_dates_per_body) {
+				double jd_arr = jd_dep + min_duration + max_min_duration_diff * num_arr_dates/(num_arr_dates_per_body - 1);
 				if(jd_arr > jd_max_arr) break;
+				samples[num_arr_dates].jd_arr = jd_arr;
+				samples[num_arr_dates].is_evaluated = 0;
+				num_arr_dates++;
+			}
+			if(num_arr_dates == 0) continue;
+
+			// coarse grid first (feasible arrival date windows at least as wide as its spacing always contain a grid point;
+			// without a minimum window every arrival date is a grid point --> exhaustive sweep)
+			double arr_date_step = max_min_duration_diff/(num_arr_dates_per_body - 1);
+			int coarse_stride = calc_data->min_arr_window > 0 && arr_date_step > 0 ? (int) (calc_data->min_arr_window/arr_date_step) : 1;
+			if(coarse_stride < 1) coarse_stride = 1;
+
+			int num_intervals = 0;
+			for(int j = 0; j < num_arr_dates; j += coarse_stride) {
+				int end = j + coarse_stride < num_arr_dates ? j + coarse_stride : num_arr_dates-1;
+				if(end <= j) break;
+				intervals[2*num_intervals] = j;
+				intervals[2*num_intervals+1] = end;
+				num_intervals++;
+			}
 
-				osv_body1 = system->prop_method == ORB_ELEMENTS ?
-							osv_from_elements(next_step_body->orbit, jd_arr) :
-							osv_from_ephem(next_step_body->ephem, next_step_body->num_ephems, jd_arr, system->cb);
-
-				Lambert3 tf = calc_lambert3(osv_body0.r, osv_body1.r, (jd_arr - jd_dep) * 86400, system->cb);
-				
-				
-				double dv_dep, dv_arr;
-				if(dep_body != NULL) {
-					double vinf = fabs(mag_vec3(subtract_vec3(tf.v0, osv_body0.v)));
-					dv_dep = tt % 2 == 0 ? dv_capture(dep_body, alt2radius(dep_body, dv_filter.dep_periapsis), vinf) : dv_circ(dep_body,alt2radius(dep_body, dv_filter.dep_periapsis),vinf);
-				} else dv_dep = mag_vec3(osv_body0.v);
-				
-				if(arr_body != NULL) {
-					double vinf = fabs(mag_vec3(subtract_vec3(tf.v1, osv_body1.v)));
-					if(tt < 2) dv_arr = dv_capture(arr_body, alt2radius(arr_body, dv_filter.arr_periapsis), vinf);
-					else if(tt < 4) dv_arr = dv_circ(arr_body, alt2radius(arr_body, dv_filter.arr_periapsis), vinf);
-					else dv_arr = 0;
-				} else {
-					dv_arr = mag_vec3(osv_body1.v);
+			int num_batch_samples = 0;
+			for(int j = 0; j < num_arr_dates; j += coarse_stride) batch_sample_indices[num_batch_samples++] = j;
+			if((num_arr_dates-1) % coarse_stride != 0) batch_sample_indices[num_batch_samples++] = num_arr_dates-1;
+
+			// evaluate samples and refine intervals (midpoints) where feasible transfers could lie until all neighbouring arrival dates are evaluated
+			while(num_batch_samples > 0) {
+				// all transfers to this body start at the same position --> solve the ones that pass the screening together
+				clear_lambert_batch(lambert_batch);
+				int num_solved_samples = 0;
+				for(int j = 0; j < num_batch_samples; j++) {
+					Initial_Transfer_Sample *sample = &samples[batch_sample_indices[j]];
+					sample->osv_arr = body_state_at(system, next_step_body, sample->jd_arr);
+					sample->is_evaluated = 1;
+					sample->is_feasible = 0;
+					enum Initial_Transfer_Stage stage = screen_initial_transfer_sample(&sweep, sample);
+					if(stage != INITIAL_TF_ACCEPTED) {
+						stats.num_per_stage[stage]++;
+						continue;
+					}
+					// solved before (other search or departure date)
+					Lambert3 cached_tf;
+					if(get_cached_lambert3(dep_body, jd_dep, osv_body0.r, next_step_body, sample->jd_arr, sample->osv_arr.r, system->cb, &cached_tf)) {
+						stats.num_per_stage[evaluate_initial_transfer_sample(&sweep, sample, cached_tf)]++;
+						continue;
+					}
+					add_lambert_batch_problem(lambert_batch, sample->osv_arr.r, (sample->jd_arr - jd_dep) * 86400);
+					batch_sample_indices[num_solved_samples++] = batch_sample_indices[j];
+				}
+				solve_lambert_batch(lambert_batch, osv_body0.r, system->cb);
+				stats.num_lambert += num_solved_samples;
+				for(int j = 0; j < num_solved_samples; j++) {
+					Initial_Transfer_Sample *sample = &samples[batch_sample_indices[j]];
+					Lambert3 tf = get_lambert_batch_solution(lambert_batch, osv_body0.r, j);
+					store_lambert3_in_cache(dep_body, jd_dep, next_step_body, sample->jd_arr, system->cb, tf);
+					stats.num_per_stage[evaluate_initial_transfer_sample(&sweep, sample, tf)]++;
 				}
-				
-				if(dv_dep > dv_filter.max_totdv || dv_dep > dv_filter.max_depdv) continue;
-				if((num_steps == 2 && dv_filter.last_transfer_type != TF_FLYBY) && (dv_dep + dv_arr > dv_filter.max_totdv || dv_arr > dv_filter.max_satdv)) continue;
-				Vector3 rp_heliocentric = calc_heliocentric_periapsis(tf.r0, tf.v0, tf.r1, tf.v1, system);
-				if(sq_mag_vec3(rp_heliocentric)/(AU*AU) < 0.01*0.01) continue;
-				
-				// check if it can reach from (-200Au, 0, 0)
-				double v_inf_sq = sq_mag_vec3(subtract_vec3(tf.v0, osv_body0.v));
-				double v_inf_x = sqrt(- osv_body0.v.y*osv_body0.v.y - osv_body0.v.z*osv_body0.v.z + v_inf_sq);
-				Vector3 v_arr0 = vec3(v_inf_x+osv_body0.v.x, 0, 0);
-				double initial_fly_by_rp = get_flyby_periapsis(v_arr0, tf.v0, osv_body0.v, dep_body);
-//				printf("%s  radius: %f\n", next_step_body->name, initial_fly_by_rp/dep_body->radius-1);
-				if(initial_fly_by_rp/dep_body->radius-1 < 0.1 || initial_fly_by_rp/dep_body->radius-1 > 100) continue;
-				// check if it can start from (-200Au, 0, 0) after t0
-				OSV new_osv = propagate_osv_ta((OSV) {osv_body0.r, v_arr0}, system->cb,-angle_vec3_vec3(osv_body0.r, vec3(-200*AU, osv_body0.r.y, osv_body0.r.z)));
-//				printf("date: %f\n", jd_dep - (mag_vec3(subtract_vec3(osv_body0.r, new_osv.r))/mag_vec3(new_osv.v))/86400.0);
-				if(jd_dep - (mag_vec3(subtract_vec3(osv_body0.r, new_osv.r))/mag_vec3(new_osv.v))/86400.0 < 0) continue;
-				
-				
+
+				num_batch_samples = 0;
+				int num_next_intervals = 0;
+				for(int j = 0; j < num_intervals; j++) {
+					int start = intervals[2*j], end = intervals[2*j+1];
+					if(end - start < 2 || !initial_transfer_interval_needs_refinement(&samples[start], &samples[end])) continue;
+					int mid = (start + end) / 2;
+					batch_sample_indices[num_batch_samples++] = mid;
+					next_intervals[2*num_next_intervals] = start;
+					next_intervals[2*num_next_intervals+1] = mid;
+					next_intervals[2*num_next_intervals+2] = mid;
+					next_intervals[2*num_next_intervals+3] = end;
+					num_next_intervals += 2;
+				}
+				int *temp = intervals;
+				intervals = next_intervals;
+				next_intervals = temp;
+				num_intervals = num_next_intervals;
+			}
+
+			stats.num_samples += num_arr_dates;
+			for(int j = 0; j < num_arr_dates; j++) {
+				if(!samples[j].is_evaluated) stats.num_skipped++;
+				if(!samples[j].is_evaluated || !samples[j].is_feasible) continue;
+				double jd_arr = samples[j].jd_arr;
+				osv_body1 = samples[j].osv_arr;
+				Lambert3 tf = samples[j].tf;
+				Vector3 rp_heliocentric = samples[j].rp_heliocentric;
+
 				curr_step = get_first(curr_step);
-				curr_step->next[next_step_id] = (struct ItinStep *) malloc(sizeof(struct ItinStep));
+				curr_step->next[next_step_id] = new_itin_step(thread_args->search_ctx->arena);
 				curr_step->next[next_step_id]->prev = curr_step;
 				curr_step->next[next_step_id]->next = NULL;
 
@@ -177,43 +586,63 @@ void *calc_itins_from_departure(void *args) {
 				curr_step->v_arr = tf.v1;
 				curr_step->v_body = osv_body1.v;
 				curr_step->num_next_nodes = 0;
+				update_itin_step_score(curr_step, system);
 
 				next_step_id++;
 			}
+			add_initial_transfer_stats_to_record(get_itin_stats_record(itin_stats, 0, dep_body, next_step_body), &body_stats0, &stats, next_step_id - next_step_id0);
 		}
+		end_itin_stats_stage(itin_stats, ITIN_STATS_STAGE_INITIAL_TRANSFERS, stage_start);
+
+		add_initial_transfer_stats(thread_args->initial_transfer_stats, &stats);
+		free_lambert_batch(lambert_batch);
+		free(samples);
+		free(batch_sample_indices);
+		free(intervals);
+		free(next_intervals);
 
 		curr_step = get_first(curr_step);
 		curr_step->num_next_nodes = next_step_id;
+		prune_equivalent_next_steps(curr_step, thread_args->search_ctx->prune_filter, system, thread_args->search_ctx->arena, itin_stats);
 
 		if(itin_seq_type == ITIN_SEQ_INFO_TO_TARGET) {
-			int num_of_end_nodes = find_copy_and_store_end_nodes(curr_step, arr_body);
-
-			// remove end nodes that do not satisfy dv requirements
-			num_of_end_nodes = remove_end_nodes_that_do_not_satisfy_dv_requirements(curr_step, num_of_end_nodes, &dv_filter);
+			int num_of_end_nodes = mark_end_nodes(curr_step, arr_body);
+
+			// end nodes that do not satisfy dv requirements are only continued
+			stage_start = start_itin_stats_stage(itin_stats);
+			int num_all_end_nodes = num_of_end_nodes;
+			num_of_end_nodes = unmark_end_nodes_that_do_not_satisfy_dv_requirements(curr_step, &dv_filter);
+			add_itin_stats_count(get_itin_step_stats_record(itin_stats, curr_step, arr_body), ITIN_STATS_REJECTED_DV, num_all_end_nodes - num_of_end_nodes);
+			end_itin_stats_stage(itin_stats, ITIN_STATS_STAGE_DV_FILTER, stage_start);
+			add_itin_end_nodes_to_score_bound(curr_step, thread_args->search_ctx->score_bound, itin_stats);
+			prune_score_bounded_next_steps(curr_step, curr_step->num_next_nodes, thread_args->search_ctx->score_bound, thread_args->search_ctx->arena, itin_stats);
 			if(curr_step->num_next_nodes > 0) {
-				continue_to_next_steps_and_check_for_valid_itins(curr_step, num_of_end_nodes, &calc_data->seq_info.to_target, jd_max_arr, max_total_duration, &dv_filter);
+				continue_to_next_steps_and_check_for_valid_itins(curr_step, &calc_data->seq_info.to_target, jd_max_arr, max_total_duration, &dv_filter, thread_args->search_ctx);
 			}
 		} else {
-			if(num_steps > 2) {
-				int itin_del = 0;
-				int init_num_next_nodes = curr_step->num_next_nodes;
-				for(int i = 0; i < init_num_next_nodes; i++) {
-					if(!calc_next_spec_itin_step(curr_step->next[i - itin_del], system, fly_by_bodies, jd_max_arr, &dv_filter, num_steps, 2)) itin_del++;
-				}
+			if(num_steps == 2 && thread_args->search_ctx->mitm == NULL) add_itin_arrivals_to_score_bound(curr_step, thread_args->search_ctx->score_bound, thread_args->search_ctx->arena, itin_stats);
+			else prune_score_bounded_next_steps(curr_step, curr_step->num_next_nodes, thread_args->search_ctx->score_bound, thread_args->search_ctx->arena, itin_stats);
+			if(num_steps > 2 && curr_step->num_next_nodes > 0) {
+				continue_to_next_spec_itin_steps(curr_step, system, fly_by_bodies, jd_max_arr, &dv_filter, num_steps, 2, thread_args->search_ctx);
+			}
+			if(thread_args->search_ctx->mitm != NULL && curr_step->num_next_nodes > 0) {
+				join_itin_mitm_partials(curr_step, thread_args->search_ctx->mitm, thread_args->search_ctx);
 			}
 		}
 
-		double progress = get_incr_thread_counter(1)+1;	// +1 because it gets the last value, not the incremented value
-		show_progress("Transfer Calculation progress", progress, jd_diff/calc_data->step_dep_date);
-		incr_thread_counter_by_amount(2, get_number_of_itineraries(get_first(curr_step)));
-		index = get_incr_thread_counter(0);
-		jd_dep = jd_min_dep + index*calc_data->step_dep_date;
+		// cancelled during the recursion --> incomplete tree (not handed to the result sink; freed with the arena and calculated again when resuming)
+		if(thread_args->result_writer != NULL && is_itin_search_cancelled(thread_args->search_ctx->status)) return NULL;
+
+		add_itin_search_progress(thread_args->search_ctx->status, 1, get_number_of_itineraries(get_first(curr_step)));
+
+		// departure is not touched anymore after this
+		if(thread_args->result_writer != NULL) push_finished_departure_to_result_writer(thread_args->result_writer, index);
 	}
 	return NULL;
 }
 
 struct Itin_Calc_Results search_for_itineraries(Itin_Calc_Data calc_data) {
-	struct Itin_Calc_Results results = {NULL, 0, 0};
+	struct Itin_Calc_Results results = {NULL, 0, 0, 0, NULL, NULL, 0};
 	
 	ItinStepBinHeaderData header_data = {
 			3, 0, 0, 0, calc_data.seq_info.to_target.system, calc_data
@@ -226,29 +655,200 @@ struct Itin_Calc_Results search_for_itineraries(Itin_Calc_Data calc_data) {
 	double elapsed_time;
 	gettimeofday(&start, NULL);  // Record the ending time
 
-	int num_deps = (int) (calc_data.jd_max_dep-calc_data.jd_min_dep+1);
+	int num_deps = (int) ((calc_data.jd_max_dep-calc_data.jd_min_dep)/calc_data.step_dep_date) + 1;
+
+	// every step of this search lives in the arena (freed at once with free_itin_calc_results)
+	struct Itin_Arena *arena = create_itin_arena();
+
+	// bodies the search can visit
+	Body **search_bodies;
+	int num_search_bodies;
+	if(calc_data.seq_info.to_target.type == ITIN_SEQ_INFO_TO_TARGET) {
+		struct ItinSequenceInfoToTarget seq_info = calc_data.seq_info.to_target;
+		num_search_bodies = seq_info.num_flyby_bodies + 2;
+		search_bodies = (Body **) malloc(num_search_bodies * sizeof(Body *));
+		search_bodies[0] = seq_info.dep_body;
+		search_bodies[1] = seq_info.arr_body;
+		for(int i = 0; i < seq_info.num_flyby_bodies; i++) search_bodies[i+2] = seq_info.flyby_bodies[i];
+	} else {
+		num_search_bodies = calc_data.seq_info.spec_seq.num_steps;
+		search_bodies = (Body **) malloc(num_search_bodies * sizeof(Body *));
+		for(int i = 0; i < num_search_bodies; i++) search_bodies[i] = calc_data.seq_info.spec_seq.bodies[i];
+	}
+
+	// opt-in: body states of the whole search window are interpolated from tables (built once per system and body)
+	if(calc_data.max_ephem_cache_error > 0) {
+		init_ephem_cache(calc_data.seq_info.to_target.system, search_bodies, num_search_bodies, calc_data.jd_min_dep-1, calc_data.jd_max_arr+1,
+						 calc_data.max_ephem_cache_error, calc_data.max_ephem_cache_vel_error);
+	}
 
 	struct ItinStep **departures = (struct ItinStep**) malloc(num_deps * sizeof(struct ItinStep*));
-	for(int i = 0; i < num_deps; i++) departures[i] = (struct ItinStep*) malloc(sizeof(struct ItinStep));
-	for(int i = 0; i < num_deps; i++) departures[i]->num_next_nodes = 0;
+	for(int i = 0; i < num_deps; i++) departures[i] = new_itin_step(arena);
+	for(int i = 0; i < num_deps; i++) {
+		departures[i]->num_next_nodes = 0;
+		departures[i]->next = NULL;
+	}
 
 
-	Itin_Calc_Thread_Args thread_args = {
-			departures,
-			&calc_data,
-	};
+	struct Thread_Pool *thread_pool = create_thread_pool(calc_data.num_threads);
+
+	// progress and cancellation of this search only (searches running at the same time don't share any state)
+	Itin_Search_Status *status = calc_data.status != NULL ? calc_data.status : create_itin_search_status();
+	begin_itin_search_status(status, thread_pool, num_deps);
 
-	thread_progress_and_prop_info = (struct Thread_Progress_and_Prop_Info) {
-			calc_data.jd_min_dep,
-			calc_data.jd_max_dep
+	// instrumentation (counted per depth and body pair of the search bodies)
+	struct Itin_Stats *itin_stats = NULL;
+	if(calc_data.stats_filepath != NULL) {
+		itin_stats = create_itin_stats(search_bodies, num_search_bodies, thread_pool);
+		start_itin_stats_snapshots(itin_stats, calc_data.stats_filepath, calc_data.stats_snapshot_interval);
+	}
+	free(search_bodies);
+
+	struct ItinSearchContext search_ctx = {
+			.pool = thread_pool,
+			.arena = arena,
+			.max_task_depth = calc_data.max_task_depth != 0 ? calc_data.max_task_depth : DEFAULT_MAX_TASK_DEPTH,
+			.min_task_num_next_nodes = calc_data.min_task_num_next_nodes > 0 ? calc_data.min_task_num_next_nodes : DEFAULT_MIN_TASK_NUM_NEXT_NODES,
+			.flyby_scratch = (struct Flyby_Search_Scratch *) malloc(get_thread_pool_size(thread_pool) * sizeof(struct Flyby_Search_Scratch)),
+			.mitm = NULL,
+			.prune_filter = calc_data.prune_filter.is_enabled ? &calc_data.prune_filter : NULL,
+			.status = status,
+			.stats = itin_stats,
+			// branch-and-bound on the competition score (only the best score_top_k itineraries are kept)
+			.score_bound = calc_data.score_top_k > 0 ? create_itin_score_bound(&calc_data, calc_data.score_top_k) : NULL
 	};
 
-	show_progress("Transfer Calculation progress", 0, 1);
-	struct Thread_Pool thread_pool;
-	thread_pool = use_thread_pool32(calc_itins_from_departure, &thread_args);
+	// finished departures are handed to the result sink by a separate writer thread (keeps the memory usage bounded)
+	Itin_Result_Writer *result_writer = NULL;
+	struct Thread_Pool *writer_pool = NULL;
+	if(calc_data.result_sink != NULL) {
+		result_writer = (Itin_Result_Writer *) calloc(1, sizeof(Itin_Result_Writer));
+		result_writer->departures = departures;
+		result_writer->sink = calc_data.result_sink;
+		result_writer->arena = arena;
+		result_writer->finished_indices = (int *) malloc(num_deps * sizeof(int));
+		result_writer->completed_deps = (char *) calloc(num_deps, sizeof(char));
+		result_writer->num_all_deps = num_deps;
+		if(calc_data.completed_deps != NULL) for(int i = 0; i < num_deps; i++) result_writer->completed_deps[i] = calc_data.completed_deps[i];
+		gettimeofday(&result_writer->last_checkpoint, NULL);
+		init_thread_mutex(&result_writer->lock);
+		init_thread_cond(&result_writer->cond);
+		writer_pool = create_thread_pool(1);
+		submit_detached_thread_pool_task(writer_pool, write_finished_departures, result_writer);
+	}
+
+	Initial_Transfer_Stats initial_transfer_stats = {0};
+	init_thread_mutex(&initial_transfer_stats.lock);
+	struct Lambert_Cache_Stats lambert_cache_stats0 = get_lambert_cache_stats();
+	Itin_Memory_Budget memory_budget = {.max_bytes = calc_data.max_memory > 0 ? (size_t) calc_data.max_memory : 0};
+	atomic_init(&memory_budget.num_skipped_deps, 0);
+	memory_budget.is_skipped = (char *) calloc(num_deps, sizeof(char));
+
+	Itin_Calc_Thread_Args *thread_args = (Itin_Calc_Thread_Args*) malloc(num_deps * sizeof(Itin_Calc_Thread_Args));
+	for(int i = 0; i < num_deps; i++) thread_args[i] = (Itin_Calc_Thread_Args) {departures, &calc_data, &search_ctx, result_writer, &initial_transfer_stats, &memory_budget, i};
+
+	// anytime search: promising departure dates first, the best itineraries so far are written to disk regularly
+	Itin_Departure_Order *dep_order = (Itin_Departure_Order *) malloc(num_deps * sizeof(Itin_Departure_Order));
+	if(search_ctx.score_bound != NULL || calc_data.max_search_time > 0) sort_departures_by_phase_mismatch(&calc_data, dep_order, num_deps);
+	else for(int i = 0; i < num_deps; i++) dep_order[i] = (Itin_Departure_Order) {0, i};
+	if(search_ctx.score_bound != NULL && calc_data.best_itins_filepath != NULL) {
+		double snapshot_interval = calc_data.best_itins_snapshot_interval > 0 ? calc_data.best_itins_snapshot_interval : DEFAULT_BEST_ITINS_SNAPSHOT_INTERVAL;
+		start_itin_score_bound_snapshots(search_ctx.score_bound, calc_data.best_itins_filepath, snapshot_interval);
+	}
+
+	register_active_itin_search(status);
+	// stops the search like a cancellation (finished departures are kept, departures cut by it are calculated again when resuming)
+	start_itin_search_deadline(status, calc_data.max_search_time);
+
+	// backward partials are needed by every departure (calculated before the departures on the same pool; cancellable from the GUI)
+	if(calc_data.meet_in_the_middle && calc_data.seq_info.to_target.type == ITIN_SEQ_INFO_SPEC_SEQ) {
+		search_ctx.mitm = build_itin_mitm_index(&calc_data, &search_ctx);
+	}
+
+	// workers only count, the progress is printed by a single reporter thread
+	if(!calc_data.hide_progress) start_itin_search_reporter(status, "Transfer Calculation progress");
+	for(int i = 0; i < num_deps; i++) {
+		int dep_idx = dep_order[i].index;
+		// already calculated in a previous (resumed) run
+		if(calc_data.completed_deps != NULL && calc_data.completed_deps[dep_idx]) {
+			add_itin_search_progress(status, 1, 0);
+			continue;
+		}
+		submit_detached_thread_pool_task(thread_pool, calc_itins_from_departure, &thread_args[dep_idx]);
+	}
 	join_thread_pool(thread_pool);
-	show_progress("Transfer Calculation progress", 1, 1);
-	printf("\n");
+	stop_itin_search_reporter(status);
+	stop_itin_search_deadline(status);
+	if(is_itin_search_deadline_reached(status)) {
+		Itin_Search_Progress progress = get_itin_search_progress(status);
+		printf("Time limit of %.0f s reached: search stopped after %ld of %d departure dates\n", calc_data.max_search_time, progress.num_deps, num_deps);
+	}
+
+	unregister_active_itin_search(status);
+	if(status != calc_data.status) free_itin_search_status(status);
+	destroy_thread_pool(thread_pool);
+	free(search_ctx.flyby_scratch);
+	if(search_ctx.mitm != NULL) {
+		print_itin_mitm_index_stats(search_ctx.mitm);
+		free_itin_mitm_index(search_ctx.mitm);
+	}
+	if(search_ctx.score_bound != NULL) {
+		print_itin_score_bound_stats(search_ctx.score_bound);
+		stop_itin_score_bound_snapshots(search_ctx.score_bound);
+		if(calc_data.best_itins_filepath != NULL && store_itin_score_bound_best_itins(search_ctx.score_bound, calc_data.best_itins_filepath))
+			printf("%d best itineraries written to %s\n", get_num_itin_score_bound_best_itins(search_ctx.score_bound), calc_data.best_itins_filepath);
+		free_itin_score_bound(search_ctx.score_bound);
+	}
+	free(dep_order);
+	free(thread_args);
+
+	print_initial_transfer_stats(&initial_transfer_stats);
+	int num_skipped_deps = atomic_load(&memory_budget.num_skipped_deps);
+	if(num_skipped_deps > 0) {
+		printf("Memory budget of %.1f MB exceeded: %d departure dates skipped\n", calc_data.max_memory/1e6, num_skipped_deps);
+		// the result set is incomplete, the caller gets the missing departure dates
+		results.skipped_dep_dates = (double *) malloc(num_skipped_deps * sizeof(double));
+		for(int i = 0; i < num_deps; i++) {
+			if(memory_budget.is_skipped[i]) results.skipped_dep_dates[results.num_skipped_deps++] = calc_data.jd_min_dep + i*calc_data.step_dep_date;
+		}
+	}
+	free(memory_budget.is_skipped);
+	struct Lambert_Cache_Stats lambert_cache_stats = get_lambert_cache_stats();
+	printf("Lambert cache: %ld hits, %ld misses, %ld evictions (%d/%d entries)\n",
+		   lambert_cache_stats.num_hits - lambert_cache_stats0.num_hits, lambert_cache_stats.num_misses - lambert_cache_stats0.num_misses,
+		   lambert_cache_stats.num_evictions - lambert_cache_stats0.num_evictions, lambert_cache_stats.num_entries, lambert_cache_stats.max_entries);
+	destroy_thread_mutex(&initial_transfer_stats.lock);
+
+	if(itin_stats != NULL) {
+		stop_itin_stats_snapshots(itin_stats);
+		if(store_itin_stats_json(itin_stats, calc_data.stats_filepath) && strcmp(calc_data.stats_filepath, "-") != 0)
+			printf("Search statistics written to %s\n", calc_data.stats_filepath);
+		free_itin_stats(itin_stats);
+	}
+
+	if(result_writer != NULL) {
+		close_result_writer(result_writer);
+		destroy_thread_pool(writer_pool);
+
+		gettimeofday(&end, NULL);  // Record the ending time
+		elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+		printf("----- | Total elapsed time: %.3f s | ---------\n", elapsed_time);
+		printf("\n%d itineraries found!\nNumber of Nodes: %d\nArena size: %.1f MB\n", result_writer->num_itins, result_writer->num_nodes, get_itin_arena_num_bytes(arena)/1e6);
+
+		results.num_deps = result_writer->num_deps;
+		results.num_nodes = result_writer->num_nodes;
+		results.num_itins = result_writer->num_itins;
+
+		// everything is written, remaining steps (cancelled departures) are freed with the arena
+		free_itin_arena(arena);
+		free(departures);
+		free(result_writer->finished_indices);
+		free(result_writer->completed_deps);
+		destroy_thread_cond(&result_writer->cond);
+		destroy_thread_mutex(&result_writer->lock);
+		free(result_writer);
+		return results;
+	}
 
 	// remove departure dates with no valid itinerary
 	for(int i = 0; i < num_deps; i++) {
@@ -269,24 +869,44 @@ struct Itin_Calc_Results search_for_itineraries(Itin_Calc_Data calc_data) {
 	for(int i = 0; i < num_deps; i++) num_itins += get_number_of_itineraries(departures[i]);
 	for(int i = 0; i < num_deps; i++) num_nodes += get_total_number_of_stored_steps(departures[i]);
 
-	printf("\n%d itineraries found!\nNumber of Nodes: %d\n", num_itins, num_nodes);
+	printf("\n%d itineraries found!\nNumber of Nodes: %d\nArena size: %.1f MB\n", num_itins, num_nodes, get_itin_arena_num_bytes(arena)/1e6);
 
 	results.departures = departures;
 	results.num_deps = num_deps;
 	results.num_nodes = num_nodes;
 	results.num_itins = num_itins;
+	results.arena = arena;
 
 	return results;
 }
 
 struct Transfer_Calc_Status get_current_transfer_calc_status() {
-	double jd_diff = thread_progress_and_prop_info.jd_max_dep-thread_progress_and_prop_info.jd_min_dep+1;
-	int num_deps = get_thread_counter(1);
-
-	return (struct Transfer_Calc_Status) {
-		.num_itins = get_thread_counter(2),
-		.num_deps = num_deps,
-		.jd_diff = jd_diff,
-		.progress = (double)num_deps/jd_diff
-	};
-}
\ No newline at end of file
+	struct Transfer_Calc_Status status = {0};
+	Itin_Search_Progress progress;
+	if(get_current_itin_search_progress(&progress) && progress.num_all_deps > 0) {
+		status = (struct Transfer_Calc_Status) {
+			.num_itins = (int) progress.num_itins,
+			.num_deps = (int) progress.num_deps,
+			.jd_diff = progress.num_all_deps,
+			.progress = (double) progress.num_deps/progress.num_all_deps,
+			.is_cancelled = progress.is_cancelled
+		};
+	}
+	return status;
+}
+
+void cancel_current_transfer_calc() {
+	cancel_current_itin_search();
+}
+
+void free_itin_calc_results(Itin_Calc_Results *results) {
+	if(results->arena != NULL) free_itin_arena(results->arena);
+	else if(results->departures != NULL) for(int i = 0; i < results->num_deps; i++) free_itinerary(results->departures[i]);
+	free(results->departures);
+	free(results->skipped_dep_dates);
+	results->departures = NULL;
+	results->arena = NULL;
+	results->skipped_dep_dates = NULL;
+	results->num_deps = 0;
+	results->num_skipped_deps = 0;
+}
@@ -5,6 +5,16 @@
 #include "tools/celestial_systems.h"
 
 
+extern const int NUM_INITIAL_TRANSFERS_PER_BODY;	// default resolution of the initial transfer sweep
+
+// receives each departure as soon as all its itineraries are calculated (called from a single writer thread; the departure is freed afterwards)
+typedef struct Itin_Result_Sink {
+	void (*store_departure)(struct ItinStep *departure, void *sink_data);
+	// optional (NULL: no checkpoints); called periodically and at the end with completed_deps[index] != 0 for every departure date that has been handed to store_departure
+	void (*store_checkpoint)(const char *completed_deps, int num_all_deps, void *sink_data);
+	void *sink_data;
+} Itin_Result_Sink;
+
 typedef struct Itin_Calc_Data {
 	double jd_min_dep;
 	double jd_max_dep;
@@ -13,13 +23,39 @@ typedef struct Itin_Calc_Data {
 	double step_dep_date;
 	int num_deps_per_date;
 	int max_num_waiting_orbits;
+	int num_threads;	// number of worker threads (<= 0: default thread pool size)
+	int max_task_depth;	// next steps of steps with a lower depth (departure: 0) are calculated as separate tasks (0: default, < 0: one task per departure date)
+	int min_task_num_next_nodes;	// minimum number of next steps for calculating them as separate tasks (<= 0: default)
 	struct Dv_Filter dv_filter;
+	struct Prune_Filter prune_filter;	// pruning of equivalent next steps (is_enabled = 0: none)
 	ItinSequenceInfo seq_info;
+	Itin_Result_Sink *result_sink;	// NULL: all departures are kept in memory and returned in the results
+	const char *completed_deps;		// resuming: departure dates with completed_deps[index] != 0 are skipped (NULL: calculate all)
+	double max_ephem_cache_error;	// > 0: body states are interpolated from tables with this maximum position error in meters (<= 0: no ephemeris cache, exact states)
+	double max_ephem_cache_vel_error;	// maximum velocity error of interpolated body states in meters per second (<= 0: default; only with max_ephem_cache_error > 0)
+	int num_arr_dates_per_body;		// resolution of the initial transfer sweep (arrival dates per body; <= 1: default)
+	double min_arr_window;			// initial transfer sweep: feasible arrival date windows at least this wide [days] are always found, narrower ones can be skipped (<= 0: all arrival dates are evaluated)
+	int meet_in_the_middle;			// specific sequences with at least 3 steps: steps up to the middle body are joined with steps calculated backwards from the arrival (0: forward only)
+	double mitm_max_date_diff;		// meet in the middle: maximum difference of the joined flyby dates [days] (<= 0: default)
+	double mitm_max_vinf_diff;		// meet in the middle: maximum difference of incoming and outgoing excess velocity of the joined flybys [m/s] (<= 0: default)
+	struct Itin_Search_Status *status;	// progress and cancellation of this search (NULL: created by the search; searches with their own status can run at the same time)
+	const char *stats_filepath;		// instrumentation: statistics are written to this JSON file at the end ("-": stdout; NULL: disabled)
+	double stats_snapshot_interval;	// instrumentation: the statistics file is also written every this many seconds during the search (<= 0: only at the end)
+	double max_memory;				// memory budget of the steps in bytes: departure dates started after the search outgrew it are skipped (resumable; <= 0: no limit)
+	int hide_progress;				// no progress output (e.g. several searches running at the same time)
+	int score_top_k;				// > 0: branch-and-bound on the competition score, steps that can't beat the score_top_k best itineraries found so far are cut (0: all itineraries are kept)
+	// anytime search
+	double max_search_time;			// seconds of wall-clock time until the search is stopped like a cancelled one (<= 0: no limit)
+	const char *best_itins_filepath;	// .itins file of the score_top_k best itineraries (NULL: not stored; needs score_top_k > 0)
+	double best_itins_snapshot_interval;	// the best itineraries are also written every this many seconds if they changed (<= 0: DEFAULT_BEST_ITINS_SNAPSHOT_INTERVAL)
 } Itin_Calc_Data;
 
 typedef struct Itin_Calc_Results {
-	struct ItinStep **departures;
+	struct ItinStep **departures;	// NULL if departures were handed to the result sink (counts still describe all found itineraries)
 	int num_deps, num_nodes, num_itins;
+	struct Itin_Arena *arena;	// all steps of the departures are allocated from this arena (NULL: malloc)
+	double *skipped_dep_dates;	// departure dates skipped because of the memory budget (result set incomplete; NULL if none)
+	int num_skipped_deps;
 } Itin_Calc_Results;
 
 typedef struct Transfer_Calc_Status {
@@ -27,10 +63,15 @@ typedef struct Transfer_Calc_Status {
 	int num_deps;
 	double jd_diff;
 	double progress;
+	int is_cancelled;
 } Transfer_Calc_Status;
 
 Itin_Calc_Results search_for_itineraries(Itin_Calc_Data calc_data);
 
 Transfer_Calc_Status get_current_transfer_calc_status();
 
+void cancel_current_transfer_calc();
+
+void free_itin_calc_results(Itin_Calc_Results *results);
+
 #endif //KSP_TRANSFER_CALC_H
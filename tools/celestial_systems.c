@@ -1,9 +1,9 @@
 #include <string.h>
 #include <stdlib.h>
-#include <gtk/gtk.h>
 #include "celestial_systems.h"
 #include "tools/file_io.h"
 #include "competition_tools.h"
+#include "ephem_cache.h"
 
 CelestSystem **available_systems;
 
@@ -51,5 +51,6 @@ CelestSystem * get_system_by_name(char *name) {
 }
 
 void free_all_celestial_systems() {
+	free_all_ephem_caches();
 	free_celestial_systems(available_systems, num_available_systems);
 }
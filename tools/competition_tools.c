@@ -6,6 +6,8 @@
 #include "orbit_calculator/transfer_calc.h"
 #include "file_io.h"
 
+const int MITM_MIN_NUM_STEPS = 6;	// sequences with at least this many steps are searched with meet in the middle
+
 enum FILE_TYPE {COMP_FILE_PLANET, COMP_FILE_COMET, COMP_FILE_ASTEROID};
 
 void parse_celestial_body_line(const char *line, enum FILE_TYPE type, Body *new_body) {
@@ -126,6 +128,7 @@ struct ItinStep * attach_initial_competition_state(struct ItinStep *step) {
 	new_step->next[0] = ptr;
 	new_step->prev = NULL;
 	new_step->had_low_perihelion = false;
+	new_step->is_end_node = false;
 	new_step->num_next_nodes = 1;
 	ptr->prev = new_step;
 	
@@ -380,9 +383,25 @@ double calc_seasonal_penalty(Competition_Transfer *transfer) {
 	return 0.1 + (0.9/(1+10*s));
 }
 
+static double calc_velocity_penalty(double c3) {
+	double v_inf = sqrt(c3)/1e3;
+	return 0.2 + exp(-v_inf/13) / (1+exp(-5*(v_inf-1.5)));
+}
+
 double calc_flyby_velocity_penalty(Competition_Transfer *transfer) {
-	double v_inf = sqrt(transfer->c3)/1e3;
-	return 0.2 + exp(-v_inf/13) / (1+exp(-5*(v_inf-1.5)));;
+	return calc_velocity_penalty(transfer->c3);
+}
+
+double get_max_competition_flyby_factor() {
+	// seasonal penalty is at most 1 (no earlier flyby of the body); velocity penalty has a single maximum at a few km/s
+	// (sampled every 0.5 m/s up to 50 km/s, the margin keeps the factor above the exact maximum)
+	double max_penalty = 0;
+	for(int i = 0; i <= 100000; i++) {
+		double v_inf = i * 0.5;
+		double penalty = calc_velocity_penalty(v_inf*v_inf);
+		if(penalty > max_penalty) max_penalty = penalty;
+	}
+	return max_penalty + 1e-6;
 }
 
 double get_competition_flyby_score(Competition_Transfer *transfer) {
@@ -404,45 +423,64 @@ double get_competition_body_score(Competition_Transfer *transfer) {
 	return score;
 }
 
-double get_itin_competition_score(struct ItinStep *arr_step, CelestSystem *system) {
-	double b = is_grand_tour() ? 1.2 : 1;
-	
-	Competition_Transfer **transfers = build_competition_transfer_from_itin(arr_step, system);
-	
-	double score = 0;
-	Competition_Transfer *ptr;
-	
-	for(int i = 1; i < 3000; i++) {
-		score += get_competition_body_score(transfers[i]);
+// score of a flyby at body with position r (seasonal penalty from the earlier flybys of body at prev and before)
+static double get_itin_flyby_score(Body *body, Vector3 r, double c3, struct ItinStep *prev) {
+	double s = 0;
+	Vector3 r_i = norm_vec3(r);
+	for(struct ItinStep *ptr = prev; ptr != NULL; ptr = ptr->prev) {
+		if(ptr->body != body) continue;
+		Vector3 r_j = norm_vec3(ptr->r);
+		double acosd = rad2deg(acos(dot_vec3(r_i, r_j)));
+		s += exp(-(acosd*acosd)/50);
 	}
+	double seasonal_penalty = 0.1 + (0.9/(1+10*s));
+	return body->scale_height * seasonal_penalty * calc_velocity_penalty(c3);
+}
 
-	ptr = transfers[0];
+// score state after the transfer from step->prev to step (same rules as the flyby lists of build_competition_transfer_from_itin)
+static struct Itin_Score_State get_next_itin_score_state(struct ItinStep *step, struct Itin_Score_State state, CelestSystem *system) {
+	struct ItinStep *prev = step->prev;
+	if(prev == NULL) return (struct Itin_Score_State) {0};
+	if(state.is_invalid || step->body == NULL || prev->body == NULL) return state;
 
-	bool was_below_0_05 = false;
-	while(ptr != NULL) {
-		if(ptr->rp/AU < 0.05) {
-			if(was_below_0_05 || ptr->rp/AU < 0.01) { free_competition_transfer_list(transfers, 3000); return 0; }
-			else was_below_0_05 = true;
-		}
-		ptr = ptr->next;
+	double rp = mag_vec3(calc_heliocentric_periapsis(prev->r, step->v_dep, step->r, step->v_arr, system));
+	if(rp/AU < 0.05) {
+		if(state.had_low_perihelion || rp/AU < 0.01) state.is_invalid = true;
+		state.had_low_perihelion = true;
 	}
-	
-	for(int i = 1; i < 3000; i++) {
-		ptr = transfers[i];
-		while(ptr != NULL) {
-			if(ptr->rp > 0) {
-				if(ptr->rp/ptr->body->radius - 1 < 0.1 || ptr->rp/ptr->body->radius - 1 > 100) {
-					free_competition_transfer_list(transfers, 3000);
-					return 0;
-				}
-			}
-			ptr = ptr->next;
-		}
+
+	if(prev->prev == NULL) {
+		// departure counts as flyby with the excess velocity of the first transfer
+		double v_inf = mag_vec3(subtract_vec3(step->v_dep, prev->v_body));
+		state.score += get_itin_flyby_score(prev->body, prev->r, v_inf*v_inf, NULL);
+	} else {
+		// arrival at the previous step became a flyby
+		double rp_flyby = get_flyby_periapsis(prev->v_arr, step->v_dep, prev->v_body, prev->body);
+		if(rp_flyby > 0 && (rp_flyby/prev->body->radius - 1 < 0.1 || rp_flyby/prev->body->radius - 1 > 100)) state.is_invalid = true;
 	}
-	
-	free_competition_transfer_list(transfers, 3000);
-	
-	return score;
+
+	double v_inf = mag_vec3(subtract_vec3(step->v_arr, step->v_body));
+	state.score += get_itin_flyby_score(step->body, step->r, v_inf*v_inf, prev);
+	return state;
+}
+
+static struct Itin_Score_State calc_itin_score_state(struct ItinStep *step, CelestSystem *system) {
+	if(step->prev == NULL) return (struct Itin_Score_State) {0};
+	return get_next_itin_score_state(step, calc_itin_score_state(step->prev, system), system);
+}
+
+double get_itin_competition_score(struct ItinStep *arr_step, CelestSystem *system) {
+	struct Itin_Score_State state = calc_itin_score_state(arr_step, system);
+	return state.is_invalid ? 0 : state.score;
+}
+
+void update_itin_step_score(struct ItinStep *step, CelestSystem *system) {
+	step->score_state = step->prev != NULL ? get_next_itin_score_state(step, step->prev->score_state, system) : (struct Itin_Score_State) {0};
+}
+
+void update_itin_score_states(struct ItinStep *step, CelestSystem *system) {
+	update_itin_step_score(step, system);
+	for(int i = 0; i < step->num_next_nodes; i++) update_itin_score_states(step->next[i], system);
 }
 
 void print_itin_competition_score(struct ItinStep *arr_step, CelestSystem *system) {
@@ -512,14 +550,13 @@ void print_itin_competition_score(struct ItinStep *arr_step, CelestSystem *syste
 	free_competition_transfer_list(transfers, 3000);
 }
 
-void run_competition_calc(char *load_filename, char *store_filename, CelestSystem *system) {
-	struct Itin_Calc_Data calc_data;
-	struct Itin_Calc_Results ic_results;
+int load_competition_calc_data(char *load_filename, CelestSystem *system, Itin_Calc_Data *calc_data) {
+	*calc_data = (Itin_Calc_Data) {0};
 	
 	FILE *file = fopen(load_filename, "r");
 	if(!file) {
 		perror("Failed to open file");
-		return;
+		return 0;
 	}
 	char line[256];  // Buffer for each line
 	// skip first line
@@ -532,12 +569,12 @@ void run_competition_calc(char *load_filename, char *store_filename, CelestSyste
 	
 	sscanf(line,
 		   "%lf,%lf,%lf,%lf,%lf,%lf,%d",
-		   &calc_data.jd_min_dep,
-		   &calc_data.jd_max_dep,
-		   &calc_data.step_dep_date,
-		   &calc_data.jd_max_arr,
-		   &calc_data.max_duration,
-		   &calc_data.dv_filter.max_totdv,
+		   &calc_data->jd_min_dep,
+		   &calc_data->jd_max_dep,
+		   &calc_data->step_dep_date,
+		   &calc_data->jd_max_arr,
+		   &calc_data->max_duration,
+		   &calc_data->dv_filter.max_totdv,
 		   &calc_type
 	);
 	
@@ -567,9 +604,7 @@ void run_competition_calc(char *load_filename, char *store_filename, CelestSyste
 			};
 			
 			seq_info_tt.flyby_bodies = fly_by_bodies;
-			calc_data.seq_info.to_target = seq_info_tt;
-			break;
-		case CCT_ItinFromFb:
+			calc_data->seq_info.to_target = seq_info_tt;
 			break;
 		case CCT_Sequence:
 			fly_by_bodies = malloc(100 * sizeof(Body*));
@@ -586,33 +621,122 @@ void run_competition_calc(char *load_filename, char *store_filename, CelestSyste
 			seq_info_spec.num_steps = counter;
 			seq_info_spec.bodies = fly_by_bodies;
 			seq_info_spec.system = system;
-			calc_data.seq_info.spec_seq = seq_info_spec;
-			
+			calc_data->seq_info.spec_seq = seq_info_spec;
+			break;
+		default:
+			printf("Calculation type %d is not supported (%s)\n", calc_type, load_filename);
+			fclose(file);
+			return 0;
 	}
 	
 	fclose(file);
 	
 	
-	calc_data.dv_filter.max_depdv = calc_data.dv_filter.max_totdv;
-	calc_data.dv_filter.max_satdv = calc_data.dv_filter.max_totdv;
-	calc_data.dv_filter.last_transfer_type = TF_FLYBY;
+	calc_data->dv_filter.max_depdv = calc_data->dv_filter.max_totdv;
+	calc_data->dv_filter.max_satdv = calc_data->dv_filter.max_totdv;
+	calc_data->dv_filter.last_transfer_type = TF_FLYBY;
 	
-	calc_data.dv_filter.dep_periapsis = 1e9;
-	calc_data.dv_filter.arr_periapsis = 1e9;
+	calc_data->dv_filter.dep_periapsis = 1e9;
+	calc_data->dv_filter.arr_periapsis = 1e9;
 	
-	calc_data.num_deps_per_date = 500;
-	calc_data.max_num_waiting_orbits = 0;
+	calc_data->num_deps_per_date = 500;
+	calc_data->max_num_waiting_orbits = 0;
+	return 1;
+}
+
+void free_competition_calc_data(Itin_Calc_Data *calc_data) {
+	if(calc_data->seq_info.to_target.type == ITIN_SEQ_INFO_TO_TARGET) free(calc_data->seq_info.to_target.flyby_bodies);
+	else free(calc_data->seq_info.spec_seq.bodies);
+}
+
+// overwrite calc data with the given run settings (NULL: keep everything)
+static void apply_competition_calc_settings(Itin_Calc_Data *calc_data, struct Competition_Calc_Settings *settings) {
+	if(settings == NULL) return;
+	calc_data->num_threads = settings->num_threads;
+	calc_data->max_memory = settings->max_memory;
+	calc_data->stats_filepath = settings->stats_filepath;
+	calc_data->stats_snapshot_interval = settings->stats_snapshot_interval;
+	calc_data->hide_progress = settings->hide_progress;
+	calc_data->score_top_k = settings->score_top_k;
+	calc_data->max_search_time = settings->max_search_time;
+	calc_data->best_itins_filepath = settings->best_itins_filepath;
+	calc_data->min_arr_window = settings->min_arr_window;
+	calc_data->max_ephem_cache_error = settings->max_ephem_cache_error;
+	// equivalent branches are only expanded once
+	if(settings->prune_equivalent_steps) calc_data->prune_filter = (struct Prune_Filter) {.is_enabled = 1, .use_competition_score = 1};
+	// long sequences are joined at the middle body
+	calc_data->meet_in_the_middle = settings->use_meet_in_the_middle && calc_data->seq_info.to_target.type == ITIN_SEQ_INFO_SPEC_SEQ &&
+									calc_data->seq_info.spec_seq.num_steps >= MITM_MIN_NUM_STEPS;
+	calc_data->status = settings->status;
+}
+
+int run_competition_calc(char *load_filename, char *store_filename, CelestSystem *system, struct Competition_Calc_Settings *settings) {
+	struct Itin_Calc_Data calc_data;
+	struct Itin_Calc_Results ic_results;
+	if(!load_competition_calc_data(load_filename, system, &calc_data)) return 0;
+	apply_competition_calc_settings(&calc_data, settings);
+	
+	// departures are written to the file while the search is still running
+	struct ItinsBFileWriter *writer = open_itins_bfile_writer(calc_data, system, store_filename, get_current_bin_file_type());
+	if(writer == NULL) {
+		free_competition_calc_data(&calc_data);
+		return 0;
+	}
+	Itin_Result_Sink result_sink = get_checkpointed_itins_bfile_result_sink(writer);
+	calc_data.result_sink = &result_sink;
 	
 	ic_results = search_for_itineraries(calc_data);
 	
-	
-	if(ic_results.departures == NULL || ic_results.num_deps == 0) return;
-	store_itineraries_in_bfile(ic_results.departures, ic_results.num_nodes, ic_results.num_deps, ic_results.num_itins,
-							   calc_data, system, store_filename, get_current_bin_file_type());
-	for(int i = 0; i < ic_results.num_deps; i++) free_itinerary(ic_results.departures[i]);
-	free(ic_results.departures);
-	free(fly_by_bodies);
+	close_itins_bfile_writer(writer);
 	if(ic_results.num_deps == 0) printf("No itineraries found!");
+	free_itin_calc_results(&ic_results);
+	free_competition_calc_data(&calc_data);
+	return 1;
+}
+
+int resume_competition_calc(char *store_filename, CelestSystem *system, struct Competition_Calc_Settings *settings) {
+	ItinStepBinHeaderData header;
+	char *completed_deps;
+	int num_all_deps;
+	struct ItinsBFileWriter *writer = resume_itins_bfile_writer(store_filename, system, &header, &completed_deps, &num_all_deps);
+	if(writer == NULL) return 0;
+	
+	Itin_Calc_Data calc_data = header.calc_data;
+	
+	// the file stores bodies as system indices --> use the same bodies of the given system
+	if(calc_data.seq_info.to_target.type == ITIN_SEQ_INFO_TO_TARGET) {
+		struct ItinSequenceInfoToTarget *seq_info = &calc_data.seq_info.to_target;
+		seq_info->system = system;
+		seq_info->dep_body = system->bodies[get_body_system_id(seq_info->dep_body, header.system)];
+		seq_info->arr_body = system->bodies[get_body_system_id(seq_info->arr_body, header.system)];
+		for(int i = 0; i < seq_info->num_flyby_bodies; i++) seq_info->flyby_bodies[i] = system->bodies[get_body_system_id(seq_info->flyby_bodies[i], header.system)];
+	} else {
+		struct ItinSequenceInfoSpecItin *seq_info = &calc_data.seq_info.spec_seq;
+		seq_info->system = system;
+		for(int i = 0; i < seq_info->num_steps; i++) seq_info->bodies[i] = system->bodies[get_body_system_id(seq_info->bodies[i], header.system)];
+	}
+	apply_competition_calc_settings(&calc_data, settings);
+	
+	int num_deps = (int) ((calc_data.jd_max_dep-calc_data.jd_min_dep)/calc_data.step_dep_date) + 1;
+	int is_resumed = num_deps == num_all_deps;
+	if(is_resumed) {
+		int num_completed_deps = 0;
+		for(int i = 0; i < num_all_deps; i++) if(completed_deps[i]) num_completed_deps++;
+		printf("Resuming search (%d of %d departure dates already calculated)\n", num_completed_deps, num_all_deps);
+		
+		Itin_Result_Sink result_sink = get_checkpointed_itins_bfile_result_sink(writer);
+		calc_data.result_sink = &result_sink;
+		calc_data.completed_deps = completed_deps;
+		
+		struct Itin_Calc_Results ic_results = search_for_itineraries(calc_data);
+		free_itin_calc_results(&ic_results);
+	} else printf("Checkpoint does not match the .itins file\n");
+	
+	close_itins_bfile_writer(writer);
+	free(completed_deps);
+	free_competition_calc_data(&calc_data);
+	free_celestial_system(header.system);
+	return is_resumed;
 }
 
 void store_competition_flyby_arc_arrival(FILE *file, struct ItinStep *step) {
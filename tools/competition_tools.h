@@ -3,18 +3,57 @@
 
 #include "orbitlib.h"
 #include "orbit_calculator/itin_tool.h"
+#include "orbit_calculator/transfer_calc.h"
 
 #define AU 149597870691.0
 
 CelestSystem * load_competition_system(char *directory);
 
+// competition score of the itinerary ending at arr_step (recalculated along the itinerary, also valid without up-to-date score states)
 double get_itin_competition_score(struct ItinStep *arr_step, CelestSystem *system);
 
+// derive the score state of step from the score state of its previous step (departure: empty state)
+// (only the earlier flybys of the same body are revisited; the previous step's state needs to be up to date)
+void update_itin_step_score(struct ItinStep *step, CelestSystem *system);
+
+// update the score states of step and all of its next steps (the previous step's state needs to be up to date)
+void update_itin_score_states(struct ItinStep *step, CelestSystem *system);
+
 void print_itin_competition_score(struct ItinStep *arr_step, CelestSystem *system);
 
+// largest score of a single flyby per unit of body weight (best seasonal and velocity penalty)
+double get_max_competition_flyby_factor();
+
 Vector3 calc_heliocentric_periapsis(Vector3 r_dep, Vector3 v_dep, Vector3 r_arr, Vector3 v_arr, CelestSystem *system);
 
-void run_competition_calc(char *load_filename, char *store_filename, CelestSystem *system);
+// read search settings from a queue file (returns 0 if the file can not be read or its calculation type is not supported)
+int load_competition_calc_data(char *load_filename, CelestSystem *system, Itin_Calc_Data *calc_data);
+
+// free the body arrays of calc data loaded with load_competition_calc_data
+void free_competition_calc_data(Itin_Calc_Data *calc_data);
+
+// settings of a run that are not part of the queue file
+struct Competition_Calc_Settings {
+	int num_threads;				// <= 0: default thread pool size
+	double max_memory;				// memory budget of the search in bytes (<= 0: no limit)
+	const char *stats_filepath;		// instrumentation JSON (NULL: disabled)
+	double stats_snapshot_interval;	// seconds between statistics snapshots (<= 0: only at the end)
+	int hide_progress;
+	int score_top_k;				// > 0: only the score_top_k best-scoring itineraries are searched for (branch-and-bound)
+	double max_search_time;			// seconds until the search is stopped (<= 0: no limit)
+	const char *best_itins_filepath;	// .itins file of the score_top_k best itineraries, also written during the search (NULL: not stored)
+	double min_arr_window;			// > 0: initial transfer sweep only guarantees feasible arrival date windows at least this wide [days] (<= 0: exhaustive)
+	int use_meet_in_the_middle;		// search sequences of 6 or more steps with meet in the middle (lossy; not stored in the .itins file --> pass again when resuming)
+	int prune_equivalent_steps;		// prune dominated and near-duplicate sibling steps (lossy; not stored in the .itins file --> pass again when resuming)
+	double max_ephem_cache_error;	// > 0: body states are interpolated from tables with this maximum position error [m] (<= 0: exact states)
+	struct Itin_Search_Status *status;	// progress and cancellation of the search (NULL: created by the search)
+};
+
+// search itineraries described by the queue file and write them to store_filename (settings NULL: defaults; returns 0 if the search could not be started)
+int run_competition_calc(char *load_filename, char *store_filename, CelestSystem *system, struct Competition_Calc_Settings *settings);
+
+// continue a cancelled or crashed run_competition_calc from the checkpoint next to its .itins file (returns 0 if the search could not be resumed)
+int resume_competition_calc(char *store_filename, CelestSystem *system, struct Competition_Calc_Settings *settings);
 
 void store_competition_solution(char *filepath, struct ItinStep *step);
 
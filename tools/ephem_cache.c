@@ -0,0 +1,360 @@
+#include "ephem_cache.h"
+#include "tools/thread_pool.h"
+#include "orbit_calculator/kepler_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#define EPHEM_CACHE_MAX_SYSTEMS 32
+#define EPHEM_CACHE_MAX_NODES_PER_BODY 1000000
+#define EPHEM_CACHE_MAX_STEP_REFINEMENTS 20
+
+
+// nodes of one body (fixed step; per node: r, v, a, jerk)
+struct Ephem_Cache_Table {
+	Body *body;
+	double jd0, step;		// days
+	double jd_max;
+	double max_pos_error, max_vel_error;
+	int num_nodes;			// 0: no interpolation table (only Kepler orbit)
+	double *nodes;			// 12 values per node
+	int has_kepler_orbit;	// orbital elements: tables and batch lookups are calculated with the Kepler batch
+	struct Kepler_Batch_Orbit kepler_orbit;
+	struct Ephem_Cache_Table *next_owned;
+};
+
+// immutable index of the tables of one system (a new version is published when bodies or dates are added)
+struct Ephem_Cache {
+	CelestSystem *system;
+	int hash_size;			// power of 2
+	struct Ephem_Cache_Table **hash;
+	struct Ephem_Cache_Table *owned_tables;		// tables of this and all previous versions
+	struct Ephem_Cache *prev_version;			// still referenced by readers that started before the current version was published
+};
+
+static _Atomic(struct Ephem_Cache *) ephem_caches[EPHEM_CACHE_MAX_SYSTEMS];
+static thread_mutex_t ephem_caches_lock = THREAD_MUTEX_INITIALIZER;
+
+
+static OSV calc_body_state(CelestSystem *system, Body *body, double jd) {
+	return system->prop_method == ORB_ELEMENTS ?
+		   osv_from_elements(body->orbit, jd) :
+		   osv_from_ephem(body->ephem, body->num_ephems, jd, system->cb);
+}
+
+static int get_body_hash(Body *body, int hash_size) {
+	uint64_t h = (uint64_t) (uintptr_t) body * 0x9E3779B97F4A7C15ull;
+	return (int) ((h >> 32) & (uint64_t) (hash_size-1));
+}
+
+static struct Ephem_Cache_Table * find_ephem_cache_table(struct Ephem_Cache *cache, Body *body) {
+	int i = get_body_hash(body, cache->hash_size);
+	while(cache->hash[i] != NULL) {
+		if(cache->hash[i]->body == body) return cache->hash[i];
+		i = (i+1) & (cache->hash_size-1);
+	}
+	return NULL;
+}
+
+static void insert_ephem_cache_table(struct Ephem_Cache *cache, struct Ephem_Cache_Table *table) {
+	int i = get_body_hash(table->body, cache->hash_size);
+	while(cache->hash[i] != NULL && cache->hash[i]->body != table->body) i = (i+1) & (cache->hash_size-1);
+	cache->hash[i] = table;
+}
+
+// states of the table's body at the given dates
+static void calc_ephem_cache_table_states(CelestSystem *system, struct Ephem_Cache_Table *table, const double *jds, OSV *osvs, int num) {
+	if(table->has_kepler_orbit) {
+		int *orbit_indices = (int *) calloc(num, sizeof(int));
+		osv_from_kepler_batch(&table->kepler_orbit, orbit_indices, jds, osvs, num);
+		free(orbit_indices);
+	} else {
+		for(int i = 0; i < num; i++) osvs[i] = calc_body_state(system, table->body, jds[i]);
+	}
+}
+
+static void store_ephem_cache_node(double mu, OSV osv, double *node) {
+	double r = sqrt(osv.r.x*osv.r.x + osv.r.y*osv.r.y + osv.r.z*osv.r.z);
+	double r3 = r*r*r;
+	double rv = osv.r.x*osv.v.x + osv.r.y*osv.v.y + osv.r.z*osv.v.z;
+	double r_arr[3] = {osv.r.x, osv.r.y, osv.r.z};
+	double v_arr[3] = {osv.v.x, osv.v.y, osv.v.z};
+	// two-body acceleration and jerk around the central body
+	for(int k = 0; k < 3; k++) {
+		node[k] = r_arr[k];
+		node[3+k] = v_arr[k];
+		node[6+k] = -mu*r_arr[k]/r3;
+		node[9+k] = -mu*(v_arr[k]/r3 - 3*rv*r_arr[k]/(r3*r*r));
+	}
+}
+
+// quintic Hermite interpolation between two nodes (s in [0,1], h: step in seconds)
+static OSV interpolate_ephem_cache_nodes(const double *n0, const double *n1, double s, double h) {
+	double s2 = s*s, s3 = s2*s, s4 = s3*s, s5 = s4*s;
+	double h0 = 1 - 10*s3 + 15*s4 - 6*s5;
+	double h1 = s - 6*s3 + 8*s4 - 3*s5;
+	double h2 = 0.5*s2 - 1.5*s3 + 1.5*s4 - 0.5*s5;
+	double h3 = 0.5*s3 - s4 + 0.5*s5;
+	double h4 = -4*s3 + 7*s4 - 3*s5;
+	double h5 = 10*s3 - 15*s4 + 6*s5;
+	double r[3], v[3];
+	for(int k = 0; k < 3; k++) {
+		r[k] = h0*n0[k] + h1*h*n0[3+k] + h2*h*h*n0[6+k] + h3*h*h*n1[6+k] + h4*h*n1[3+k] + h5*n1[k];
+		v[k] = h0*n0[3+k] + h1*h*n0[6+k] + h2*h*h*n0[9+k] + h3*h*h*n1[9+k] + h4*h*n1[6+k] + h5*n1[3+k];
+	}
+	return (OSV) {vec3(r[0], r[1], r[2]), vec3(v[0], v[1], v[2])};
+}
+
+static OSV interpolate_ephem_cache_table(struct Ephem_Cache_Table *table, double jd) {
+	double x = (jd - table->jd0) / table->step;
+	int i = (int) x;
+	if(i >= table->num_nodes-1) i = table->num_nodes-2;
+	return interpolate_ephem_cache_nodes(&table->nodes[12*i], &table->nodes[12*(i+1)], x - i, table->step*86400);
+}
+
+// table without nodes (only the Kepler orbit for batch lookups)
+static struct Ephem_Cache_Table * create_kepler_ephem_cache_table(CelestSystem *system, Body *body, double jd_ref) {
+	struct Ephem_Cache_Table *table = (struct Ephem_Cache_Table *) calloc(1, sizeof(struct Ephem_Cache_Table));
+	table->body = body;
+	table->jd0 = INFINITY;
+	table->jd_max = -INFINITY;
+	table->max_pos_error = INFINITY;
+	table->max_vel_error = INFINITY;
+	table->has_kepler_orbit = system->prop_method == ORB_ELEMENTS;
+	if(table->has_kepler_orbit) table->kepler_orbit = prepare_kepler_batch_orbit(body->orbit, jd_ref);
+	return table;
+}
+
+// builds the table with the largest step that satisfies max_pos_error and max_vel_error at all interval midpoints (NULL if not possible)
+// (excess velocities of transfers and flybys depend on the interpolated velocities --> checked separately from the positions)
+static struct Ephem_Cache_Table * create_ephem_cache_table(CelestSystem *system, Body *body, double jd_min, double jd_max, double max_pos_error, double max_vel_error) {
+	struct Ephem_Cache_Table *table = create_kepler_ephem_cache_table(system, body, jd_min);
+
+	// start with the step of a quintic Hermite error bound for a circular orbit at the body's current angular rate
+	OSV osv;
+	calc_ephem_cache_table_states(system, table, &jd_min, &osv, 1);
+	double r = mag_vec3(osv.r);
+	double angular_rate = mag_vec3(cross_vec3(osv.r, osv.v)) / (r*r);	// rad/s
+	double step = angular_rate > 0 ? pow(46080*max_pos_error/r, 1.0/6) / angular_rate / 86400 : jd_max-jd_min;
+	if(step > jd_max-jd_min) step = jd_max-jd_min;
+	if(step <= 0) step = 1;
+
+	table->jd0 = jd_min;
+	table->max_pos_error = max_pos_error;
+	table->max_vel_error = max_vel_error;
+
+	for(int refinement = 0; refinement < EPHEM_CACHE_MAX_STEP_REFINEMENTS; refinement++) {
+		int num_intervals = (int) ceil((jd_max-jd_min)/step);
+		if(num_intervals < 1) num_intervals = 1;
+		if(num_intervals+1 > EPHEM_CACHE_MAX_NODES_PER_BODY) break;
+		table->step = (jd_max-jd_min)/num_intervals;
+		table->num_nodes = num_intervals+1;
+		table->jd_max = jd_max;
+		free(table->nodes);
+		table->nodes = (double *) malloc(12 * table->num_nodes * sizeof(double));
+
+		// nodes and interval midpoints
+		int num_states = table->num_nodes + num_intervals;
+		double *jds = (double *) malloc(num_states * sizeof(double));
+		OSV *osvs = (OSV *) malloc(num_states * sizeof(OSV));
+		for(int i = 0; i < num_states; i++) jds[i] = jd_min + 0.5*i*table->step;
+		calc_ephem_cache_table_states(system, table, jds, osvs, num_states);
+		for(int i = 0; i < table->num_nodes; i++) store_ephem_cache_node(system->cb->mu, osvs[2*i], &table->nodes[12*i]);
+
+		int is_accurate = 1;
+		for(int i = 0; i < num_intervals && is_accurate; i++) {
+			OSV interpolated = interpolate_ephem_cache_table(table, jds[2*i+1]);
+			if(mag_vec3(subtract_vec3(interpolated.r, osvs[2*i+1].r)) > max_pos_error) is_accurate = 0;
+			if(mag_vec3(subtract_vec3(interpolated.v, osvs[2*i+1].v)) > max_vel_error) is_accurate = 0;
+		}
+		free(jds);
+		free(osvs);
+		if(is_accurate) return table;
+		step = table->step/2;
+	}
+
+	printf("Ephemeris cache: no table for %s (accuracy not reachable)\n", body->name);
+	free(table->nodes);
+	free(table);
+	return NULL;
+}
+
+static int get_ephem_cache_slot(CelestSystem *system) {
+	for(int i = 0; i < EPHEM_CACHE_MAX_SYSTEMS; i++) {
+		struct Ephem_Cache *cache = atomic_load_explicit(&ephem_caches[i], memory_order_acquire);
+		if(cache != NULL && cache->system == system) return i;
+	}
+	return -1;
+}
+
+// publishes a new version of the system's cache with tables for the given bodies (only_kepler: tables without nodes for bodies without a table, calibrated at jd_min)
+static void update_ephem_cache(CelestSystem *system, Body **bodies, int num_bodies, double jd_min, double jd_max, double max_pos_error, double max_vel_error, int only_kepler) {
+	lock_thread_mutex(&ephem_caches_lock);
+	int slot = get_ephem_cache_slot(system);
+	struct Ephem_Cache *prev_cache = NULL;
+	if(slot < 0) {
+		for(int i = 0; i < EPHEM_CACHE_MAX_SYSTEMS && slot < 0; i++) if(atomic_load(&ephem_caches[i]) == NULL) slot = i;
+		if(slot < 0) {
+			printf("Ephemeris cache: too many cached systems\n");
+			unlock_thread_mutex(&ephem_caches_lock);
+			return;
+		}
+	} else prev_cache = atomic_load(&ephem_caches[slot]);
+
+	int num_prev_tables = 0;
+	if(prev_cache != NULL) for(int i = 0; i < prev_cache->hash_size; i++) if(prev_cache->hash[i] != NULL) num_prev_tables++;
+
+	struct Ephem_Cache *cache = (struct Ephem_Cache *) malloc(sizeof(struct Ephem_Cache));
+	cache->system = system;
+	cache->hash_size = 16;
+	while(cache->hash_size < 2*(num_prev_tables + num_bodies)) cache->hash_size *= 2;
+	cache->hash = (struct Ephem_Cache_Table **) calloc(cache->hash_size, sizeof(struct Ephem_Cache_Table *));
+	cache->owned_tables = prev_cache != NULL ? prev_cache->owned_tables : NULL;
+	cache->prev_version = prev_cache;
+
+	if(prev_cache != NULL) {
+		for(int i = 0; i < prev_cache->hash_size; i++) if(prev_cache->hash[i] != NULL) insert_ephem_cache_table(cache, prev_cache->hash[i]);
+	}
+
+	int num_new_tables = 0;
+	for(int i = 0; i < num_bodies; i++) {
+		Body *body = bodies[i];
+		if(body == NULL || body == system->cb) continue;
+		struct Ephem_Cache_Table *table = find_ephem_cache_table(cache, body);
+		struct Ephem_Cache_Table *new_table;
+		if(only_kepler) {
+			if(table != NULL) continue;
+			new_table = create_kepler_ephem_cache_table(system, body, jd_min);
+		} else {
+			if(table != NULL && table->jd0 <= jd_min && table->jd_max >= jd_max && table->max_pos_error <= max_pos_error && table->max_vel_error <= max_vel_error) continue;
+
+			// replacing table covers the old date range as well
+			double table_jd_min = table != NULL && table->jd0 < jd_min ? table->jd0 : jd_min;
+			double table_jd_max = table != NULL && table->jd_max > jd_max ? table->jd_max : jd_max;
+			double table_max_pos_error = table != NULL && table->max_pos_error < max_pos_error ? table->max_pos_error : max_pos_error;
+			double table_max_vel_error = table != NULL && table->max_vel_error < max_vel_error ? table->max_vel_error : max_vel_error;
+			new_table = create_ephem_cache_table(system, body, table_jd_min, table_jd_max, table_max_pos_error, table_max_vel_error);
+			if(new_table == NULL) continue;
+		}
+		new_table->next_owned = cache->owned_tables;
+		cache->owned_tables = new_table;
+		insert_ephem_cache_table(cache, new_table);
+		num_new_tables++;
+	}
+
+	if(num_new_tables == 0 && prev_cache != NULL) {
+		free(cache->hash);
+		free(cache);
+	} else atomic_store_explicit(&ephem_caches[slot], cache, memory_order_release);
+	unlock_thread_mutex(&ephem_caches_lock);
+}
+
+void init_ephem_cache(CelestSystem *system, Body **bodies, int num_bodies, double jd_min, double jd_max, double max_pos_error, double max_vel_error) {
+	if(max_pos_error <= 0) max_pos_error = EPHEM_CACHE_DEFAULT_MAX_POS_ERROR;
+	if(max_vel_error <= 0) max_vel_error = EPHEM_CACHE_DEFAULT_MAX_VEL_ERROR;
+	if(bodies == NULL) {
+		bodies = system->bodies;
+		num_bodies = system->num_bodies;
+	}
+	if(jd_max <= jd_min) jd_max = jd_min + 1;
+	update_ephem_cache(system, bodies, num_bodies, jd_min, jd_max, max_pos_error, max_vel_error, 0);
+}
+
+void free_ephem_cache(CelestSystem *system) {
+	lock_thread_mutex(&ephem_caches_lock);
+	int slot = get_ephem_cache_slot(system);
+	if(slot >= 0) {
+		struct Ephem_Cache *cache = atomic_load(&ephem_caches[slot]);
+		atomic_store(&ephem_caches[slot], NULL);
+		struct Ephem_Cache_Table *table = cache->owned_tables;
+		while(table != NULL) {
+			struct Ephem_Cache_Table *next_table = table->next_owned;
+			free(table->nodes);
+			free(table);
+			table = next_table;
+		}
+		while(cache != NULL) {
+			struct Ephem_Cache *prev_version = cache->prev_version;
+			free(cache->hash);
+			free(cache);
+			cache = prev_version;
+		}
+	}
+	unlock_thread_mutex(&ephem_caches_lock);
+}
+
+void free_all_ephem_caches() {
+	for(int i = 0; i < EPHEM_CACHE_MAX_SYSTEMS; i++) {
+		struct Ephem_Cache *cache = atomic_load(&ephem_caches[i]);
+		if(cache != NULL) free_ephem_cache(cache->system);
+	}
+}
+
+static struct Ephem_Cache * get_ephem_cache(CelestSystem *system) {
+	for(int i = 0; i < EPHEM_CACHE_MAX_SYSTEMS; i++) {
+		struct Ephem_Cache *cache = atomic_load_explicit(&ephem_caches[i], memory_order_acquire);
+		if(cache != NULL && cache->system == system) return cache;
+	}
+	return NULL;
+}
+
+OSV body_state_at(CelestSystem *system, Body *body, double jd) {
+	struct Ephem_Cache *cache = get_ephem_cache(system);
+	if(cache != NULL) {
+		struct Ephem_Cache_Table *table = find_ephem_cache_table(cache, body);
+		if(table != NULL && jd >= table->jd0 && jd <= table->jd_max) return interpolate_ephem_cache_table(table, jd);
+	}
+	return calc_body_state(system, body, jd);
+}
+
+void bodies_state_at(CelestSystem *system, Body **bodies, int num_bodies, double jd, OSV *osvs) {
+	if(bodies == NULL) {
+		bodies = system->bodies;
+		num_bodies = system->num_bodies;
+	}
+
+	// Kepler orbits of bodies without a table are prepared once and kept in the cache
+	struct Ephem_Cache *cache = get_ephem_cache(system);
+	if(system->prop_method == ORB_ELEMENTS) {
+		int is_complete = cache != NULL;
+		for(int i = 0; i < num_bodies && is_complete; i++) {
+			if(bodies[i] != system->cb && find_ephem_cache_table(cache, bodies[i]) == NULL) is_complete = 0;
+		}
+		if(!is_complete) {
+			update_ephem_cache(system, bodies, num_bodies, jd, jd, INFINITY, INFINITY, 1);
+			cache = get_ephem_cache(system);
+		}
+	}
+
+	struct Kepler_Batch_Orbit *kepler_orbits = (struct Kepler_Batch_Orbit *) malloc(num_bodies * sizeof(struct Kepler_Batch_Orbit));
+	int *kepler_indices = (int *) malloc(num_bodies * sizeof(int));
+	double *kepler_jds = (double *) malloc(num_bodies * sizeof(double));
+	OSV *kepler_osvs = (OSV *) malloc(num_bodies * sizeof(OSV));
+	int num_kepler = 0;
+
+	for(int i = 0; i < num_bodies; i++) {
+		if(bodies[i] == system->cb) {
+			osvs[i] = (OSV) {vec3(0,0,0), vec3(0,0,0)};
+			continue;
+		}
+		struct Ephem_Cache_Table *table = cache != NULL ? find_ephem_cache_table(cache, bodies[i]) : NULL;
+		if(table != NULL && jd >= table->jd0 && jd <= table->jd_max) {
+			osvs[i] = interpolate_ephem_cache_table(table, jd);
+		} else if(table != NULL && table->has_kepler_orbit) {
+			kepler_orbits[num_kepler] = table->kepler_orbit;
+			kepler_indices[num_kepler] = i;
+			kepler_jds[num_kepler] = jd;
+			num_kepler++;
+		} else osvs[i] = calc_body_state(system, bodies[i], jd);
+	}
+
+	osv_from_kepler_batch(kepler_orbits, NULL, kepler_jds, kepler_osvs, num_kepler);
+	for(int i = 0; i < num_kepler; i++) osvs[kepler_indices[i]] = kepler_osvs[i];
+
+	free(kepler_orbits);
+	free(kepler_indices);
+	free(kepler_jds);
+	free(kepler_osvs);
+}
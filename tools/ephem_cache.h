@@ -0,0 +1,60 @@
+#ifndef KMAT_EPHEM_CACHE_H
+#define KMAT_EPHEM_CACHE_H
+
+#include "orbitlib.h"
+
+#define EPHEM_CACHE_DEFAULT_MAX_POS_ERROR 1.0	// m
+#define EPHEM_CACHE_DEFAULT_MAX_VEL_ERROR 1e-4	// m/s
+
+
+/**
+ * @brief Builds interpolation tables of the given bodies of the system for the given date range (fixed step per body,
+ *        quintic Hermite interpolation of position and velocity). Already cached bodies and dates are kept.
+ *        Must not be called while another thread frees the cache of the same system.
+ *
+ * @param system        The system the bodies belong to (decides between orbital elements and ephemerides)
+ * @param bodies        The bodies to be cached (NULL: all bodies of the system)
+ * @param num_bodies    The number of bodies in the bodies array
+ * @param jd_min        The first date to be cached
+ * @param jd_max        The last date to be cached
+ * @param max_pos_error The maximum position error of an interpolated state in meters (<= 0: EPHEM_CACHE_DEFAULT_MAX_POS_ERROR)
+ * @param max_vel_error The maximum velocity error of an interpolated state in meters per second (<= 0: EPHEM_CACHE_DEFAULT_MAX_VEL_ERROR)
+ */
+void init_ephem_cache(CelestSystem *system, Body **bodies, int num_bodies, double jd_min, double jd_max, double max_pos_error, double max_vel_error);
+
+/**
+ * @brief Frees all interpolation tables of the system (needs to be called before the system is freed; no other thread may use the system's states meanwhile)
+ *
+ * @param system The system
+ */
+void free_ephem_cache(CelestSystem *system);
+
+/**
+ * @brief Frees the interpolation tables of all systems
+ */
+void free_all_ephem_caches();
+
+/**
+ * @brief Returns the state of the body at the given date (interpolated from the cache if available, calculated from
+ *        the system's orbital elements or ephemerides otherwise)
+ *
+ * @param system The system the body belongs to
+ * @param body   The body
+ * @param jd     The date
+ * @return The position and velocity of the body relative to the system's central body
+ */
+OSV body_state_at(CelestSystem *system, Body *body, double jd);
+
+/**
+ * @brief Calculates the states of many bodies at the given date (interpolated from the cache if available; the
+ *        Kepler orbits of bodies without a table are prepared once and solved together with the Kepler batch)
+ *
+ * @param system     The system the bodies belong to
+ * @param bodies     The bodies (NULL: all bodies of the system; the central body gets a zero state)
+ * @param num_bodies The number of bodies in the bodies array
+ * @param jd         The date
+ * @param osvs       The array the states are stored in (same order as the bodies)
+ */
+void bodies_state_at(CelestSystem *system, Body **bodies, int num_bodies, double jd, OSV *osvs);
+
+#endif //KMAT_EPHEM_CACHE_H
@@ -1,11 +1,24 @@
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64	// 64-bit off_t for ftello(), fseeko() and ftruncate() on 32-bit systems
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
-#include <gtk/gtk.h>
+#include <errno.h>
+#include <dirent.h>		// for opendir()
+#include <sys/stat.h>	// for stat(), mkdir()
+#ifdef _WIN32
+#include <io.h>		// for _chsize_s(), _fileno()
+#include <direct.h>	// for _mkdir()
+#else
+#include <unistd.h>	// for ftruncate()
+#endif
 
 #include "file_io.h"
+#include "competition_tools.h"
 #include "orbitlib_fileio.h"
 
 
@@ -40,14 +53,89 @@ BinTypes get_itin_file_bin_types_from_file_type(int file_type) {
 }
 
 
+static int make_directory(const char *path) {
+	#ifdef _WIN32
+		return _mkdir(path);
+	#else
+		return mkdir(path, 0755);
+	#endif
+}
+
 void create_directory_if_not_exists(const char *path) {
-	if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
-		GError *error = NULL;
-		if (g_mkdir_with_parents(path, 0755) == -1) {
-			g_warning("Failed to create directory: %s", error->message);
-			g_error_free(error);
+	char dir[1024];
+	snprintf(dir, sizeof(dir), "%s", path);
+	// parent directories first
+	for(char *c = dir+1; ; c++) {
+		if(*c != '/' && *c != '\\' && *c != '\0') continue;
+		char separator = *c;
+		*c = '\0';
+		// drive letters are not created
+		if(c[-1] != ':' && make_directory(dir) != 0 && errno != EEXIST) {
+			printf("Failed to create directory: %s\n", dir);
+			return;
+		}
+		if(separator == '\0') break;
+		*c = separator;
+	}
+}
+
+static int compare_file_names(const void *a, const void *b) {
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int get_directory_file_names(const char *directory, const char *extension, char ***file_names) {
+	*file_names = NULL;
+	DIR *dir = opendir(directory);
+	if(dir == NULL) return -1;
+
+	int num_files = 0, max_files = 16;
+	char **names = (char **) malloc(max_files * sizeof(char *));
+	size_t extension_length = extension != NULL ? strlen(extension) : 0;
+	struct dirent *entry;
+	while((entry = readdir(dir)) != NULL) {
+		size_t name_length = strlen(entry->d_name);
+		if(name_length <= extension_length || strcmp(entry->d_name + name_length - extension_length, extension != NULL ? extension : "") != 0) continue;
+
+		// regular files only
+		char path[1024];
+		struct stat file_stat;
+		snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+		if(stat(path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) continue;
+
+		if(num_files == max_files) {
+			max_files *= 2;
+			names = (char **) realloc(names, max_files * sizeof(char *));
 		}
+		names[num_files] = (char *) malloc(name_length + 1);
+		memcpy(names[num_files++], entry->d_name, name_length + 1);
+	}
+	closedir(dir);
+
+	qsort(names, num_files, sizeof(char *), compare_file_names);
+	*file_names = names;
+	return num_files;
+}
+
+void free_directory_file_names(char **file_names, int num_files) {
+	if(file_names == NULL) return;
+	for(int i = 0; i < num_files; i++) free(file_names[i]);
+	free(file_names);
+}
+
+int does_file_exist(const char *filepath) {
+	struct stat file_stat;
+	return stat(filepath, &file_stat) == 0;
+}
+
+int move_file(const char *from_filepath, const char *to_filepath) {
+	#ifdef _WIN32
+		remove(to_filepath);
+	#endif
+	if(rename(from_filepath, to_filepath) != 0) {
+		printf("Failed to move %s to %s\n", from_filepath, to_filepath);
+		return 0;
 	}
+	return 1;
 }
 
 
@@ -377,25 +465,78 @@ union ItinStepBin convert_ItinStep_bin(struct ItinStep *step, CelestSystem *syst
 	return bin_step;
 }
 
-void store_step_in_bfile(struct ItinStep *step, CelestSystem *system, FILE *file, int step_type) {
-	union ItinStepBin bin_step;
+void store_step_record_in_bfile(struct ItinStep *step, int num_next_nodes, CelestSystem *system, FILE *file, int step_type) {
+	union ItinStepBin bin_step = convert_ItinStep_bin(step, system, step_type);
 	switch(step_type) {
-		case 0:	bin_step = convert_ItinStep_bin(step, system, step_type);
+		case 0:	bin_step.t0.num_next_nodes = num_next_nodes;
 				fwrite(&bin_step.t0, sizeof(struct ItinStepBinT0), 1, file);
 				break;
-		case 2: bin_step = convert_ItinStep_bin(step, system, step_type);
+		case 2: bin_step.t2.num_next_nodes = num_next_nodes;
 				fwrite(&bin_step.t2, sizeof(struct ItinStepBinT2), 1, file);
 				break;
 		default: break;
 	}
+}
+
+int store_step_in_bfile(struct ItinStep *step, CelestSystem *system, FILE *file, int step_type) {
+	// next steps that are end nodes with next steps of their own are stored a second time as leaf sibling
+	// (right after their subtree; same tree as with the former end node copies)
+	int num_end_node_leaves = 0;
+	for(int i = 0; i < step->num_next_nodes; i++) {
+		if(step->next[i]->is_end_node && step->next[i]->num_next_nodes > 0) num_end_node_leaves++;
+	}
+	store_step_record_in_bfile(step, step->num_next_nodes + num_end_node_leaves, system, file, step_type);
+
+	int num_stored_steps = 1;
 	for(int i = 0; i < step->num_next_nodes; i++) {
-		store_step_in_bfile(step->next[i], system, file, step_type);
+		struct ItinStep *next = step->next[i];
+		num_stored_steps += store_step_in_bfile(next, system, file, step_type);
+		if(next->is_end_node && next->num_next_nodes > 0) {
+			store_step_record_in_bfile(next, 0, system, file, step_type);
+			num_stored_steps++;
+		}
 	}
+	return num_stored_steps;
 }
 
-void store_itineraries_in_bfile(struct ItinStep **departures, int num_nodes, int num_deps, int num_itins, Itin_Calc_Data calc_data, CelestSystem *system, char *filepath, int file_type) {
+struct ItinsBFileWriter {
+	FILE *file;
+	char *filepath;
+	CelestSystem *system;
+	BinTypes bin_types;
+	struct ItinStepBinHeaderT3 header;
+};
+
+// sidecar file next to an .itins file that is being written (followed by one completion flag per departure date)
+struct ItinsCheckpointBin {
+	int file_type;					// ITINS_CHECKPOINT_FILE_TYPE
+	int num_all_deps;				// number of departure dates of the search
+	int num_nodes, num_deps, num_itins;	// counts of the departures stored in the .itins file until file_size
+	int64_t file_size;
+};
+
+const int ITINS_CHECKPOINT_FILE_TYPE = 1;
+
+// file positions of .itins files can be beyond 2 GB (long is 32-bit on Windows)
+static int64_t get_itins_file_position(FILE *file) {
+#ifdef _WIN32
+	return _ftelli64(file);
+#else
+	return (int64_t) ftello(file);
+#endif
+}
+
+static int set_itins_file_position(FILE *file, int64_t position) {
+#ifdef _WIN32
+	return _fseeki64(file, position, SEEK_SET);
+#else
+	return fseeko(file, (off_t) position, SEEK_SET);
+#endif
+}
+
+struct ItinsBFileWriter * open_itins_bfile_writer(Itin_Calc_Data calc_data, CelestSystem *system, char *filepath, int file_type) {
 	BinTypes bin_types = get_itins_file_bin_types_from_file_type(file_type);
-	if(bin_types.file_type < 0) return;
+	if(bin_types.file_type < 0 || bin_types.header_type != 3) return NULL;
 	
 	// Check if the string ends with ".itins"
 	if (strlen(filepath) >= 6 && strcmp(filepath + strlen(filepath) - 6, ".itins") != 0) {
@@ -403,61 +544,219 @@ void store_itineraries_in_bfile(struct ItinStep **departures, int num_nodes, int
 		strcat(filepath, ".itins");
 	}
 
-	union ItinStepBinHeader bin_header;
 	int end_of_header_designator = -1;
 	FILE *file = fopen(filepath, "wb");
+	if(file == NULL) {
+		perror("Failed to open .itins file for writing");
+		return NULL;
+	}
+
+	struct ItinsBFileWriter *writer = (struct ItinsBFileWriter *) malloc(sizeof(struct ItinsBFileWriter));
+	writer->file = file;
+	writer->filepath = (char *) malloc(strlen(filepath) + 1);
+	strcpy(writer->filepath, filepath);
+	writer->system = system;
+	writer->bin_types = bin_types;
+
 	fwrite(&file_type, sizeof(int), 1, file);
 
-	switch(bin_types.header_type) {
-		case 3:	bin_header.t3.num_nodes = num_nodes;
-				bin_header.t3.num_deps = num_deps;
-				bin_header.t3.num_itins = num_itins;
-		
-				bin_header.t3.calc_data = (CalcDataBin) {
-					.jd_min_dep = calc_data.jd_min_dep,
-					.jd_max_dep = calc_data.jd_max_dep,
-					.jd_max_arr = calc_data.jd_max_arr,
-					.max_duration = calc_data.max_duration,
-					.step_dep_date = calc_data.step_dep_date,
-					.num_deps_per_date = calc_data.num_deps_per_date,
-					.max_num_waiting_orbits = calc_data.max_num_waiting_orbits,
-					.dv_filter = calc_data.dv_filter
-				};
-		
-				printf("Filesize: ~%.3f MB\n", (double) num_nodes*sizeof(struct ItinStepBinT2)/1e6);
-		
-				fwrite(&bin_header.t3, sizeof(struct ItinStepBinHeaderT3), 1, file);
-		
-				store_celestial_system_in_bfile(system, file, bin_types);
-				if(calc_data.seq_info.to_target.type == ITIN_SEQ_INFO_TO_TARGET) {
-					fwrite(&calc_data.seq_info.to_target.type, sizeof(int), 1, file);
-					fwrite(&calc_data.seq_info.to_target.num_flyby_bodies, sizeof(int), 1, file);
-					int *body_ids = malloc((calc_data.seq_info.to_target.num_flyby_bodies + 2) * sizeof(int));
-					body_ids[0] = get_body_system_id(calc_data.seq_info.to_target.dep_body, system);
-					body_ids[1] = get_body_system_id(calc_data.seq_info.to_target.arr_body, system);
-					for(int i = 0; i < calc_data.seq_info.to_target.num_flyby_bodies; i++) body_ids[i+2] = get_body_system_id(calc_data.seq_info.to_target.flyby_bodies[i], system);
-					fwrite(body_ids, sizeof(int), calc_data.seq_info.to_target.num_flyby_bodies + 2, file);
-					free(body_ids);
-				} else {
-					fwrite(&calc_data.seq_info.spec_seq.type, sizeof(int), 1, file);
-					fwrite(&calc_data.seq_info.spec_seq.num_steps, sizeof(int), 1, file);
-					int *body_ids = malloc((calc_data.seq_info.spec_seq.num_steps) * sizeof(int));
-					for(int i = 0; i < calc_data.seq_info.spec_seq.num_steps; i++) body_ids[i] = get_body_system_id(calc_data.seq_info.spec_seq.bodies[i], system);
-					fwrite(body_ids, sizeof(int), calc_data.seq_info.spec_seq.num_steps, file);
-					free(body_ids);
-				}
-		
-				fwrite(&end_of_header_designator, sizeof(int), 1, file);
-		
-				for(int i = 0; i < num_deps; i++) {
-					store_step_in_bfile(departures[i], system, file, bin_types.itin_step_type);
-				}
-				break;
-		default: bin_header.is_valid.ptr = NULL;
+	// counts are written as 0 and patched in close_itins_bfile_writer
+	writer->header.num_nodes = 0;
+	writer->header.num_deps = 0;
+	writer->header.num_itins = 0;
+
+	writer->header.calc_data = (CalcDataBin) {
+		.jd_min_dep = calc_data.jd_min_dep,
+		.jd_max_dep = calc_data.jd_max_dep,
+		.jd_max_arr = calc_data.jd_max_arr,
+		.max_duration = calc_data.max_duration,
+		.step_dep_date = calc_data.step_dep_date,
+		.num_deps_per_date = calc_data.num_deps_per_date,
+		.max_num_waiting_orbits = calc_data.max_num_waiting_orbits,
+		.dv_filter = calc_data.dv_filter
+	};
+
+	fwrite(&writer->header, sizeof(struct ItinStepBinHeaderT3), 1, file);
+
+	store_celestial_system_in_bfile(system, file, bin_types);
+	if(calc_data.seq_info.to_target.type == ITIN_SEQ_INFO_TO_TARGET) {
+		fwrite(&calc_data.seq_info.to_target.type, sizeof(int), 1, file);
+		fwrite(&calc_data.seq_info.to_target.num_flyby_bodies, sizeof(int), 1, file);
+		int *body_ids = malloc((calc_data.seq_info.to_target.num_flyby_bodies + 2) * sizeof(int));
+		body_ids[0] = get_body_system_id(calc_data.seq_info.to_target.dep_body, system);
+		body_ids[1] = get_body_system_id(calc_data.seq_info.to_target.arr_body, system);
+		for(int i = 0; i < calc_data.seq_info.to_target.num_flyby_bodies; i++) body_ids[i+2] = get_body_system_id(calc_data.seq_info.to_target.flyby_bodies[i], system);
+		fwrite(body_ids, sizeof(int), calc_data.seq_info.to_target.num_flyby_bodies + 2, file);
+		free(body_ids);
+	} else {
+		fwrite(&calc_data.seq_info.spec_seq.type, sizeof(int), 1, file);
+		fwrite(&calc_data.seq_info.spec_seq.num_steps, sizeof(int), 1, file);
+		int *body_ids = malloc((calc_data.seq_info.spec_seq.num_steps) * sizeof(int));
+		for(int i = 0; i < calc_data.seq_info.spec_seq.num_steps; i++) body_ids[i] = get_body_system_id(calc_data.seq_info.spec_seq.bodies[i], system);
+		fwrite(body_ids, sizeof(int), calc_data.seq_info.spec_seq.num_steps, file);
+		free(body_ids);
 	}
-	// ---------------------------------------------------
 
+	fwrite(&end_of_header_designator, sizeof(int), 1, file);
+
+	return writer;
+}
+
+void append_departure_to_itins_bfile(struct ItinsBFileWriter *writer, struct ItinStep *departure) {
+	if(departure == NULL || departure->num_next_nodes == 0) return;
+	int num_stored_steps = store_step_in_bfile(departure, writer->system, writer->file, writer->bin_types.itin_step_type);
+	writer->header.num_deps++;
+	writer->header.num_nodes += num_stored_steps;
+	writer->header.num_itins += get_number_of_itineraries(departure);
+}
+
+void close_itins_bfile_writer(struct ItinsBFileWriter *writer) {
+	if(writer == NULL) return;
+	printf("Filesize: ~%.3f MB\n", (double) writer->header.num_nodes*sizeof(struct ItinStepBinT2)/1e6);
+
+	// patch header counts (header starts after file type)
+	fflush(writer->file);
+	fseek(writer->file, sizeof(int), SEEK_SET);
+	fwrite(&writer->header, sizeof(struct ItinStepBinHeaderT3), 1, writer->file);
+
+	fclose(writer->file);
+	free(writer->filepath);
+	free(writer);
+}
+
+void get_itins_checkpoint_filepath(char *itins_filepath, char *checkpoint_filepath) {
+	sprintf(checkpoint_filepath, "%s.ckpt", itins_filepath);
+}
+
+void store_itins_bfile_checkpoint(struct ItinsBFileWriter *writer, const char *completed_deps, int num_all_deps) {
+	// everything up to the checkpointed file size needs to be on disk
+	fflush(writer->file);
+	struct ItinsCheckpointBin checkpoint = {
+		.file_type = ITINS_CHECKPOINT_FILE_TYPE,
+		.num_all_deps = num_all_deps,
+		.num_nodes = writer->header.num_nodes,
+		.num_deps = writer->header.num_deps,
+		.num_itins = writer->header.num_itins,
+		.file_size = get_itins_file_position(writer->file)
+	};
+
+	// write to temporary file first so a crash while writing keeps the last checkpoint
+	char checkpoint_filepath[1024], temp_filepath[1040];
+	get_itins_checkpoint_filepath(writer->filepath, checkpoint_filepath);
+	sprintf(temp_filepath, "%s.tmp", checkpoint_filepath);
+
+	FILE *file = fopen(temp_filepath, "wb");
+	if(file == NULL) {
+		perror("Failed to write checkpoint");
+		return;
+	}
+	fwrite(&checkpoint, sizeof(struct ItinsCheckpointBin), 1, file);
+	fwrite(completed_deps, sizeof(char), num_all_deps, file);
 	fclose(file);
+
+	remove(checkpoint_filepath);	// rename does not replace existing files on Windows
+	if(rename(temp_filepath, checkpoint_filepath) != 0) perror("Failed to write checkpoint");
+}
+
+struct ItinsBFileWriter * resume_itins_bfile_writer(char *filepath, CelestSystem *system, ItinStepBinHeaderData *header, char **completed_deps, int *num_all_deps) {
+	char checkpoint_filepath[1024];
+	get_itins_checkpoint_filepath(filepath, checkpoint_filepath);
+
+	FILE *checkpoint_file = fopen(checkpoint_filepath, "rb");
+	if(checkpoint_file == NULL) {
+		perror("Failed to open checkpoint");
+		return NULL;
+	}
+	struct ItinsCheckpointBin checkpoint;
+	if(fread(&checkpoint, sizeof(struct ItinsCheckpointBin), 1, checkpoint_file) != 1 ||
+	   checkpoint.file_type != ITINS_CHECKPOINT_FILE_TYPE || checkpoint.num_all_deps <= 0) {
+		printf("Problems reading checkpoint file\n");
+		fclose(checkpoint_file);
+		return NULL;
+	}
+	*completed_deps = (char *) malloc(checkpoint.num_all_deps * sizeof(char));
+	if(fread(*completed_deps, sizeof(char), checkpoint.num_all_deps, checkpoint_file) != checkpoint.num_all_deps) {
+		printf("Problems reading checkpoint file\n");
+		fclose(checkpoint_file);
+		free(*completed_deps);
+		*completed_deps = NULL;
+		return NULL;
+	}
+	fclose(checkpoint_file);
+	*num_all_deps = checkpoint.num_all_deps;
+
+	FILE *file = fopen(filepath, "r+b");
+	if(file == NULL) {
+		perror("Failed to open .itins file for resuming");
+		free(*completed_deps);
+		*completed_deps = NULL;
+		return NULL;
+	}
+	*header = get_itins_bfile_header(file);
+	BinTypes bin_types = get_itins_file_bin_types_from_file_type(header->file_type);
+	if(header->num_deps < 0 || bin_types.header_type != 3) {
+		printf("Problems reading itinerary file header\n");
+		fclose(file);
+		free(*completed_deps);
+		*completed_deps = NULL;
+		return NULL;
+	}
+
+	// departures written after the last checkpoint are calculated again
+	fflush(file);
+#ifdef _WIN32
+	int truncate_error = _chsize_s(_fileno(file), checkpoint.file_size);
+#else
+	int truncate_error = ftruncate(fileno(file), (off_t) checkpoint.file_size);
+#endif
+	if(truncate_error != 0) printf("Failed to truncate .itins file to last checkpoint\n");
+	if(set_itins_file_position(file, checkpoint.file_size) != 0) printf("Failed to go to the last checkpoint of the .itins file\n");
+
+	struct ItinsBFileWriter *writer = (struct ItinsBFileWriter *) malloc(sizeof(struct ItinsBFileWriter));
+	writer->file = file;
+	writer->filepath = (char *) malloc(strlen(filepath) + 1);
+	strcpy(writer->filepath, filepath);
+	writer->system = system != NULL ? system : header->system;
+	writer->bin_types = bin_types;
+	writer->header.num_nodes = checkpoint.num_nodes;
+	writer->header.num_deps = checkpoint.num_deps;
+	writer->header.num_itins = checkpoint.num_itins;
+	writer->header.calc_data = (CalcDataBin) {
+		.jd_min_dep = header->calc_data.jd_min_dep,
+		.jd_max_dep = header->calc_data.jd_max_dep,
+		.jd_max_arr = header->calc_data.jd_max_arr,
+		.max_duration = header->calc_data.max_duration,
+		.step_dep_date = header->calc_data.step_dep_date,
+		.num_deps_per_date = header->calc_data.num_deps_per_date,
+		.max_num_waiting_orbits = header->calc_data.max_num_waiting_orbits,
+		.dv_filter = header->calc_data.dv_filter
+	};
+	return writer;
+}
+
+void store_departure_in_itins_bfile_writer(struct ItinStep *departure, void *sink_data) {
+	append_departure_to_itins_bfile((struct ItinsBFileWriter *) sink_data, departure);
+}
+
+void store_checkpoint_of_itins_bfile_writer(const char *completed_deps, int num_all_deps, void *sink_data) {
+	store_itins_bfile_checkpoint((struct ItinsBFileWriter *) sink_data, completed_deps, num_all_deps);
+}
+
+Itin_Result_Sink get_itins_bfile_result_sink(struct ItinsBFileWriter *writer) {
+	return (Itin_Result_Sink) {store_departure_in_itins_bfile_writer, NULL, writer};
+}
+
+Itin_Result_Sink get_checkpointed_itins_bfile_result_sink(struct ItinsBFileWriter *writer) {
+	return (Itin_Result_Sink) {store_departure_in_itins_bfile_writer, store_checkpoint_of_itins_bfile_writer, writer};
+}
+
+void store_itineraries_in_bfile(struct ItinStep **departures, int num_nodes, int num_deps, int num_itins, Itin_Calc_Data calc_data, CelestSystem *system, char *filepath, int file_type) {
+	struct ItinsBFileWriter *writer = open_itins_bfile_writer(calc_data, system, filepath, file_type);
+	if(writer == NULL) return;
+	for(int i = 0; i < num_deps; i++) {
+		append_departure_to_itins_bfile(writer, departures[i]);
+	}
+	close_itins_bfile_writer(writer);
 }
 
 
@@ -499,6 +798,8 @@ void load_step_from_bfile(struct ItinStep *step, FILE *file, struct Body **body,
 				break;
 		default: break;
 	}
+	update_itin_step_score(step, system);
+	step->is_end_node = false;	// stored as separate leaves
 
 	if(step->num_next_nodes > 1e6) return;	// avoid overflows
 
@@ -534,7 +835,6 @@ ItinStepBinHeaderData get_itins_bfile_header(FILE *file) {
 		
 				if(buf != -1) {
 					printf("Problems reading itinerary file (Body list or header wrong)\n");
-					fclose(file);
 					header_data.num_deps = -1;
 					return header_data;
 				}
@@ -661,7 +961,10 @@ struct ItinsLoadFileResults load_itineraries_from_bfile(char *filepath) {
 	print_header_data_to_string(header_data, header_string, DATE_ISO);
 	printf("\n--\n%s--\n", header_string);
 
-	if(header_data.num_deps < 0) return (struct ItinsLoadFileResults){header_data, NULL};
+	if(header_data.num_deps < 0) {
+		fclose(file);
+		return (struct ItinsLoadFileResults){header_data, NULL};
+	}
 
 	departures = (struct ItinStep **) malloc(header_data.num_deps * sizeof(struct ItinStep *));
 
@@ -781,6 +1084,8 @@ struct ItinLoadFileResults load_single_itinerary_from_bfile(char *filepath) {
 		convert_bin_ItinStep(bin_step, itin, system->bodies[bodies_id[i]], system, bin_types.itin_step_type);
 		itin->prev = last_step;
 		itin->next = NULL;
+		itin->is_end_node = false;
+		update_itin_step_score(itin, system);
 		if(last_step != NULL) {
 			last_step->next = (struct ItinStep**) malloc(sizeof(struct ItinStep*));
 			last_step->next[0] = itin;
@@ -12,6 +12,18 @@ int get_current_bin_file_type();
 
 void create_directory_if_not_exists(const char *path);
 
+// names of the regular files in directory ending with extension, sorted by name (NULL: all files; needs to be freed with free_directory_file_names)
+// returns the number of files (-1 if the directory can't be opened)
+int get_directory_file_names(const char *directory, const char *extension, char ***file_names);
+
+void free_directory_file_names(char **file_names, int num_files);
+
+// returns 1 if a file or directory exists at filepath (0 otherwise)
+int does_file_exist(const char *filepath);
+
+// rename/move file (an existing file at to_filepath is replaced; returns 0 on failure)
+int move_file(const char *from_filepath, const char *to_filepath);
+
 /**
  * @brief Writes a .csv-file with fields and their data
  *
@@ -45,6 +57,27 @@ struct ItinLoadFileResults {
 	CelestSystem *system;
 };
 
+// .itins file that departures can be appended to one after another (header counts are patched when closing)
+struct ItinsBFileWriter;
+
+// create .itins file and write header without counts (returns NULL if file can't be created or file type is not supported)
+struct ItinsBFileWriter * open_itins_bfile_writer(Itin_Calc_Data calc_data, CelestSystem *system, char *filepath, int file_type);
+
+// append all itineraries from departure to .itins file (pre-order storing; departures without next steps are skipped)
+void append_departure_to_itins_bfile(struct ItinsBFileWriter *writer, struct ItinStep *departure);
+
+// write the final counts to the header, close .itins file and free writer
+void close_itins_bfile_writer(struct ItinsBFileWriter *writer);
+
+// result sink that appends calculated departures to the given writer (for Itin_Calc_Data.result_sink)
+Itin_Result_Sink get_itins_bfile_result_sink(struct ItinsBFileWriter *writer);
+
+// like get_itins_bfile_result_sink but additionally stores checkpoints in <filepath>.ckpt during the search
+Itin_Result_Sink get_checkpointed_itins_bfile_result_sink(struct ItinsBFileWriter *writer);
+
+// write <filepath>.ckpt with the completed departure dates (completed_deps[index] != 0) and the current state of the .itins file
+void store_itins_bfile_checkpoint(struct ItinsBFileWriter *writer, const char *completed_deps, int num_all_deps);
+
 // store itineraries in binary file from multiple departures (pre-order storing)
 void store_itineraries_in_bfile(struct ItinStep **departures, int num_nodes, int num_deps, int num_itins, Itin_Calc_Data calc_data, CelestSystem *system, char *filepath, int file_type);
 
@@ -62,5 +95,9 @@ struct ItinLoadFileResults load_single_itinerary_from_bfile(char *filepath);
 // returns calc parameters used to create .itins-file
 ItinStepBinHeaderData get_itins_bfile_header(FILE *file);
 
+// reopen .itins file at its last checkpoint (<filepath>.ckpt) for appending the missing departure dates (bodies of appended steps are from system; NULL: system of file)
+// (header gets the calc parameters and system of the file, completed_deps is allocated with num_all_deps flags; returns NULL on failure)
+struct ItinsBFileWriter * resume_itins_bfile_writer(char *filepath, CelestSystem *system, ItinStepBinHeaderData *header, char **completed_deps, int *num_all_deps);
+
 
 #endif
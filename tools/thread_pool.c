@@ -1,144 +1,471 @@
 #include "thread_pool.h"
 #include <stdlib.h>
 #include <stdio.h>
-
-thread_t threads32[32];
-thread_t threads01[1];
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <malloc.h>		// for _aligned_malloc() (msvcrt has no aligned_alloc)
+#else
+#include <unistd.h>
+#include <time.h>
+#endif
 
 #define NUM_COUNTER 4
+#define INITIAL_DEQUE_CAPACITY 64
+#define CACHE_LINE_SIZE 64
 
-int counter[NUM_COUNTER];
-thread_mutex_t counter_lock[NUM_COUNTER];
 
-struct Thread_Pool use_thread_pool32(void *thread_method(void*), void *thread_args) {
-	size_t size = 32;
-	struct Thread_Pool thread_pool = {threads32, size};
+struct Thread_Pool_Task {
+	void *(*task_method)(void*);
+	void *task_args;
+	void *result;
+	struct Thread_Pool *pool;
+	atomic_int is_finished;
+	int is_detached;
+};
 
-	// Initialize counters
-	for (int i = 0; i < NUM_COUNTER; i++) {
-		counter[i] = 0;
+// ring buffer of tasks; the owning worker pushes and pops at the tail (LIFO), idle workers steal from the head (FIFO)
+struct Thread_Pool_Deque {
+	struct Thread_Pool_Task **tasks;
+	size_t capacity;
+	size_t head, tail;
+	thread_mutex_t lock;
+	char padding[64];	// keep the deques of different workers on different cache lines
+};
+
+struct Thread_Pool_Worker {
+	struct Thread_Pool *pool;
+	int id;
+	thread_t thread;
+};
+
+struct Thread_Pool {
+	struct Thread_Pool_Worker *workers;
+	struct Thread_Pool_Deque *deques;	// one deque per worker + one injection queue for tasks submitted from outside the pool
+	int size;
+
+	atomic_int num_queued;		// tasks inside the deques
+	atomic_int num_injected;	// tasks inside the injection queue (part of num_queued)
+	atomic_int num_unfinished;	// submitted tasks that did not finish yet
+	atomic_int num_waiting;		// threads sleeping on cond
+	atomic_int is_shutting_down;
+	thread_mutex_t lock;
+	thread_cond_t cond;
+
+	struct Thread_Pool_Counter {
+		_Alignas(64) atomic_int value;	// own cache line per counter (counters are incremented by different workers)
+	} counter[NUM_COUNTER];
+};
+
+static _Thread_local struct Thread_Pool *current_pool = NULL;
+static _Thread_local int current_worker_id = -1;
+
+static int default_thread_pool_size = 0;
+
+static struct Thread_Pool *global_thread_pool = NULL;
+static thread_mutex_t global_thread_pool_lock = THREAD_MUTEX_INITIALIZER;
+
+
+void init_thread_mutex(thread_mutex_t *mutex) {
+	#ifdef _WIN32
+		InitializeSRWLock(mutex);
+	#else
+		pthread_mutex_init(mutex, NULL);
+	#endif
+}
+
+void lock_thread_mutex(thread_mutex_t *mutex) {
+	#ifdef _WIN32
+		AcquireSRWLockExclusive(mutex);
+	#else
+		pthread_mutex_lock(mutex);
+	#endif
+}
+
+void unlock_thread_mutex(thread_mutex_t *mutex) {
+	#ifdef _WIN32
+		ReleaseSRWLockExclusive(mutex);
+	#else
+		pthread_mutex_unlock(mutex);
+	#endif
+}
+
+void destroy_thread_mutex(thread_mutex_t *mutex) {
+	#ifndef _WIN32
+		pthread_mutex_destroy(mutex);	// SRW locks do not need to be destroyed
+	#endif
+}
+
+void init_thread_cond(thread_cond_t *cond) {
+	#ifdef _WIN32
+		InitializeConditionVariable(cond);
+	#else
+		pthread_cond_init(cond, NULL);
+	#endif
+}
+
+void wait_thread_cond(thread_cond_t *cond, thread_mutex_t *mutex) {
+	#ifdef _WIN32
+		SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+	#else
+		pthread_cond_wait(cond, mutex);
+	#endif
+}
+
+void timed_wait_thread_cond(thread_cond_t *cond, thread_mutex_t *mutex, int timeout_ms) {
+	#ifdef _WIN32
+		SleepConditionVariableSRW(cond, mutex, timeout_ms, 0);
+	#else
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_ms / 1000;
+		ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+		if(ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+		pthread_cond_timedwait(cond, mutex, &ts);
+	#endif
+}
+
+void broadcast_thread_cond(thread_cond_t *cond) {
+	#ifdef _WIN32
+		WakeAllConditionVariable(cond);
+	#else
+		pthread_cond_broadcast(cond);
+	#endif
+}
+
+void destroy_thread_cond(thread_cond_t *cond) {
+	#ifndef _WIN32
+		pthread_cond_destroy(cond);	// Windows condition variables do not need to be destroyed
+	#endif
+}
+
+
+int get_num_available_cores() {
+	int num_cores;
+	#ifdef _WIN32
+		SYSTEM_INFO sys_info;
+		GetSystemInfo(&sys_info);
+		num_cores = (int) sys_info.dwNumberOfProcessors;
+	#else
+		num_cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	#endif
+	return num_cores > 0 ? num_cores : 1;
+}
+
+void set_default_thread_pool_size(int num_threads) {
+	default_thread_pool_size = num_threads > 0 ? num_threads : 0;
+}
+
+int get_default_thread_pool_size() {
+	return default_thread_pool_size > 0 ? default_thread_pool_size : get_num_available_cores();
+}
+
+
+static void push_task_to_deque(struct Thread_Pool_Deque *deque, struct Thread_Pool_Task *task) {
+	lock_thread_mutex(&deque->lock);
+	if(deque->tail - deque->head == deque->capacity) {
+		size_t new_capacity = deque->capacity * 2;
+		struct Thread_Pool_Task **new_tasks = (struct Thread_Pool_Task **) malloc(new_capacity * sizeof(struct Thread_Pool_Task *));
+		for(size_t i = deque->head; i < deque->tail; i++) new_tasks[i % new_capacity] = deque->tasks[i % deque->capacity];
+		free(deque->tasks);
+		deque->tasks = new_tasks;
+		deque->capacity = new_capacity;
 	}
+	deque->tasks[deque->tail % deque->capacity] = task;
+	deque->tail++;
+	unlock_thread_mutex(&deque->lock);
+}
 
-	// Initialize mutexes
-	for (int i = 0; i < NUM_COUNTER; i++) {
-		#ifdef _WIN32
-				InitializeCriticalSection(&counter_lock[i]); // Windows mutex init
-		#else
-				pthread_mutex_init(&counter_lock[i], NULL); // Linux mutex init
-		#endif
+static struct Thread_Pool_Task * pop_task_from_deque_tail(struct Thread_Pool_Deque *deque) {
+	struct Thread_Pool_Task *task = NULL;
+	lock_thread_mutex(&deque->lock);
+	if(deque->tail > deque->head) {
+		deque->tail--;
+		task = deque->tasks[deque->tail % deque->capacity];
 	}
+	unlock_thread_mutex(&deque->lock);
+	return task;
+}
+
+static struct Thread_Pool_Task * pop_task_from_deque_head(struct Thread_Pool_Deque *deque) {
+	struct Thread_Pool_Task *task = NULL;
+	lock_thread_mutex(&deque->lock);
+	if(deque->tail > deque->head) {
+		task = deque->tasks[deque->head % deque->capacity];
+		deque->head++;
+	}
+	unlock_thread_mutex(&deque->lock);
+	return task;
+}
+
+static void wake_waiting_threads(struct Thread_Pool *pool) {
+	if(atomic_load(&pool->num_waiting) == 0) return;
+	lock_thread_mutex(&pool->lock);
+	broadcast_thread_cond(&pool->cond);
+	unlock_thread_mutex(&pool->lock);
+}
+
+// own deque first (newest task), then the injection queue (oldest task; only if use_injection_queue), then steal from the other workers (oldest task)
+static struct Thread_Pool_Task * find_task(struct Thread_Pool *pool, int worker_id, int use_injection_queue) {
+	if(atomic_load(&pool->num_queued) == 0) return NULL;
+	struct Thread_Pool_Task *task = NULL;
+	if(worker_id >= 0) task = pop_task_from_deque_tail(&pool->deques[worker_id]);
+	if(task == NULL && use_injection_queue) {
+		task = pop_task_from_deque_head(&pool->deques[pool->size]);
+		if(task != NULL) atomic_fetch_sub(&pool->num_injected, 1);
+	}
+	for(int i = 1; task == NULL && i < pool->size; i++) {
+		int victim = (worker_id + i) % pool->size;
+		task = pop_task_from_deque_head(&pool->deques[victim]);
+	}
+	if(task != NULL) atomic_fetch_sub(&pool->num_queued, 1);
+	return task;
+}
+
+static void run_task(struct Thread_Pool *pool, struct Thread_Pool_Task *task) {
+	void *result = task->task_method(task->task_args);
+	if(task->is_detached) {
+		free(task);
+	} else {
+		task->result = result;
+		atomic_store(&task->is_finished, 1);	// the joining thread may free the task from here on
+	}
+	atomic_fetch_sub(&pool->num_unfinished, 1);
+	wake_waiting_threads(pool);
+}
+
+static void *thread_pool_worker(void *args) {
+	struct Thread_Pool_Worker *worker = (struct Thread_Pool_Worker *) args;
+	struct Thread_Pool *pool = worker->pool;
+	current_pool = pool;
+	current_worker_id = worker->id;
+
+	while(1) {
+		struct Thread_Pool_Task *task = find_task(pool, worker->id, 1);
+		if(task != NULL) {
+			run_task(pool, task);
+			continue;
+		}
+
+		lock_thread_mutex(&pool->lock);
+		atomic_fetch_add(&pool->num_waiting, 1);
+		while(atomic_load(&pool->num_queued) == 0 && !atomic_load(&pool->is_shutting_down)) wait_thread_cond(&pool->cond, &pool->lock);
+		atomic_fetch_sub(&pool->num_waiting, 1);
+		int do_exit = atomic_load(&pool->is_shutting_down) && atomic_load(&pool->num_queued) == 0;
+		unlock_thread_mutex(&pool->lock);
+		if(do_exit) break;
+	}
+	return NULL;
+}
+
+struct Thread_Pool * create_thread_pool(int num_threads) {
+	struct Thread_Pool *pool = (struct Thread_Pool *) alloc_cache_aligned(sizeof(struct Thread_Pool));
+	pool->size = num_threads > 0 ? num_threads : get_default_thread_pool_size();
+	pool->workers = (struct Thread_Pool_Worker *) malloc(pool->size * sizeof(struct Thread_Pool_Worker));
+	pool->deques = (struct Thread_Pool_Deque *) malloc((pool->size + 1) * sizeof(struct Thread_Pool_Deque));
+	for(int i = 0; i <= pool->size; i++) {
+		pool->deques[i].capacity = INITIAL_DEQUE_CAPACITY;
+		pool->deques[i].tasks = (struct Thread_Pool_Task **) malloc(INITIAL_DEQUE_CAPACITY * sizeof(struct Thread_Pool_Task *));
+		pool->deques[i].head = 0;
+		pool->deques[i].tail = 0;
+		init_thread_mutex(&pool->deques[i].lock);
+	}
+
+	atomic_init(&pool->num_queued, 0);
+	atomic_init(&pool->num_injected, 0);
+	atomic_init(&pool->num_unfinished, 0);
+	atomic_init(&pool->num_waiting, 0);
+	atomic_init(&pool->is_shutting_down, 0);
+	init_thread_mutex(&pool->lock);
+	init_thread_cond(&pool->cond);
+
+	// Initialize counters
+	for(int i = 0; i < NUM_COUNTER; i++) atomic_init(&pool->counter[i].value, 0);
 
 	// Create threads
-	for (int i = 0; i < size; i++) {
+	for(int i = 0; i < pool->size; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
 		#ifdef _WIN32
-			thread_pool.threads[i] = CreateThread(
+			pool->workers[i].thread = CreateThread(
 					NULL,                        // default security attributes
 					0,                           // default stack size
-					(LPTHREAD_START_ROUTINE) thread_method, // pointer to the thread function
-					thread_args,                 // argument to thread function
+					(LPTHREAD_START_ROUTINE) thread_pool_worker, // pointer to the thread function
+					&pool->workers[i],           // argument to thread function
 					0,                           // default creation flags
 					NULL);                       // thread ID (not needed in this case)
 
-			if (thread_pool.threads[i] == NULL) {
+			if(pool->workers[i].thread == NULL) {
 				fprintf(stderr, "Error creating thread %d\n", i);
 				exit(EXIT_FAILURE);
 			}
 		#else
-			if (pthread_create(&thread_pool.threads[i], NULL, thread_method, thread_args) != 0) {
+			if(pthread_create(&pool->workers[i].thread, NULL, thread_pool_worker, &pool->workers[i]) != 0) {
 				perror("pthread_create");
 				exit(EXIT_FAILURE);
 			}
 		#endif
 	}
 
-	return thread_pool;
+	return pool;
 }
 
-struct Thread_Pool use_thread_pool01(void *thread_method(void*), void *thread_args) {
-	size_t size = 1;
-	struct Thread_Pool thread_pool = {threads01, size};
+void destroy_thread_pool(struct Thread_Pool *pool) {
+	if(pool == NULL) return;
+	join_thread_pool(pool);
 
-	// Initialize counters
-	for (int i = 0; i < NUM_COUNTER; i++) {
-		counter[i] = 0;
+	lock_thread_mutex(&pool->lock);
+	atomic_store(&pool->is_shutting_down, 1);
+	broadcast_thread_cond(&pool->cond);
+	unlock_thread_mutex(&pool->lock);
+
+	for(int i = 0; i < pool->size; i++) {
+		#ifdef _WIN32
+			WaitForSingleObject(pool->workers[i].thread, INFINITE); // Windows join
+			CloseHandle(pool->workers[i].thread);
+		#else
+			pthread_join(pool->workers[i].thread, NULL); // Linux join
+		#endif
 	}
 
-	// Initialize mutexes
-	for (int i = 0; i < NUM_COUNTER; i++) {
-#ifdef _WIN32
-		InitializeCriticalSection(&counter_lock[i]); // Windows mutex init
-#else
-		pthread_mutex_init(&counter_lock[i], NULL); // Linux mutex init
-#endif
+	for(int i = 0; i <= pool->size; i++) {
+		free(pool->deques[i].tasks);
+		destroy_thread_mutex(&pool->deques[i].lock);
 	}
+	destroy_thread_cond(&pool->cond);
+	destroy_thread_mutex(&pool->lock);
+	free(pool->deques);
+	free(pool->workers);
+	free_cache_aligned(pool);
+}
 
-	// Create threads
-	for (int i = 0; i < size; i++) {
-#ifdef _WIN32
-		thread_pool.threads[i] = CreateThread(
-				NULL,                        // default security attributes
-				0,                           // default stack size
-				(LPTHREAD_START_ROUTINE) thread_method, // pointer to the thread function
-				thread_args,                 // argument to thread function
-				0,                           // default creation flags
-				NULL);                       // thread ID (not needed in this case)
-
-		if (thread_pool.threads[i] == NULL) {
-			fprintf(stderr, "Error creating thread %d\n", i);
-			exit(EXIT_FAILURE);
-		}
-#else
-		if (pthread_create(&thread_pool.threads[i], NULL, thread_method, thread_args) != 0) {
-				perror("pthread_create");
-				exit(EXIT_FAILURE);
+struct Thread_Pool * get_global_thread_pool() {
+	lock_thread_mutex(&global_thread_pool_lock);
+	if(global_thread_pool == NULL) global_thread_pool = create_thread_pool(0);
+	unlock_thread_mutex(&global_thread_pool_lock);
+	return global_thread_pool;
+}
+
+int get_thread_pool_size(struct Thread_Pool *pool) {
+	return pool->size;
+}
+
+struct Thread_Pool * get_current_thread_pool() {
+	return current_pool;
+}
+
+int get_current_thread_pool_worker_id() {
+	return current_worker_id;
+}
+
+static struct Thread_Pool_Task * submit_task(struct Thread_Pool *pool, void *task_method(void*), void *task_args, int is_detached) {
+	struct Thread_Pool_Task *task = (struct Thread_Pool_Task *) malloc(sizeof(struct Thread_Pool_Task));
+	task->task_method = task_method;
+	task->task_args = task_args;
+	task->result = NULL;
+	task->pool = pool;
+	task->is_detached = is_detached;
+	atomic_init(&task->is_finished, 0);
+
+	int deque_id = current_pool == pool ? current_worker_id : pool->size;
+	atomic_fetch_add(&pool->num_unfinished, 1);
+	atomic_fetch_add(&pool->num_queued, 1);
+	if(deque_id == pool->size) atomic_fetch_add(&pool->num_injected, 1);
+	push_task_to_deque(&pool->deques[deque_id], task);
+	wake_waiting_threads(pool);
+	return task;
+}
+
+struct Thread_Pool_Task * submit_thread_pool_task(struct Thread_Pool *pool, void *task_method(void*), void *task_args) {
+	return submit_task(pool, task_method, task_args, 0);
+}
+
+void submit_detached_thread_pool_task(struct Thread_Pool *pool, void *task_method(void*), void *task_args) {
+	submit_task(pool, task_method, task_args, 1);
+}
+
+void * join_thread_pool_task(struct Thread_Pool_Task *task) {
+	struct Thread_Pool *pool = task->pool;
+	int worker_id = current_pool == pool ? current_worker_id : -1;
+
+	while(!atomic_load(&task->is_finished)) {
+		// workers of the same pool help out instead of blocking (tasks joining their sub-tasks can not deadlock)
+		// with tasks of the worker deques only: a task from the injection queue (e.g. a whole departure) would grow
+		// the stack without bound and keep the join waiting for unrelated work
+		if(worker_id >= 0) {
+			struct Thread_Pool_Task *other_task = find_task(pool, worker_id, 0);
+			if(other_task != NULL) {
+				run_task(pool, other_task);
+				continue;
 			}
-#endif
+		}
+
+		lock_thread_mutex(&pool->lock);
+		atomic_fetch_add(&pool->num_waiting, 1);
+		while(!atomic_load(&task->is_finished) && (worker_id < 0 || atomic_load(&pool->num_queued) - atomic_load(&pool->num_injected) <= 0))
+			wait_thread_cond(&pool->cond, &pool->lock);
+		atomic_fetch_sub(&pool->num_waiting, 1);
+		unlock_thread_mutex(&pool->lock);
 	}
 
-	return thread_pool;
+	void *result = task->result;
+	free(task);
+	return result;
+}
+
+void join_thread_pool(struct Thread_Pool *pool) {
+	lock_thread_mutex(&pool->lock);
+	atomic_fetch_add(&pool->num_waiting, 1);
+	while(atomic_load(&pool->num_unfinished) > 0) wait_thread_cond(&pool->cond, &pool->lock);
+	atomic_fetch_sub(&pool->num_waiting, 1);
+	unlock_thread_mutex(&pool->lock);
+}
+
+
+void reset_thread_pool_counters(struct Thread_Pool *pool) {
+	for(int i = 0; i < NUM_COUNTER; i++) atomic_store(&pool->counter[i].value, 0);
+}
+
+int get_thread_pool_counter(struct Thread_Pool *pool, int counter_index) {
+	return atomic_load_explicit(&pool->counter[counter_index].value, memory_order_relaxed);
+}
+
+int get_incr_thread_pool_counter(struct Thread_Pool *pool, int counter_index) {
+	return atomic_fetch_add(&pool->counter[counter_index].value, 1);
+}
+
+void incr_thread_pool_counter_by_amount(struct Thread_Pool *pool, int counter_index, int amount) {
+	atomic_fetch_add(&pool->counter[counter_index].value, amount);
 }
 
 int get_thread_counter(int counter_index) {
-	return counter[counter_index];
+	if(current_pool == NULL) return 0;
+	return get_thread_pool_counter(current_pool, counter_index);
 }
 
 int get_incr_thread_counter(int counter_index) {
-	int counter_value;
-	#ifdef _WIN32
-		EnterCriticalSection(&counter_lock[counter_index]); // Windows lock
-	#else
-		pthread_mutex_lock(&counter_lock[counter_index]); // Linux lock
-	#endif
-	counter_value = counter[counter_index];
-	counter[counter_index]++;
-	#ifdef _WIN32
-		LeaveCriticalSection(&counter_lock[counter_index]); // Windows unlock
-	#else
-		pthread_mutex_unlock(&counter_lock[counter_index]); // Linux unlock
-	#endif
-	return counter_value;
+	if(current_pool == NULL) return 0;
+	return get_incr_thread_pool_counter(current_pool, counter_index);
 }
 
 void incr_thread_counter_by_amount(int counter_index, int amount) {
+	if(current_pool == NULL) return;
+	incr_thread_pool_counter_by_amount(current_pool, counter_index, amount);
+}
+
+void * alloc_cache_aligned(size_t size) {
+	// aligned_alloc needs a multiple of the alignment
+	size = (size + CACHE_LINE_SIZE-1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
 	#ifdef _WIN32
-		EnterCriticalSection(&counter_lock[counter_index]); // Windows lock
+		return _aligned_malloc(size, CACHE_LINE_SIZE);
 	#else
-		pthread_mutex_lock(&counter_lock[counter_index]); // Linux lock
+		return aligned_alloc(CACHE_LINE_SIZE, size);
 	#endif
-	counter[counter_index] += amount;
+}
+
+void free_cache_aligned(void *ptr) {
 	#ifdef _WIN32
-		LeaveCriticalSection(&counter_lock[counter_index]); // Windows unlock
+		_aligned_free(ptr);
 	#else
-		pthread_mutex_unlock(&counter_lock[counter_index]); // Linux unlock
+		free(ptr);
 	#endif
 }
-
-void join_thread_pool(struct Thread_Pool thread_pool) {
-    for(int i = 0; i < thread_pool.size; i++) {
-		#ifdef _WIN32
-				WaitForSingleObject(thread_pool.threads[i], INFINITE); // Windows join
-		#else
-				pthread_join(thread_pool.threads[i], NULL); // Linux join
-		#endif
-    }
-}
\ No newline at end of file
@@ -1,63 +1,189 @@
 #ifndef KSP_THREAD_POOL_H
 #define KSP_THREAD_POOL_H
 
+#include <stddef.h>
+
 #ifdef _WIN32
 #include <windows.h>
 typedef HANDLE thread_t;  // Use Windows HANDLE for threads
-typedef CRITICAL_SECTION thread_mutex_t;  // Use Windows CRITICAL_SECTION for mutexes
+typedef SRWLOCK thread_mutex_t;  // Use Windows slim reader/writer lock for mutexes (statically initializable)
+typedef CONDITION_VARIABLE thread_cond_t;  // Use Windows CONDITION_VARIABLE for condition variables
+#define THREAD_MUTEX_INITIALIZER SRWLOCK_INIT
 #else
 #include <pthread.h>
 typedef pthread_t thread_t;  // Use pthread_t for Linux
 typedef pthread_mutex_t thread_mutex_t;  // Use pthread_mutex_t for Linux
+typedef pthread_cond_t thread_cond_t;  // Use pthread_cond_t for Linux
+#define THREAD_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
 #endif
 
 
 /**
- * @brief Represents a thread pool containing multiple threads and the number of threads in the pool
+ * @brief Represents a work-stealing thread pool (each worker owns a deque of tasks and steals from the others when idle)
+ */
+struct Thread_Pool;
+
+/**
+ * @brief Join handle of a task submitted to a thread pool (holds the return value of the task method once finished)
+ */
+struct Thread_Pool_Task;
+
+
+/**
+ * @brief Returns the number of processor cores available to this process
+ *
+ * @return The number of available cores (at least 1)
+ */
+int get_num_available_cores();
+
+/**
+ * @brief Sets the number of threads used by thread pools that are created without an explicit size
+ *
+ * @param num_threads The number of threads (<= 0 resets to the number of available cores)
+ */
+void set_default_thread_pool_size(int num_threads);
+
+/**
+ * @brief Returns the number of threads used by thread pools that are created without an explicit size
+ *
+ * @return The configured number of threads or the number of available cores if not configured
+ */
+int get_default_thread_pool_size();
+
+/**
+ * @brief Creates a thread pool, starts its worker threads and sets its counters to 0
+ *
+ * @param num_threads The number of worker threads (<= 0 uses the default thread pool size)
+ * @return The newly created thread pool (needs to be destroyed with destroy_thread_pool)
  */
-struct Thread_Pool {
-	thread_t *threads; /**< Array of threads in the pool */
-	size_t size;        /**< Size of the thread pool */
-};
+struct Thread_Pool * create_thread_pool(int num_threads);
 
+/**
+ * @brief Waits for all tasks of the thread pool to finish, stops its worker threads and frees the pool
+ *
+ * @param pool The thread pool to be destroyed
+ */
+void destroy_thread_pool(struct Thread_Pool *pool);
 
 /**
- * @brief Creates, initializes and runs a thread pool with 64 threads and sets counters to 0
+ * @brief Returns the process-wide thread pool used for background jobs (created on first use with the default size)
  *
- * @param thread_method Pointer to the thread method function
- * @param thread_args   Pointer to the arguments for the thread method
- * @return A populated Thread_Pool structure with 64 threads
+ * @return The global thread pool
  */
-struct Thread_Pool use_thread_pool32(void *thread_method(void*), void *thread_args);
-struct Thread_Pool use_thread_pool01(void *thread_method(void*), void *thread_args);
+struct Thread_Pool * get_global_thread_pool();
 
 /**
- * @brief Gets the current specified thread counter value
+ * @brief Returns the number of worker threads of the given thread pool
  *
+ * @param pool The thread pool
+ * @return The number of worker threads
+ */
+int get_thread_pool_size(struct Thread_Pool *pool);
+
+/**
+ * @brief Returns the thread pool the calling thread is a worker of
+ *
+ * @return The thread pool of the calling worker thread or NULL if called from outside any thread pool
+ */
+struct Thread_Pool * get_current_thread_pool();
+
+/**
+ * @brief Returns the index of the calling worker thread inside its thread pool
+ *
+ * @return The worker index (0 to size-1) or -1 if called from outside any thread pool
+ */
+int get_current_thread_pool_worker_id();
+
+/**
+ * @brief Submits a task to the thread pool (tasks submitted from a worker of the same pool are pushed to its own deque)
+ *
+ * @param pool        The thread pool the task should run on
+ * @param task_method Pointer to the task method function
+ * @param task_args   Pointer to the arguments for the task method
+ * @return The join handle of the task (needs to be joined with join_thread_pool_task)
+ */
+struct Thread_Pool_Task * submit_thread_pool_task(struct Thread_Pool *pool, void *task_method(void*), void *task_args);
+
+/**
+ * @brief Submits a task to the thread pool without a join handle (the task is freed after it finished)
+ *
+ * @param pool        The thread pool the task should run on
+ * @param task_method Pointer to the task method function
+ * @param task_args   Pointer to the arguments for the task method
+ */
+void submit_detached_thread_pool_task(struct Thread_Pool *pool, void *task_method(void*), void *task_args);
+
+/**
+ * @brief Waits for the task to finish, frees its join handle and returns the value returned by the task method.
+ *        Worker threads execute other pending tasks while waiting, so tasks can safely join their own sub-tasks.
+ *
+ * @param task The join handle of the task
+ * @return The value returned by the task method
+ */
+void * join_thread_pool_task(struct Thread_Pool_Task *task);
+
+/**
+ * @brief Waits for all tasks submitted to the specified thread pool to finish.
+ *
+ * @param pool The thread pool to be joined.
+ */
+void join_thread_pool(struct Thread_Pool *pool);
+
+
+/**
+ * @brief Resets all counters of the thread pool to 0
+ *
+ * @param pool The thread pool
+ */
+void reset_thread_pool_counters(struct Thread_Pool *pool);
+
+/**
+ * @brief Gets the current specified counter value of the given thread pool
+ *
+ * @param pool          The thread pool
  * @param counter_index The index of the specified thread counter
  * @return The current value of the thread counter
  */
-int get_thread_counter(int counter_index);
-
+int get_thread_pool_counter(struct Thread_Pool *pool, int counter_index);
 
 /**
- * @brief Gets the current specified thread counter value and increases it by one
+ * @brief Gets the current specified counter value of the given thread pool and increases it by one
  *
+ * @param pool          The thread pool
  * @param counter_index The index of the specified thread counter
  * @return The current value of the thread counter
  */
-int get_incr_thread_counter(int counter_index);
+int get_incr_thread_pool_counter(struct Thread_Pool *pool, int counter_index);
 
+/**
+ * @brief Increases specified counter of the given thread pool by given amount
+ *
+ * @param pool          The thread pool
+ * @param counter_index The index of the specified thread counter
+ * @param amount        The amount the counter should be increased by
+ */
+void incr_thread_pool_counter_by_amount(struct Thread_Pool *pool, int counter_index, int amount);
 
 /**
- * @brief Waits for all threads in the specified thread pool to finish.
+ * @brief Gets the current specified thread counter value (of the thread pool the calling worker belongs to)
  *
- * @param thread_pool The thread pool structure to be joined.
+ * @param counter_index The index of the specified thread counter
+ * @return The current value of the thread counter (0 if called from outside any thread pool)
  */
+int get_thread_counter(int counter_index);
 
 
 /**
- * @brief Increases specified thread counter by given amount
+ * @brief Gets the current specified thread counter value and increases it by one (of the thread pool the calling worker belongs to)
+ *
+ * @param counter_index The index of the specified thread counter
+ * @return The current value of the thread counter (0 if called from outside any thread pool)
+ */
+int get_incr_thread_counter(int counter_index);
+
+
+/**
+ * @brief Increases specified thread counter by given amount (of the thread pool the calling worker belongs to)
  *
  * @param counter_index The index of the specified thread counter
  * @param amount The amount the counter should be increased by
@@ -65,5 +191,87 @@ int get_incr_thread_counter(int counter_index);
 void incr_thread_counter_by_amount(int counter_index, int amount);
 
 
+/**
+ * @brief Initializes a mutex (not needed for mutexes initialized with THREAD_MUTEX_INITIALIZER)
+ *
+ * @param mutex The mutex to be initialized
+ */
+void init_thread_mutex(thread_mutex_t *mutex);
+
+/**
+ * @brief Locks the given mutex
+ *
+ * @param mutex The mutex to be locked
+ */
+void lock_thread_mutex(thread_mutex_t *mutex);
+
+/**
+ * @brief Unlocks the given mutex
+ *
+ * @param mutex The mutex to be unlocked
+ */
+void unlock_thread_mutex(thread_mutex_t *mutex);
+
+/**
+ * @brief Destroys the given mutex
+ *
+ * @param mutex The mutex to be destroyed
+ */
+void destroy_thread_mutex(thread_mutex_t *mutex);
+
+/**
+ * @brief Initializes a condition variable
+ *
+ * @param cond The condition variable to be initialized
+ */
+void init_thread_cond(thread_cond_t *cond);
+
+/**
+ * @brief Releases the locked mutex and waits for the condition variable to be signaled (mutex is locked again on return)
+ *
+ * @param cond  The condition variable
+ * @param mutex The locked mutex
+ */
+void wait_thread_cond(thread_cond_t *cond, thread_mutex_t *mutex);
+
+/**
+ * @brief Like wait_thread_cond but returns after the given timeout at the latest
+ *
+ * @param cond       The condition variable
+ * @param mutex      The locked mutex
+ * @param timeout_ms The maximum waiting time in milliseconds
+ */
+void timed_wait_thread_cond(thread_cond_t *cond, thread_mutex_t *mutex, int timeout_ms);
+
+/**
+ * @brief Wakes up all threads waiting for the condition variable
+ *
+ * @param cond The condition variable
+ */
+void broadcast_thread_cond(thread_cond_t *cond);
+
+/**
+ * @brief Destroys the given condition variable
+ *
+ * @param cond The condition variable to be destroyed
+ */
+void destroy_thread_cond(thread_cond_t *cond);
+
+/**
+ * @brief Allocates memory that starts at a cache line (for data written by different threads; also available with MinGW)
+ *
+ * @param size The number of bytes to be allocated
+ * @return The allocated memory or NULL on failure (needs to be freed with free_cache_aligned)
+ */
+void * alloc_cache_aligned(size_t size);
+
+/**
+ * @brief Frees memory allocated with alloc_cache_aligned
+ *
+ * @param ptr The memory to be freed (NULL: nothing happens)
+ */
+void free_cache_aligned(void *ptr);
+
+
 
 #endif //KSP_THREAD_POOL_H